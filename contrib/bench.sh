@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs a reference server on 'cores' cores and replays the test.c request
+# corpus against it with contrib/loadgen, on the remaining cores if there
+# are any. Extra arguments go to loadgen. The server reports the share of
+# its CPU time spent in the parser when it is stopped.
+#
+#   contrib/bench.sh [uring_server|epoll_server] [cores] [loadgen options]
+
+server=${1:-uring_server}
+cores=${2:-1}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+
+dir=$(dirname "$0")
+port=${PORT:-8080}
+ncpu=$(nproc)
+
+"$dir/$server" -p "$port" -t "$cores" &
+pid=$!
+sleep 1
+
+if [ "$cores" -lt "$ncpu" ]; then
+  taskset -c "$cores-$((ncpu - 1))" \
+    "$dir/loadgen" -p "$port" -C "$cores" -t $((ncpu - cores)) "$@"
+else
+  "$dir/loadgen" -p "$port" -C "$cores" "$@"
+fi
+
+kill -TERM $pid
+wait $pid
@@ -0,0 +1,249 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Replays a synthetic mix of hits and misses against http_cache. Every
+ * thread draws a key from a hot set, pre-filled, with the given hit
+ * ratio, and a key never seen before otherwise. A miss parses a canned
+ * upstream response through a fill, a hit reads the stored iovec. Threads
+ * share the hot set, so concurrent misses of a hot key after an eviction
+ * are collapsed.
+ */
+#include <http_cache.h>
+#include <http_writer.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+struct worker {
+  pthread_t thread;
+  int id;
+  uint64_t rng;
+  uint64_t bytes;  /* served from hits, so the reads are not optimized out */
+} __attribute__((aligned(64)));
+
+
+static struct http_cache *cache;
+static char *upstream;
+static size_t upstream_len;
+static uint64_t hot_keys = 10000;
+static unsigned int hit_ratio = 90;
+static uint64_t ops = 1000000;
+
+
+/* Keys stand in for struct http_parser_key hashes, so they get mixed */
+static uint64_t
+mix (uint64_t x)
+{
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+
+static uint64_t
+next_random (uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+
+static void
+fetch (uint64_t key)
+{
+  struct http_cache_fill fill;
+  http_parser parser;
+
+  http_cache_fill_init(&fill, cache, key);
+  http_parser_init(&parser, HTTP_RESPONSE);
+  parser.data = &fill;
+  if (http_parser_execute(&parser, &http_cache_fill_settings,
+                          upstream, upstream_len) != upstream_len) {
+    http_cache_fill_abort(&fill);
+  }
+}
+
+
+static void
+request (struct worker *w, uint64_t key)
+{
+  struct http_cache_entry *e;
+
+  if (http_cache_lookup(cache, key, 1, &e) == HTTP_CACHE_HIT) {
+    w->bytes += ((const unsigned char *) e->iov.iov_base)[e->iov.iov_len - 1];
+    w->bytes += e->iov.iov_len;
+    http_cache_release(e);
+  } else {
+    fetch(key);
+  }
+}
+
+
+static void *
+run (void *arg)
+{
+  struct worker *w = arg;
+  uint64_t i, cold = 0, r;
+
+  for (i = 0; i < ops; i++) {
+    r = next_random(&w->rng);
+    if (r % 100 < hit_ratio) {
+      request(w, mix((r >> 8) % hot_keys));
+    } else {
+      /* never seen: thread id in the top bits */
+      request(w, mix((uint64_t) (w->id + 1) << 48 | cold++));
+    }
+  }
+  return NULL;
+}
+
+
+/* A 200 with a 'size' byte chunked body, as an upstream might send it */
+static void
+upstream_init (size_t size)
+{
+  size_t chunk = 4096, off = 0, n;
+
+  upstream = malloc(size + 256 + (size / chunk + 1) * 16);
+  if (!upstream) exit(1);
+
+  upstream_len = sprintf(upstream,
+                         "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: text/html\r\n"
+                         "Cache-Control: max-age=3600\r\n"
+                         "Transfer-Encoding: chunked\r\n"
+                         "Connection: keep-alive\r\n"
+                         "\r\n");
+  while (off < size) {
+    n = size - off < chunk ? size - off : chunk;
+    upstream_len += http_chunk_header(upstream + upstream_len, n);
+    memset(upstream + upstream_len, 'x', n);
+    upstream_len += n;
+    memcpy(upstream + upstream_len, "\r\n", 2);
+    upstream_len += 2;
+    off += n;
+  }
+  memcpy(upstream + upstream_len, "0\r\n\r\n", 5);
+  upstream_len += 5;
+}
+
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-t threads] [-k keys] [-r hit%%] [-n ops] [-b MB] "
+          "[-s bytes] [-S shards]\n"
+          "  -t  threads (1)\n"
+          "  -k  hot keys, pre-filled (10000)\n"
+          "  -r  share of lookups for a hot key, in percent (90)\n"
+          "  -n  lookups per thread (1000000)\n"
+          "  -b  cache budget in MB (64)\n"
+          "  -s  response body size (1024)\n"
+          "  -S  shards (64)\n",
+          name);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct http_cache_stats stats;
+  struct worker *workers;
+  struct timespec t0, t1;
+  size_t budget = 64, body = 1024;
+  unsigned int shards = 64;
+  int nthreads = 1, i, opt;
+  double seconds;
+
+  while ((opt = getopt(argc, argv, "t:k:r:n:b:s:S:")) != -1) {
+    switch (opt) {
+      case 't': nthreads = atoi(optarg); break;
+      case 'k': hot_keys = strtoull(optarg, NULL, 10); break;
+      case 'r': hit_ratio = atoi(optarg); break;
+      case 'n': ops = strtoull(optarg, NULL, 10); break;
+      case 'b': budget = strtoull(optarg, NULL, 10); break;
+      case 's': body = strtoull(optarg, NULL, 10); break;
+      case 'S': shards = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (nthreads < 1 || hot_keys < 1 || hit_ratio > 100 || shards < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  cache = http_cache_new(budget << 20, shards);
+  if (!cache) return 1;
+  upstream_init(body);
+
+  for (i = 0; (uint64_t) i < hot_keys; i++) {
+    fetch(mix(i));
+  }
+
+  if (posix_memalign((void **) &workers, 64, nthreads * sizeof *workers)) {
+    return 1;
+  }
+  memset(workers, 0, nthreads * sizeof *workers);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nthreads; i++) {
+    workers[i].id = i;
+    workers[i].rng = mix(i + 1);
+    if (pthread_create(&workers[i].thread, NULL, run, &workers[i]) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  http_cache_stats(cache, &stats);
+
+  printf("%d thread%s, %llu hot keys, %u%% hot, %zu byte bodies\n",
+         nthreads, nthreads == 1 ? "" : "s",
+         (unsigned long long) hot_keys, hit_ratio, body);
+  printf("%.0f lookups/s, %.0f ns/lookup per thread\n",
+         nthreads * ops / seconds, seconds * 1e9 / ops);
+  printf("hits %llu, misses %llu, waits %llu, evictions %llu\n",
+         (unsigned long long) stats.hits,
+         (unsigned long long) stats.misses,
+         (unsigned long long) stats.waits,
+         (unsigned long long) stats.evictions);
+  printf("%llu entries, %.1f MB\n",
+         (unsigned long long) stats.entries, stats.bytes / 1048576.0);
+
+  http_cache_free(cache);
+  free(upstream);
+  free(workers);
+  return 0;
+}
@@ -0,0 +1,208 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Reference server on epoll: one edge-triggered event loop per core, each
+ * accepting on its own SO_REUSEPORT listener, so the kernel shards the
+ * connections and no state is shared between cores. Connections come from
+ * a per-core pool allocated up front. One receive buffer per core is
+ * enough: the parser is not in retain mode, so nothing refers to the data
+ * once http_parser_execute() has returned.
+ */
+#define _GNU_SOURCE
+#include "server.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define RECV_SIZE (64*1024)
+#define MAX_EVENTS 256
+
+/* epoll data of the listening socket; connections use their pool index */
+#define LISTENER UINT32_MAX
+
+
+struct slot {
+  struct conn conn;
+  int closing;   /* close once the queued responses are written */
+  int next_free;
+};
+
+
+struct loop {
+  struct server_thread *thread;
+  int epfd;
+  struct slot *slots;
+  int free_slot;
+  char buf[RECV_SIZE];
+};
+
+
+static void
+release (struct loop *l, int i)
+{
+  close(l->slots[i].conn.fd);
+  l->slots[i].next_free = l->free_slot;
+  l->free_slot = i;
+}
+
+
+/* Writes what has been queued. Returns -1 if the slot was released. */
+static int
+flush (struct loop *l, int i)
+{
+  struct slot *s = &l->slots[i];
+  struct conn *c = &s->conn;
+  ssize_t n;
+
+  while (c->out_sent < c->out_len) {
+    n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+             MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) return 0;  /* EPOLLOUT follows */
+      release(l, i);
+      return -1;
+    }
+    c->out_sent += n;
+  }
+  c->out_len = c->out_sent = 0;
+
+  if (s->closing) {
+    release(l, i);
+    return -1;
+  }
+  return 0;
+}
+
+
+static void
+on_accept (struct loop *l)
+{
+  struct epoll_event ev;
+  int fd, i, one = 1;
+
+  for (;;) {
+    fd = accept4(l->thread->listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      return;
+    }
+
+    i = l->free_slot;
+    if (i < 0) {
+      close(fd);
+      continue;
+    }
+    l->free_slot = l->slots[i].next_free;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    conn_init(&l->slots[i].conn, l->thread, fd);
+    l->slots[i].closing = 0;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u32 = i;
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) release(l, i);
+  }
+}
+
+
+static void
+on_readable (struct loop *l, int i)
+{
+  struct slot *s = &l->slots[i];
+  ssize_t n;
+
+  while (!s->closing) {
+    n = recv(s->conn.fd, l->buf, sizeof l->buf, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      n = 0;
+    }
+    if (conn_recv(&s->conn, l->buf, n) != 0) s->closing = 1;
+    if (n < (ssize_t)sizeof l->buf) break;
+  }
+}
+
+
+static void *
+epoll_loop (void *arg)
+{
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event ev;
+  struct loop *l;
+  int i, n;
+
+  l = calloc(1, sizeof *l);
+  if (!l) exit(1);
+  l->thread = arg;
+  l->epfd = epoll_create1(0);
+  l->slots = calloc(l->thread->max_conns, sizeof *l->slots);
+  if (l->epfd < 0 || !l->slots) exit(1);
+
+  l->free_slot = -1;
+  for (i = l->thread->max_conns - 1; i >= 0; i--) {
+    l->slots[i].next_free = l->free_slot;
+    l->free_slot = i;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.u32 = LISTENER;
+  if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->thread->listen_fd, &ev) != 0) {
+    perror("epoll_ctl");
+    exit(1);
+  }
+
+  for (;;) {
+    n = epoll_wait(l->epfd, events, MAX_EVENTS, -1);
+
+    for (i = 0; i < n; i++) {
+      uint32_t index = events[i].data.u32;
+
+      if (index == LISTENER) {
+        on_accept(l);
+        continue;
+      }
+
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        on_readable(l, index);
+      }
+      flush(l, index);
+    }
+  }
+
+  return NULL;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  return server_main(argc, argv, epoll_loop);
+}
@@ -0,0 +1,246 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Throughput of http_inflate on a large gzip response, parsed in socket
+ * sized reads, next to a bare zlib inflate of the same stream into the
+ * same window. The difference is what the parser and the window handling
+ * cost on top of zlib.
+ */
+#include <http_inflate.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static uint64_t checksum;
+
+
+static int
+on_data (struct http_inflate *inf, const char *at, size_t len)
+{
+  (void)inf;
+  /* touch the window so the work is not optimized out */
+  checksum += (unsigned char) at[0] + (unsigned char) at[len - 1] + len;
+  return 0;
+}
+
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Log-like text, compressing about 5:1 like typical API payloads */
+static char *
+make_text (size_t size)
+{
+  char *text = malloc(size + 128);
+  uint64_t rng = 88172645463325252ULL;
+  size_t len = 0;
+
+  if (!text) exit(1);
+  while (len < size) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    len += sprintf(text + len,
+                   "{\"id\":%llu,\"user\":\"u%04u\",\"status\":%u,"
+                   "\"latency_ms\":%u}\n",
+                   (unsigned long long) (rng >> 20), (unsigned) (rng % 5000),
+                   rng % 7 ? 200 : 404, (unsigned) (rng >> 50) % 900);
+  }
+  return text;
+}
+
+
+static size_t
+gzip (char *out, size_t size, const char *in, size_t len)
+{
+  z_stream z;
+
+  memset(&z, 0, sizeof z);
+  if (deflateInit2(&z, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    exit(1);
+  }
+  z.next_in = (Bytef *) in;
+  z.avail_in = len;
+  z.next_out = (Bytef *) out;
+  z.avail_out = size;
+  if (deflate(&z, Z_FINISH) != Z_STREAM_END) exit(1);
+  deflateEnd(&z);
+  return size - z.avail_out;
+}
+
+
+/* The response as an upstream would send it, chunked or not */
+static size_t
+make_response (char *out, const char *gz, size_t gz_len, int chunked)
+{
+  size_t len, off, n;
+
+  if (!chunked) {
+    len = sprintf(out, "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: application/x-ndjson\r\n"
+                       "Content-Encoding: gzip\r\n"
+                       "Content-Length: %zu\r\n"
+                       "\r\n", gz_len);
+    memcpy(out + len, gz, gz_len);
+    return len + gz_len;
+  }
+
+  len = sprintf(out, "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/x-ndjson\r\n"
+                     "Content-Encoding: gzip\r\n"
+                     "Transfer-Encoding: chunked\r\n"
+                     "\r\n");
+  for (off = 0; off < gz_len; off += n) {
+    n = gz_len - off < 8192 ? gz_len - off : 8192;
+    len += sprintf(out + len, "%zx\r\n", n);
+    memcpy(out + len, gz + off, n);
+    len += n;
+    memcpy(out + len, "\r\n", 2);
+    len += 2;
+  }
+  memcpy(out + len, "0\r\n\r\n", 5);
+  return len + 5;
+}
+
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-s MB] [-r bytes] [-w bytes] [-n runs] [-c]\n"
+          "  -s  decoded body size in MB (64)\n"
+          "  -r  read size (65536)\n"
+          "  -w  output window size (65536)\n"
+          "  -n  runs, the best one counts (5)\n"
+          "  -c  chunked upstream\n",
+          name);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct http_inflate inf;
+  http_parser parser;
+  z_stream z;
+  char *text, *gz, *response, *window;
+  size_t size = 64, read_size = 65536, window_size = 65536;
+  size_t text_len, gz_len, len, off, n;
+  int runs = 5, chunked = 0, opt, run;
+  double t, best = 1e9, best_zlib = 1e9;
+
+  while ((opt = getopt(argc, argv, "s:r:w:n:c")) != -1) {
+    switch (opt) {
+      case 's': size = strtoull(optarg, NULL, 10); break;
+      case 'r': read_size = strtoull(optarg, NULL, 10); break;
+      case 'w': window_size = strtoull(optarg, NULL, 10); break;
+      case 'n': runs = atoi(optarg); break;
+      case 'c': chunked = 1; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (size < 1 || read_size < 1 || window_size < 1 || runs < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  text = make_text(size << 20);
+  text_len = size << 20;
+  gz = malloc(text_len + 1024);
+  response = malloc(text_len * 2 + 1024);
+  window = malloc(window_size);
+  if (!gz || !response || !window) return 1;
+  gz_len = gzip(gz, text_len + 1024, text, text_len);
+  len = make_response(response, gz, gz_len, chunked);
+
+  http_inflate_init(&inf, window, window_size, on_data);
+  for (run = 0; run < runs; run++) {
+    t = now();
+    http_parser_init(&parser, HTTP_RESPONSE);
+    parser.data = &inf;
+    for (off = 0; off < len; off += n) {
+      n = len - off < read_size ? len - off : read_size;
+      if (http_parser_execute(&parser, &http_inflate_settings,
+                              response + off, n) != n) {
+        fprintf(stderr, "parse error: %s\n",
+                http_errno_description(HTTP_PARSER_ERRNO(&parser)));
+        return 1;
+      }
+    }
+    t = now() - t;
+    if (inf.error || inf.out != text_len) {
+      fprintf(stderr, "inflate error: %s\n", http_inflate_strerror(inf.error));
+      return 1;
+    }
+    if (t < best) best = t;
+  }
+  http_inflate_end(&inf);
+
+  /* zlib alone, same reads and window */
+  memset(&z, 0, sizeof z);
+  if (inflateInit2(&z, 31) != Z_OK) return 1;
+  for (run = 0; run < runs; run++) {
+    t = now();
+    inflateReset(&z);
+    for (off = 0; off < gz_len; off += n) {
+      n = gz_len - off < read_size ? gz_len - off : read_size;
+      z.next_in = (Bytef *) gz + off;
+      z.avail_in = n;
+      while (z.avail_in > 0) {
+        z.next_out = (Bytef *) window;
+        z.avail_out = window_size;
+        if (inflate(&z, Z_NO_FLUSH) < 0) return 1;
+        if (z.avail_out < window_size) {
+          on_data(NULL, window, window_size - z.avail_out);
+        }
+      }
+    }
+    t = now() - t;
+    if (t < best_zlib) best_zlib = t;
+  }
+  inflateEnd(&z);
+
+  printf("%zu MB %s body, %.1f:1, %zu byte reads, %zu byte window\n",
+         size, chunked ? "chunked" : "Content-Length",
+         (double) text_len / gz_len, read_size, window_size);
+  printf("http_inflate  %7.1f MB/s in, %7.1f MB/s out\n",
+         gz_len / best / 1048576, text_len / best / 1048576);
+  printf("zlib alone    %7.1f MB/s in, %7.1f MB/s out\n",
+         gz_len / best_zlib / 1048576, text_len / best_zlib / 1048576);
+  printf("checksum %llu\n", (unsigned long long) checksum);
+
+  free(text);
+  free(gz);
+  free(response);
+  free(window);
+  return 0;
+}
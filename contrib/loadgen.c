@@ -0,0 +1,375 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Load generator for the reference servers. Replays the keep-alive
+ * requests of the test corpus over persistent connections, keeping up to
+ * 'depth' requests pipelined on each, and parses the responses with
+ * http_parser. Reports requests per second, per server core, and the
+ * median and 99th percentile latency from writing a request to parsing
+ * the end of its response.
+ */
+#define _GNU_SOURCE
+#include <http_parser.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_corpus.h"
+
+
+/* Latency histogram: exact below 32ns, then 16 buckets per power of 2,
+ * which keeps the error under 7%.
+ */
+#define HIST_BUCKETS (32 + 59 * 16)
+
+#define OUT_SIZE (64*1024)
+
+
+struct client {
+  http_parser parser;
+  struct worker *worker;
+  int fd;
+  int next;           /* next request of the corpus to send */
+  int inflight;
+  uint64_t sent_at[HTTP_MAX_PENDING_REQUESTS];
+  unsigned sent_head;
+  size_t out_len;
+  size_t out_sent;
+  char out[OUT_SIZE];
+};
+
+
+struct worker {
+  pthread_t thread;
+  int nclients;
+  struct client *clients;
+  uint64_t completed;
+  uint64_t hist[HIST_BUCKETS];
+};
+
+
+static const struct message *corpus[64];
+static int corpus_len;
+
+static struct sockaddr_in server;
+static int depth = HTTP_MAX_PENDING_REQUESTS;
+
+/* 0 while warming up, 1 while measuring, 2 to stop */
+static volatile int phase;
+
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static unsigned
+hist_bucket (uint64_t v)
+{
+  unsigned e;
+
+  if (v < 32) return (unsigned)v;
+  e = 63 - __builtin_clzll(v);
+  return 32 + (e - 5) * 16 + (unsigned)((v >> (e - 4)) & 15);
+}
+
+
+static uint64_t
+hist_value (unsigned bucket)
+{
+  unsigned e;
+
+  if (bucket < 32) return bucket;
+  e = (bucket - 32) / 16 + 5;
+  return (uint64_t)(16 + (bucket - 32) % 16) << (e - 4);
+}
+
+
+static uint64_t
+hist_percentile (const uint64_t *hist, uint64_t total, double p)
+{
+  uint64_t seen = 0, rank = (uint64_t)(p * total);
+  unsigned i;
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist[i];
+    if (seen > rank) return hist_value(i);
+  }
+  return 0;
+}
+
+
+static int
+response_complete_cb (http_parser *p)
+{
+  struct client *c = p->data;
+  uint64_t latency = now_ns() - c->sent_at[c->sent_head];
+
+  c->sent_head = (c->sent_head + 1) % HTTP_MAX_PENDING_REQUESTS;
+  c->inflight--;
+
+  if (phase == 1) {
+    c->worker->completed++;
+    c->worker->hist[hist_bucket(latency)]++;
+  }
+
+  if (p->status_code != 200) {
+    fprintf(stderr, "unexpected status %u\n", p->status_code);
+    exit(1);
+  }
+  return 0;
+}
+
+
+static http_parser_settings response_settings =
+  {.on_message_complete = response_complete_cb
+  };
+
+
+/* Tops the pipeline up to 'depth' requests and writes what it can. */
+static int
+client_send (struct client *c)
+{
+  uint64_t now = now_ns();
+  ssize_t n;
+
+  while (c->inflight < depth) {
+    const struct message *m = corpus[c->next];
+    size_t len = strlen(m->raw);
+    unsigned slot;
+
+    if (c->out_len + len > sizeof c->out) break;
+    memcpy(c->out + c->out_len, m->raw, len);
+    c->out_len += len;
+
+    slot = (c->sent_head + c->inflight) % HTTP_MAX_PENDING_REQUESTS;
+    c->sent_at[slot] = now;
+    c->inflight++;
+    http_parser_expect_response(&c->parser, m->method);
+
+    c->next = (c->next + 1) % corpus_len;
+  }
+
+  while (c->out_sent < c->out_len) {
+    n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+             MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN) return 0;
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    c->out_sent += n;
+  }
+  c->out_len = c->out_sent = 0;
+  return 0;
+}
+
+
+static int
+client_connect (struct client *c, int epfd)
+{
+  struct epoll_event ev;
+  int one = 1;
+
+  c->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (c->fd < 0 ||
+      connect(c->fd, (struct sockaddr *)&server, sizeof server) != 0) {
+    perror("connect");
+    return -1;
+  }
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  if (fcntl(c->fd, F_SETFL, O_NONBLOCK) != 0) return -1;
+
+  http_parser_init(&c->parser, HTTP_RESPONSE);
+  c->parser.data = c;
+
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = c;
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+
+static void *
+worker_loop (void *arg)
+{
+  struct worker *w = arg;
+  struct epoll_event events[64];
+  static __thread char buf[64*1024];
+  int epfd = epoll_create1(0);
+  int i, n;
+
+  for (i = 0; i < w->nclients; i++) {
+    struct client *c = &w->clients[i];
+    c->worker = w;
+    c->next = i % corpus_len;
+    if (client_connect(c, epfd) != 0 || client_send(c) != 0) exit(1);
+  }
+
+  while (phase < 2) {
+    n = epoll_wait(epfd, events, 64, 100);
+
+    for (i = 0; i < n; i++) {
+      struct client *c = events[i].data.ptr;
+      ssize_t r;
+
+      if (events[i].events & EPOLLIN) {
+        while ((r = recv(c->fd, buf, sizeof buf, 0)) > 0) {
+          if (http_parser_execute(&c->parser, &response_settings, buf, r)
+              != (size_t)r) {
+            fprintf(stderr, "bad response: %s\n",
+                    http_errno_description(HTTP_PARSER_ERRNO(&c->parser)));
+            exit(1);
+          }
+        }
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+          fprintf(stderr, "server closed the connection\n");
+          exit(1);
+        }
+      }
+
+      if (client_send(c) != 0) {
+        perror("send");
+        exit(1);
+      }
+    }
+  }
+
+  close(epfd);
+  return NULL;
+}
+
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-a addr] [-p port] [-t threads] [-c connections]\n"
+          "          [-d depth] [-s seconds] [-w seconds] [-C cores]\n"
+          "  -a  server address (127.0.0.1)\n"
+          "  -p  server port (8080)\n"
+          "  -t  client threads (1)\n"
+          "  -c  connections in total (64)\n"
+          "  -d  requests pipelined per connection, 1 to %d (%d)\n"
+          "  -s  measurement time (10)\n"
+          "  -w  warm up time, not measured (1)\n"
+          "  -C  cores the server runs on, for the per core rate (1)\n",
+          name, HTTP_MAX_PENDING_REQUESTS, HTTP_MAX_PENDING_REQUESTS);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *addr = "127.0.0.1";
+  int port = 8080, nthreads = 1, nclients = 64, seconds = 10, warmup = 1;
+  int cores = 1;
+  struct worker *workers;
+  struct client *clients;
+  uint64_t *hist, completed = 0, start, elapsed;
+  int i, j, opt;
+
+  while ((opt = getopt(argc, argv, "a:p:t:c:d:s:w:C:")) != -1) {
+    switch (opt) {
+      case 'a': addr = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 't': nthreads = atoi(optarg); break;
+      case 'c': nclients = atoi(optarg); break;
+      case 'd': depth = atoi(optarg); break;
+      case 's': seconds = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'C': cores = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (nclients < nthreads) nclients = nthreads;
+  if (nthreads < 1 || nclients < 1 || depth < 1 ||
+      depth > HTTP_MAX_PENDING_REQUESTS || seconds < 1 || warmup < 0 ||
+      cores < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  memset(&server, 0, sizeof server);
+  server.sin_family = AF_INET;
+  server.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr, &server.sin_addr) != 1) {
+    fprintf(stderr, "bad address %s\n", addr);
+    return 1;
+  }
+
+  /* Requests that would end the connection are left out. */
+  for (i = 0; requests[i].name; i++) {
+    if (!requests[i].should_keep_alive || requests[i].upgrade) continue;
+    corpus[corpus_len++] = &requests[i];
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  workers = calloc(nthreads, sizeof *workers);
+  clients = calloc(nclients, sizeof *clients);
+  hist = calloc(HIST_BUCKETS, sizeof *hist);
+  if (!workers || !clients || !hist) return 1;
+
+  for (i = 0; i < nthreads; i++) {
+    workers[i].clients = clients + (size_t)nclients * i / nthreads;
+    workers[i].nclients = nclients * (i + 1) / nthreads
+                        - nclients * i / nthreads;
+    pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]);
+  }
+
+  sleep(warmup);
+  phase = 1;
+  start = now_ns();
+  sleep(seconds);
+  phase = 2;
+  elapsed = now_ns() - start;
+
+  for (i = 0; i < nthreads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    completed += workers[i].completed;
+    for (j = 0; j < HIST_BUCKETS; j++) hist[j] += workers[i].hist[j];
+  }
+
+  printf("%d connections, depth %d, %d requests in the corpus, %d s\n",
+         nclients, depth, corpus_len, seconds);
+  printf("requests/sec %10.0f  per core %10.0f\n",
+         completed * 1e9 / elapsed, completed * 1e9 / elapsed / cores);
+  printf("latency p50  %8.1f us  p99 %8.1f us\n",
+         hist_percentile(hist, completed, 0.50) / 1e3,
+         hist_percentile(hist, completed, 0.99) / 1e3);
+  return 0;
+}
@@ -0,0 +1,160 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Throughput of multipart_parser on an upload of random binary files, as
+ * a browser sends it, parsed in socket sized reads. Part data is only
+ * summed, so the figure is the cost of finding the boundaries.
+ */
+#include <multipart_parser.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define BOUNDARY "----WebKitFormBoundary7MA4YWxkTrZu0gW"
+
+
+static uint64_t data_bytes;
+
+
+static int
+on_part_data (multipart_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  data_bytes += len + (unsigned char) at[len - 1];
+  return 0;
+}
+
+
+static const multipart_parser_settings settings =
+  { .on_part_data = on_part_data };
+
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* 'nfiles' parts of random bytes, 'size' bytes in all */
+static size_t
+make_body (char *out, size_t size, int nfiles)
+{
+  uint64_t rng = 88172645463325252ULL;
+  size_t len = 0, part = size / nfiles, i;
+  int f;
+
+  for (f = 0; f < nfiles; f++) {
+    len += sprintf(out + len,
+                   "--" BOUNDARY "\r\n"
+                   "Content-Disposition: form-data; name=\"file%d\"; "
+                   "filename=\"upload%d.bin\"\r\n"
+                   "Content-Type: application/octet-stream\r\n"
+                   "\r\n", f, f);
+    for (i = 0; i < part; i += 8) {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      memcpy(out + len + i, &rng, 8);
+    }
+    len += part;
+    len += sprintf(out + len, "\r\n");
+  }
+  len += sprintf(out + len, "--" BOUNDARY "--\r\n");
+  return len;
+}
+
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-s MB] [-f files] [-r bytes] [-n runs]\n"
+          "  -s  upload size in MB (256)\n"
+          "  -f  files in the upload (4)\n"
+          "  -r  read size (65536)\n"
+          "  -n  runs, the best one counts (5)\n",
+          name);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  multipart_parser parser;
+  char *body;
+  size_t size = 256, read_size = 65536, len, off, n;
+  int files = 4, runs = 5, opt, run;
+  double t, best = 1e9;
+
+  while ((opt = getopt(argc, argv, "s:f:r:n:")) != -1) {
+    switch (opt) {
+      case 's': size = strtoull(optarg, NULL, 10); break;
+      case 'f': files = atoi(optarg); break;
+      case 'r': read_size = strtoull(optarg, NULL, 10); break;
+      case 'n': runs = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (size < 1 || files < 1 || read_size < 1 || runs < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  body = malloc((size << 20) + files * 256 + 64);
+  if (!body) return 1;
+  len = make_body(body, size << 20, files);
+
+  for (run = 0; run < runs; run++) {
+    t = now();
+    multipart_parser_init(&parser, BOUNDARY, sizeof BOUNDARY - 1);
+    for (off = 0; off < len; off += n) {
+      n = len - off < read_size ? len - off : read_size;
+      if (multipart_parser_execute(&parser, &settings, body + off, n) != n) {
+        fprintf(stderr, "parse error: %s\n", multipart_errno_description(
+                multipart_parser_errno(&parser)));
+        return 1;
+      }
+    }
+    multipart_parser_execute(&parser, &settings, NULL, 0);
+    t = now() - t;
+    if (multipart_parser_errno(&parser) != MPE_OK
+        || parser.nparts != (unsigned) files) {
+      fprintf(stderr, "bad upload\n");
+      return 1;
+    }
+    if (t < best) best = t;
+  }
+
+  printf("%zu MB in %d files, %zu byte reads\n", size, files, read_size);
+  printf("%.2f GB/s\n", len / best / 1e9);
+  printf("checksum %llu\n", (unsigned long long) data_bytes);
+
+  free(body);
+  return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Runs contrib/bench.sh with 1 to 'max' server cores. Requests per core
+# falling off while the parser's share of the server's CPU time drops
+# marks the point where the parser stopped being the bottleneck.
+#
+#   contrib/scale.sh [epoll_server|uring_server] [max] [loadgen options]
+
+server=${1:-epoll_server}
+max=${2:-$(nproc)}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+
+dir=$(dirname "$0")
+
+for n in $(seq 1 "$max"); do
+  echo "== $server on $n core(s)"
+  "$dir/bench.sh" "$server" "$n" "$@" 2>&1 | grep -v '^listening'
+done
@@ -0,0 +1,379 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include "server.h"
+#include <http_writer.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define BODY "Hello, World!"
+
+
+/* A response rendered once at startup. HEAD requests get 'head_len'
+ * bytes of it.
+ */
+struct response {
+  size_t head_len;
+  size_t len;
+  char buf[256];
+};
+
+static struct response ok;
+static struct response ok_close;
+static struct response bad_request;
+static struct response too_large;
+static struct response uri_too_long;
+static struct response body_too_large;
+static struct response switching;
+static struct response connected;
+
+
+#define HEADER(F, V) {F, sizeof(F)-1, V, sizeof(V)-1}
+
+static const struct http_header close_header[] =
+  { HEADER("Connection", "close")
+  };
+
+static const struct http_header upgrade_headers[] =
+  { HEADER("Connection", "Upgrade")
+  , HEADER("Upgrade", "echo")
+  };
+
+
+/* Renders a response with 'body', or without Content-Type and
+ * Content-Length if 'body' is NULL, followed by 'extra' headers.
+ */
+static void
+response_init (struct response *r,
+               unsigned short status_code,
+               const char *body,
+               const struct http_header *extra,
+               int nextra)
+{
+  struct http_header headers[4];
+  struct http_head head;
+  char length[16];
+  int n = 0, i;
+
+  if (body) {
+    headers[n].field = "Content-Type";
+    headers[n].field_len = sizeof("Content-Type")-1;
+    headers[n].value = "text/plain";
+    headers[n].value_len = sizeof("text/plain")-1;
+    n++;
+
+    headers[n].field = "Content-Length";
+    headers[n].field_len = sizeof("Content-Length")-1;
+    headers[n].value = length;
+    headers[n].value_len = snprintf(length, sizeof length, "%u",
+                                    (unsigned int)strlen(body));
+    n++;
+  } else {
+    body = "";
+  }
+
+  for (i = 0; i < nextra; i++) {
+    headers[n++] = extra[i];
+  }
+
+  memset(&head, 0, sizeof head);
+  head.type = HTTP_RESPONSE;
+  head.http_major = 1;
+  head.http_minor = 1;
+  head.status_code = status_code;
+  head.headers = headers;
+  head.num_headers = n;
+
+  r->head_len = http_head_write(&head, r->buf, sizeof r->buf);
+  if (r->head_len == 0 || r->head_len + strlen(body) > sizeof r->buf) {
+    fprintf(stderr, "can't render %u response\n", status_code);
+    exit(1);
+  }
+  memcpy(r->buf + r->head_len, body, strlen(body));
+  r->len = r->head_len + strlen(body);
+}
+
+
+static int
+queue (struct conn *c, const char *buf, size_t len)
+{
+  if (c->out_len + len > sizeof c->out) return -1;
+  memcpy(c->out + c->out_len, buf, len);
+  c->out_len += len;
+  return 0;
+}
+
+
+static int
+message_complete_cb (http_parser *p)
+{
+  struct conn *c = p->data;
+  const struct response *r;
+
+  /* Answered in conn_recv() once the parser has stopped. */
+  if (p->upgrade) return 0;
+
+  c->thread->requests++;
+
+  r = http_should_keep_alive(p) ? &ok : &ok_close;
+
+  if (queue(c, r->buf, p->method == HTTP_HEAD ? r->head_len : r->len) != 0 ||
+      r == &ok_close) {
+    /* Stop parsing, whatever follows is not answered. */
+    c->keep_alive = 0;
+    return -1;
+  }
+  return 0;
+}
+
+
+/* Nothing here reads a URL or a body, so keep both short. */
+static const struct http_parser_limits limits =
+  { .max_url_size = 8192
+  , .max_body_size = 1 << 20
+  };
+
+
+static http_parser_settings settings =
+  {.on_message_complete = message_complete_cb
+  ,.limits = &limits
+  };
+
+
+void
+conn_init (struct conn *c, struct server_thread *thread, int fd)
+{
+  http_parser_init(&c->parser, HTTP_REQUEST);
+  c->parser.data = c;
+  c->thread = thread;
+  c->fd = fd;
+  c->keep_alive = 1;
+  c->tunnel = 0;
+  c->out_len = 0;
+  c->out_sent = 0;
+}
+
+
+int
+conn_recv (struct conn *c, const char *buf, size_t len)
+{
+  size_t nparsed;
+  uint64_t start;
+  const struct response *r;
+
+  if (len == 0) return -1;
+
+  /* After an upgrade or CONNECT the connection echoes what it gets. */
+  if (c->tunnel) return queue(c, buf, len);
+
+  start = http_parser_clock();
+  nparsed = http_parser_execute(&c->parser, &settings, buf, len);
+  c->thread->parse_ticks += http_parser_clock() - start;
+
+  if (!c->keep_alive) return -1;
+
+  if (c->parser.upgrade) {
+    c->thread->requests++;
+    r = c->parser.method == HTTP_CONNECT ? &connected : &switching;
+    c->tunnel = 1;
+    if (queue(c, r->buf, r->len) != 0) return -1;
+    return queue(c, buf + nparsed, len - nparsed);
+  }
+
+  if (nparsed != len) {
+    switch (HTTP_PARSER_ERRNO(&c->parser)) {
+      case HPE_HEADER_OVERFLOW:
+      case HPE_HEADER_LINE_OVERFLOW:
+      case HPE_TOO_MANY_HEADERS:
+        r = &too_large;
+        break;
+      case HPE_URL_OVERFLOW:
+        r = &uri_too_long;
+        break;
+      case HPE_BODY_OVERFLOW:
+        r = &body_too_large;
+        break;
+      default:
+        r = &bad_request;
+        break;
+    }
+    queue(c, r->buf, r->len);
+    c->keep_alive = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static int
+server_listen (const char *addr, int port)
+{
+  struct sockaddr_in sin;
+  int fd, one = 1;
+
+  memset(&sin, 0, sizeof sin);
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+    fprintf(stderr, "bad address %s\n", addr);
+    return -1;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) != 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0 ||
+      bind(fd, (struct sockaddr *)&sin, sizeof sin) != 0 ||
+      listen(fd, 4096) != 0) {
+    perror("listen");
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-a addr] [-p port] [-t threads] [-c connections]\n"
+          "  -a  address to listen on (127.0.0.1)\n"
+          "  -p  port (8080)\n"
+          "  -t  event loops, one per core starting at core 0 (1)\n"
+          "  -c  connections per event loop (1024)\n",
+          name);
+}
+
+
+int
+server_main (int argc, char **argv, void *(*loop)(void *))
+{
+  const char *addr = "127.0.0.1";
+  int port = 8080, nthreads = 1, max_conns = 1024;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  struct server_thread *threads;
+  struct timespec t0, t1;
+  uint64_t ticks0;
+  double ticks_per_ns;
+  sigset_t stop;
+  int i, opt, sig;
+
+  while ((opt = getopt(argc, argv, "a:p:t:c:")) != -1) {
+    switch (opt) {
+      case 'a': addr = optarg; break;
+      case 'p': port = atoi(optarg); break;
+      case 't': nthreads = atoi(optarg); break;
+      case 'c': max_conns = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (nthreads < 1 || max_conns < 1 || ncpu < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  response_init(&ok, 200, BODY, NULL, 0);
+  response_init(&ok_close, 200, BODY, close_header, 1);
+  response_init(&bad_request, 400, "", close_header, 1);
+  response_init(&too_large, 431, "", close_header, 1);
+  response_init(&uri_too_long, 414, "", close_header, 1);
+  response_init(&body_too_large, 413, "", close_header, 1);
+  response_init(&switching, 101, NULL, upgrade_headers, 2);
+  response_init(&connected, 200, NULL, NULL, 0);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  /* Only this thread takes them, see the end. */
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+  if (posix_memalign((void **)&threads, 64, nthreads * sizeof *threads)) {
+    return 1;
+  }
+  memset(threads, 0, nthreads * sizeof *threads);
+
+  for (i = 0; i < nthreads; i++) {
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+
+    threads[i].id = i;
+    threads[i].max_conns = max_conns;
+    threads[i].listen_fd = server_listen(addr, port);
+    if (threads[i].listen_fd < 0) return 1;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(i % ncpu, &cpus);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof cpus, &cpus);
+    if (pthread_create(&threads[i].thread, &attr, loop, &threads[i]) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+    pthread_attr_destroy(&attr);
+  }
+
+  fprintf(stderr, "listening on %s:%d with %d thread%s\n",
+          addr, port, nthreads, nthreads == 1 ? "" : "s");
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  ticks0 = http_parser_clock();
+
+  while (sigwait(&stop, &sig) != 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ticks_per_ns = (double)(http_parser_clock() - ticks0)
+               / ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec));
+
+  /* The event loops never return. The counters are read while they may
+   * still be running, which is close enough for a report.
+   */
+  for (i = 0; i < nthreads; i++) {
+    struct timespec cpu = {0, 0};
+    clockid_t clock;
+    double parse_ns;
+
+    if (pthread_getcpuclockid(threads[i].thread, &clock) == 0) {
+      clock_gettime(clock, &cpu);
+    }
+    parse_ns = threads[i].parse_ticks / ticks_per_ns;
+
+    fprintf(stderr, "thread %d: %llu requests, %.1f s cpu, parser %.1f%%\n",
+            i, (unsigned long long)threads[i].requests,
+            cpu.tv_sec + cpu.tv_nsec / 1e9,
+            100 * parse_ns / (cpu.tv_sec * 1e9 + cpu.tv_nsec + 1));
+  }
+  return 0;
+}
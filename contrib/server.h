@@ -0,0 +1,95 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef server_h
+#define server_h
+
+
+/* Connection handling shared by the reference servers in this directory.
+ * They differ only in how bytes get in and out of the kernel; parsing and
+ * the canned responses live here so their numbers can be compared.
+ */
+
+#include <http_parser.h>
+#include <pthread.h>
+#include <stdint.h>
+
+
+/* Responses queued on a connection and not yet written. A client that
+ * pipelines more than fits is disconnected.
+ */
+#define CONN_OUT_SIZE (16*1024)
+
+
+struct conn {
+  http_parser parser;
+  struct server_thread *thread;
+  int fd;
+
+  /* 0 once the response closing the connection has been queued */
+  int keep_alive;
+
+  /* Upgraded or CONNECTed, received data is echoed */
+  int tunnel;
+
+  /* The event loop resets both to 0 once everything has been written. */
+  size_t out_len;
+  size_t out_sent;
+  char out[CONN_OUT_SIZE];
+};
+
+
+/* One event loop, pinned to one core, with its own listening socket.
+ * Nothing in here or in its connections is touched by other loops; each
+ * one has cache lines of its own.
+ */
+struct server_thread {
+  int id;
+  int listen_fd;
+  int max_conns;
+  pthread_t thread;
+
+  /* Reported when the server is stopped */
+  uint64_t requests;
+  uint64_t parse_ticks;  /* in http_parser_execute(), http_parser_clock() */
+} __attribute__((aligned(64)));
+
+
+void conn_init(struct conn *c, struct server_thread *thread, int fd);
+
+
+/* Parses 'len' bytes read from the connection, 0 for EOF, and queues a
+ * response for every complete request. Upgrade requests are answered
+ * with 101, CONNECT with 200, and from then on the connection echoes.
+ * Returns -1 if the connection is to be closed once the queued responses
+ * have been written.
+ */
+int conn_recv(struct conn *c, const char *buf, size_t len);
+
+
+/* Parses the command line, opens a SO_REUSEPORT listener per thread and
+ * runs 'loop' on each, pinned to consecutive cores. 'loop' never returns.
+ * On SIGINT or SIGTERM prints requests, CPU time and the share of it
+ * spent in the parser per thread, and returns the exit status for main().
+ */
+int server_main(int argc, char **argv, void *(*loop)(void *));
+
+
+#endif
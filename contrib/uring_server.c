@@ -0,0 +1,469 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Reference server on io_uring: one ring per core, a multishot accept on
+ * the core's SO_REUSEPORT listener, a multishot recv per connection
+ * drawing from a provided buffer ring, and one send in flight per
+ * connection. Receive buffers go back to the kernel as soon as
+ * http_parser_execute() returns; the parser is not in retain mode, so
+ * nothing refers to them afterwards.
+ *
+ * Talks to the kernel through the raw system calls, no liburing needed.
+ * Requires Linux 5.19 or later.
+ */
+#define _GNU_SOURCE
+#include "server.h"
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define RING_ENTRIES 1024
+
+/* Provided receive buffers per ring, a power of 2 */
+#define BUF_COUNT 1024
+#define BUF_SIZE  4096
+#define BUF_GROUP 0
+
+enum op { OP_ACCEPT = 0, OP_RECV, OP_SEND, OP_CANCEL };
+
+#define USER_DATA(OP, I) ((uint64_t)(OP) << 32 | (uint32_t)(I))
+#define USER_OP(U)       ((enum op)((U) >> 32))
+#define USER_INDEX(U)    ((int)(uint32_t)(U))
+
+
+struct ring {
+  int fd;
+
+  /* Submission queue. 'tail' is ours until published by ring_submit(). */
+  unsigned *sq_khead;
+  unsigned *sq_ktail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_tail;
+  unsigned sq_submitted;
+  struct io_uring_sqe *sqes;
+
+  unsigned *cq_khead;
+  unsigned *cq_ktail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct io_uring_buf_ring *br;
+  uint16_t br_tail;
+  char *bufs;
+};
+
+
+struct slot {
+  struct conn conn;
+  int in_use;
+  int recv_armed;   /* the multishot recv has not terminated yet */
+  int sending;
+  int closing;      /* close once the queued responses are written */
+  int canceling;
+  int next_free;
+};
+
+
+struct loop {
+  struct server_thread *thread;
+  struct ring ring;
+  struct slot *slots;
+  int free_slot;
+};
+
+
+static int
+io_uring_setup (unsigned entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter (int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                       flags, NULL, 0);
+}
+
+
+static int
+io_uring_register (int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+static void
+buf_recycle (struct ring *r, unsigned bid)
+{
+  struct io_uring_buf *b = &r->br->bufs[r->br_tail & (BUF_COUNT - 1)];
+
+  b->addr = (uintptr_t)(r->bufs + (size_t)bid * BUF_SIZE);
+  b->len = BUF_SIZE;
+  b->bid = bid;
+  r->br_tail++;
+  __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+
+static int
+ring_init (struct ring *r)
+{
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+  size_t sq_size, cq_size;
+  char *sq, *cq;
+  unsigned i;
+
+  memset(&p, 0, sizeof p);
+  p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN
+          | IORING_SETUP_CQSIZE;
+  p.cq_entries = 4 * RING_ENTRIES;
+  r->fd = io_uring_setup(RING_ENTRIES, &p);
+  if (r->fd < 0 && errno == EINVAL) {
+    /* Kernels before 6.0 */
+    memset(&p, 0, sizeof p);
+    r->fd = io_uring_setup(RING_ENTRIES, &p);
+  }
+  if (r->fd < 0) {
+    perror("io_uring_setup");
+    return -1;
+  }
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_size > sq_size) sq_size = cq_size;
+  }
+
+  sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) return -1;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cq = sq;
+  } else {
+    cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) return -1;
+  }
+
+  r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) return -1;
+
+  r->sq_khead = (unsigned *)(sq + p.sq_off.head);
+  r->sq_ktail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_entries = p.sq_entries;
+  r->sq_tail = *r->sq_ktail;
+  r->sq_submitted = r->sq_tail;
+
+  r->cq_khead = (unsigned *)(cq + p.cq_off.head);
+  r->cq_ktail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  r->br = mmap(NULL, BUF_COUNT * sizeof(struct io_uring_buf),
+               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  r->bufs = malloc((size_t)BUF_COUNT * BUF_SIZE);
+  if (r->br == MAP_FAILED || !r->bufs) return -1;
+
+  memset(&reg, 0, sizeof reg);
+  reg.ring_addr = (uintptr_t)r->br;
+  reg.ring_entries = BUF_COUNT;
+  reg.bgid = BUF_GROUP;
+  if (io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    perror("IORING_REGISTER_PBUF_RING");
+    return -1;
+  }
+
+  r->br_tail = 0;
+  for (i = 0; i < BUF_COUNT; i++) {
+    buf_recycle(r, i);
+  }
+  return 0;
+}
+
+
+/* Publishes the queued entries and enters the kernel, waiting for
+ * 'wait' completions.
+ */
+static int
+ring_submit (struct ring *r, unsigned wait)
+{
+  int ret;
+
+  __atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+
+  do {
+    ret = io_uring_enter(r->fd, r->sq_tail - r->sq_submitted, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    if (errno == EBUSY || errno == EAGAIN) return 0;
+    perror("io_uring_enter");
+    return -1;
+  }
+  r->sq_submitted += ret;
+  return 0;
+}
+
+
+static struct io_uring_sqe *
+ring_sqe (struct ring *r)
+{
+  struct io_uring_sqe *sqe;
+  unsigned index;
+
+  while (r->sq_tail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE)
+         >= r->sq_entries) {
+    if (ring_submit(r, 0) != 0) abort();
+  }
+
+  index = r->sq_tail & r->sq_mask;
+  r->sq_array[index] = index;
+  r->sq_tail++;
+
+  sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof *sqe);
+  return sqe;
+}
+
+
+static void
+arm_accept (struct loop *l)
+{
+  struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = l->thread->listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = USER_DATA(OP_ACCEPT, 0);
+}
+
+
+static void
+arm_recv (struct loop *l, int i)
+{
+  struct io_uring_sqe *sqe = ring_sqe(&l->ring);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = l->slots[i].conn.fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUF_GROUP;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = USER_DATA(OP_RECV, i);
+  l->slots[i].recv_armed = 1;
+}
+
+
+/* Starts writing the queued responses, or finishes closing. */
+static void
+flush (struct loop *l, int i)
+{
+  struct slot *s = &l->slots[i];
+  struct conn *c = &s->conn;
+  struct io_uring_sqe *sqe;
+
+  if (s->sending) return;
+
+  if (c->out_sent < c->out_len) {
+    sqe = ring_sqe(&l->ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t)(c->out + c->out_sent);
+    sqe->len = c->out_len - c->out_sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = USER_DATA(OP_SEND, i);
+    s->sending = 1;
+    return;
+  }
+
+  c->out_len = c->out_sent = 0;
+
+  if (!s->closing) return;
+
+  if (s->recv_armed) {
+    if (!s->canceling) {
+      sqe = ring_sqe(&l->ring);
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = USER_DATA(OP_RECV, i);
+      sqe->user_data = USER_DATA(OP_CANCEL, i);
+      s->canceling = 1;
+    }
+    return;
+  }
+
+  close(c->fd);
+  s->in_use = 0;
+  s->next_free = l->free_slot;
+  l->free_slot = i;
+}
+
+
+static void
+on_accept (struct loop *l, const struct io_uring_cqe *cqe)
+{
+  int fd = cqe->res, one = 1, i;
+  struct slot *s;
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) arm_accept(l);
+  if (fd < 0) return;
+
+  i = l->free_slot;
+  if (i < 0) {
+    close(fd);
+    return;
+  }
+  s = &l->slots[i];
+  l->free_slot = s->next_free;
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  conn_init(&s->conn, l->thread, fd);
+  s->in_use = 1;
+  s->sending = 0;
+  s->closing = 0;
+  s->canceling = 0;
+  arm_recv(l, i);
+}
+
+
+static void
+on_recv (struct loop *l, const struct io_uring_cqe *cqe)
+{
+  int i = USER_INDEX(cqe->user_data);
+  struct slot *s = &l->slots[i];
+  unsigned bid;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0 && !s->closing) {
+      if (conn_recv(&s->conn, l->ring.bufs + (size_t)bid * BUF_SIZE,
+                    cqe->res) != 0) {
+        s->closing = 1;
+      }
+    }
+    buf_recycle(&l->ring, bid);
+  }
+
+  if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS)) {
+    s->closing = 1;
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    s->recv_armed = 0;
+    /* Out of buffers, or the kernel ended the multishot for its own
+     * reasons. Buffers have been recycled by now.
+     */
+    if (!s->closing) arm_recv(l, i);
+  }
+
+  flush(l, i);
+}
+
+
+static void
+on_send (struct loop *l, const struct io_uring_cqe *cqe)
+{
+  int i = USER_INDEX(cqe->user_data);
+  struct slot *s = &l->slots[i];
+
+  s->sending = 0;
+  if (cqe->res < 0) {
+    s->conn.out_sent = s->conn.out_len;
+    s->closing = 1;
+  } else {
+    s->conn.out_sent += cqe->res;
+  }
+  flush(l, i);
+}
+
+
+static void *
+uring_loop (void *arg)
+{
+  struct loop l;
+  int i;
+
+  memset(&l, 0, sizeof l);
+  l.thread = arg;
+  if (ring_init(&l.ring) != 0) exit(1);
+
+  l.slots = calloc(l.thread->max_conns, sizeof *l.slots);
+  if (!l.slots) exit(1);
+  l.free_slot = -1;
+  for (i = l.thread->max_conns - 1; i >= 0; i--) {
+    l.slots[i].next_free = l.free_slot;
+    l.free_slot = i;
+  }
+
+  arm_accept(&l);
+
+  for (;;) {
+    struct ring *r = &l.ring;
+    unsigned head, tail;
+
+    if (ring_submit(r, 1) != 0) exit(1);
+
+    head = *r->cq_khead;
+    tail = __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe cqe = r->cqes[head & r->cq_mask];
+
+      switch (USER_OP(cqe.user_data)) {
+        case OP_ACCEPT: on_accept(&l, &cqe); break;
+        case OP_RECV:   on_recv(&l, &cqe); break;
+        case OP_SEND:   on_send(&l, &cqe); break;
+        case OP_CANCEL: break;
+      }
+    }
+
+    __atomic_store_n(r->cq_khead, head, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  return server_main(argc, argv, uring_loop);
+}
@@ -0,0 +1,183 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Throughput of websocket_parser on masked client frames of one payload
+ * size, parsed in socket sized reads. Small frames measure the header
+ * path, large ones the unmasking and, with -t, the UTF-8 check.
+ */
+#include <websocket_parser.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static uint64_t payload_bytes;
+static uint64_t messages;
+
+
+static int
+on_frame_payload (websocket_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  payload_bytes += len + (unsigned char) at[len - 1];
+  return 0;
+}
+
+
+static int
+on_message_end (websocket_parser *p)
+{
+  (void)p;
+  messages++;
+  return 0;
+}
+
+
+static const websocket_parser_settings settings =
+  { .on_frame_payload = on_frame_payload
+  , .on_message_end = on_message_end
+  };
+
+
+static double
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Frames of 'frame' bytes of payload until 'size' bytes are written */
+static size_t
+make_frames (char *out, size_t size, size_t frame, int text, size_t *nframes)
+{
+  static const char words[] = "mostly ASCII, caf\xc3\xa9, \xe2\x82\xac. ";
+  uint64_t rng = 88172645463325252ULL;
+  unsigned char mask[4];
+  size_t len = 0, i;
+
+  *nframes = 0;
+  while (len + WEBSOCKET_MAX_HEADER_SIZE + frame <= size) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    memcpy(mask, &rng, 4);
+    len += websocket_frame_header(out + len, 1, text ? WS_TEXT : WS_BINARY,
+                                  frame, mask);
+    for (i = 0; i < frame; i++) {
+      out[len + i] = text ? words[i % (sizeof words - 1)]
+                          : (char) (rng >> (i & 31));
+    }
+    /* text must not end inside a character */
+    while (text && i > 0 && (unsigned char) out[len + i - 1] >= 0x80) {
+      out[len + --i] = '.';
+    }
+    websocket_mask(out + len, frame, mask, 0);
+    len += frame;
+    (*nframes)++;
+  }
+  return len;
+}
+
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-s MB] [-f bytes] [-t] [-r bytes] [-n runs]\n"
+          "  -s  data size in MB (256)\n"
+          "  -f  payload size of each frame (4096)\n"
+          "  -t  text frames, checked to be UTF-8\n"
+          "  -r  read size (65536)\n"
+          "  -n  runs, the best one counts (5)\n",
+          name);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  websocket_parser parser;
+  char *frames, *buf;
+  size_t size = 256, frame = 4096, read_size = 65536, len, off, n, nframes;
+  int text = 0, runs = 5, opt, run;
+  double t, best = 1e9;
+
+  while ((opt = getopt(argc, argv, "s:f:tr:n:")) != -1) {
+    switch (opt) {
+      case 's': size = strtoull(optarg, NULL, 10); break;
+      case 'f': frame = strtoull(optarg, NULL, 10); break;
+      case 't': text = 1; break;
+      case 'r': read_size = strtoull(optarg, NULL, 10); break;
+      case 'n': runs = atoi(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (size < 1 || frame < 1 || read_size < 1 || runs < 1
+      || frame + WEBSOCKET_MAX_HEADER_SIZE > size << 20) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  frames = malloc(size << 20);
+  buf = malloc(size << 20);
+  if (!frames || !buf) return 1;
+  len = make_frames(frames, size << 20, frame, text, &nframes);
+
+  for (run = 0; run < runs; run++) {
+    /* the parser unmasks in place */
+    memcpy(buf, frames, len);
+    messages = 0;
+
+    t = now();
+    memset(&parser, 0, sizeof parser);
+    websocket_parser_init(&parser, WS_SERVER);
+    for (off = 0; off < len; off += n) {
+      n = len - off < read_size ? len - off : read_size;
+      if (websocket_parser_execute(&parser, &settings, buf + off, n) != n) {
+        fprintf(stderr, "parse error: %s\n", websocket_errno_description(
+                websocket_parser_errno(&parser)));
+        return 1;
+      }
+    }
+    t = now() - t;
+    if (messages != nframes) {
+      fprintf(stderr, "bad frames\n");
+      return 1;
+    }
+    if (t < best) best = t;
+  }
+
+  printf("%zu %s frames of %zu bytes, %zu byte reads\n",
+         nframes, text ? "text" : "binary", frame, read_size);
+  printf("%.2f GB/s, %.3g M frames/s\n",
+         len / best / 1e9, nframes / best / 1e6);
+  printf("checksum %llu\n", (unsigned long long) payload_bytes);
+
+  free(frames);
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,972 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <http_cache.h>
+#include <http_writer.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+
+#if defined(__GNUC__)
+# define CACHE_ALIGNED __attribute__((aligned(64)))
+# define REFS_ADD(P, N) __atomic_add_fetch((P), (N), __ATOMIC_ACQ_REL)
+#else
+# define CACHE_ALIGNED
+# define REFS_ADD(P, N) (*(P) += (N))
+#endif
+
+#define INITIAL_BUCKETS 64
+#define INITIAL_FILL_SIZE 1024
+
+
+/* Everything in a shard is guarded by its lock, except the entry
+ * reference counts. Shards are cache line aligned so that threads busy in
+ * different shards do not share lines.
+ */
+struct shard {
+  pthread_mutex_t lock;
+  pthread_cond_t filled;  /* a placeholder went away */
+
+  struct http_cache_entry **buckets;
+  size_t nbuckets;  /* a power of two */
+  size_t count;
+
+  /* CLOCK ring of the stored entries, placeholders are not in it. New
+   * entries go right behind the hand, the last place it looks.
+   */
+  struct http_cache_entry *hand;
+  size_t bytes;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t waits;
+  uint64_t inserts;
+  uint64_t evictions;
+  uint64_t expired;
+} CACHE_ALIGNED;
+
+
+struct http_cache {
+  struct shard *shards;
+  unsigned int nshards;  /* a power of two */
+  size_t shard_budget;
+  unsigned int default_ttl;
+  time_t (*clock)(time_t *);
+  const char * const *key_headers;
+};
+
+
+static inline struct shard *
+shard_of (struct http_cache *cache, uint64_t key)
+{
+  return &cache->shards[key & (cache->nshards - 1)];
+}
+
+
+/* The low bits pick the shard */
+static inline struct http_cache_entry **
+bucket_of (struct shard *s, uint64_t key)
+{
+  return &s->buckets[(key >> 32) & (s->nbuckets - 1)];
+}
+
+
+static inline size_t
+entry_size (const struct http_cache_entry *e)
+{
+  return sizeof *e + e->iov.iov_len;
+}
+
+
+static struct http_cache_entry *
+table_find (struct shard *s, uint64_t key)
+{
+  struct http_cache_entry *e;
+
+  for (e = *bucket_of(s, key); e; e = e->next) {
+    if (e->key == key) return e;
+  }
+  return NULL;
+}
+
+
+static void
+table_remove (struct shard *s, struct http_cache_entry *e)
+{
+  struct http_cache_entry **p = bucket_of(s, e->key);
+
+  while (*p != e) p = &(*p)->next;
+  *p = e->next;
+  s->count--;
+}
+
+
+/* Doubles the buckets once there are more entries than buckets. Stays
+ * with the ones it has if out of memory.
+ */
+static void
+table_insert (struct shard *s, struct http_cache_entry *e)
+{
+  struct http_cache_entry **p;
+
+  if (s->count >= s->nbuckets) {
+    struct http_cache_entry **old = s->buckets, *o, *next;
+    size_t n = s->nbuckets, i;
+
+    s->buckets = calloc(2 * n, sizeof *s->buckets);
+    if (s->buckets) {
+      s->nbuckets = 2 * n;
+      for (i = 0; i < n; i++) {
+        for (o = old[i]; o; o = next) {
+          next = o->next;
+          p = bucket_of(s, o->key);
+          o->next = *p;
+          *p = o;
+        }
+      }
+      free(old);
+    } else {
+      s->buckets = old;
+    }
+  }
+
+  p = bucket_of(s, e->key);
+  e->next = *p;
+  *p = e;
+  s->count++;
+}
+
+
+static void
+clock_insert (struct shard *s, struct http_cache_entry *e)
+{
+  if (s->hand) {
+    e->clock_next = s->hand;
+    e->clock_prev = s->hand->clock_prev;
+    e->clock_prev->clock_next = e;
+    s->hand->clock_prev = e;
+  } else {
+    e->clock_next = e->clock_prev = e;
+    s->hand = e;
+  }
+  s->bytes += entry_size(e);
+}
+
+
+static void
+clock_remove (struct shard *s, struct http_cache_entry *e)
+{
+  if (e->clock_next == e) {
+    s->hand = NULL;
+  } else {
+    e->clock_prev->clock_next = e->clock_next;
+    e->clock_next->clock_prev = e->clock_prev;
+    if (s->hand == e) s->hand = e->clock_next;
+  }
+  s->bytes -= entry_size(e);
+}
+
+
+/* Takes a stored entry out of the shard. Memory goes once the last lookup
+ * holding it has released it.
+ */
+static void
+drop (struct shard *s, struct http_cache_entry *e)
+{
+  table_remove(s, e);
+  clock_remove(s, e);
+  http_cache_release(e);
+}
+
+
+/* Evicts until 'need' more bytes fit into 'budget'. */
+static void
+evict (struct shard *s, size_t budget, size_t need)
+{
+  struct http_cache_entry *e;
+
+  while (s->hand && s->bytes + need > budget) {
+    e = s->hand;
+    if (e->referenced) {
+      e->referenced = 0;
+      s->hand = e->clock_next;
+    } else {
+      drop(s, e);
+      s->evictions++;
+    }
+  }
+}
+
+
+struct http_cache *
+http_cache_new (size_t budget, unsigned int nshards)
+{
+  struct http_cache *cache;
+  unsigned int n = 1, i;
+
+  while (n < nshards) n <<= 1;
+
+  cache = calloc(1, sizeof *cache);
+  if (!cache) return NULL;
+
+  if (posix_memalign((void **) &cache->shards, 64, n * sizeof *cache->shards)) {
+    free(cache);
+    return NULL;
+  }
+  memset(cache->shards, 0, n * sizeof *cache->shards);
+  cache->nshards = n;
+  cache->shard_budget = budget / n;
+  cache->default_ttl = HTTP_CACHE_DEFAULT_TTL;
+  cache->clock = time;
+
+  for (i = 0; i < n; i++) {
+    struct shard *s = &cache->shards[i];
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->filled, NULL);
+    s->nbuckets = INITIAL_BUCKETS;
+    s->buckets = calloc(s->nbuckets, sizeof *s->buckets);
+    if (!s->buckets) {
+      cache->nshards = i + 1;
+      http_cache_free(cache);
+      return NULL;
+    }
+  }
+  return cache;
+}
+
+
+void
+http_cache_free (struct http_cache *cache)
+{
+  struct http_cache_entry *e, *next;
+  unsigned int i;
+  size_t b;
+
+  for (i = 0; i < cache->nshards; i++) {
+    struct shard *s = &cache->shards[i];
+
+    for (b = 0; s->buckets && b < s->nbuckets; b++) {
+      for (e = s->buckets[b]; e; e = next) {
+        next = e->next;
+        free(e);
+      }
+    }
+    free(s->buckets);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->filled);
+  }
+  free(cache->shards);
+  free(cache);
+}
+
+
+void
+http_cache_set_default_ttl (struct http_cache *cache, unsigned int ttl)
+{
+  cache->default_ttl = ttl;
+}
+
+
+void
+http_cache_set_clock (struct http_cache *cache, time_t (*clock)(time_t *))
+{
+  cache->clock = clock;
+}
+
+
+void
+http_cache_set_key_headers (struct http_cache *cache,
+                            const char * const *names)
+{
+  cache->key_headers = names;
+}
+
+
+enum http_cache_result
+http_cache_lookup (struct http_cache *cache,
+                   uint64_t key,
+                   int wait,
+                   struct http_cache_entry **entry)
+{
+  struct shard *s = shard_of(cache, key);
+  struct http_cache_entry *e;
+  enum http_cache_result result;
+  time_t now = cache->clock(NULL);
+
+  *entry = NULL;
+
+  pthread_mutex_lock(&s->lock);
+
+  for (;;) {
+    e = table_find(s, key);
+
+    if (e && !e->filling && e->expires <= now) {
+      /* stale, fetched again like a key never seen */
+      drop(s, e);
+      s->expired++;
+      e = NULL;
+    }
+
+    if (!e) {
+      /* Ours to fetch. The placeholder makes the others wait. */
+      e = calloc(1, sizeof *e);
+      if (e) {
+        e->key = key;
+        e->filling = 1;
+        table_insert(s, e);
+      }
+      s->misses++;
+      result = HTTP_CACHE_MISS;
+      break;
+    }
+
+    if (!e->filling) {
+      REFS_ADD(&e->refs, 1);
+      e->referenced = 1;
+      s->hits++;
+      *entry = e;
+      result = HTTP_CACHE_HIT;
+      break;
+    }
+
+    if (!wait) {
+      result = HTTP_CACHE_PENDING;
+      break;
+    }
+
+    s->waits++;
+    pthread_cond_wait(&s->filled, &s->lock);
+  }
+
+  pthread_mutex_unlock(&s->lock);
+  return result;
+}
+
+
+void
+http_cache_release (struct http_cache_entry *entry)
+{
+  if (REFS_ADD(&entry->refs, -1) == 0) free(entry);
+}
+
+
+/* Replaces the placeholder, or an older entry, of 'key' with 'e', or just
+ * removes it if 'e' is NULL, and wakes whoever waits for it.
+ */
+static void
+publish (struct http_cache *cache, uint64_t key, struct http_cache_entry *e)
+{
+  struct shard *s = shard_of(cache, key);
+  struct http_cache_entry *old;
+
+  pthread_mutex_lock(&s->lock);
+
+  old = table_find(s, key);
+  if (old && old->filling) {
+    table_remove(s, old);
+    free(old);
+  } else if (old && e) {
+    drop(s, old);
+  }
+
+  if (e) {
+    evict(s, cache->shard_budget, entry_size(e));
+    e->refs = 1;  /* the shard's */
+    table_insert(s, e);
+    clock_insert(s, e);
+    s->inserts++;
+  }
+
+  pthread_cond_broadcast(&s->filled);
+  pthread_mutex_unlock(&s->lock);
+}
+
+
+void
+http_cache_stats (struct http_cache *cache, struct http_cache_stats *stats)
+{
+  unsigned int i;
+
+  memset(stats, 0, sizeof *stats);
+
+  for (i = 0; i < cache->nshards; i++) {
+    struct shard *s = &cache->shards[i];
+    struct http_cache_entry *e;
+
+    pthread_mutex_lock(&s->lock);
+    stats->hits += s->hits;
+    stats->misses += s->misses;
+    stats->waits += s->waits;
+    stats->inserts += s->inserts;
+    stats->evictions += s->evictions;
+    stats->expired += s->expired;
+    stats->bytes += s->bytes;
+    if ((e = s->hand)) {
+      do {
+        stats->entries++;
+        e = e->clock_next;
+      } while (e != s->hand);
+    }
+    pthread_mutex_unlock(&s->lock);
+  }
+}
+
+
+/* Fill */
+
+
+static void
+fill_fail (struct http_cache_fill *fill)
+{
+  free(fill->buf);
+  fill->buf = NULL;
+  fill->len = fill->size = 0;
+  fill->failed = 1;
+}
+
+
+static int
+fill_append (struct http_cache_fill *fill, const char *at, size_t len)
+{
+  size_t size = fill->size ? fill->size : INITIAL_FILL_SIZE;
+  char *buf;
+
+  if (fill->failed) return -1;
+
+  if (fill->len + len > fill->cache->shard_budget) {
+    fill_fail(fill);
+    return -1;
+  }
+
+  if (fill->len + len > fill->size) {
+    while (size < fill->len + len) size *= 2;
+    buf = realloc(fill->buf, size);
+    if (!buf) {
+      fill_fail(fill);
+      return -1;
+    }
+    fill->buf = buf;
+    fill->size = size;
+  }
+
+  memcpy(fill->buf + fill->len, at, len);
+  fill->len += len;
+  return 0;
+}
+
+
+static int
+field_is (const struct http_cache_fill *fill, int i, const char *name)
+{
+  return fill->headers[i].field_len == strlen(name)
+      && 0 == strncasecmp(fill->buf + fill->headers[i].field,
+                          name,
+                          fill->headers[i].field_len);
+}
+
+
+/* Does header value 'i' contain 'token', ignoring case? */
+static int
+value_has (const struct http_cache_fill *fill, int i, const char *token)
+{
+  const char *v = fill->buf + fill->headers[i].value;
+  size_t len = fill->headers[i].value_len, n = strlen(token), j;
+
+  for (j = 0; j + n <= len; j++) {
+    if (0 == strncasecmp(v + j, token, n)) return 1;
+  }
+  return 0;
+}
+
+
+/* The seconds of a Cache-Control 'directive' in header value 'i', or -1
+ * if it is not there. A value that is not a number counts as 0.
+ */
+static long long
+directive_seconds (const struct http_cache_fill *fill,
+                   int i,
+                   const char *directive)
+{
+  const char *v = fill->buf + fill->headers[i].value;
+  const char *end = v + fill->headers[i].value_len;
+  size_t n = strlen(directive);
+  long long seconds = 0;
+  const char *p;
+
+  for (p = v; p + n < end; p++) {
+    if (p[n] != '=' || 0 != strncasecmp(p, directive, n)) continue;
+    if (p > v && p[-1] != ',' && p[-1] != ' ' && p[-1] != '\t') continue;
+
+    p += n + 1;
+    if (p < end && *p == '"') p++;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (seconds < 1LL << 40) seconds = seconds * 10 + (*p - '0');
+    }
+    return seconds;
+  }
+  return -1;
+}
+
+
+/* Days from 1970-01-01 to the given date of the proleptic Gregorian
+ * calendar, 'month' from 1.
+ */
+static long long
+days_from_civil (long long year, int month, int day)
+{
+  long long era, yoe, doy, doe;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  yoe = year - era * 400;
+  doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+
+static int
+two_digits (const char *p)
+{
+  if (p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9') return -1;
+  return (p[0] - '0') * 10 + (p[1] - '0');
+}
+
+
+/* Parses an IMF-fixdate as http_date() writes it,
+ * "Sun, 06 Nov 1994 08:49:37 GMT". Returns -1 for anything else.
+ */
+static int
+parse_http_date (const char *p, size_t len, time_t *t)
+{
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  int day, month, century, year, hour, min, sec;
+
+  if (len != 29 || p[3] != ',' || p[4] != ' ' || p[7] != ' '
+      || p[11] != ' ' || p[16] != ' ' || p[19] != ':' || p[22] != ':'
+      || 0 != memcmp(p + 25, " GMT", 4)) {
+    return -1;
+  }
+
+  for (month = 0; month < 12; month++) {
+    if (0 == memcmp(p + 8, months + 3 * month, 3)) break;
+  }
+  day = two_digits(p + 5);
+  century = two_digits(p + 12);
+  year = two_digits(p + 14);
+  hour = two_digits(p + 17);
+  min = two_digits(p + 20);
+  sec = two_digits(p + 23);
+  if (month == 12 || day < 1 || day > 31 || century < 0 || year < 0
+      || hour < 0 || hour > 23 || min < 0 || min > 59 || sec < 0
+      || sec > 60) {
+    return -1;
+  }
+
+  *t = (time_t) ((days_from_civil(century * 100 + year, month + 1, day)
+                  * 24 + hour) * 60 + min) * 60 + sec;
+  return 0;
+}
+
+
+/* When the response stops being fresh, or 0 if it already has */
+static time_t
+fresh_until (const struct http_cache_fill *fill, time_t now)
+{
+  const struct http_cache *cache = fill->cache;
+  long long s_maxage = -1, max_age = -1, age = 0, lifetime, n;
+  time_t date = 0, expires = 0;
+  int has_date = 0, has_expires = 0, i;
+
+  for (i = 0; i < fill->nheaders; i++) {
+    const char *v = fill->buf + fill->headers[i].value;
+    size_t len = fill->headers[i].value_len;
+
+    if (field_is(fill, i, "cache-control")) {
+      if (s_maxage < 0) s_maxage = directive_seconds(fill, i, "s-maxage");
+      if (max_age < 0) max_age = directive_seconds(fill, i, "max-age");
+    } else if (field_is(fill, i, "expires")) {
+      /* one that does not parse, like "0", is in the past */
+      has_expires = 1;
+      if (parse_http_date(v, len, &expires) != 0) expires = 0;
+    } else if (field_is(fill, i, "date")) {
+      has_date = parse_http_date(v, len, &date) == 0;
+    } else if (field_is(fill, i, "age")) {
+      for (n = 0; len > 0 && *v >= '0' && *v <= '9'; v++, len--) {
+        if (n < 1LL << 40) n = n * 10 + (*v - '0');
+      }
+      age = n;
+    }
+  }
+
+  if (s_maxage >= 0) {
+    lifetime = s_maxage;
+  } else if (max_age >= 0) {
+    lifetime = max_age;
+  } else if (has_expires) {
+    lifetime = (long long) expires - (has_date ? date : now);
+  } else {
+    lifetime = cache->default_ttl;
+  }
+
+  /* the time it spent in other caches or on the way */
+  if (has_date && now - date > age) age = now - date;
+
+  return lifetime > age ? now + (time_t) (lifetime - age) : 0;
+}
+
+
+/* Not stored, they describe the upstream connection or the framing */
+static int
+hop_by_hop (const struct http_cache_fill *fill, int i)
+{
+  return field_is(fill, i, "connection")
+      || field_is(fill, i, "keep-alive")
+      || field_is(fill, i, "proxy-connection")
+      || field_is(fill, i, "te")
+      || field_is(fill, i, "trailer")
+      || field_is(fill, i, "transfer-encoding")
+      || field_is(fill, i, "upgrade")
+      || field_is(fill, i, "content-length");
+}
+
+
+/* Marks the headers not to store: the fixed ones and those the
+ * Connection header lists.
+ */
+static void
+mark_hop_by_hop (struct http_cache_fill *fill)
+{
+  const char *v, *end, *token;
+  size_t len;
+  int i, j;
+
+  for (i = 0; i < fill->nheaders; i++) {
+    fill->headers[i].hop = hop_by_hop(fill, i);
+  }
+
+  for (i = 0; i < fill->nheaders; i++) {
+    if (!field_is(fill, i, "connection")) continue;
+
+    v = fill->buf + fill->headers[i].value;
+    end = v + fill->headers[i].value_len;
+    while (v < end) {
+      while (v < end && (*v == ',' || *v == ' ' || *v == '\t')) v++;
+      for (token = v; v < end && *v != ',' && *v != ' ' && *v != '\t'; v++);
+      len = v - token;
+      if (len == 0) continue;
+
+      for (j = 0; j < fill->nheaders; j++) {
+        if (fill->headers[j].field_len == len
+            && 0 == strncasecmp(fill->buf + fill->headers[j].field,
+                                token, len)) {
+          fill->headers[j].hop = 1;
+        }
+      }
+    }
+  }
+}
+
+
+/* Is every header Vary header 'i' names in the key? That is Host and the
+ * cache's key headers, never "*".
+ */
+static int
+vary_keyed (const struct http_cache_fill *fill, int i)
+{
+  const char * const *names = fill->cache->key_headers;
+  const char *v, *end, *token;
+  size_t len;
+  int j, found;
+
+  v = fill->buf + fill->headers[i].value;
+  end = v + fill->headers[i].value_len;
+  while (v < end) {
+    while (v < end && (*v == ',' || *v == ' ' || *v == '\t')) v++;
+    for (token = v; v < end && *v != ',' && *v != ' ' && *v != '\t'; v++);
+    len = v - token;
+    if (len == 0) continue;
+
+    found = len == 4 && 0 == strncasecmp(token, "host", 4);
+    for (j = 0; !found && names && names[j]; j++) {
+      found = strlen(names[j]) == len
+           && 0 == strncasecmp(names[j], token, len);
+    }
+    if (!found) return 0;
+  }
+  return 1;
+}
+
+
+/* Statuses a shared cache may store without explicit freshness */
+static int
+cacheable_status (unsigned short status_code)
+{
+  switch (status_code) {
+    case 200:
+    case 203:
+    case 204:
+    case 300:
+    case 301:
+    case 404:
+    case 405:
+    case 410:
+    case 414:
+    case 501:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+
+void
+http_cache_fill_init (struct http_cache_fill *fill,
+                      struct http_cache *cache,
+                      uint64_t key)
+{
+  memset(fill, 0, sizeof *fill);
+  fill->cache = cache;
+  fill->key = key;
+}
+
+
+int
+http_cache_fill_header_field (struct http_cache_fill *fill,
+                              const char *at,
+                              size_t len)
+{
+  int i;
+
+  if (fill->failed || fill->in_body) return 0;
+
+  if (fill->nheaders == 0 || fill->last_value) {
+    if (fill->nheaders == HTTP_CACHE_MAX_HEADERS) {
+      fill_fail(fill);
+      return 0;
+    }
+    i = fill->nheaders++;
+    fill->headers[i].field = fill->len;
+    fill->headers[i].field_len = 0;
+    fill->headers[i].value = fill->len;
+    fill->headers[i].value_len = 0;
+    fill->last_value = 0;
+  }
+
+  i = fill->nheaders - 1;
+  if (fill_append(fill, at, len) == 0) fill->headers[i].field_len += len;
+  return 0;
+}
+
+
+int
+http_cache_fill_header_value (struct http_cache_fill *fill,
+                              const char *at,
+                              size_t len)
+{
+  int i = fill->nheaders - 1;
+
+  if (fill->failed || fill->in_body || i < 0) return 0;
+
+  if (!fill->last_value) {
+    fill->headers[i].value = fill->len;
+    fill->last_value = 1;
+  }
+
+  if (fill_append(fill, at, len) == 0) fill->headers[i].value_len += len;
+  return 0;
+}
+
+
+int
+http_cache_fill_headers_complete (struct http_cache_fill *fill,
+                                  const http_parser *parser)
+{
+  int i;
+
+  fill->in_body = 1;
+  fill->status_code = parser->status_code;
+  fill->http_major = parser->http_major;
+  fill->http_minor = parser->http_minor;
+  fill->body = fill->len;
+
+  if (fill->failed) return 0;
+
+  /* Decided now, before any of the body is copied */
+  if (!cacheable_status(fill->status_code) || parser->upgrade) {
+    fill_fail(fill);
+    return 0;
+  }
+
+  for (i = 0; i < fill->nheaders; i++) {
+    if ((field_is(fill, i, "cache-control")
+         && (value_has(fill, i, "no-store")
+             || value_has(fill, i, "no-cache")
+             || value_has(fill, i, "private")))
+        || field_is(fill, i, "set-cookie")
+        || (field_is(fill, i, "vary") && !vary_keyed(fill, i))) {
+      fill_fail(fill);
+      return 0;
+    }
+  }
+
+  fill->expires = fresh_until(fill, fill->cache->clock(NULL));
+  if (fill->expires == 0) {
+    fill_fail(fill);
+    return 0;
+  }
+
+  mark_hop_by_hop(fill);
+  return 0;
+}
+
+
+int
+http_cache_fill_body (struct http_cache_fill *fill,
+                      const char *at,
+                      size_t len)
+{
+  fill_append(fill, at, len);
+  return 0;
+}
+
+
+int
+http_cache_fill_finish (struct http_cache_fill *fill)
+{
+  struct http_header headers[HTTP_CACHE_MAX_HEADERS + 1];
+  struct http_cache_entry *e = NULL;
+  struct http_head head;
+  char length[24];
+  size_t body_len, head_len;
+  int i, n = 0;
+
+  if (fill->failed || !fill->in_body) goto done;
+
+  for (i = 0; i < fill->nheaders; i++) {
+    if (fill->headers[i].hop) continue;
+    headers[n].field = fill->buf + fill->headers[i].field;
+    headers[n].field_len = fill->headers[i].field_len;
+    headers[n].value = fill->buf + fill->headers[i].value;
+    headers[n].value_len = fill->headers[i].value_len;
+    n++;
+  }
+
+  /* 1xx and 204 responses must not carry one */
+  body_len = fill->len - fill->body;
+  if (fill->status_code >= 200 && fill->status_code != 204) {
+    headers[n].field = "Content-Length";
+    headers[n].field_len = sizeof("Content-Length")-1;
+    headers[n].value = length;
+    headers[n].value_len = snprintf(length, sizeof length, "%llu",
+                                    (unsigned long long) body_len);
+    n++;
+  }
+
+  memset(&head, 0, sizeof head);
+  head.type = HTTP_RESPONSE;
+  head.http_major = fill->http_major;
+  head.http_minor = fill->http_minor;
+  head.status_code = fill->status_code;
+  head.headers = headers;
+  head.num_headers = n;
+
+  head_len = http_head_size(&head);
+  if (head_len == 0
+      || sizeof *e + head_len + body_len > fill->cache->shard_budget) {
+    goto done;
+  }
+
+  e = malloc(sizeof *e + head_len + body_len);
+  if (!e) goto done;
+  memset(e, 0, sizeof *e);
+  e->key = fill->key;
+  e->expires = fill->expires;
+  e->iov.iov_base = (char *) (e + 1);
+  e->iov.iov_len = head_len + body_len;
+  e->head_len = head_len;
+  http_head_write(&head, e->iov.iov_base, head_len);
+  memcpy((char *) e->iov.iov_base + head_len, fill->buf + fill->body, body_len);
+
+done:
+  publish(fill->cache, fill->key, e);
+  fill_fail(fill);
+  return e ? 0 : -1;
+}
+
+
+void
+http_cache_fill_abort (struct http_cache_fill *fill)
+{
+  publish(fill->cache, fill->key, NULL);
+  fill_fail(fill);
+}
+
+
+static int
+fill_header_field_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_cache_fill_header_field(p->data, at, len);
+}
+
+
+static int
+fill_header_value_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_cache_fill_header_value(p->data, at, len);
+}
+
+
+static int
+fill_headers_complete_cb (http_parser *p)
+{
+  return http_cache_fill_headers_complete(p->data, p);
+}
+
+
+static int
+fill_body_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_cache_fill_body(p->data, at, len);
+}
+
+
+static int
+fill_message_complete_cb (http_parser *p)
+{
+  http_cache_fill_finish(p->data);
+  return 0;
+}
+
+
+const http_parser_settings http_cache_fill_settings =
+  { .on_header_field = fill_header_field_cb
+  , .on_header_value = fill_header_value_cb
+  , .on_headers_complete = fill_headers_complete_cb
+  , .on_body = fill_body_cb
+  , .on_message_complete = fill_message_complete_cb
+  };
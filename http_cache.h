@@ -0,0 +1,223 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef http_cache_h
+#define http_cache_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <http_parser.h>
+#include <time.h>
+
+
+/* An in-memory response cache for a caching proxy, safe to share between
+ * threads. Responses are keyed by the 64 bit hash of their request, see
+ * struct http_parser_key; requests that hash alike are taken to be the
+ * same. The cache is split into shards, each with its own lock, table and
+ * share of the byte budget. Entries are evicted with CLOCK: a hit marks
+ * an entry, and the hand spares marked entries once.
+ *
+ * Responses are captured from the upstream with the response parser and
+ * stored serialized: the head rendered again without hop-by-hop headers
+ * and, unless it is a 204, with a Content-Length, followed by the whole
+ * body. A hit is one iovec, ready for writev(). Each entry expires when
+ * its response stops being fresh; a lookup then misses and the response
+ * is fetched again.
+ */
+struct http_cache;
+
+
+struct http_cache_entry {
+  /* The response and the length of its head, for HEAD requests. Valid
+   * until the entry is released.
+   */
+  struct iovec iov;
+  size_t head_len;
+
+  /** PRIVATE **/
+  uint64_t key;
+  struct http_cache_entry *next;        /* in its table bucket */
+  struct http_cache_entry *clock_prev;  /* in the CLOCK ring */
+  struct http_cache_entry *clock_next;
+  time_t expires;  /* stale from then on */
+  int refs;
+  unsigned char referenced;
+  unsigned char filling;  /* a placeholder while a response is fetched */
+};
+
+
+/* Counters summed over all shards, see http_cache_stats(). */
+struct http_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t waits;       /* lookups that waited for another fetch */
+  uint64_t inserts;
+  uint64_t evictions;
+  uint64_t expired;     /* lookups that found a stale entry */
+  uint64_t entries;
+  uint64_t bytes;
+};
+
+
+/* Creates a cache holding up to 'budget' bytes, entries included, in
+ * 'nshards' shards, rounded up to a power of two. An entry can be at most
+ * budget / nshards bytes. Returns NULL if out of memory.
+ */
+struct http_cache *http_cache_new(size_t budget, unsigned int nshards);
+
+
+/* Frees the cache and its entries. No entry may be held and no fill
+ * running.
+ */
+void http_cache_free(struct http_cache *cache);
+
+
+/* Seconds a response stays fresh when it has no s-maxage, max-age or
+ * Expires, unless changed with http_cache_set_default_ttl(). 0 stores
+ * only responses with explicit freshness.
+ */
+#define HTTP_CACHE_DEFAULT_TTL 60
+
+/* These are set before the cache is shared between threads */
+void http_cache_set_default_ttl(struct http_cache *cache, unsigned int ttl);
+
+/* The clock freshness is measured with, time() by default */
+void http_cache_set_clock(struct http_cache *cache, time_t (*clock)(time_t *));
+
+/* The request headers hashed into the keys, the settings.route_headers of
+ * the parsers computing them: a NULL terminated list of lowercase names,
+ * kept by reference. A response that varies on any other header than
+ * these and Host is not stored. None by default.
+ */
+void http_cache_set_key_headers(struct http_cache *cache,
+                                const char * const *names);
+
+
+enum http_cache_result
+  { HTTP_CACHE_HIT
+  /* The caller fetches the response and must end with
+   * http_cache_fill_finish() or http_cache_fill_abort() on the key.
+   */
+  , HTTP_CACHE_MISS
+  /* Another fetch of the key is running, only without 'wait' */
+  , HTTP_CACHE_PENDING
+  };
+
+
+/* Looks up 'key'. On a hit '*entry' is held until http_cache_release().
+ * A miss makes the caller the one fetching the key: later lookups of the
+ * same key wait for that fetch with 'wait' set, or return
+ * HTTP_CACHE_PENDING without. If the fetch is aborted or the response
+ * can not be cached, one of the waiting lookups returns a miss in turn.
+ */
+enum http_cache_result http_cache_lookup(struct http_cache *cache,
+                                         uint64_t key,
+                                         int wait,
+                                         struct http_cache_entry **entry);
+
+
+void http_cache_release(struct http_cache_entry *entry);
+
+
+void http_cache_stats(struct http_cache *cache, struct http_cache_stats *stats);
+
+
+#define HTTP_CACHE_MAX_HEADERS 64
+
+
+/* Captures one upstream response for the key of a missed lookup. Feed it
+ * from the callbacks of an HTTP_RESPONSE parser, or use
+ * http_cache_fill_settings. Only responses to GET requests should be
+ * filled.
+ *
+ * A response is stored if its status is cacheable by default, it has no
+ * Cache-Control no-store, no-cache or private, no Set-Cookie, no Vary
+ * beyond the key headers, it is still fresh and it fits into a shard.
+ * Freshness comes from s-maxage, max-age or Expires, in that order, less
+ * the Age and the time since the Date of the response.
+ */
+struct http_cache_fill {
+  /** PRIVATE **/
+  struct http_cache *cache;
+  uint64_t key;
+  int failed;
+  int in_body;
+  int last_value;  /* the last header callback was for a value */
+  unsigned short status_code;
+  unsigned short http_major;
+  unsigned short http_minor;
+  time_t expires;
+  int nheaders;
+  struct {
+    size_t field;
+    size_t field_len;
+    size_t value;
+    size_t value_len;
+    int hop;  /* hop-by-hop, not stored */
+  } headers[HTTP_CACHE_MAX_HEADERS];
+  char *buf;  /* header fields and values, then the body */
+  size_t len;
+  size_t size;
+  size_t body;
+};
+
+
+void http_cache_fill_init(struct http_cache_fill *fill,
+                          struct http_cache *cache,
+                          uint64_t key);
+
+int http_cache_fill_header_field(struct http_cache_fill *fill,
+                                 const char *at,
+                                 size_t len);
+
+int http_cache_fill_header_value(struct http_cache_fill *fill,
+                                 const char *at,
+                                 size_t len);
+
+int http_cache_fill_headers_complete(struct http_cache_fill *fill,
+                                     const http_parser *parser);
+
+int http_cache_fill_body(struct http_cache_fill *fill,
+                         const char *at,
+                         size_t len);
+
+
+/* Stores the response, from on_message_complete, and wakes the lookups
+ * waiting for it. Returns 0 if it was stored, -1 if not.
+ */
+int http_cache_fill_finish(struct http_cache_fill *fill);
+
+
+/* Gives up the fetch, e.g. when the upstream failed. */
+void http_cache_fill_abort(struct http_cache_fill *fill);
+
+
+/* Callbacks filling the http_cache_fill in the parser's 'data' field,
+ * finishing it in on_message_complete.
+ */
+extern const http_parser_settings http_cache_fill_settings;
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,449 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <http_inflate.h>
+#include <string.h>
+#include <strings.h>
+
+
+#define CONTENT_ENCODING "content-encoding"
+#define CONTENT_ENCODING_LEN (sizeof CONTENT_ENCODING - 1)
+
+/* zlib or gzip header, told apart by zlib */
+#define WINDOW_BITS (15 + 32)
+#define RAW_WINDOW_BITS (-15)
+
+
+static const char *error_strings[] =
+  { "success"
+  , "unsupported content coding"
+  , "corrupt encoded body"
+  , "encoded body cut short"
+  , "decoded body larger than the limit"
+  , "decoded body expands more than the limit"
+  , "out of memory"
+  , "the on_data callback failed"
+  };
+
+
+static int
+fail (struct http_inflate *inf, enum http_inflate_error error)
+{
+  if (inf->error == HTTP_INFLATE_OK) inf->error = error;
+  return -1;
+}
+
+
+static int
+flush (struct http_inflate *inf)
+{
+  size_t len = inf->window_len;
+
+  inf->window_len = 0;
+  if (len && inf->on_data(inf, inf->window, len) != 0) {
+    return fail(inf, HTTP_INFLATE_CALLBACK);
+  }
+  return 0;
+}
+
+
+static int
+over_limits (struct http_inflate *inf)
+{
+  if (inf->max_size && inf->out > inf->max_size) {
+    return fail(inf, HTTP_INFLATE_TOO_LARGE);
+  }
+  if (inf->max_ratio && inf->out > HTTP_INFLATE_RATIO_FLOOR
+      && inf->out > inf->in * inf->max_ratio) {
+    return fail(inf, HTTP_INFLATE_RATIO);
+  }
+  return 0;
+}
+
+
+int
+http_inflate_init (struct http_inflate *inf,
+                   char *window,
+                   size_t window_size,
+                   http_inflate_cb on_data)
+{
+  memset(inf, 0, sizeof *inf);
+  inf->window = window;
+  inf->window_size = window_size;
+  inf->on_data = on_data;
+  inf->max_ratio = HTTP_INFLATE_DEFAULT_RATIO;
+  http_inflate_reset(inf);
+  return window_size > 0 ? 0 : -1;
+}
+
+
+void
+http_inflate_reset (struct http_inflate *inf)
+{
+  inf->coding = HTTP_INFLATE_IDENTITY;
+  inf->error = HTTP_INFLATE_OK;
+  inf->in = 0;
+  inf->out = 0;
+  inf->window_len = 0;
+  inf->in_body = 0;
+  inf->last_value = 1;
+  inf->field_pos = -1;
+  inf->codings = 0;
+  inf->value_len = 0;
+  inf->stream_end = 0;
+}
+
+
+void
+http_inflate_end (struct http_inflate *inf)
+{
+  if (inf->z_ready) inflateEnd(&inf->z);
+  inf->z_ready = 0;
+}
+
+
+int
+http_inflate_header_field (struct http_inflate *inf,
+                           const char *at,
+                           size_t len)
+{
+  size_t i;
+
+  if (inf->in_body) return 0;  /* trailers */
+
+  if (inf->last_value) {
+    inf->field_pos = 0;
+    inf->last_value = 0;
+  }
+
+  for (i = 0; i < len && inf->field_pos >= 0; i++) {
+    if ((size_t) inf->field_pos < CONTENT_ENCODING_LEN
+        && (at[i] | 0x20) == CONTENT_ENCODING[inf->field_pos]) {
+      inf->field_pos++;
+    } else {
+      inf->field_pos = -1;
+    }
+  }
+  return 0;
+}
+
+
+int
+http_inflate_header_value (struct http_inflate *inf,
+                           const char *at,
+                           size_t len)
+{
+  int match = inf->field_pos == (int) CONTENT_ENCODING_LEN;
+  size_t n;
+
+  if (inf->in_body) return 0;
+
+  if (!inf->last_value) {
+    inf->last_value = 1;
+    if (match) {
+      inf->codings++;
+      inf->value_len = 0;
+    }
+  }
+  if (!match) return 0;
+
+  /* Longer values are no coding we know; one byte over is enough to tell */
+  n = sizeof inf->value - inf->value_len;
+  if (n > len) n = len;
+  memcpy(inf->value + inf->value_len, at, n);
+  inf->value_len += n;
+  return 0;
+}
+
+
+static enum http_inflate_coding
+coding_of (const char *value, size_t len)
+{
+  while (len && (*value == ' ' || *value == '\t')) {
+    value++;
+    len--;
+  }
+  while (len && (value[len - 1] == ' ' || value[len - 1] == '\t')) len--;
+
+#define IS(name) (len == sizeof name - 1 && strncasecmp(value, name, len) == 0)
+  if (len == 0 || IS("identity")) return HTTP_INFLATE_IDENTITY;
+  if (IS("gzip") || IS("x-gzip")) return HTTP_INFLATE_GZIP;
+  if (IS("deflate")) return HTTP_INFLATE_DEFLATE;
+#undef IS
+  return HTTP_INFLATE_OTHER;
+}
+
+
+int
+http_inflate_headers_complete (struct http_inflate *inf)
+{
+  int rc;
+
+  inf->in_body = 1;
+  if (inf->codings > 1) {
+    /* stacked codings, as "gzip" and "gzip" again */
+    inf->coding = HTTP_INFLATE_OTHER;
+  } else if (inf->codings == 1) {
+    inf->coding = coding_of(inf->value, inf->value_len);
+  }
+
+  switch (inf->coding) {
+    case HTTP_INFLATE_IDENTITY:
+      return 0;
+    case HTTP_INFLATE_OTHER:
+      return fail(inf, HTTP_INFLATE_UNSUPPORTED);
+    default:
+      break;
+  }
+
+  /* zlib would make no progress */
+  if (inf->window_size == 0) return fail(inf, HTTP_INFLATE_NOMEM);
+
+  if (inf->z_ready) {
+    rc = inflateReset2(&inf->z, WINDOW_BITS);
+  } else {
+    memset(&inf->z, 0, sizeof inf->z);
+    rc = inflateInit2(&inf->z, WINDOW_BITS);
+    inf->z_ready = rc == Z_OK;
+  }
+  if (rc != Z_OK) return fail(inf, HTTP_INFLATE_NOMEM);
+  return 0;
+}
+
+
+int
+http_inflate_body (struct http_inflate *inf, const char *at, size_t len)
+{
+  z_stream *z = &inf->z;
+  size_t room, made;
+  int rc;
+
+  if (inf->error) return -1;
+
+  if (inf->coding == HTTP_INFLATE_IDENTITY) {
+    inf->in += len;
+    inf->out += len;
+    if (over_limits(inf)) return -1;
+    if (inf->on_data(inf, at, len) != 0) {
+      return fail(inf, HTTP_INFLATE_CALLBACK);
+    }
+    return 0;
+  }
+
+  /* Servers differ on whether "deflate" has the zlib wrapper. Without it
+   * the first byte can not be the zlib method byte.
+   */
+  if (inf->coding == HTTP_INFLATE_DEFLATE && inf->in == 0 && len > 0
+      && (at[0] & 0x0f) != Z_DEFLATED) {
+    if (inflateReset2(z, RAW_WINDOW_BITS) != Z_OK) {
+      return fail(inf, HTTP_INFLATE_CORRUPT);
+    }
+  }
+
+  z->next_in = (Bytef *) at;
+  z->avail_in = len;
+
+  while (z->avail_in > 0) {
+    if (inf->stream_end) {
+      /* gzip members may follow each other, nothing else may */
+      if (inf->coding != HTTP_INFLATE_GZIP) {
+        return fail(inf, HTTP_INFLATE_CORRUPT);
+      }
+      inflateReset(z);
+      inf->stream_end = 0;
+    }
+
+    room = inf->window_size - inf->window_len;
+    z->next_out = (Bytef *) inf->window + inf->window_len;
+    z->avail_out = room;
+
+    len = z->avail_in;
+    rc = inflate(z, Z_NO_FLUSH);
+    inf->in += len - z->avail_in;
+    made = room - z->avail_out;
+    inf->window_len += made;
+    inf->out += made;
+
+    switch (rc) {
+      case Z_STREAM_END:
+        inf->stream_end = 1;
+        break;
+      case Z_OK:
+      case Z_BUF_ERROR:
+        break;
+      case Z_MEM_ERROR:
+        return fail(inf, HTTP_INFLATE_NOMEM);
+      default:
+        return fail(inf, HTTP_INFLATE_CORRUPT);
+    }
+
+    if (over_limits(inf)) return -1;
+    if (inf->window_len == inf->window_size && flush(inf) != 0) return -1;
+  }
+  return 0;
+}
+
+
+int
+http_inflate_finish (struct http_inflate *inf)
+{
+  if (inf->error) return -1;
+  if (inf->coding == HTTP_INFLATE_IDENTITY) return 0;
+
+  /* An empty body, as that of a HEAD response, is not a stream at all */
+  if (inf->in > 0 && !inf->stream_end) {
+    return fail(inf, HTTP_INFLATE_TRUNCATED);
+  }
+  return flush(inf);
+}
+
+
+const char *
+http_inflate_strerror (enum http_inflate_error error)
+{
+  return error_strings[error];
+}
+
+
+static int
+inflate_message_begin_cb (http_parser *p)
+{
+  http_inflate_reset(p->data);
+  return 0;
+}
+
+
+static int
+inflate_header_field_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_inflate_header_field(p->data, at, len);
+}
+
+
+static int
+inflate_header_value_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_inflate_header_value(p->data, at, len);
+}
+
+
+static int
+inflate_headers_complete_cb (http_parser *p)
+{
+  return http_inflate_headers_complete(p->data);
+}
+
+
+static int
+inflate_body_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_inflate_body(p->data, at, len);
+}
+
+
+static int
+inflate_message_complete_cb (http_parser *p)
+{
+  return http_inflate_finish(p->data);
+}
+
+
+const http_parser_settings http_inflate_settings =
+  { .on_message_begin = inflate_message_begin_cb
+  , .on_header_field = inflate_header_field_cb
+  , .on_header_value = inflate_header_value_cb
+  , .on_headers_complete = inflate_headers_complete_cb
+  , .on_body = inflate_body_cb
+  , .on_message_complete = inflate_message_complete_cb
+  };
+
+
+static int
+stage_data_cb (struct http_inflate *inf, const char *at, size_t len)
+{
+  return http_stage_emit(inf->data, at, len);
+}
+
+
+static int
+stage_message_begin_cb (struct http_stage *stage)
+{
+  http_inflate_reset(stage->data);
+  return 0;
+}
+
+
+static int
+stage_header_field_cb (struct http_stage *stage, const char *at, size_t len)
+{
+  return http_inflate_header_field(stage->data, at, len);
+}
+
+
+static int
+stage_header_value_cb (struct http_stage *stage, const char *at, size_t len)
+{
+  return http_inflate_header_value(stage->data, at, len);
+}
+
+
+static int
+stage_headers_complete_cb (struct http_stage *stage, const http_parser *p)
+{
+  (void)p;
+  return http_inflate_headers_complete(stage->data);
+}
+
+
+static int
+stage_body_cb (struct http_stage *stage, const char *at, size_t len)
+{
+  return http_inflate_body(stage->data, at, len);
+}
+
+
+static int
+stage_message_complete_cb (struct http_stage *stage)
+{
+  return http_inflate_finish(stage->data);
+}
+
+
+int
+http_inflate_stage_init (struct http_stage *stage,
+                         struct http_inflate *inf,
+                         char *window,
+                         size_t window_size)
+{
+  int rc = http_inflate_init(inf, window, window_size, stage_data_cb);
+
+  inf->data = stage;
+
+  memset(stage, 0, sizeof *stage);
+  stage->data = inf;
+  stage->name = "inflate";
+  stage->on_message_begin = stage_message_begin_cb;
+  stage->on_header_field = stage_header_field_cb;
+  stage->on_header_value = stage_header_value_cb;
+  stage->on_headers_complete = stage_headers_complete_cb;
+  stage->on_body = stage_body_cb;
+  stage->on_message_complete = stage_message_complete_cb;
+  return rc;
+}
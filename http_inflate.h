@@ -0,0 +1,180 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef http_inflate_h
+#define http_inflate_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <http_parser.h>
+#include <http_pipeline.h>
+#include <zlib.h>
+
+
+/* Decodes the Content-Encoding of a message body as it arrives, with
+ * zlib. The coding is taken from the headers; gzip, x-gzip and deflate
+ * are inflated, identity bodies and bodies without the header are passed
+ * on as they are. Any other coding is refused.
+ *
+ * Decoded bytes are collected in a window given by the application and
+ * handed out whenever it is full and when the body ends, so memory stays
+ * bounded by the window and zlib's own state of some 40 kB, whatever the
+ * size of the body. Limits on the decoded size and on the ratio of
+ * decoded to encoded bytes stop decompression bombs at the first window
+ * over them.
+ */
+struct http_inflate;
+
+typedef int (*http_inflate_cb) (struct http_inflate *, const char *at,
+                                size_t len);
+
+
+enum http_inflate_error
+  { HTTP_INFLATE_OK = 0
+  , HTTP_INFLATE_UNSUPPORTED  /* a coding other than gzip or deflate */
+  , HTTP_INFLATE_CORRUPT      /* not a valid stream of the coding */
+  , HTTP_INFLATE_TRUNCATED    /* the body ended before the stream did */
+  , HTTP_INFLATE_TOO_LARGE    /* over max_size */
+  , HTTP_INFLATE_RATIO        /* over max_ratio */
+  , HTTP_INFLATE_NOMEM
+  , HTTP_INFLATE_CALLBACK     /* on_data returned non-zero */
+  };
+
+
+enum http_inflate_coding
+  { HTTP_INFLATE_IDENTITY = 0
+  , HTTP_INFLATE_GZIP
+  , HTTP_INFLATE_DEFLATE
+  , HTTP_INFLATE_OTHER
+  };
+
+
+/* The ratio limit only applies once this many bytes are decoded, so that
+ * small bodies that compress well are not refused.
+ */
+#define HTTP_INFLATE_RATIO_FLOOR (64 * 1024)
+
+#define HTTP_INFLATE_DEFAULT_RATIO 100
+
+
+struct http_inflate {
+  /** PUBLIC **/
+  void *data;
+
+  /* Limits for each message, 0 for none. http_inflate_init() sets
+   * max_ratio to HTTP_INFLATE_DEFAULT_RATIO and max_size to 0.
+   */
+  uint64_t max_size;
+  unsigned int max_ratio;
+
+  /** READ-ONLY **/
+  enum http_inflate_coding coding;
+  enum http_inflate_error error;
+  uint64_t in;   /* encoded bytes of the current message */
+  uint64_t out;  /* decoded bytes of the current message */
+
+  /** PRIVATE **/
+  http_inflate_cb on_data;
+  char *window;
+  size_t window_size;
+  size_t window_len;
+  z_stream z;
+  int z_ready;      /* inflateInit2() was called */
+  int in_body;
+  int last_value;   /* the last header callback was for a value */
+  int field_pos;    /* matched of "content-encoding", -1 for another field */
+  int codings;      /* Content-Encoding headers seen */
+  char value[16];   /* the Content-Encoding value, maybe cut off */
+  size_t value_len;
+  int stream_end;   /* the last stream seen has ended */
+};
+
+
+/* Sets up 'inf' to decode into 'window' and to hand the decoded bytes to
+ * 'on_data'. Nothing is allocated until the first encoded body. Returns
+ * -1 if 'window_size' is 0: encoded bodies then fail with
+ * HTTP_INFLATE_NOMEM.
+ */
+int http_inflate_init(struct http_inflate *inf,
+                      char *window,
+                      size_t window_size,
+                      http_inflate_cb on_data);
+
+
+/* Gets ready for the next message, from on_message_begin. zlib's state is
+ * kept for reuse.
+ */
+void http_inflate_reset(struct http_inflate *inf);
+
+
+/* Releases zlib's state. 'inf' may be reset and used again afterwards. */
+void http_inflate_end(struct http_inflate *inf);
+
+
+/* The header, headers_complete and body functions are fed from the
+ * parser callbacks of the same name and return what those should return:
+ * 0, or -1 with 'error' set to stop the parser.
+ */
+int http_inflate_header_field(struct http_inflate *inf,
+                              const char *at,
+                              size_t len);
+
+int http_inflate_header_value(struct http_inflate *inf,
+                              const char *at,
+                              size_t len);
+
+int http_inflate_headers_complete(struct http_inflate *inf);
+
+int http_inflate_body(struct http_inflate *inf, const char *at, size_t len);
+
+
+/* Hands out what is left in the window and checks that the encoded
+ * stream is complete, from on_message_complete. Returns 0 or -1.
+ */
+int http_inflate_finish(struct http_inflate *inf);
+
+
+const char *http_inflate_strerror(enum http_inflate_error error);
+
+
+/* Callbacks feeding the http_inflate in the parser's 'data' field. The
+ * decoded body goes to its on_data. The parser does not stop when on_body
+ * fails: after an error the rest of the body is skipped and
+ * on_message_complete fails, with 'error' telling why.
+ */
+extern const http_parser_settings http_inflate_settings;
+
+
+/* Sets up 'stage' as a decoding stage of an http_pipeline, around 'inf'
+ * initialized to decode into 'window'. The stage emits the window.
+ * Returns -1 if 'window_size' is 0, as http_inflate_init().
+ */
+int http_inflate_stage_init(struct http_stage *stage,
+                            struct http_inflate *inf,
+                            char *window,
+                            size_t window_size);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
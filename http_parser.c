@@ -21,17 +21,47 @@
 #include <http_parser.h>
 #include <assert.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 
 #ifndef MIN
 # define MIN(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
+#ifndef ARRAY_SIZE
+# define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+
+#define SET_ERRNO(e)                                                 \
+do {                                                                 \
+  parser->http_errno = (e);                                          \
+} while (0)
+
+
+/* A callback returned RC, non-zero: http_parser_execute() returns next */
+#define CALLBACK_FAILED(FOR, RC)                                     \
+do {                                                                 \
+  SET_ERRNO(HPE_CB_##FOR);                                           \
+  STAT_ADD(errors[HPE_CB_##FOR], 1);                                 \
+  TRACE_CALLBACK(FOR, RC);                                           \
+} while (0)
+
 
 #define CALLBACK2(FOR)                                               \
 do {                                                                 \
+  TRACE(TRACE_##FOR, 0);                                             \
   if (settings->on_##FOR) {                                          \
-    if (0 != settings->on_##FOR(parser)) return (p - data);          \
+    int rc_;                                                         \
+    TIMED(FOR, rc_, settings->on_##FOR(parser));                     \
+    if (0 != rc_) {                                                  \
+      CALLBACK_FAILED(FOR, rc_);                                     \
+      return (p - data);                                             \
+    }                                                                \
+  } else {                                                           \
+    TIMING(FOR);                                                     \
   }                                                                  \
 } while (0)
 
@@ -41,17 +71,55 @@ do {                                                                 \
   FOR##_mark = p;                                                    \
 } while (0)
 
+#define CALLBACK_DATA(FOR, AT, LEN)                                  \
+do {                                                                 \
+  if (settings->on_##FOR) {                                          \
+    int rc_;                                                         \
+    TIMED(parser, rc_, settings->on_##FOR(parser, (AT), (LEN)));     \
+    if (0 != rc_) {                                                  \
+      CALLBACK_FAILED(FOR, rc_);                                     \
+      return (p - data);                                             \
+    }                                                                \
+  }                                                                  \
+} while (0)
+
 #define CALLBACK_NOCLEAR(FOR)                                        \
 do {                                                                 \
   if (FOR##_mark) {                                                  \
-    if (settings->on_##FOR) {                                        \
-      if (0 != settings->on_##FOR(parser,                            \
-                                 FOR##_mark,                         \
-                                 p - FOR##_mark))                    \
-      {                                                              \
-        return (p - data);                                           \
-      }                                                              \
+    if (key && KEY_##FOR) {                                          \
+      key_update(key, FOR##_mark, p - FOR##_mark);                   \
     }                                                                \
+    CALLBACK_DATA(FOR, FOR##_mark, p - FOR##_mark);                  \
+  }                                                                  \
+} while (0)
+
+
+/* A body or message callback paused the parser: stop after the current
+ * byte. See http_parser_pause().
+ */
+#define PAUSE_CHECK()                                                \
+do {                                                                 \
+  if (parser->http_errno == HPE_PAUSED) pe = p + 1;                  \
+} while (0)
+
+
+/* The return value of on_body is ignored */
+#define BODY_CALLBACK(AT, LEN)                                       \
+do {                                                                 \
+  if (settings->on_body) {                                           \
+    int rc_;                                                         \
+    TIMED(parser, rc_, settings->on_body(parser, (AT), (LEN)));      \
+    (void) rc_;                                                      \
+  }                                                                  \
+} while (0)
+
+
+/* Delivers the chunk payload coalesced by http_parser_execute_inplace() */
+#define BODY_FLUSH()                                                 \
+do {                                                                 \
+  if (coalesced) {                                                   \
+    BODY_CALLBACK(coalesced, coalesced_end - coalesced);             \
+    coalesced = NULL;                                                \
   }                                                                  \
 } while (0)
 
@@ -59,18 +127,124 @@ do {                                                                 \
 #define CALLBACK(FOR)                                                \
 do {                                                                 \
   CALLBACK_NOCLEAR(FOR);                                             \
+  if (key && FOR##_mark && KEY_##FOR) key_end(key, KEY_##FOR);       \
   FOR##_mark = NULL;                                                 \
 } while (0)
 
 
+/* What the span of a data callback goes into the cache key as, 0 for
+ * nothing. See struct http_parser_key.
+ */
+#define KEY_URL 1
+#define KEY_HOST 2
+#define KEY_HEADER 3  /* + index in settings->route_headers */
+
+#define KEY_path 0
+#define KEY_query_string 0
+#define KEY_url KEY_URL
+#define KEY_fragment 0
+#define KEY_header_field 0
+#define KEY_header_value key_header(parser->route_match)
+#define KEY_host KEY_HOST
+
+
+#ifndef HTTP_PARSER_STATS
+# define HTTP_PARSER_STATS 0
+#endif
+
+#if HTTP_PARSER_STATS
+# if defined(__GNUC__)
+#  define STAT_STORE(P, V) __atomic_store_n((P), (V), __ATOMIC_RELAXED)
+# else
+#  define STAT_STORE(P, V) (*(P) = (V))
+# endif
+# define STAT_ADD(FIELD, N)                                          \
+do {                                                                 \
+  if (stats) STAT_STORE(&stats->FIELD, stats->FIELD + (N));          \
+} while (0)
+#else
+# define STAT_ADD(FIELD, N)
+#endif
+
+#if defined(__GNUC__)
+# define STAT_LOAD(P) __atomic_load_n((P), __ATOMIC_RELAXED)
+# define TRACE_HEAD_LOAD(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+# define TRACE_HEAD_STORE(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+# define TRACE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+# define TRACE_COLD __attribute__((cold, noinline))
+#else
+# define STAT_LOAD(P) (*(P))
+# define TRACE_HEAD_LOAD(P) (*(P))
+# define TRACE_HEAD_STORE(P, V) (*(P) = (V))
+# define TRACE_FENCE()
+# define TRACE_COLD
+#endif
+
+
+#ifndef HTTP_PARSER_TIMING
+# define HTTP_PARSER_TIMING 0
+#endif
+
+#if HTTP_PARSER_TIMING
+# define TIMING(PHASE)                                               \
+do {                                                                 \
+  if (timing) timing_##PHASE(timing);                                \
+} while (0)
+/* Brackets a callback, storing its return value in RC: the checkpoint
+ * PHASE before it, 'parser' for a data callback, and callback time after.
+ */
+# define TIMED(PHASE, RC, CALL)                                      \
+do {                                                                 \
+  if (timing) timing_##PHASE(timing);                                \
+  (RC) = (CALL);                                                     \
+  if (timing) timing_callback_done(timing);                          \
+} while (0)
+#else
+# define TIMING(PHASE)
+# define TIMED(PHASE, RC, CALL)                                      \
+do {                                                                 \
+  (RC) = (CALL);                                                     \
+} while (0)
+#endif
+
+
+#ifndef HTTP_PARSER_TRACE
+# define HTTP_PARSER_TRACE 0
+#endif
+
+#if HTTP_PARSER_TRACE
+# define TRACE(TYPE, ARG)                                            \
+do {                                                                 \
+  if (trace_sampled())                                               \
+    trace_event(thread_trace, (TYPE), state, p - data, (ARG));       \
+} while (0)
+# define TRACE_CALLBACK(FOR, RC)                                     \
+  TRACE(HTTP_TRACE_CALLBACK, TRACE_CB_##FOR << 8 | (uint8_t) (RC))
+#else
+# define TRACE(TYPE, ARG)
+# define TRACE_CALLBACK(FOR, RC)
+#endif
+
+#define TRACE_message_begin HTTP_TRACE_MESSAGE_BEGIN
+#define TRACE_message_complete HTTP_TRACE_MESSAGE_COMPLETE
+
+/* TRACE_CB_message_begin and so on, for TRACE_CALLBACK() */
+#define TRACE_CB_GEN(n, s) TRACE_CB_##s = HTTP_TRACE_CB_##n,
+enum { HTTP_TRACE_CALLBACK_MAP(TRACE_CB_GEN) };
+#undef TRACE_CB_GEN
+
+
 #define PROXY_CONNECTION "proxy-connection"
 #define CONNECTION "connection"
 #define CONTENT_LENGTH "content-length"
 #define TRANSFER_ENCODING "transfer-encoding"
 #define UPGRADE "upgrade"
+#define HOST "host"
 #define CHUNKED "chunked"
 #define KEEP_ALIVE "keep-alive"
 #define CLOSE "close"
+#define TE "te"
+#define TRAILER "trailer"
 
 
 static const char *method_strings[] =
@@ -185,6 +359,9 @@ static const uint8_t normal_url_char[256] = {
         1,       1,       1,       1,       1,       1,       1,       0 };
 
 
+/* The values of enum state and enum header_states are part of the
+ * snapshot format. Bump HTTP_PARSER_SNAPSHOT_VERSION when they change.
+ */
 enum state
   { s_dead = 1 /* important that this is > 0 */
 
@@ -233,6 +410,7 @@ enum state
   , s_header_field
   , s_header_value_start
   , s_header_value
+  , s_header_skip
 
   , s_header_almost_done
 
@@ -253,10 +431,45 @@ enum state
   , s_body_identity_eof
   };
 
+#define IN_CHUNKS(state) \
+  ((state) >= s_chunk_size_start && (state) <= s_chunk_data_done)
+
 
 #define PARSING_HEADER(state) (state <= s_headers_almost_done && 0 == (parser->flags & F_TRAILING))
 
 
+/* The marks that are live between two calls are implied by the state, so
+ * there is nothing to save but the offset of the url part in retain mode.
+ * The url sub-marks always come with the url mark.
+ */
+enum mark_kind
+  { MARK_NONE = 0
+  , MARK_HEADER_FIELD
+  , MARK_HEADER_VALUE
+  , MARK_URL
+  , MARK_URL_PATH
+  , MARK_URL_QUERY_STRING
+  , MARK_URL_FRAGMENT
+  };
+
+
+static const unsigned char state_mark[] =
+  { [s_req_schema]              = MARK_URL
+  , [s_req_schema_slash]        = MARK_URL
+  , [s_req_schema_slash_slash]  = MARK_URL
+  , [s_req_host]                = MARK_URL
+  , [s_req_port]                = MARK_URL
+  , [s_req_path]                = MARK_URL_PATH
+  , [s_req_query_string_start]  = MARK_URL
+  , [s_req_query_string]        = MARK_URL_QUERY_STRING
+  , [s_req_fragment_start]      = MARK_URL
+  , [s_req_fragment]            = MARK_URL_FRAGMENT
+  , [s_header_field]            = MARK_HEADER_FIELD
+  , [s_header_value]            = MARK_HEADER_VALUE
+  , [s_body_identity_eof]       = MARK_NONE /* sizes the table */
+  };
+
+
 enum header_states
   { h_general = 0
   , h_C
@@ -268,19 +481,41 @@ enum header_states
   , h_matching_content_length
   , h_matching_transfer_encoding
   , h_matching_upgrade
+  , h_matching_host
 
   , h_connection
   , h_content_length
   , h_transfer_encoding
   , h_upgrade
+  , h_host
 
   , h_matching_transfer_encoding_chunked
+
+  /* Connection is a comma separated list of tokens. Each token is matched
+   * on its own, h_matching_connection_token skips one we don't know.
+   */
+  , h_matching_connection_token_start
+  , h_matching_connection_token
   , h_matching_connection_keep_alive
   , h_matching_connection_close
+  , h_matching_connection_upgrade
+  , h_matching_connection_te
+  , h_matching_connection_trailer
 
   , h_transfer_encoding_chunked
   , h_connection_keep_alive
   , h_connection_close
+  , h_connection_upgrade
+  , h_connection_te
+  , h_connection_trailer
+  };
+
+
+/* What http_parser_expect_response() remembers about a request. */
+enum pending_request
+  { PENDING_OTHER   = 0
+  , PENDING_HEAD    = 1
+  , PENDING_CONNECT = 2
   };
 
 
@@ -296,6 +531,9 @@ enum flags
 
 #define CR '\r'
 #define LF '\n'
+
+/* "0\r\n\r\n", the shortest end of a chunked body */
+#define LAST_CHUNK_LEN 5
 #define LOWER(c) (unsigned char)(c | 0x20)
 #define TOKEN(c) tokens[(unsigned char)c]
 
@@ -303,206 +541,728 @@ enum flags
 #define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
 
 
-#if HTTP_PARSER_STRICT
-# define STRICT_CHECK(cond) if (cond) goto error
-# define NEW_MESSAGE() (http_should_keep_alive(parser) ? start_state : s_dead)
-#else
-# define STRICT_CHECK(cond)
-# define NEW_MESSAGE() start_state
-#endif
+/* Decides how a response is framed from its status code and the method of
+ * the request it answers. RFC 2616 section 4.4: 1xx, 204 and 304 responses
+ * and responses to HEAD never have a body, whatever their headers say. A
+ * 101 or a 2xx answer to CONNECT hands the connection to another protocol.
+ */
+static inline void
+frame_response (http_parser *parser)
+{
+  unsigned short status = parser->status_code;
+  enum pending_request request = PENDING_OTHER;
 
+  if (status / 100 == 1 && status != 101) {
+    /* Interim response, the final one is still to come. */
+    parser->flags |= F_SKIPBODY;
+    return;
+  }
 
-size_t http_parser_execute (http_parser *parser,
-                            const http_parser_settings *settings,
-                            const char *data,
-                            size_t len)
+  if (parser->npending > 0) {
+    request = (enum pending_request) (parser->pending & 3);
+    parser->pending >>= 2;
+    parser->npending--;
+  }
+
+  if (status == 101 || (request == PENDING_CONNECT && status / 100 == 2)) {
+    parser->upgrade = 1;
+  } else if (status == 204 || status == 304 || request == PENDING_HEAD) {
+    parser->flags |= F_SKIPBODY;
+  }
+}
+
+
+/* Picks the matcher for a token in a Connection header value by its first
+ * (lowercased) character.
+ */
+static inline enum header_states
+connection_token_start (char c)
 {
-  char c, ch;
-  const char *p = data, *pe;
-  int64_t to_read;
+  switch (c) {
+    case ',': return h_matching_connection_token_start;
+    case 'k': return h_matching_connection_keep_alive;
+    case 'c': return h_matching_connection_close;
+    case 'u': return h_matching_connection_upgrade;
+    case 't': return h_matching_connection_te;
+    default:  return h_matching_connection_token;
+  }
+}
 
-  enum state state = (enum state) parser->state;
-  enum header_states header_state = (enum header_states) parser->header_state;
-  uint64_t index = parser->index;
-  uint64_t nread = parser->nread;
 
-  if (len == 0) {
-    if (state == s_body_identity_eof) {
-      CALLBACK2(message_complete);
-    }
-    return 0;
+/* Records the Connection token that just ended. */
+static inline void
+connection_token_end (http_parser *parser, enum header_states header_state)
+{
+  switch (header_state) {
+    case h_connection_keep_alive:
+      parser->flags |= F_CONNECTION_KEEP_ALIVE;
+      parser->hop_by_hop |= HTTP_HOP_KEEP_ALIVE;
+      break;
+    case h_connection_close:
+      parser->flags |= F_CONNECTION_CLOSE;
+      break;
+    case h_connection_upgrade:
+      parser->hop_by_hop |= HTTP_HOP_UPGRADE;
+      break;
+    case h_connection_te:
+      parser->hop_by_hop |= HTTP_HOP_TE;
+      break;
+    case h_connection_trailer:
+      parser->hop_by_hop |= HTTP_HOP_TRAILER;
+      break;
+    case h_matching_connection_token_start:
+      /* empty list element */
+      break;
+    default:
+      parser->hop_by_hop |= HTTP_HOP_OTHER;
+      break;
   }
+}
 
-  /* technically we could combine all of these (except for url_mark) into one
-     variable, saving stack space, but it seems more clear to have them
-     separated. */
-  const char *header_field_mark = 0;
-  const char *header_value_mark = 0;
-  const char *fragment_mark = 0;
-  const char *query_string_mark = 0;
-  const char *path_mark = 0;
-  const char *url_mark = 0;
 
-  if (state == s_header_field)
-    header_field_mark = data;
-  if (state == s_header_value)
-    header_value_mark = data;
-  if (state == s_req_fragment)
-    fragment_mark = data;
-  if (state == s_req_query_string)
-    query_string_mark = data;
-  if (state == s_req_path)
-    path_mark = data;
-  if (state == s_req_path || state == s_req_schema || state == s_req_schema_slash
-      || state == s_req_schema_slash_slash || state == s_req_port
-      || state == s_req_query_string_start || state == s_req_query_string
-      || state == s_req_host
-      || state == s_req_fragment_start || state == s_req_fragment)
-    url_mark = data;
-
-  for (p=data, pe=data+len; p != pe; p++) {
-    ch = *p;
+/* Route headers starting with 'c', see http_parser_set_route(). */
+static inline unsigned char
+route_start (const http_parser_settings *settings, char c)
+{
+  const char * const *names = settings->route_headers;
+  unsigned char match = 0;
+  int i;
 
-    if (PARSING_HEADER(state)) {
-      ++nread;
-      /* Buffer overflow attack */
-      if (nread > HTTP_MAX_HEADER_SIZE) goto error;
-    }
+  for (i = 0; names && names[i] && i < HTTP_MAX_ROUTE_HEADERS; i++) {
+    if (names[i][0] == c) match |= 1 << i;
+  }
+  return match;
+}
 
-    switch (state) {
 
-      case s_dead:
-        /* this state is used after a 'Connection: close' message
-         * the parser will error out if it reads another message
-         */
-        goto error;
+/* Drops the route headers in 'match' without 'c' at 'index'. */
+static inline unsigned char
+route_step (const http_parser_settings *settings,
+            unsigned char match,
+            uint64_t index,
+            char c)
+{
+  int i;
 
-      case s_start_req_or_res:
-      {
-        if (ch == CR || ch == LF)
-          break;
-        parser->flags = 0;
-        parser->content_length = -1;
+  for (i = 0; i < HTTP_MAX_ROUTE_HEADERS; i++) {
+    if ((match & 1 << i) && settings->route_headers[i][index] != c) {
+      match &= ~(1 << i);
+    }
+  }
+  return match;
+}
 
-        CALLBACK2(message_begin);
 
-        if (ch == 'H')
-          state = s_res_or_resp_H;
-        else {
-          parser->type = HTTP_REQUEST;
-          goto start_req_method_assign;
-        }
-        break;
-      }
+/* Keeps the route headers in 'match' that end after 'index'. */
+static inline unsigned char
+route_end (const http_parser_settings *settings,
+           unsigned char match,
+           uint64_t index)
+{
+  return route_step(settings, match, index + 1, '\0');
+}
 
-      case s_res_or_resp_H:
-        if (ch == 'T') {
-          parser->type = HTTP_RESPONSE;
-          state = s_res_HT;
-        } else {
-          if (ch != 'E') goto error;
-          parser->type = HTTP_REQUEST;
-          parser->method = HTTP_HEAD;
-          index = 2;
-          state = s_req_method;
-        }
-        break;
 
-      case s_start_res:
-      {
-        parser->flags = 0;
-        parser->content_length = -1;
+static inline int
+route_index (unsigned char match)
+{
+  int i = 0;
 
-        CALLBACK2(message_begin);
+  while (!(match & 1 << i)) i++;
+  return i;
+}
 
-        switch (ch) {
-          case 'H':
-            state = s_res_H;
-            break;
 
-          case CR:
-          case LF:
-            break;
+static inline const char *
+route_name (const http_parser_settings *settings, unsigned char match)
+{
+  return settings->route_headers[route_index(match)];
+}
 
-          default:
-            goto error;
-        }
-        break;
-      }
 
-      case s_res_H:
-        STRICT_CHECK(ch != 'T');
-        state = s_res_HT;
-        break;
+/* The cache key is XXH64's round and avalanche over the bytes as little
+ * endian words. Every URL or header value ends in a word with its tag and
+ * the length of its last partial word in the top byte, so where one
+ * value ends and the next starts changes the hash.
+ */
+#define KEY_PRIME1 0x9E3779B185EBCA87ULL
+#define KEY_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define KEY_PRIME3 0x165667B19E3779F9ULL
+#define KEY_PRIME5 0x27D4EB2F165667C5ULL
 
-      case s_res_HT:
-        STRICT_CHECK(ch != 'T');
-        state = s_res_HTT;
-        break;
+static inline uint64_t
+key_round (uint64_t acc, uint64_t word)
+{
+  acc += word * KEY_PRIME2;
+  acc = (acc << 31) | (acc >> 33);
+  return acc * KEY_PRIME1;
+}
 
-      case s_res_HTT:
-        STRICT_CHECK(ch != 'P');
-        state = s_res_HTTP;
-        break;
 
-      case s_res_HTTP:
-        STRICT_CHECK(ch != '/');
-        state = s_res_first_http_major;
-        break;
+static inline uint64_t
+key_load (const unsigned char *s)
+{
+  return (uint64_t) s[0]       | (uint64_t) s[1] << 8
+       | (uint64_t) s[2] << 16 | (uint64_t) s[3] << 24
+       | (uint64_t) s[4] << 32 | (uint64_t) s[5] << 40
+       | (uint64_t) s[6] << 48 | (uint64_t) s[7] << 56;
+}
 
-      case s_res_first_http_major:
-        if (ch < '1' || ch > '9') goto error;
-        parser->http_major = ch - '0';
-        state = s_res_http_major;
-        break;
 
-      /* major HTTP version or dot */
-      case s_res_http_major:
-      {
-        if (ch == '.') {
-          state = s_res_first_http_minor;
-          break;
-        }
+static inline int
+key_header (unsigned char route_match)
+{
+  return route_match ? KEY_HEADER + route_index(route_match) : 0;
+}
 
-        if (ch < '0' || ch > '9') goto error;
 
-        parser->http_major *= 10;
-        parser->http_major += ch - '0';
+static void
+key_begin (struct http_parser_key *key)
+{
+  key->acc = key->seed + KEY_PRIME5;
+  key->word = 0;
+  key->nbytes = 0;
+}
 
-        if (parser->http_major > 999) goto error;
-        break;
-      }
 
-      /* first digit of minor HTTP version */
-      case s_res_first_http_minor:
-        if (ch < '0' || ch > '9') goto error;
-        parser->http_minor = ch - '0';
-        state = s_res_http_minor;
-        break;
+static void
+key_update (struct http_parser_key *key, const char *at, size_t len)
+{
+  const unsigned char *s = (const unsigned char *) at;
+  const unsigned char *end = s + len;
+
+  /* fill up the word the last piece left */
+  while (key->nbytes && s < end) {
+    key->word |= (uint64_t) *s++ << (8 * key->nbytes);
+    if (++key->nbytes == 8) {
+      key->acc = key_round(key->acc, key->word);
+      key->word = 0;
+      key->nbytes = 0;
+    }
+  }
 
-      /* minor HTTP version or end of request line */
-      case s_res_http_minor:
-      {
-        if (ch == ' ') {
-          state = s_res_first_status_code;
-          break;
-        }
+  for (; end - s >= 8; s += 8) {
+    key->acc = key_round(key->acc, key_load(s));
+  }
 
-        if (ch < '0' || ch > '9') goto error;
+  while (s < end) {
+    key->word |= (uint64_t) *s++ << (8 * key->nbytes++);
+  }
+}
 
-        parser->http_minor *= 10;
-        parser->http_minor += ch - '0';
 
-        if (parser->http_minor > 999) goto error;
-        break;
-      }
+static void
+key_end (struct http_parser_key *key, int tag)
+{
+  uint64_t last = (uint64_t) (tag << 3 | key->nbytes) << 56;
 
-      case s_res_first_status_code:
+  key->acc = key_round(key->acc, key->word | last);
+  key->word = 0;
+  key->nbytes = 0;
+}
+
+
+static void
+key_finish (struct http_parser_key *key, unsigned char method)
+{
+  uint64_t h = key_round(key->acc, method);
+
+  h ^= h >> 33;
+  h *= KEY_PRIME2;
+  h ^= h >> 29;
+  h *= KEY_PRIME3;
+  h ^= h >> 32;
+  key->hash = h;
+}
+
+
+#if HTTP_PARSER_STRICT
+# define STRICT_CHECK(cond)                                           \
+do {                                                                 \
+  if (cond) {                                                        \
+    SET_ERRNO(HPE_STRICT);                                           \
+    goto error;                                                      \
+  }                                                                  \
+} while (0)
+# define NEW_MESSAGE() (http_should_keep_alive(parser) ? start_state : s_dead)
+#else
+# define STRICT_CHECK(cond)
+# define NEW_MESSAGE() start_state
+#endif
+
+
+static inline uint64_t
+cheap_clock (void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+uint64_t
+http_parser_clock (void)
+{
+  return cheap_clock();
+}
+
+
+#if HTTP_PARSER_TIMING
+static inline uint64_t
+timing_now (const struct http_parser_timing *timing)
+{
+  return timing->clock ? timing->clock() : timing->now;
+}
+
+
+/* Everything since the last checkpoint was spent in the parser. */
+static inline uint64_t
+timing_parser (struct http_parser_timing *timing)
+{
+  uint64_t now = timing_now(timing);
+
+  timing->in_parser += now - timing->last;
+  timing->last = now;
+  return now;
+}
+
+
+static inline void
+timing_callback_done (struct http_parser_timing *timing)
+{
+  uint64_t now = timing_now(timing);
+
+  timing->in_callbacks += now - timing->last;
+  timing->last = now;
+}
+
+
+static inline void
+timing_message_begin (struct http_parser_timing *timing)
+{
+  timing->begin = timing->last = timing_now(timing);
+  timing->headers_complete = 0;
+  timing->message_complete = 0;
+  timing->in_callbacks = 0;
+  timing->in_parser = 0;
+}
+
+
+static inline void
+timing_headers_complete (struct http_parser_timing *timing)
+{
+  timing->headers_complete = timing_parser(timing);
+}
+
+
+static inline void
+timing_message_complete (struct http_parser_timing *timing)
+{
+  timing->message_complete = timing_parser(timing);
+}
+#endif
+
+
+#if HTTP_PARSER_TRACE
+# if defined(_MSC_VER)
+#  define THREAD_LOCAL __declspec(thread)
+# else
+#  define THREAD_LOCAL __thread
+# endif
+
+static THREAD_LOCAL struct http_trace *thread_trace;
+
+/* Calls until the next sampled one. 0 when no ring is attached: it then
+ * wraps and only comes back to 1 every 2^32 calls.
+ */
+static THREAD_LOCAL uint32_t thread_countdown;
+
+
+/* Out of line, to keep execute()'s registers for the common case. */
+static TRACE_COLD void
+trace_event (struct http_trace *trace,
+             enum http_trace_type type,
+             enum state state,
+             uint32_t offset,
+             uint16_t arg)
+{
+  uint64_t head = trace->head;
+  struct http_trace_event *event = &trace->events[head & (trace->size - 1)];
+
+  event->time = cheap_clock();
+  event->offset = offset;
+  event->arg = arg;
+  event->type = type;
+  event->state = state;
+
+  TRACE_HEAD_STORE(&trace->head, head + 1);
+}
+
+
+static TRACE_COLD void
+trace_call (const http_parser *parser, uint32_t len)
+{
+  struct http_trace *trace = thread_trace;
+
+  if (!trace) return;
+  thread_countdown = trace->sample;
+  trace_event(trace, HTTP_TRACE_EXECUTE, (enum state) parser->state, len, 0);
+}
+
+
+/* Called by the entry points rather than by execute(), which would have
+ * to keep its arguments across the call and spill more of its state.
+ */
+static inline void
+trace_start (const http_parser *parser, size_t len)
+{
+  if (--thread_countdown == 0) trace_call(parser, len);
+}
+
+
+/* Whether the current call is sampled: the countdown has just been reset.
+ * execute() keeps no state of its own for tracing. A parser run from a
+ * callback counts as a call too and may end the outer call's sample.
+ */
+static inline int
+trace_sampled (void)
+{
+  return thread_trace && thread_countdown == thread_trace->sample;
+}
+
+
+/* Errors are recorded whether the call was sampled or not. */
+static TRACE_COLD void
+trace_error (const http_parser *parser,
+             enum state state,
+             uint32_t offset,
+             unsigned char ch)
+{
+  struct http_trace *trace = thread_trace;
+
+  if (!trace) return;
+
+  trace_event(trace, HTTP_TRACE_ERROR, state, offset, ch);
+  if (trace->on_error) trace->on_error(trace, parser);
+}
+#endif
+
+
+/* 'inplace' is set for http_parser_execute_inplace(), 'data' is writable
+ * then.
+ */
+static size_t
+execute (http_parser *parser,
+         const http_parser_settings *settings,
+         const char *data,
+         size_t len,
+         int inplace)
+{
+  char c, ch;
+  const char *p = data, *pe;
+  int64_t to_read;
+
+  /* In-place mode: chunk payload moved together and not yet delivered */
+  char *coalesced = NULL, *coalesced_end = NULL;
+
+  enum state state = (enum state) parser->state;
+  enum header_states header_state = (enum header_states) parser->header_state;
+  uint64_t index = parser->index;
+  uint64_t nread = parser->nread;
+  uint64_t limit_pos = parser->limit_pos;
+  const struct http_parser_limits *limits = settings->limits;
+  uint64_t max_head = limits && limits->max_head_size ? limits->max_head_size
+                                                      : HTTP_MAX_HEADER_SIZE;
+  struct http_parser_key *key = parser->key;
+#if HTTP_PARSER_STATS
+  struct http_parser_stats *stats = parser->stats;
+#endif
+#if HTTP_PARSER_TIMING
+  struct http_parser_timing *timing = parser->timing;
+
+  if (timing) timing->last = timing_now(timing);
+#endif
+
+  if (parser->http_errno == HPE_PAUSED) return 0;
+
+  if (len == 0) {
+    switch (state) {
+      case s_body_identity_eof:
+        CALLBACK2(message_complete);
+        break;
+
+      case s_dead:
+      case s_start_req_or_res:
+      case s_start_res:
+      case s_start_req:
+        break;
+
+      default:
+        /* the message was cut short */
+        SET_ERRNO(HPE_INVALID_EOF_STATE);
+        STAT_ADD(errors[HPE_INVALID_EOF_STATE], 1);
+        parser->state = s_dead;
+        break;
+    }
+    return 0;
+  }
+
+  /* Dechunk mode: the decoded body ends where the last call left it */
+  if (inplace && parser->dechunk && IN_CHUNKS(state)) {
+    coalesced_end = (char *) data - parser->body_gap;
+  }
+
+  /* technically we could combine all of these (except for url_mark) into one
+     variable, saving stack space, but it seems more clear to have them
+     separated. */
+  const char *header_field_mark = 0;
+  const char *header_value_mark = 0;
+  const char *fragment_mark = 0;
+  const char *query_string_mark = 0;
+  const char *path_mark = 0;
+  const char *url_mark = 0;
+  const char *host_mark = 0;
+
+  /* In retain mode the data starts with the bytes retained by the previous
+   * call. They have been parsed already, the marks point into them.
+   */
+  const char *sub_mark = data + parser->retained_mark;
+
+  p = data;
+  if (parser->retained > len) {
+    SET_ERRNO(HPE_INVALID_RETAINED);
+    goto error;
+  }
+  p += parser->retained;
+  parser->retained = 0;
+  parser->retained_mark = 0;
+
+  switch (state_mark[state]) {
+    case MARK_NONE:
+      break;
+    case MARK_HEADER_FIELD:
+      if (!parser->route) header_field_mark = data;
+      break;
+    case MARK_HEADER_VALUE:
+      if (!parser->route || parser->route_match) header_value_mark = data;
+      if (header_state == h_host) host_mark = data;
+      break;
+    case MARK_URL_PATH:
+      path_mark = sub_mark;
+      url_mark = data;
+      break;
+    case MARK_URL_QUERY_STRING:
+      query_string_mark = sub_mark;
+      url_mark = data;
+      break;
+    case MARK_URL_FRAGMENT:
+      fragment_mark = sub_mark;
+      url_mark = data;
+      break;
+    case MARK_URL:
+      url_mark = data;
+      break;
+  }
+
+  for (pe=data+len; p != pe; p++) {
+    ch = *p;
+
+    if (PARSING_HEADER(state)) {
+      ++nread;
+      /* Buffer overflow attack */
+      if (nread > max_head) {
+        SET_ERRNO(HPE_HEADER_OVERFLOW);
+        goto error;
+      }
+
+      /* The terminating space or CR of a token that just fits is fine. */
+      if (limits) {
+        if (state >= s_req_schema && state <= s_req_fragment) {
+          if (limits->max_url_size
+              && nread - limit_pos > limits->max_url_size
+              && ch != ' ' && ch != CR && ch != LF) {
+            SET_ERRNO(HPE_URL_OVERFLOW);
+            goto error;
+          }
+        } else if (state >= s_header_field && state <= s_header_skip) {
+          if (limits->max_header_size
+              && nread - limit_pos > limits->max_header_size
+              && ch != CR && ch != LF) {
+            SET_ERRNO(HPE_HEADER_LINE_OVERFLOW);
+            goto error;
+          }
+        }
+      }
+    }
+
+    switch (state) {
+
+      case s_dead:
+        /* this state is used after a 'Connection: close' message
+         * the parser will error out if it reads another message
+         */
+        SET_ERRNO(HPE_CLOSED_CONNECTION);
+        goto error;
+
+      case s_start_req_or_res:
+      {
+        if (ch == CR || ch == LF)
+          break;
+        parser->flags = 0;
+        parser->hop_by_hop = 0;
+        parser->nheaders = 0;
+        parser->content_length = -1;
+
+        if (key) key_begin(key);
+        CALLBACK2(message_begin);
+
+        if (ch == 'H')
+          state = s_res_or_resp_H;
+        else {
+          parser->type = HTTP_REQUEST;
+          goto start_req_method_assign;
+        }
+        break;
+      }
+
+      case s_res_or_resp_H:
+        if (ch == 'T') {
+          parser->type = HTTP_RESPONSE;
+          state = s_res_HT;
+        } else {
+          if (ch != 'E') {
+            SET_ERRNO(HPE_INVALID_CONSTANT);
+            goto error;
+          }
+          parser->type = HTTP_REQUEST;
+          parser->method = HTTP_HEAD;
+          index = 2;
+          state = s_req_method;
+        }
+        break;
+
+      case s_start_res:
+      {
+        parser->flags = 0;
+        parser->hop_by_hop = 0;
+        parser->nheaders = 0;
+        parser->content_length = -1;
+
+        if (key) key_begin(key);
+        CALLBACK2(message_begin);
+
+        switch (ch) {
+          case 'H':
+            state = s_res_H;
+            break;
+
+          case CR:
+          case LF:
+            break;
+
+          default:
+            SET_ERRNO(HPE_INVALID_CONSTANT);
+            goto error;
+        }
+        break;
+      }
+
+      case s_res_H:
+        STRICT_CHECK(ch != 'T');
+        state = s_res_HT;
+        break;
+
+      case s_res_HT:
+        STRICT_CHECK(ch != 'T');
+        state = s_res_HTT;
+        break;
+
+      case s_res_HTT:
+        STRICT_CHECK(ch != 'P');
+        state = s_res_HTTP;
+        break;
+
+      case s_res_HTTP:
+        STRICT_CHECK(ch != '/');
+        state = s_res_first_http_major;
+        break;
+
+      case s_res_first_http_major:
+        if (ch < '1' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
+        parser->http_major = ch - '0';
+        state = s_res_http_major;
+        break;
+
+      /* major HTTP version or dot */
+      case s_res_http_major:
+      {
+        if (ch == '.') {
+          state = s_res_first_http_minor;
+          break;
+        }
+
+        if (ch < '0' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
+
+        parser->http_major *= 10;
+        parser->http_major += ch - '0';
+
+        if (parser->http_major > 999) {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
+        break;
+      }
+
+      /* first digit of minor HTTP version */
+      case s_res_first_http_minor:
+        if (ch < '0' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
+        parser->http_minor = ch - '0';
+        state = s_res_http_minor;
+        break;
+
+      /* minor HTTP version or end of request line */
+      case s_res_http_minor:
+      {
+        if (ch == ' ') {
+          state = s_res_first_status_code;
+          break;
+        }
+
+        if (ch < '0' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
+
+        parser->http_minor *= 10;
+        parser->http_minor += ch - '0';
+
+        if (parser->http_minor > 999) {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
+        break;
+      }
+
+      case s_res_first_status_code:
       {
         if (ch < '0' || ch > '9') {
           if (ch == ' ') {
             break;
           }
+          SET_ERRNO(HPE_INVALID_STATUS);
           goto error;
         }
         parser->status_code = ch - '0';
@@ -524,6 +1284,7 @@ size_t http_parser_execute (http_parser *parser,
               state = s_header_field_start;
               break;
             default:
+              SET_ERRNO(HPE_INVALID_STATUS);
               goto error;
           }
           break;
@@ -532,7 +1293,10 @@ size_t http_parser_execute (http_parser *parser,
         parser->status_code *= 10;
         parser->status_code += ch - '0';
 
-        if (parser->status_code > 999) goto error;
+        if (parser->status_code > 999) {
+          SET_ERRNO(HPE_INVALID_STATUS);
+          goto error;
+        }
         break;
       }
 
@@ -560,11 +1324,17 @@ size_t http_parser_execute (http_parser *parser,
         if (ch == CR || ch == LF)
           break;
         parser->flags = 0;
+        parser->hop_by_hop = 0;
+        parser->nheaders = 0;
         parser->content_length = -1;
 
+        if (key) key_begin(key);
         CALLBACK2(message_begin);
 
-        if (ch < 'A' || 'Z' < ch) goto error;
+        if (ch < 'A' || 'Z' < ch) {
+          SET_ERRNO(HPE_INVALID_METHOD);
+          goto error;
+        }
 
       start_req_method_assign:
         parser->method = (enum http_method) 0;
@@ -581,7 +1351,9 @@ size_t http_parser_execute (http_parser *parser,
           case 'R': parser->method = HTTP_REPORT; break;
           case 'T': parser->method = HTTP_TRACE; break;
           case 'U': parser->method = HTTP_UNLOCK; break;
-          default: goto error;
+          default:
+            SET_ERRNO(HPE_INVALID_METHOD);
+            goto error;
         }
         state = s_req_method;
         break;
@@ -589,8 +1361,10 @@ size_t http_parser_execute (http_parser *parser,
 
       case s_req_method:
       {
-        if (ch == '\0')
+        if (ch == '\0') {
+          SET_ERRNO(HPE_INVALID_METHOD);
           goto error;
+        }
 
         const char *matcher = method_strings[parser->method];
         if (ch == ' ' && matcher[index] == '\0') {
@@ -618,6 +1392,7 @@ size_t http_parser_execute (http_parser *parser,
         } else if (index == 4 && parser->method == HTTP_PROPFIND && ch == 'P') {
           parser->method = HTTP_PROPPATCH;
         } else {
+          SET_ERRNO(HPE_INVALID_METHOD);
           goto error;
         }
 
@@ -628,6 +1403,8 @@ size_t http_parser_execute (http_parser *parser,
       {
         if (ch == ' ') break;
 
+        limit_pos = nread - 1;
+
         if (ch == '/') {
           MARK(url);
           MARK(path);
@@ -643,6 +1420,7 @@ size_t http_parser_execute (http_parser *parser,
           break;
         }
 
+        SET_ERRNO(HPE_INVALID_URL);
         goto error;
       }
 
@@ -663,6 +1441,7 @@ size_t http_parser_execute (http_parser *parser,
           break;
         }
 
+        SET_ERRNO(HPE_INVALID_URL);
         goto error;
       }
 
@@ -698,6 +1477,7 @@ size_t http_parser_execute (http_parser *parser,
             state = s_req_http_start;
             break;
           default:
+            SET_ERRNO(HPE_INVALID_HOST);
             goto error;
         }
         break;
@@ -720,6 +1500,7 @@ size_t http_parser_execute (http_parser *parser,
             state = s_req_http_start;
             break;
           default:
+            SET_ERRNO(HPE_INVALID_PORT);
             goto error;
         }
         break;
@@ -758,6 +1539,7 @@ size_t http_parser_execute (http_parser *parser,
             state = s_req_fragment_start;
             break;
           default:
+            SET_ERRNO(HPE_INVALID_PATH);
             goto error;
         }
         break;
@@ -794,6 +1576,7 @@ size_t http_parser_execute (http_parser *parser,
             state = s_req_fragment_start;
             break;
           default:
+            SET_ERRNO(HPE_INVALID_QUERY_STRING);
             goto error;
         }
         break;
@@ -831,6 +1614,7 @@ size_t http_parser_execute (http_parser *parser,
             state = s_req_fragment_start;
             break;
           default:
+            SET_ERRNO(HPE_INVALID_QUERY_STRING);
             goto error;
         }
         break;
@@ -868,6 +1652,7 @@ size_t http_parser_execute (http_parser *parser,
           case '#':
             break;
           default:
+            SET_ERRNO(HPE_INVALID_FRAGMENT);
             goto error;
         }
         break;
@@ -901,6 +1686,7 @@ size_t http_parser_execute (http_parser *parser,
           case '#':
             break;
           default:
+            SET_ERRNO(HPE_INVALID_FRAGMENT);
             goto error;
         }
         break;
@@ -914,6 +1700,7 @@ size_t http_parser_execute (http_parser *parser,
           case ' ':
             break;
           default:
+            SET_ERRNO(HPE_INVALID_CONSTANT);
             goto error;
         }
         break;
@@ -940,7 +1727,10 @@ size_t http_parser_execute (http_parser *parser,
 
       /* first digit of major HTTP version */
       case s_req_first_http_major:
-        if (ch < '1' || ch > '9') goto error;
+        if (ch < '1' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
         parser->http_major = ch - '0';
         state = s_req_http_major;
         break;
@@ -953,18 +1743,27 @@ size_t http_parser_execute (http_parser *parser,
           break;
         }
 
-        if (ch < '0' || ch > '9') goto error;
+        if (ch < '0' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
 
         parser->http_major *= 10;
         parser->http_major += ch - '0';
 
-        if (parser->http_major > 999) goto error;
+        if (parser->http_major > 999) {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
         break;
       }
 
       /* first digit of minor HTTP version */
       case s_req_first_http_minor:
-        if (ch < '0' || ch > '9') goto error;
+        if (ch < '0' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
         parser->http_minor = ch - '0';
         state = s_req_http_minor;
         break;
@@ -984,19 +1783,28 @@ size_t http_parser_execute (http_parser *parser,
 
         /* XXX allow spaces after digit? */
 
-        if (ch < '0' || ch > '9') goto error;
+        if (ch < '0' || ch > '9') {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
 
         parser->http_minor *= 10;
         parser->http_minor += ch - '0';
 
-        if (parser->http_minor > 999) goto error;
+        if (parser->http_minor > 999) {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          goto error;
+        }
         break;
       }
 
       /* end of request line */
       case s_req_line_almost_done:
       {
-        if (ch != LF) goto error;
+        if (ch != LF) {
+          SET_ERRNO(HPE_LF_EXPECTED);
+          goto error;
+        }
         state = s_header_field_start;
         break;
       }
@@ -1017,9 +1825,23 @@ size_t http_parser_execute (http_parser *parser,
 
         c = TOKEN(ch);
 
-        if (!c) goto error;
+        if (!c) {
+          SET_ERRNO(HPE_INVALID_HEADER_TOKEN);
+          goto error;
+        }
+
+        if (limits && limits->max_headers
+            && ++parser->nheaders > limits->max_headers) {
+          SET_ERRNO(HPE_TOO_MANY_HEADERS);
+          goto error;
+        }
 
-        MARK(header_field);
+        parser->route_match = parser->route || key
+                              ? route_start(settings, c)
+                              : 0;
+        if (!parser->route) MARK(header_field);
+        STAT_ADD(headers, 1);
+        limit_pos = nread - 1;
 
         index = 0;
         state = s_header_field;
@@ -1029,6 +1851,10 @@ size_t http_parser_execute (http_parser *parser,
             header_state = h_C;
             break;
 
+          case 'h':
+            header_state = h_matching_host;
+            break;
+
           case 'p':
             header_state = h_matching_proxy_connection;
             break;
@@ -1045,6 +1871,11 @@ size_t http_parser_execute (http_parser *parser,
             header_state = h_general;
             break;
         }
+
+        if (parser->route && header_state == h_general
+            && !parser->route_match) {
+          state = s_header_skip;
+        }
         break;
       }
 
@@ -1053,22 +1884,21 @@ size_t http_parser_execute (http_parser *parser,
         c = TOKEN(ch);
 
         if (c) {
+          index++;
+
           switch (header_state) {
             case h_general:
               break;
 
             case h_C:
-              index++;
               header_state = (c == 'o' ? h_CO : h_general);
               break;
 
             case h_CO:
-              index++;
               header_state = (c == 'n' ? h_CON : h_general);
               break;
 
             case h_CON:
-              index++;
               switch (c) {
                 case 'n':
                   header_state = h_matching_connection;
@@ -1085,7 +1915,6 @@ size_t http_parser_execute (http_parser *parser,
             /* connection */
 
             case h_matching_connection:
-              index++;
               if (index > sizeof(CONNECTION)-1
                   || c != CONNECTION[index]) {
                 header_state = h_general;
@@ -1097,7 +1926,6 @@ size_t http_parser_execute (http_parser *parser,
             /* proxy-connection */
 
             case h_matching_proxy_connection:
-              index++;
               if (index > sizeof(PROXY_CONNECTION)-1
                   || c != PROXY_CONNECTION[index]) {
                 header_state = h_general;
@@ -1109,7 +1937,6 @@ size_t http_parser_execute (http_parser *parser,
             /* content-length */
 
             case h_matching_content_length:
-              index++;
               if (index > sizeof(CONTENT_LENGTH)-1
                   || c != CONTENT_LENGTH[index]) {
                 header_state = h_general;
@@ -1121,7 +1948,6 @@ size_t http_parser_execute (http_parser *parser,
             /* transfer-encoding */
 
             case h_matching_transfer_encoding:
-              index++;
               if (index > sizeof(TRANSFER_ENCODING)-1
                   || c != TRANSFER_ENCODING[index]) {
                 header_state = h_general;
@@ -1133,7 +1959,6 @@ size_t http_parser_execute (http_parser *parser,
             /* upgrade */
 
             case h_matching_upgrade:
-              index++;
               if (index > sizeof(UPGRADE)-1
                   || c != UPGRADE[index]) {
                 header_state = h_general;
@@ -1142,10 +1967,22 @@ size_t http_parser_execute (http_parser *parser,
               }
               break;
 
+            /* host */
+
+            case h_matching_host:
+              if (index > sizeof(HOST)-1
+                  || c != HOST[index]) {
+                header_state = h_general;
+              } else if (index == sizeof(HOST)-2) {
+                header_state = h_host;
+              }
+              break;
+
             case h_connection:
             case h_content_length:
             case h_transfer_encoding:
             case h_upgrade:
+            case h_host:
               if (ch != ' ') header_state = h_general;
               break;
 
@@ -1153,10 +1990,30 @@ size_t http_parser_execute (http_parser *parser,
               assert(0 && "Unknown header_state");
               break;
           }
+
+          if (parser->route_match) {
+            parser->route_match = route_step(settings,
+                                             parser->route_match,
+                                             index,
+                                             c);
+          }
+          if (parser->route && header_state == h_general
+              && !parser->route_match) {
+            state = s_header_skip;
+          }
           break;
         }
 
         if (ch == ':') {
+          if (parser->route_match) {
+            parser->route_match = route_end(settings,
+                                            parser->route_match,
+                                            index);
+          }
+          if (parser->route && parser->route_match) {
+            const char *name = route_name(settings, parser->route_match);
+            CALLBACK_DATA(header_field, name, strlen(name));
+          }
           CALLBACK(header_field);
           state = s_header_value_start;
           break;
@@ -1174,6 +2031,7 @@ size_t http_parser_execute (http_parser *parser,
           break;
         }
 
+        SET_ERRNO(HPE_INVALID_HEADER_TOKEN);
         goto error;
       }
 
@@ -1181,13 +2039,15 @@ size_t http_parser_execute (http_parser *parser,
       {
         if (ch == ' ') break;
 
-        MARK(header_value);
+        if (!parser->route || parser->route_match) MARK(header_value);
+        if (header_state == h_host) MARK(host);
 
         state = s_header_value;
         index = 0;
 
         if (ch == CR) {
           CALLBACK(header_value);
+          CALLBACK(host);
           header_state = h_general;
           state = s_header_almost_done;
           break;
@@ -1195,6 +2055,7 @@ size_t http_parser_execute (http_parser *parser,
 
         if (ch == LF) {
           CALLBACK(header_value);
+          CALLBACK(host);
           state = s_header_field_start;
           break;
         }
@@ -1202,6 +2063,9 @@ size_t http_parser_execute (http_parser *parser,
         c = LOWER(ch);
 
         switch (header_state) {
+          case h_host:
+            break;
+
           case h_upgrade:
             parser->flags |= F_UPGRADE;
             header_state = h_general;
@@ -1217,20 +2081,16 @@ size_t http_parser_execute (http_parser *parser,
             break;
 
           case h_content_length:
-            if (ch < '0' || ch > '9') goto error;
+            if (ch < '0' || ch > '9') {
+              SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
+              goto error;
+            }
             parser->content_length = ch - '0';
             break;
 
           case h_connection:
-            /* looking for 'Connection: keep-alive' */
-            if (c == 'k') {
-              header_state = h_matching_connection_keep_alive;
-            /* looking for 'Connection: close' */
-            } else if (c == 'c') {
-              header_state = h_matching_connection_close;
-            } else {
-              header_state = h_general;
-            }
+            /* looking for 'Connection: keep-alive, close, ...' */
+            header_state = connection_token_start(c);
             break;
 
           default:
@@ -1245,12 +2105,14 @@ size_t http_parser_execute (http_parser *parser,
 
         if (ch == CR) {
           CALLBACK(header_value);
+          CALLBACK(host);
           state = s_header_almost_done;
           break;
         }
 
         if (ch == LF) {
           CALLBACK(header_value);
+          CALLBACK(host);
           goto header_almost_done;
         }
 
@@ -1258,6 +2120,7 @@ size_t http_parser_execute (http_parser *parser,
 
         switch (header_state) {
           case h_general:
+          case h_host:
             break;
 
           case h_connection:
@@ -1267,7 +2130,10 @@ size_t http_parser_execute (http_parser *parser,
 
           case h_content_length:
             if (ch == ' ') break;
-            if (ch < '0' || ch > '9') goto error;
+            if (ch < '0' || ch > '9') {
+              SET_ERRNO(HPE_INVALID_CONTENT_LENGTH);
+              goto error;
+            }
             parser->content_length *= 10;
             parser->content_length += ch - '0';
             break;
@@ -1283,30 +2149,94 @@ size_t http_parser_execute (http_parser *parser,
             }
             break;
 
-          /* looking for 'Connection: keep-alive' */
+          /* Connection: token, token, ... */
+          case h_matching_connection_token_start:
+            if (ch == ' ' || ch == '\t') break;
+            index = 0;
+            header_state = connection_token_start(c);
+            break;
+
+          case h_matching_connection_token:
+            if (ch == ',') {
+              connection_token_end(parser, header_state);
+              header_state = h_matching_connection_token_start;
+            }
+            break;
+
           case h_matching_connection_keep_alive:
             index++;
             if (index > sizeof(KEEP_ALIVE)-1
                 || c != KEEP_ALIVE[index]) {
-              header_state = h_general;
+              goto connection_token_mismatch;
             } else if (index == sizeof(KEEP_ALIVE)-2) {
               header_state = h_connection_keep_alive;
             }
             break;
 
-          /* looking for 'Connection: close' */
           case h_matching_connection_close:
             index++;
             if (index > sizeof(CLOSE)-1 || c != CLOSE[index]) {
-              header_state = h_general;
+              goto connection_token_mismatch;
             } else if (index == sizeof(CLOSE)-2) {
               header_state = h_connection_close;
             }
             break;
 
-          case h_transfer_encoding_chunked:
+          case h_matching_connection_upgrade:
+            index++;
+            if (index > sizeof(UPGRADE)-1 || c != UPGRADE[index]) {
+              goto connection_token_mismatch;
+            } else if (index == sizeof(UPGRADE)-2) {
+              header_state = h_connection_upgrade;
+            }
+            break;
+
+          /* 'te' or 'trailer' */
+          case h_matching_connection_te:
+            index++;
+            if (index == 1 && c == 'r') {
+              header_state = h_matching_connection_trailer;
+            } else if (index > sizeof(TE)-1 || c != TE[index]) {
+              goto connection_token_mismatch;
+            } else if (index == sizeof(TE)-2) {
+              header_state = h_connection_te;
+            }
+            break;
+
+          case h_matching_connection_trailer:
+            index++;
+            if (index > sizeof(TRAILER)-1 || c != TRAILER[index]) {
+              goto connection_token_mismatch;
+            } else if (index == sizeof(TRAILER)-2) {
+              header_state = h_connection_trailer;
+            }
+            break;
+
+          connection_token_mismatch:
+            /* A ',' ends the token early, anything else makes it one we
+             * don't know.
+             */
+            header_state = h_matching_connection_token;
+            if (ch == ',') {
+              connection_token_end(parser, header_state);
+              header_state = h_matching_connection_token_start;
+            }
+            break;
+
           case h_connection_keep_alive:
           case h_connection_close:
+          case h_connection_upgrade:
+          case h_connection_te:
+          case h_connection_trailer:
+            if (ch == ',') {
+              connection_token_end(parser, header_state);
+              header_state = h_matching_connection_token_start;
+            } else if (ch != ' ' && ch != '\t') {
+              header_state = h_matching_connection_token;
+            }
+            break;
+
+          case h_transfer_encoding_chunked:
             if (ch != ' ') header_state = h_general;
             break;
 
@@ -1318,6 +2248,52 @@ size_t http_parser_execute (http_parser *parser,
         break;
       }
 
+      case s_header_skip:
+      {
+        /* Route mode: a header nobody asked for, find the end of its line
+         * without looking at what is in it.
+         */
+        const char *lf, *over = NULL;
+        uint64_t n;
+
+        if (ch == LF) {
+          state = s_header_field_start;
+          break;
+        }
+
+        lf = memchr(p + 1, LF, pe - p - 1);
+        n = (lf ? lf : pe) - (p + 1);
+
+        /* The limits, as if the bytes had gone through the loop */
+        if (PARSING_HEADER(state)) {
+          if (nread + n > max_head) {
+            over = p + (max_head - nread + 1);
+            SET_ERRNO(HPE_HEADER_OVERFLOW);
+          }
+          if (limits && limits->max_header_size
+              && nread + n - limit_pos > limits->max_header_size) {
+            const char *q = p + 1;
+
+            if (nread - limit_pos < limits->max_header_size) {
+              q = p + (limits->max_header_size + limit_pos - nread + 1);
+            }
+            while (q <= p + n && *q == CR) q++;
+            if (q <= p + n && (!over || q < over)) {
+              over = q;
+              SET_ERRNO(HPE_HEADER_LINE_OVERFLOW);
+            }
+          }
+          if (over) {
+            p = over;
+            goto error;
+          }
+          nread += n;
+        }
+
+        p += n;
+        break;
+      }
+
       case s_header_almost_done:
       header_almost_done:
       {
@@ -1326,15 +2302,24 @@ size_t http_parser_execute (http_parser *parser,
         state = s_header_field_start;
 
         switch (header_state) {
-          case h_connection_keep_alive:
-            parser->flags |= F_CONNECTION_KEEP_ALIVE;
-            break;
-          case h_connection_close:
-            parser->flags |= F_CONNECTION_CLOSE;
-            break;
           case h_transfer_encoding_chunked:
             parser->flags |= F_CHUNKED;
             break;
+          case h_matching_connection_token_start:
+          case h_matching_connection_token:
+          case h_matching_connection_keep_alive:
+          case h_matching_connection_close:
+          case h_matching_connection_upgrade:
+          case h_matching_connection_te:
+          case h_matching_connection_trailer:
+          case h_connection_keep_alive:
+          case h_connection_close:
+          case h_connection_upgrade:
+          case h_connection_te:
+          case h_connection_trailer:
+            /* the last token of a Connection header */
+            connection_token_end(parser, header_state);
+            break;
           default:
             break;
         }
@@ -1347,26 +2332,47 @@ size_t http_parser_execute (http_parser *parser,
         STRICT_CHECK(ch != LF);
 
         if (parser->flags & F_TRAILING) {
-          /* End of a chunked request */
+          /* End of a chunked request. Clear F_TRAILING so the first byte
+           * of the next message counts towards its head.
+           */
+          parser->flags &= ~F_TRAILING;
           CALLBACK2(message_complete);
           state = NEW_MESSAGE();
+          PAUSE_CHECK();
           break;
         }
 
-        nread = 0;
+        STAT_ADD(messages, 1);
+        STAT_ADD(head_bytes, nread);
+        parser->nread = nread; /* http_parser_head_length() */
+        limit_pos = 0;
+        parser->body_decoded = 0;
+        if (key) key_finish(key, parser->method);
 
-        if (parser->flags & F_UPGRADE || parser->method == HTTP_CONNECT) {
-          parser->upgrade = 1;
+        if (parser->type == HTTP_REQUEST) {
+          if (parser->flags & F_UPGRADE || parser->method == HTTP_CONNECT) {
+            parser->upgrade = 1;
+          }
+        } else {
+          frame_response(parser);
         }
 
         /* Here we call the headers_complete callback. This is somewhat
          * different than other callbacks because if the user returns 1, we
          * will interpret that as saying that this message has no body. This
          * is needed for the annoying case of recieving a response to a HEAD
-         * request.
+         * request when http_parser_expect_response() was not used.
          */
+        TRACE(HTTP_TRACE_HEADERS_COMPLETE, parser->type == HTTP_REQUEST
+                                           ? parser->method
+                                           : parser->status_code);
+
         if (settings->on_headers_complete) {
-          switch (settings->on_headers_complete(parser)) {
+          int rc;
+
+          TIMED(headers_complete, rc, settings->on_headers_complete(parser));
+
+          switch (rc) {
             case 0:
               break;
 
@@ -1375,14 +2381,28 @@ size_t http_parser_execute (http_parser *parser,
               break;
 
             default:
+              CALLBACK_FAILED(headers_complete, rc);
               return p - data; /* Error */
           }
+        } else {
+          TIMING(headers_complete);
         }
 
-        /* Exit, the rest of the connect is in a different protocol. */
+        nread = 0;
+
+        /* Exit, the rest of the connect is in a different protocol. The
+         * other protocol starts right after this LF.
+         */
         if (parser->upgrade) {
+          STAT_ADD(upgrades, 1);
+          if (parser->type == HTTP_REQUEST
+              ? parser->method == HTTP_CONNECT
+              : parser->status_code != 101) {
+            STAT_ADD(connects, 1);
+          }
           CALLBACK2(message_complete);
-          return (p - data);
+          TIMING(parser);
+          return (p - data) + 1;
         }
 
         if (parser->flags & F_SKIPBODY) {
@@ -1391,6 +2411,7 @@ size_t http_parser_execute (http_parser *parser,
         } else if (parser->flags & F_CHUNKED) {
           /* chunked encoding - ignore Content-Length header */
           state = s_chunk_size_start;
+          if (inplace && parser->dechunk) coalesced_end = (char *) p + 1;
         } else {
           if (parser->content_length == 0) {
             /* Content-Length header given but zero: Content-Length: 0\r\n */
@@ -1398,6 +2419,11 @@ size_t http_parser_execute (http_parser *parser,
             state = NEW_MESSAGE();
           } else if (parser->content_length > 0) {
             /* Content-Length header given and non-zero */
+            if (limits && limits->max_body_size
+                && parser->content_length > limits->max_body_size) {
+              SET_ERRNO(HPE_BODY_OVERFLOW);
+              goto error;
+            }
             state = s_body_identity;
           } else {
             if (parser->type == HTTP_REQUEST || http_should_keep_alive(parser)) {
@@ -1411,28 +2437,41 @@ size_t http_parser_execute (http_parser *parser,
           }
         }
 
+        PAUSE_CHECK();
         break;
       }
 
       case s_body_identity:
         to_read = MIN(pe - p, (int64_t)parser->content_length);
         if (to_read > 0) {
-          if (settings->on_body) settings->on_body(parser, p, to_read);
+          BODY_CALLBACK(p, to_read);
+          STAT_ADD(body_bytes, to_read);
           p += to_read - 1;
           parser->content_length -= to_read;
           if (parser->content_length == 0) {
             CALLBACK2(message_complete);
             state = NEW_MESSAGE();
           }
+          PAUSE_CHECK();
         }
         break;
 
       /* read until EOF */
       case s_body_identity_eof:
         to_read = pe - p;
+        if (limits && limits->max_body_size
+            && limit_pos + to_read > limits->max_body_size) {
+          /* stop at the first byte over the budget */
+          p += limits->max_body_size - limit_pos;
+          SET_ERRNO(HPE_BODY_OVERFLOW);
+          goto error;
+        }
+        limit_pos += to_read;
         if (to_read > 0) {
-          if (settings->on_body) settings->on_body(parser, p, to_read);
+          BODY_CALLBACK(p, to_read);
+          STAT_ADD(body_bytes, to_read);
           p += to_read - 1;
+          PAUSE_CHECK();
         }
         break;
 
@@ -1441,8 +2480,16 @@ size_t http_parser_execute (http_parser *parser,
         assert(parser->flags & F_CHUNKED);
 
         c = unhex[(unsigned char)ch];
-        if (c == -1) goto error;
+        if (c == -1) {
+          SET_ERRNO(HPE_INVALID_CHUNK_SIZE);
+          goto error;
+        }
         parser->content_length = c;
+        if (limits && limits->max_body_size
+            && limit_pos + parser->content_length > limits->max_body_size) {
+          SET_ERRNO(HPE_BODY_OVERFLOW);
+          goto error;
+        }
         state = s_chunk_size;
         break;
       }
@@ -1463,11 +2510,18 @@ size_t http_parser_execute (http_parser *parser,
             state = s_chunk_parameters;
             break;
           }
+          SET_ERRNO(HPE_INVALID_CHUNK_SIZE);
           goto error;
         }
 
         parser->content_length *= 16;
         parser->content_length += c;
+
+        if (limits && limits->max_body_size
+            && limit_pos + parser->content_length > limits->max_body_size) {
+          SET_ERRNO(HPE_BODY_OVERFLOW);
+          goto error;
+        }
         break;
       }
 
@@ -1488,9 +2542,19 @@ size_t http_parser_execute (http_parser *parser,
         STRICT_CHECK(ch != LF);
 
         if (parser->content_length == 0) {
+          BODY_FLUSH();
+          if (inplace && parser->dechunk) {
+            CALLBACK_DATA(body_span,
+                          coalesced_end - parser->body_decoded,
+                          parser->body_decoded);
+          }
           parser->flags |= F_TRAILING;
           state = s_header_field_start;
+          PAUSE_CHECK();
         } else {
+          STAT_ADD(chunks, 1);
+          limit_pos += parser->content_length;
+          parser->body_decoded += parser->content_length;
           state = s_chunk_data;
         }
         break;
@@ -1503,15 +2567,33 @@ size_t http_parser_execute (http_parser *parser,
         to_read = MIN(pe - p, (int64_t)(parser->content_length));
 
         if (to_read > 0) {
-          if (settings->on_body) settings->on_body(parser, p, to_read);
+          if (inplace) {
+            /* One move per chunk, over the framing since the last one.
+             * Dechunk mode keeps moving onto the body already decoded.
+             */
+            if (!coalesced) {
+              if (!parser->dechunk) coalesced_end = (char *) p;
+              coalesced = coalesced_end;
+            }
+            if (coalesced_end != p) memmove(coalesced_end, p, to_read);
+            coalesced_end += to_read;
+          } else {
+            BODY_CALLBACK(p, to_read);
+          }
+          STAT_ADD(body_bytes, to_read);
           p += to_read - 1;
         }
 
         if (to_read == parser->content_length) {
           state = s_chunk_data_almost_done;
+          if (settings->body_coalesce && coalesced
+              && (size_t) (coalesced_end - coalesced) >= settings->body_coalesce) {
+            BODY_FLUSH();
+          }
         }
 
         parser->content_length -= to_read;
+        PAUSE_CHECK();
         break;
       }
 
@@ -1529,30 +2611,341 @@ size_t http_parser_execute (http_parser *parser,
 
       default:
         assert(0 && "unhandled state");
+        SET_ERRNO(HPE_INVALID_INTERNAL_STATE);
         goto error;
     }
   }
 
-  CALLBACK_NOCLEAR(header_field);
-  CALLBACK_NOCLEAR(header_value);
-  CALLBACK_NOCLEAR(fragment);
-  CALLBACK_NOCLEAR(query_string);
-  CALLBACK_NOCLEAR(path);
-  CALLBACK_NOCLEAR(url);
+  BODY_FLUSH();
+
+  if (parser->retain) {
+    /* Keep the token in progress for the next call instead of handing out
+     * a piece of it. The url mark is always the oldest one.
+     */
+    const char *mark = NULL;
+
+    switch (state_mark[state]) {
+      case MARK_NONE:
+        break;
+      case MARK_HEADER_FIELD:
+        mark = sub_mark = header_field_mark;
+        break;
+      case MARK_HEADER_VALUE:
+        /* host_mark is the same, if set */
+        mark = sub_mark = header_value_mark ? header_value_mark : host_mark;
+        break;
+      case MARK_URL_PATH:
+        mark = url_mark;
+        sub_mark = path_mark;
+        break;
+      case MARK_URL_QUERY_STRING:
+        mark = url_mark;
+        sub_mark = query_string_mark;
+        break;
+      case MARK_URL_FRAGMENT:
+        mark = url_mark;
+        sub_mark = fragment_mark;
+        break;
+      case MARK_URL:
+        mark = sub_mark = url_mark;
+        break;
+    }
+
+    if (mark) {
+      parser->retained = pe - mark;
+      parser->retained_mark = sub_mark - mark;
+    }
+  } else {
+    switch (state_mark[state]) {
+      case MARK_NONE:
+        break;
+      case MARK_HEADER_FIELD:
+        CALLBACK_NOCLEAR(header_field);
+        break;
+      case MARK_HEADER_VALUE:
+        CALLBACK_NOCLEAR(header_value);
+        CALLBACK_NOCLEAR(host);
+        break;
+      case MARK_URL_PATH:
+        CALLBACK_NOCLEAR(path);
+        CALLBACK_NOCLEAR(url);
+        break;
+      case MARK_URL_QUERY_STRING:
+        CALLBACK_NOCLEAR(query_string);
+        CALLBACK_NOCLEAR(url);
+        break;
+      case MARK_URL_FRAGMENT:
+        CALLBACK_NOCLEAR(fragment);
+        CALLBACK_NOCLEAR(url);
+        break;
+      case MARK_URL:
+        CALLBACK_NOCLEAR(url);
+        break;
+    }
+  }
+
+  if (inplace && parser->dechunk && IN_CHUNKS(state)) {
+    parser->body_gap = p - coalesced_end;
+  }
 
   parser->state = state;
   parser->header_state = header_state;
   parser->index = index;
   parser->nread = nread;
+  parser->limit_pos = limit_pos;
 
-  return len;
+  TIMING(parser);
+  return (p - data);
 
 error:
+  STAT_ADD(errors[parser->http_errno], 1);
   parser->state = s_dead;
+#if HTTP_PARSER_TRACE
+  trace_error(parser, state, p - data, p < data + len ? *p : 0);
+#endif
   return (p - data);
 }
 
 
+size_t
+http_parser_execute (http_parser *parser,
+                     const http_parser_settings *settings,
+                     const char *data,
+                     size_t len)
+{
+#if HTTP_PARSER_TRACE
+  trace_start(parser, len);
+#endif
+  return execute(parser, settings, data, len, 0);
+}
+
+
+size_t
+http_parser_execute_inplace (http_parser *parser,
+                             const http_parser_settings *settings,
+                             char *data,
+                             size_t len)
+{
+#if HTTP_PARSER_TRACE
+  trace_start(parser, len);
+#endif
+  return execute(parser, settings, data, len, 1);
+}
+
+
+enum http_expect
+http_parser_expected_bytes (const http_parser *parser,
+                            const http_parser_settings *settings,
+                            uint64_t *n)
+{
+  const struct http_parser_limits *limits = settings ? settings->limits : NULL;
+  uint64_t max_head = limits && limits->max_head_size ? limits->max_head_size
+                                                      : HTTP_MAX_HEADER_SIZE;
+  enum http_expect expect;
+  uint64_t left = 0;
+  int64_t cl = parser->content_length;
+
+  switch (parser->state) {
+    case s_dead:
+      expect = HTTP_EXPECT_NONE;
+      break;
+
+    case s_body_identity:
+      expect = HTTP_EXPECT_BODY;
+      left = cl;
+      break;
+
+    case s_body_identity_eof:
+      expect = HTTP_EXPECT_EOF;
+      break;
+
+    /* The rest is the smallest chunked tail, e.g. for s_chunk_size with a
+     * size of 1a so far: "\r\n" 1a bytes "\r\n" "0\r\n\r\n".
+     */
+    case s_chunk_size_start:
+      expect = HTTP_EXPECT_CHUNK;
+      left = LAST_CHUNK_LEN;
+      break;
+
+    case s_chunk_size:
+    case s_chunk_parameters:
+      expect = HTTP_EXPECT_CHUNK;
+      left = cl == 0 ? 4 : 2 + cl + 2 + LAST_CHUNK_LEN;
+      break;
+
+    case s_chunk_size_almost_done:
+      expect = HTTP_EXPECT_CHUNK;
+      left = cl == 0 ? 3 : 1 + cl + 2 + LAST_CHUNK_LEN;
+      break;
+
+    case s_chunk_data:
+      expect = HTTP_EXPECT_CHUNK;
+      left = cl + 2 + LAST_CHUNK_LEN;
+      break;
+
+    case s_chunk_data_almost_done:
+      expect = HTTP_EXPECT_CHUNK;
+      left = 2 + LAST_CHUNK_LEN;
+      break;
+
+    case s_chunk_data_done:
+      expect = HTTP_EXPECT_CHUNK;
+      left = 1 + LAST_CHUNK_LEN;
+      break;
+
+    case s_start_req_or_res:
+    case s_start_req:
+    case s_start_res:
+      /* flags still belong to the previous message */
+      expect = HTTP_EXPECT_HEAD;
+      left = max_head;
+      break;
+
+    default:
+      if (parser->flags & F_TRAILING) {
+        /* trailers, at least the LF ending them */
+        expect = HTTP_EXPECT_CHUNK;
+        left = 1;
+      } else {
+        expect = HTTP_EXPECT_HEAD;
+        left = max_head - MIN(parser->nread, max_head);
+      }
+      break;
+  }
+
+  if (parser->upgrade) {
+    expect = HTTP_EXPECT_NONE;
+    left = 0;
+  }
+
+  if (n) *n = left;
+  return expect;
+}
+
+
+void
+http_parser_set_retain (http_parser *parser, int retain)
+{
+  parser->retain = retain ? 1 : 0;
+}
+
+
+void
+http_parser_set_route (http_parser *parser, int route)
+{
+  parser->route = route ? 1 : 0;
+}
+
+
+void
+http_parser_set_dechunk (http_parser *parser, int dechunk)
+{
+  parser->dechunk = dechunk ? 1 : 0;
+}
+
+
+void
+http_parser_pause (http_parser *parser, int paused)
+{
+  /* an error is not overwritten */
+  if (parser->http_errno == HPE_OK || parser->http_errno == HPE_PAUSED) {
+    SET_ERRNO(paused ? HPE_PAUSED : HPE_OK);
+  }
+}
+
+
+uint32_t
+http_parser_head_length (const http_parser *parser)
+{
+  return parser->nread;
+}
+
+
+size_t
+http_parser_retained (const http_parser *parser)
+{
+  return parser->retained;
+}
+
+
+/* Misuse of the API: nothing is parsed and the parser is dead, as after a
+ * parse error.
+ */
+static size_t
+invalid_argument (http_parser *parser)
+{
+#if HTTP_PARSER_STATS
+  struct http_parser_stats *stats = parser->stats;
+
+  STAT_ADD(errors[HPE_INVALID_ARGUMENT], 1);
+#endif
+  SET_ERRNO(HPE_INVALID_ARGUMENT);
+  parser->state = s_dead;
+  return 0;
+}
+
+
+size_t
+http_parser_execute_iov (http_parser *parser,
+                         const http_parser_settings *settings,
+                         const struct iovec *iov,
+                         int iovcnt)
+{
+  const char *base;
+  size_t len, nparsed, total = 0;
+  int i = 0;
+
+  /* retained bytes would have to be moved in front of the next segment */
+  if (parser->retain) return invalid_argument(parser);
+
+  while (i < iovcnt) {
+    base = (const char *) iov[i].iov_base;
+    len = iov[i].iov_len;
+
+    /* Merge segments which are adjacent in memory, callbacks get one
+     * contiguous piece for them.
+     */
+    for (i++; i < iovcnt && (const char *) iov[i].iov_base == base + len; i++) {
+      len += iov[i].iov_len;
+    }
+
+    /* zero length would mean EOF */
+    if (len == 0) continue;
+
+    nparsed = http_parser_execute(parser, settings, base, len);
+    total += nparsed;
+
+    if (nparsed != len || parser->upgrade) break;
+  }
+
+  return total;
+}
+
+
+size_t
+http_parser_execute_ring (http_parser *parser,
+                          const http_parser_settings *settings,
+                          const char *ring,
+                          size_t size,
+                          size_t start,
+                          size_t len)
+{
+  struct iovec iov[2];
+  size_t first;
+
+  if (start >= size || len > size) return invalid_argument(parser);
+
+  first = MIN(len, size - start);
+
+  iov[0].iov_base = (void *) (ring + start);
+  iov[0].iov_len = first;
+  iov[1].iov_base = (void *) ring;
+  iov[1].iov_len = len - first;
+
+  return http_parser_execute_iov(parser, settings, iov, 2);
+}
+
+
 int
 http_should_keep_alive (http_parser *parser)
 {
@@ -1574,19 +2967,396 @@ http_should_keep_alive (http_parser *parser)
 }
 
 
+int
+http_parser_expect_response (http_parser *parser, enum http_method method)
+{
+  enum pending_request request = PENDING_OTHER;
+
+  if (parser->npending >= HTTP_MAX_PENDING_REQUESTS) return -1;
+
+  if (method == HTTP_HEAD) request = PENDING_HEAD;
+  if (method == HTTP_CONNECT) request = PENDING_CONNECT;
+
+  parser->pending |= request << (2 * parser->npending);
+  parser->npending++;
+  return 0;
+}
+
+
+#define HTTP_STATS_MAP(XX)                                          \
+  XX(messages,   "Message heads parsed.")                           \
+  XX(head_bytes, "Bytes of request or status lines and headers.")   \
+  XX(body_bytes, "Bytes of body payload.")                          \
+  XX(headers,    "Header fields, including trailers.")              \
+  XX(chunks,     "Body chunks.")                                    \
+  XX(upgrades,   "Messages that switched protocols.")               \
+  XX(connects,   "CONNECT tunnels established.")
+
+
+void
+http_parser_stats_merge (struct http_parser_stats *total,
+                         const struct http_parser_stats *stats)
+{
+  int i;
+
+#define XX(name, help) total->name += STAT_LOAD(&stats->name);
+  HTTP_STATS_MAP(XX)
+#undef XX
+
+  for (i = 0; i < HTTP_ERRNO_MAX; i++) {
+    total->errors[i] += STAT_LOAD(&stats->errors[i]);
+  }
+}
+
+
+size_t
+http_parser_stats_format (const struct http_parser_stats *stats,
+                          char *buf,
+                          size_t len)
+{
+  size_t n = 0;
+  int i, r;
+
+#define PRINT(...)                                                   \
+do {                                                                 \
+  r = snprintf(buf + n, len - n, __VA_ARGS__);                       \
+  if (r < 0 || (size_t) r >= len - n) return 0;                      \
+  n += r;                                                            \
+} while (0)
+
+#define XX(name, help)                                               \
+  PRINT("# HELP http_parser_" #name "_total " help "\n"              \
+        "# TYPE http_parser_" #name "_total counter\n"               \
+        "http_parser_" #name "_total %llu\n",                        \
+        (unsigned long long) STAT_LOAD(&stats->name));
+  HTTP_STATS_MAP(XX)
+#undef XX
+
+  PRINT("# HELP http_parser_errors_total Errors by errno, callback "
+        "failures included.\n"
+        "# TYPE http_parser_errors_total counter\n");
+
+  /* HPE_PAUSED is not an error */
+  for (i = HPE_CB_message_begin; i < HPE_PAUSED; i++) {
+    PRINT("http_parser_errors_total{errno=\"%s\"} %llu\n",
+          http_errno_name(i),
+          (unsigned long long) STAT_LOAD(&stats->errors[i]));
+  }
+
+#undef PRINT
+
+  return n;
+}
+
+
+int
+http_trace_init (struct http_trace *trace,
+                 struct http_trace_event *events,
+                 uint32_t size,
+                 uint32_t sample)
+{
+  if (size < 2 || (size & (size - 1))) return -1;
+  if (sample == 0 || (sample & (sample - 1))) return -1;
+
+  trace->events = events;
+  trace->size = size;
+  trace->sample = sample;
+  trace->on_error = NULL;
+  trace->head = 0;
+  return 0;
+}
+
+
+void
+http_trace_attach (struct http_trace *trace)
+{
+#if HTTP_PARSER_TRACE
+  thread_trace = trace;
+  thread_countdown = trace ? 1 : 0;
+#else
+  (void) trace;
+#endif
+}
+
+
+size_t
+http_trace_read (const struct http_trace *trace,
+                 struct http_trace_event *out,
+                 size_t n)
+{
+  uint64_t head, first, oldest, i;
+  size_t skip;
+
+  /* the slot of the oldest event may be being refilled */
+  head = TRACE_HEAD_LOAD(&trace->head);
+  n = MIN(n, MIN(head, trace->size - 1));
+  first = head - n;
+
+  for (i = first; i < head; i++) {
+    out[i - first] = trace->events[i & (trace->size - 1)];
+  }
+
+  /* The writer may have lapped us meanwhile. It fills the slot of event
+   * 'head' - 'size' before it publishes 'head' + 1.
+   */
+  TRACE_FENCE();
+  head = TRACE_HEAD_LOAD(&trace->head);
+  oldest = head >= trace->size ? head - trace->size + 1 : 0;
+
+  if (first >= oldest) return n;
+
+  skip = MIN(oldest - first, n);
+  for (i = skip; i < n; i++) out[i - skip] = out[i];
+  return n - skip;
+}
+
+
+static const char *trace_type_names[] =
+  { "execute"
+  , "message_begin"
+  , "headers_complete"
+  , "message_complete"
+  , "callback"
+  , "error"
+  };
+
+
+#define TRACE_CB_NAME_GEN(n, s) #s,
+static const char *trace_callback_names[] = {
+  HTTP_TRACE_CALLBACK_MAP(TRACE_CB_NAME_GEN)
+};
+#undef TRACE_CB_NAME_GEN
+
+
+size_t
+http_trace_format (const struct http_trace_event *event,
+                   char *buf,
+                   size_t len)
+{
+  int r;
+  unsigned cb = event->arg >> 8;
+
+  if (event->type == HTTP_TRACE_CALLBACK && cb < ARRAY_SIZE(trace_callback_names)) {
+    r = snprintf(buf, len, "%llu callback state=%u offset=%u %s returned %d\n",
+                 (unsigned long long) event->time,
+                 event->state,
+                 event->offset,
+                 trace_callback_names[cb],
+                 (int8_t) (event->arg & 0xff));
+  } else if (event->type < ARRAY_SIZE(trace_type_names)) {
+    r = snprintf(buf, len, "%llu %s state=%u offset=%u arg=%u\n",
+                 (unsigned long long) event->time,
+                 trace_type_names[event->type],
+                 event->state,
+                 event->offset,
+                 event->arg);
+  } else {
+    r = snprintf(buf, len, "%llu unknown(%u)\n",
+                 (unsigned long long) event->time,
+                 event->type);
+  }
+
+  if (r < 0 || (size_t) r >= len) return 0;
+  return r;
+}
+
+
+static char *
+put16 (char *p, uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+
+static char *
+put32 (char *p, uint32_t v)
+{
+  p = put16(p, v & 0xffff);
+  return put16(p, v >> 16);
+}
+
+
+static char *
+put64 (char *p, uint64_t v)
+{
+  p = put32(p, v & 0xffffffff);
+  return put32(p, v >> 32);
+}
+
+
+static uint16_t
+get16 (const unsigned char *p)
+{
+  return p[0] | (uint16_t) p[1] << 8;
+}
+
+
+static uint32_t
+get32 (const unsigned char *p)
+{
+  return get16(p) | (uint32_t) get16(p + 2) << 16;
+}
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return get32(p) | (uint64_t) get32(p + 4) << 32;
+}
+
+
+size_t
+http_parser_snapshot (const http_parser *parser, char *buf, size_t len)
+{
+  char *p = buf;
+
+  if (len < HTTP_PARSER_SNAPSHOT_SIZE) return 0;
+
+  *p++ = HTTP_PARSER_SNAPSHOT_VERSION;
+  *p++ = parser->type;
+  *p++ = parser->flags;
+  *p++ = parser->state;
+  *p++ = parser->header_state;
+  *p++ = parser->index;
+  *p++ = parser->npending;
+  *p++ = parser->retain;
+  *p++ = parser->method;
+  *p++ = parser->hop_by_hop;
+  *p++ = parser->upgrade;
+  *p++ = parser->http_errno;
+  p = put16(p, parser->pending);
+  p = put16(p, parser->http_major);
+  p = put16(p, parser->http_minor);
+  p = put16(p, parser->status_code);
+  p = put32(p, parser->nread);
+  p = put32(p, parser->retained);
+  p = put32(p, parser->retained_mark);
+  p = put64(p, parser->content_length);
+  p = put16(p, parser->nheaders);
+  p = put32(p, parser->limit_pos);
+  *p++ = parser->route;
+  *p++ = parser->route_match;
+  *p++ = parser->dechunk;
+  p = put32(p, parser->body_gap);
+  p = put64(p, parser->body_decoded);
+
+  assert(p - buf == HTTP_PARSER_SNAPSHOT_SIZE);
+  return HTTP_PARSER_SNAPSHOT_SIZE;
+}
+
+
+int
+http_parser_restore (http_parser *parser, const char *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) buf;
+
+  if (len < HTTP_PARSER_SNAPSHOT_SIZE) return -1;
+  if (p[0] != HTTP_PARSER_SNAPSHOT_VERSION) return -1;
+
+  /* don't let a corrupt snapshot take the state machine anywhere */
+  if (p[1] > HTTP_BOTH
+      || p[2] >= 1 << 6
+      || p[3] < s_dead || p[3] > s_body_identity_eof
+      || p[4] > h_connection_trailer
+      || p[6] > HTTP_MAX_PENDING_REQUESTS
+      || p[11] >= HTTP_ERRNO_MAX
+      || get32(p + 24) < get32(p + 28))
+  {
+    return -1;
+  }
+
+  parser->type = p[1];
+  parser->flags = p[2];
+  parser->state = p[3];
+  parser->header_state = p[4];
+  parser->index = p[5];
+  parser->npending = p[6];
+  parser->retain = p[7];
+  parser->method = p[8];
+  parser->hop_by_hop = p[9];
+  parser->upgrade = p[10];
+  parser->http_errno = p[11];
+  parser->pending = get16(p + 12);
+  parser->http_major = get16(p + 14);
+  parser->http_minor = get16(p + 16);
+  parser->status_code = get16(p + 18);
+  parser->nread = get32(p + 20);
+  parser->retained = get32(p + 24);
+  parser->retained_mark = get32(p + 28);
+  parser->content_length = get64(p + 32);
+  parser->nheaders = get16(p + 40);
+  parser->limit_pos = get32(p + 42);
+  parser->route = p[46];
+  parser->route_match = p[47];
+  parser->dechunk = p[48];
+  parser->body_gap = get32(p + 49);
+  parser->body_decoded = get64(p + 53);
+
+  return 0;
+}
+
+
 const char * http_method_str (enum http_method m)
 {
   return method_strings[m];
 }
 
 
+/* Map errno values to strings for human-readable output */
+#define HTTP_STRERROR_GEN(n, s) { "HPE_" #n, s },
+static struct {
+  const char *name;
+  const char *description;
+} http_strerror_tab[] = {
+  HTTP_ERRNO_MAP(HTTP_STRERROR_GEN)
+};
+#undef HTTP_STRERROR_GEN
+
+
+const char *
+http_errno_name (enum http_errno err)
+{
+  assert(err < HTTP_ERRNO_MAX);
+  return http_strerror_tab[err].name;
+}
+
+
+const char *
+http_errno_description (enum http_errno err)
+{
+  assert(err < HTTP_ERRNO_MAX);
+  return http_strerror_tab[err].description;
+}
+
+
 void
 http_parser_init (http_parser *parser, enum http_parser_type t)
 {
   parser->type = t;
   parser->state = (t == HTTP_REQUEST ? s_start_req : (t == HTTP_RESPONSE ? s_start_res : s_start_req_or_res));
+  parser->header_state = h_general;
+  parser->index = 0;
   parser->nread = 0;
+  parser->stats = NULL;
+  parser->timing = NULL;
+  parser->key = NULL;
   parser->upgrade = 0;
   parser->flags = 0;
+  parser->hop_by_hop = 0;
+  parser->nheaders = 0;
+  parser->route = 0;
+  parser->route_match = 0;
+  parser->limit_pos = 0;
+  parser->dechunk = 0;
+  parser->body_gap = 0;
+  parser->body_decoded = 0;
+  parser->http_errno = HPE_OK;
   parser->method = 0;
+  parser->pending = 0;
+  parser->npending = 0;
+  parser->retain = 0;
+  parser->retained = 0;
+  parser->retained_mark = 0;
 }
@@ -42,6 +42,15 @@ typedef int ssize_t;
 #include <stdint.h>
 #endif
 
+#if defined(_WIN32)
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 /* Compile with -DHTTP_PARSER_STRICT=0 to make less checks, but run
  * faster
  */
@@ -55,6 +64,19 @@ typedef int ssize_t;
 /* Maximium header size allowed */
 #define HTTP_MAX_HEADER_SIZE (80*1024)
 
+/* Maximum number of requests http_parser_expect_response() can queue */
+#define HTTP_MAX_PENDING_REQUESTS 8
+
+
+/* What http_parser_expected_bytes() knows about the data to come */
+enum http_expect
+  { HTTP_EXPECT_HEAD   /* a head, at most n bytes before the size limit */
+  , HTTP_EXPECT_BODY   /* exactly n more bytes of body */
+  , HTTP_EXPECT_CHUNK  /* a chunked body, at least n more bytes */
+  , HTTP_EXPECT_EOF    /* body bytes until the connection is closed */
+  , HTTP_EXPECT_NONE   /* nothing, after an error or an upgrade */
+  };
+
 
 typedef struct http_parser http_parser;
 typedef struct http_parser_settings http_parser_settings;
@@ -67,7 +89,9 @@ typedef struct http_parser_settings http_parser_settings;
  * returning '1' from on_headers_complete will tell the parser that it
  * should not expect a body. This is used when receiving a response to a
  * HEAD request which may contain 'Content-Length' or 'Transfer-Encoding:
- * chunked' headers that indicate the presence of a body.
+ * chunked' headers that indicate the presence of a body. Clients that tell
+ * the parser about their requests with http_parser_expect_response() don't
+ * need to do this.
  *
  * http_data_cb does not return data chunks. It will be call arbitrarally
  * many times for each string. E.G. you might get 10 callbacks for "on_path"
@@ -107,6 +131,91 @@ enum http_method
 enum http_parser_type { HTTP_REQUEST, HTTP_RESPONSE, HTTP_BOTH };
 
 
+/* Why http_parser_execute() stopped early. Errors other than the callback
+ * ones leave the parser dead.
+ */
+#define HTTP_ERRNO_MAP(XX)                                           \
+  /* No error */                                                     \
+  XX(OK, "success")                                                  \
+                                                                     \
+  /* A callback returned non-zero */                                 \
+  XX(CB_message_begin, "the on_message_begin callback failed")       \
+  XX(CB_path, "the on_path callback failed")                         \
+  XX(CB_query_string, "the on_query_string callback failed")         \
+  XX(CB_url, "the on_url callback failed")                           \
+  XX(CB_fragment, "the on_fragment callback failed")                 \
+  XX(CB_header_field, "the on_header_field callback failed")         \
+  XX(CB_header_value, "the on_header_value callback failed")         \
+  XX(CB_headers_complete, "the on_headers_complete callback failed") \
+  XX(CB_message_complete, "the on_message_complete callback failed") \
+  XX(CB_host, "the on_host callback failed")                         \
+  XX(CB_body_span, "the on_body_span callback failed")               \
+                                                                     \
+  /* Parse errors */                                                 \
+  XX(INVALID_EOF_STATE, "stream ended at an unexpected time")        \
+  XX(HEADER_OVERFLOW,                                                \
+     "too many header bytes seen; overflow detected")                \
+  XX(URL_OVERFLOW, "URL longer than the limit")                      \
+  XX(HEADER_LINE_OVERFLOW, "header line longer than the limit")      \
+  XX(TOO_MANY_HEADERS, "more header fields than the limit")          \
+  XX(BODY_OVERFLOW, "body larger than the limit")                    \
+  XX(CLOSED_CONNECTION,                                              \
+     "data received after completed connection: close message")      \
+  XX(INVALID_VERSION, "invalid HTTP version")                        \
+  XX(INVALID_STATUS, "invalid HTTP status code")                     \
+  XX(INVALID_METHOD, "invalid HTTP method")                          \
+  XX(INVALID_URL, "invalid URL")                                     \
+  XX(INVALID_HOST, "invalid host")                                   \
+  XX(INVALID_PORT, "invalid port")                                   \
+  XX(INVALID_PATH, "invalid path")                                   \
+  XX(INVALID_QUERY_STRING, "invalid query string")                   \
+  XX(INVALID_FRAGMENT, "invalid fragment")                           \
+  XX(LF_EXPECTED, "LF character expected")                           \
+  XX(INVALID_HEADER_TOKEN, "invalid character in header")            \
+  XX(INVALID_CONTENT_LENGTH,                                         \
+     "invalid character in content-length header")                   \
+  XX(INVALID_CHUNK_SIZE,                                             \
+     "invalid character in chunk size header")                       \
+  XX(INVALID_CONSTANT, "invalid constant string")                    \
+  XX(INVALID_RETAINED, "retained bytes were not passed again")       \
+  XX(INVALID_ARGUMENT, "invalid argument")                           \
+  XX(INVALID_INTERNAL_STATE, "encountered unexpected internal state")\
+  XX(STRICT, "strict mode assertion failed")                         \
+  XX(UNKNOWN, "an unknown error occurred")                           \
+                                                                     \
+  /* Not an error, see http_parser_pause() */                        \
+  XX(PAUSED, "parser is paused")
+
+
+#define HTTP_ERRNO_GEN(n, s) HPE_##n,
+enum http_errno {
+  HTTP_ERRNO_MAP(HTTP_ERRNO_GEN)
+  HTTP_ERRNO_MAX
+};
+#undef HTTP_ERRNO_GEN
+
+
+/* Get an http_errno value from an http_parser */
+#define HTTP_PARSER_ERRNO(p) ((enum http_errno) (p)->http_errno)
+
+
+/* Hop-by-hop headers named by the tokens of a Connection (or
+ * Proxy-Connection) header. A proxy must remove these headers, and the
+ * Connection header itself, before forwarding the message. The 'close'
+ * token is only reflected by http_should_keep_alive().
+ */
+enum http_hop_by_hop
+  { HTTP_HOP_KEEP_ALIVE = 1 << 0
+  , HTTP_HOP_UPGRADE    = 1 << 1
+  , HTTP_HOP_TE         = 1 << 2
+  , HTTP_HOP_TRAILER    = 1 << 3
+  /* Some other token was listed. The Connection header value has to be
+   * inspected to find out which headers it names.
+   */
+  , HTTP_HOP_OTHER      = 1 << 4
+  };
+
+
 struct http_parser {
   /** PRIVATE **/
   unsigned char type : 2;
@@ -118,14 +227,51 @@ struct http_parser {
   uint32_t nread;
   int64_t content_length;
 
+  /* Requests waiting for their response, 2 bits each. See
+   * http_parser_expect_response().
+   */
+  uint16_t pending;
+  unsigned char npending;
+
+  /* See http_parser_set_retain() */
+  unsigned char retain;
+  uint32_t retained;
+  uint32_t retained_mark;
+
+  /* See struct http_parser_limits. 'limit_pos' is the value of 'nread'
+   * where the current URL or header line started while in the head, and
+   * the number of body bytes seen while in the body.
+   */
+  uint16_t nheaders;
+
+  /* See http_parser_set_route(). 'route_match' has a bit for every
+   * route header the current header field may still be.
+   */
+  unsigned char route;
+  unsigned char route_match;
+
+  uint32_t limit_pos;
+
+  /* See http_parser_set_dechunk(). 'body_gap' is the number of bytes
+   * between the end of the decoded body and the end of the last call's
+   * data, 'body_decoded' the length of the decoded body so far.
+   */
+  unsigned char dechunk;
+  uint32_t body_gap;
+  uint64_t body_decoded;
+
   /** READ-ONLY **/
   unsigned short http_major;
   unsigned short http_minor;
   unsigned short status_code; /* responses only */
   unsigned char method;    /* requests only */
+  unsigned char hop_by_hop; /* bitmask of enum http_hop_by_hop */
+  unsigned char http_errno; /* enum http_errno, see HTTP_PARSER_ERRNO() */
 
-  /* 1 = Upgrade header was present and the parser has exited because of that.
-   * 0 = No upgrade header present.
+  /* 1 = The connection switched protocols and the parser has exited because
+   *     of that: a request with an Upgrade header or a CONNECT request, a
+   *     101 response, or a 2xx response to an expected CONNECT request.
+   * 0 = No upgrade.
    * Should be checked when http_parser_execute() returns in addition to
    * error checking.
    */
@@ -133,6 +279,21 @@ struct http_parser {
 
   /** PUBLIC **/
   void *data; /* A pointer to get hook to the "connection" or "socket" object */
+
+  /* Counters to update, NULL for none. Only used when the library is
+   * built with HTTP_PARSER_STATS=1. See struct http_parser_stats.
+   */
+  struct http_parser_stats *stats;
+
+  /* Phase timestamps of the current message, NULL for none. Only used
+   * when the library is built with HTTP_PARSER_TIMING=1.
+   */
+  struct http_parser_timing *timing;
+
+  /* Cache key of the current message, NULL for none. See struct
+   * http_parser_key.
+   */
+  struct http_parser_key *key;
 };
 
 
@@ -147,7 +308,252 @@ struct http_parser_settings {
   http_cb      on_headers_complete;
   http_data_cb on_body;
   http_cb      on_message_complete;
+
+  /* Budgets for messages parsed with these settings, NULL for the
+   * defaults.
+   */
+  const struct http_parser_limits *limits;
+
+  /* The value of a Host header, in any mode. Called like on_header_value
+   * and right after it, with the same data.
+   */
+  http_data_cb on_host;
+
+  /* NULL terminated list of at most HTTP_MAX_ROUTE_HEADERS lowercase
+   * header names the application routes on: the only headers reported in
+   * route mode, see http_parser_set_route(), and the ones hashed into the
+   * cache key, see struct http_parser_key.
+   */
+  const char * const *route_headers;
+
+  /* http_parser_execute_inplace() only: chunk payload is held back until
+   * at least this many bytes are together, the body ends or the call
+   * returns. 0 holds it back for the whole call.
+   */
+  size_t body_coalesce;
+
+  /* Dechunk mode only: the whole decoded body of a chunked message, in
+   * place, right after its last chunk and before any trailers. See
+   * http_parser_set_dechunk().
+   */
+  http_data_cb on_body_span;
+};
+
+
+#define HTTP_MAX_ROUTE_HEADERS 8
+
+
+/* Per-message budgets, checked as the bytes arrive: a message is rejected
+ * at the first byte over a limit, with the errno given. 0 means the
+ * default for max_head_size and no limit for the others.
+ */
+struct http_parser_limits {
+  /* Request or status line and headers, HPE_HEADER_OVERFLOW. The default
+   * is HTTP_MAX_HEADER_SIZE.
+   */
+  uint32_t max_head_size;
+
+  /* The request URL, HPE_URL_OVERFLOW */
+  uint32_t max_url_size;
+
+  /* One header line without its CRLF, HPE_HEADER_LINE_OVERFLOW */
+  uint32_t max_header_size;
+
+  /* Header fields, including trailers, HPE_TOO_MANY_HEADERS */
+  uint32_t max_headers;
+
+  /* Body payload, without chunk framing, HPE_BODY_OVERFLOW. A bigger
+   * Content-Length is rejected as soon as the head is complete.
+   */
+  uint32_t max_body_size;
+};
+
+
+/* Counters updated by http_parser_execute() as it goes through the
+ * message, when built with HTTP_PARSER_STATS=1. Point the 'stats' field
+ * of any number of parsers at one of these.
+ *
+ * Each counter has a single writer: all parsers sharing a struct must be
+ * used from the same thread. Counters are stored with relaxed atomics so
+ * other threads can read them at any time without a lock, normally with
+ * http_parser_stats_merge() into a total per scrape.
+ */
+struct http_parser_stats {
+  uint64_t messages;    /* message heads parsed */
+  uint64_t head_bytes;  /* bytes of request/status line and headers */
+  uint64_t body_bytes;  /* body payload, without chunk framing */
+  uint64_t headers;     /* header fields, including trailers */
+  uint64_t chunks;      /* body chunks, without the last one */
+  uint64_t upgrades;    /* messages that switched protocols... */
+  uint64_t connects;    /* ...of which CONNECT tunnels */
+  uint64_t errors[HTTP_ERRNO_MAX]; /* by enum http_errno, except PAUSED */
+};
+
+
+/* Adds the counters in 'stats', possibly still being updated by another
+ * thread, to 'total'.
+ */
+void http_parser_stats_merge(struct http_parser_stats *total,
+                             const struct http_parser_stats *stats);
+
+
+/* Renders the counters in the Prometheus text exposition format into
+ * 'buf'. Returns the length written, without the terminating '\0', or 0
+ * if it does not fit into 'len' bytes.
+ */
+size_t http_parser_stats_format(const struct http_parser_stats *stats,
+                                char *buf,
+                                size_t len);
+
+
+enum http_trace_type
+  { HTTP_TRACE_EXECUTE = 0      /* a call, 'offset' is the length passed */
+  , HTTP_TRACE_MESSAGE_BEGIN
+  , HTTP_TRACE_HEADERS_COMPLETE /* 'arg' is the method or status code */
+  , HTTP_TRACE_MESSAGE_COMPLETE
+  , HTTP_TRACE_CALLBACK         /* a callback returned non-zero, see below */
+  , HTTP_TRACE_ERROR            /* 'arg' is the offending byte */
+  };
+
+
+/* Callbacks identified in HTTP_TRACE_CALLBACK events */
+#define HTTP_TRACE_CALLBACK_MAP(XX)                                  \
+  XX(MESSAGE_BEGIN, message_begin)                                   \
+  XX(PATH, path)                                                     \
+  XX(QUERY_STRING, query_string)                                     \
+  XX(URL, url)                                                       \
+  XX(FRAGMENT, fragment)                                             \
+  XX(HEADER_FIELD, header_field)                                     \
+  XX(HEADER_VALUE, header_value)                                     \
+  XX(HEADERS_COMPLETE, headers_complete)                             \
+  XX(MESSAGE_COMPLETE, message_complete)                             \
+  XX(HOST, host)                                                     \
+  XX(BODY_SPAN, body_span)                                           \
+
+#define HTTP_TRACE_CB_GEN(n, s) HTTP_TRACE_CB_##n,
+enum http_trace_callback {
+  HTTP_TRACE_CALLBACK_MAP(HTTP_TRACE_CB_GEN)
+  HTTP_TRACE_CB_MAX
 };
+#undef HTTP_TRACE_CB_GEN
+
+
+/* One entry of the trace ring. 'offset' is relative to the data passed to
+ * the call the event happened in, 'state' the parser state at that point.
+ * For HTTP_TRACE_CALLBACK, 'arg' is the enum http_trace_callback in the
+ * high byte and the return code, cast to int8_t, in the low byte.
+ */
+struct http_trace_event {
+  uint64_t time;   /* TSC ticks on x86, CLOCK_MONOTONIC ns elsewhere */
+  uint32_t offset;
+  uint16_t arg;
+  unsigned char type;
+  unsigned char state;
+};
+
+
+/* A ring of the most recent parser events of one thread, recorded when the
+ * library is built with HTTP_PARSER_TRACE=1. Only one call in 'sample' is
+ * traced; errors are always recorded.
+ *
+ * The ring has a single writer, the thread it is attached to. Any thread
+ * may read it at any time with http_trace_read().
+ */
+struct http_trace {
+  struct http_trace_event *events;
+  uint32_t size;    /* number of slots, a power of 2 greater than 1 */
+  uint32_t sample;  /* a power of 2, 1 traces every call */
+
+  /* Called after an error has been recorded, may be NULL. */
+  void (*on_error)(struct http_trace *trace, const http_parser *parser);
+
+  /** PRIVATE **/
+  uint64_t head;
+};
+
+
+/* Sets up 'trace' to record into 'events'. Returns -1 if 'size' or
+ * 'sample' is not a power of 2.
+ */
+int http_trace_init(struct http_trace *trace,
+                    struct http_trace_event *events,
+                    uint32_t size,
+                    uint32_t sample);
+
+
+/* Makes all parsers running on the calling thread record into 'trace',
+ * NULL stops tracing. No-op unless built with HTTP_PARSER_TRACE=1.
+ */
+void http_trace_attach(struct http_trace *trace);
+
+
+/* Copies the newest events, up to 'n' and at most 'size' - 1, into 'out',
+ * oldest first. Events overwritten while copying are left out. Returns
+ * the number copied.
+ */
+size_t http_trace_read(const struct http_trace *trace,
+                       struct http_trace_event *out,
+                       size_t n);
+
+
+/* Renders one event as a line of text, with the '\n'. Returns the length
+ * written without the terminating '\0', or 0 if it does not fit.
+ */
+size_t http_trace_format(const struct http_trace_event *event,
+                         char *buf,
+                         size_t len);
+
+
+/* Phase boundaries of the message being parsed, recorded when the library
+ * is built with HTTP_PARSER_TIMING=1 and the parser's 'timing' field
+ * points here. All values are final when on_message_complete is called.
+ *
+ * Timestamps come from 'clock' if set, http_parser_clock() is a cheap
+ * one. Otherwise the caller stores the current time in 'now' before each
+ * call to http_parser_execute(); boundaries then have the resolution of a
+ * call, and time in callbacks and in the parser is not measured.
+ */
+struct http_parser_timing {
+  uint64_t (*clock)(void);
+  uint64_t now;
+
+  uint64_t begin;             /* first byte of the message */
+  uint64_t headers_complete;  /* last byte of the head */
+  uint64_t message_complete;  /* last byte of the body */
+
+  /* Time spent inside callbacks and inside the parser itself while the
+   * message was parsed, excluding on_message_complete.
+   */
+  uint64_t in_callbacks;
+  uint64_t in_parser;
+
+  /** PRIVATE **/
+  uint64_t last;
+};
+
+
+/* A 64 bit hash of the method, the URL, the Host value and the values of
+ * settings->route_headers, updated as the bytes are scanned when the
+ * parser's 'key' field points here. 'hash' is final in
+ * on_headers_complete, so a cache lookup needs no copy of the request.
+ *
+ * Header values are hashed as they appear, in the order they arrive.
+ * The hash is the same however the message is split across calls; it is
+ * not meant to resist collisions chosen by an attacker who knows 'seed'.
+ */
+struct http_parser_key {
+  uint64_t seed;
+  uint64_t hash;
+
+  /** PRIVATE **/
+  uint64_t acc;
+  uint64_t word;
+  unsigned char nbytes;
+};
+
+
+/* TSC ticks on x86, CLOCK_MONOTONIC nanoseconds elsewhere. */
+uint64_t http_parser_clock(void);
 
 
 void http_parser_init(http_parser *parser, enum http_parser_type type);
@@ -159,6 +565,176 @@ size_t http_parser_execute(http_parser *parser,
                            size_t len);
 
 
+/* By default the parser flushes partially received tokens (URL, header
+ * fields and values) through their data callbacks at the end of each call
+ * to http_parser_execute(). Afterwards no callback will refer to the data
+ * passed in again, the whole buffer can be reused.
+ *
+ * In retain mode a token is only handed out when it is complete, in one
+ * piece. At the end of a call the bytes of an incomplete token are left to
+ * the caller: http_parser_retained() tells how many bytes at the end of the
+ * buffer that are. The caller must pass them again, unchanged, at the
+ * start of the buffer for the next call, followed by new data. Everything
+ * before them can be discarded. This allows a small receive buffer to be
+ * compacted instead of keeping whole buffers alive until the head is
+ * complete.
+ *
+ * Retain mode needs contiguous data and can't be combined with
+ * http_parser_execute_iov() or http_parser_execute_ring().
+ */
+void http_parser_set_retain(http_parser *parser, int retain);
+
+
+/* Tells the I/O layer how much data the parser is waiting for, to size
+ * reads and choose between copying and splice(). Stores the byte count
+ * described by the returned enum http_expect into 'n' (may be NULL).
+ * 'settings' are those passed to http_parser_execute(), for the head
+ * limit. NULL means the default limit.
+ *
+ * For a chunked body 'n' counts the rest of the current chunk, its CRLF and
+ * the shortest possible last chunk. The rest of the chunk payload alone is
+ * 'n' - 7 while the payload is being read.
+ */
+enum http_expect http_parser_expected_bytes(const http_parser *parser,
+                                            const http_parser_settings *settings,
+                                            uint64_t *n);
+
+
+/* Route mode is for proxies and load balancers that pick a backend from
+ * the method, the URL and the Host header and forward the message as it
+ * is. Header fields are matched as they arrive against Host, the headers
+ * that frame the message and settings->route_headers. Any other header is
+ * skipped with a scan for the end of its line: no callbacks, and its
+ * field and value are not validated.
+ *
+ * on_header_field is called only for route headers, in one piece and with
+ * the name as given in route_headers, followed by on_header_value as
+ * usual. on_host works as in normal mode. Framing headers are interpreted
+ * but not reported unless they are route headers.
+ */
+void http_parser_set_route(http_parser *parser, int route);
+
+
+/* Length of the message head, including the request or status line,
+ * the blank line ending it and any empty lines before it. Only valid in
+ * on_headers_complete.
+ */
+uint32_t http_parser_head_length(const http_parser *parser);
+
+
+/* Number of bytes at the end of the last buffer a callback may still refer
+ * to. Always 0 when not in retain mode. After http_parser_execute()
+ * returned 'nparsed', the lowest offset still in use is
+ * nparsed - http_parser_retained(parser).
+ */
+size_t http_parser_retained(const http_parser *parser);
+
+
+/* Version of the format written by http_parser_snapshot(). A parser can
+ * only be restored by a build with the same version.
+ */
+#define HTTP_PARSER_SNAPSHOT_VERSION 6
+
+/* Size of a snapshot in bytes */
+#define HTTP_PARSER_SNAPSHOT_SIZE 61
+
+
+/* Serializes the parser into 'buf' so it can continue on another thread,
+ * in another process or on another machine with http_parser_restore().
+ * Everything needed to continue mid-message is captured: the state
+ * machine, the remaining body or chunk length, pending requests and the
+ * READ-ONLY fields. The 'data', 'stats', 'timing' and 'key' pointers are
+ * not.
+ *
+ * The format is a fixed sequence of little-endian integers starting with
+ * HTTP_PARSER_SNAPSHOT_VERSION. Returns the number of bytes written,
+ * HTTP_PARSER_SNAPSHOT_SIZE, or 0 if 'len' is too small.
+ *
+ * In retain mode the http_parser_retained() bytes belong to the state and
+ * must be moved along with the snapshot.
+ */
+size_t http_parser_snapshot(const http_parser *parser, char *buf, size_t len);
+
+
+/* Restores a parser from a snapshot. 'data', 'stats', 'timing' and 'key'
+ * are left alone. Returns 0 on success, -1 if the snapshot is truncated, of
+ * another version or inconsistent; the parser is not changed then.
+ */
+int http_parser_restore(http_parser *parser, const char *buf, size_t len);
+
+
+/* Same as http_parser_execute() for data spread over several buffers, as
+ * readv() or pooled receive buffers leave it. Segments which happen to be
+ * adjacent in memory are parsed as one. Otherwise data callbacks are split
+ * at segment boundaries, just as they are split between two calls to
+ * http_parser_execute().
+ *
+ * Returns the number of bytes parsed over all segments. Empty segments are
+ * skipped; to signal EOF call http_parser_execute() with a length of 0.
+ * In retain mode nothing is parsed and the error is HPE_INVALID_ARGUMENT.
+ */
+size_t http_parser_execute_iov(http_parser *parser,
+                               const http_parser_settings *settings,
+                               const struct iovec *iov,
+                               int iovcnt);
+
+
+/* Same as http_parser_execute() for a buffer the parser may write to.
+ * Chunk payloads are moved down over the chunk-size lines and CRLFs that
+ * separate them, one memmove() per chunk, so consecutive chunks can be
+ * delivered by a single on_body call; see settings->body_coalesce. Body
+ * held back this way is lost when the parser stops on an error. The
+ * bytes between the delivered body and the next ones parsed are garbage
+ * afterwards.
+ */
+size_t http_parser_execute_inplace(http_parser *parser,
+                                   const http_parser_settings *settings,
+                                   char *data,
+                                   size_t len);
+
+
+/* Dechunk mode is for http_parser_execute_inplace() on a buffer that
+ * collects a whole message: the data of each call must directly follow
+ * the data of the previous one in memory. Chunk payloads are then moved
+ * down over all the framing since the head, so the decoded body of a
+ * chunked message ends up in one piece right after the head, however the
+ * message was split between calls. settings->on_body_span is called with
+ * that piece once the last chunk is parsed. on_body is called as usual,
+ * with pieces already at their final place.
+ *
+ * Nothing is allocated and each chunk is moved once. The buffer may only
+ * be moved or reused when the parser is between messages.
+ */
+void http_parser_set_dechunk(http_parser *parser, int dechunk);
+
+
+/* Called from on_headers_complete, on_body, on_body_span or
+ * on_message_complete, stops http_parser_execute() right after the bytes
+ * given to the callback, for backpressure. The execute call returns the
+ * number of bytes parsed and HTTP_PARSER_ERRNO() is HPE_PAUSED. Further
+ * calls parse nothing until the parser is resumed with 'paused' 0; then
+ * the rest of the data is passed again.
+ *
+ * Body held back by http_parser_execute_inplace() is still delivered
+ * before it returns.
+ */
+void http_parser_pause(http_parser *parser, int paused);
+
+
+/* Parses 'len' bytes of a ring buffer of 'size' bytes starting at offset
+ * 'start', wrapping around to the beginning of 'ring' when the end is
+ * reached. Nothing is copied. Returns the number of bytes parsed. A
+ * 'start' outside the ring, a 'len' over 'size' or retain mode is an
+ * HPE_INVALID_ARGUMENT error.
+ */
+size_t http_parser_execute_ring(http_parser *parser,
+                                const http_parser_settings *settings,
+                                const char *ring,
+                                size_t size,
+                                size_t start,
+                                size_t len);
+
+
 /* If http_should_keep_alive() in the on_headers_complete or
  * on_message_complete callback returns true, then this will be should be
  * the last message on the connection.
@@ -167,9 +743,26 @@ size_t http_parser_execute(http_parser *parser,
  */
 int http_should_keep_alive(http_parser *parser);
 
+/* For HTTP_RESPONSE parsers: call once for every request sent on the
+ * connection, in order. The parser takes the method into account when it
+ * frames the matching response, so the response to a HEAD request has no
+ * body and a 2xx response to CONNECT sets parser->upgrade. Without this,
+ * responses are framed from their status code and headers alone.
+ *
+ * Returns 0, or -1 if HTTP_MAX_PENDING_REQUESTS requests are already
+ * waiting for their responses.
+ */
+int http_parser_expect_response(http_parser *parser, enum http_method method);
+
 /* Returns a string version of the HTTP method. */
 const char *http_method_str(enum http_method);
 
+/* Return a string name of the given error */
+const char *http_errno_name(enum http_errno err);
+
+/* Return a string description of the given error */
+const char *http_errno_description(enum http_errno err);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,325 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <http_pipeline.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+static uint64_t
+now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+int
+http_pool_init (struct http_pool *pool,
+                size_t size,
+                unsigned int count,
+                unsigned int low)
+{
+  unsigned int i;
+
+  memset(pool, 0, sizeof *pool);
+  pool->mem = malloc(size * count);
+  pool->stack = malloc(count * sizeof *pool->stack);
+  if (!pool->mem || !pool->stack) {
+    http_pool_free(pool);
+    return -1;
+  }
+
+  pool->size = size;
+  pool->count = count;
+  pool->low = low;
+  for (i = 0; i < count; i++) {
+    pool->stack[i] = pool->mem + (count - 1 - i) * size;
+  }
+  pool->nfree = count;
+  return 0;
+}
+
+
+void
+http_pool_free (struct http_pool *pool)
+{
+  free(pool->mem);
+  free(pool->stack);
+  pool->mem = NULL;
+  pool->stack = NULL;
+  pool->nfree = pool->count = 0;
+}
+
+
+char *
+http_pool_get (struct http_pool *pool)
+{
+  return pool->nfree ? pool->stack[--pool->nfree] : NULL;
+}
+
+
+void
+http_pool_put (struct http_pool *pool, char *buf)
+{
+  assert(buf >= pool->mem && buf < pool->mem + pool->size * pool->count);
+  assert(pool->nfree < pool->count);
+  pool->stack[pool->nfree++] = buf;
+}
+
+
+void
+http_pipeline_init (struct http_pipeline *pipeline, struct http_pool *pool)
+{
+  memset(pipeline, 0, sizeof *pipeline);
+  pipeline->pool = pool;
+}
+
+
+void
+http_pipeline_add (struct http_pipeline *pipeline, struct http_stage *stage)
+{
+  memset(&stage->stats, 0, sizeof stage->stats);
+  stage->pipeline = pipeline;
+  stage->next = NULL;
+  if (pipeline->last) {
+    pipeline->last->next = stage;
+  } else {
+    pipeline->first = stage;
+  }
+  pipeline->last = stage;
+}
+
+
+static int
+deliver (struct http_stage *stage, const char *at, size_t len)
+{
+  int rc;
+
+  stage->stats.calls++;
+  stage->stats.bytes_in += len;
+  if (!stage->on_body) return http_stage_emit(stage, at, len);
+
+  if (!stage->pipeline->timed) return stage->on_body(stage, at, len);
+
+  stage->since = now();
+  rc = stage->on_body(stage, at, len);
+  stage->stats.ns += now() - stage->since;
+  return rc;
+}
+
+
+int
+http_stage_emit (struct http_stage *stage, const char *at, size_t len)
+{
+  int timed = stage->pipeline->timed && stage->on_body;
+  int rc;
+
+  stage->stats.bytes_out += len;
+  if (!stage->next || len == 0) return 0;
+
+  /* the next stage's time is its own */
+  if (timed) stage->stats.ns += now() - stage->since;
+  rc = deliver(stage->next, at, len);
+  if (timed) stage->since = now();
+  return rc;
+}
+
+
+void
+http_pipeline_pause (struct http_pipeline *pipeline)
+{
+  if (pipeline->parser) http_parser_pause(pipeline->parser, 1);
+}
+
+
+void
+http_pipeline_resume (struct http_pipeline *pipeline)
+{
+  if (pipeline->parser) http_parser_pause(pipeline->parser, 0);
+}
+
+
+static int
+fail (struct http_pipeline *pipeline)
+{
+  pipeline->failed = 1;
+  return -1;
+}
+
+
+int
+http_pipeline_message_begin (struct http_pipeline *pipeline,
+                             http_parser *parser)
+{
+  struct http_stage *s;
+
+  pipeline->parser = parser;
+  pipeline->failed = 0;
+  for (s = pipeline->first; s; s = s->next) {
+    if (s->on_message_begin && s->on_message_begin(s) != 0) {
+      return fail(pipeline);
+    }
+  }
+  return 0;
+}
+
+
+int
+http_pipeline_header_field (struct http_pipeline *pipeline,
+                            const char *at,
+                            size_t len)
+{
+  struct http_stage *s;
+
+  for (s = pipeline->first; s; s = s->next) {
+    if (s->on_header_field && s->on_header_field(s, at, len) != 0) {
+      return fail(pipeline);
+    }
+  }
+  return 0;
+}
+
+
+int
+http_pipeline_header_value (struct http_pipeline *pipeline,
+                            const char *at,
+                            size_t len)
+{
+  struct http_stage *s;
+
+  for (s = pipeline->first; s; s = s->next) {
+    if (s->on_header_value && s->on_header_value(s, at, len) != 0) {
+      return fail(pipeline);
+    }
+  }
+  return 0;
+}
+
+
+int
+http_pipeline_headers_complete (struct http_pipeline *pipeline)
+{
+  struct http_stage *s;
+
+  for (s = pipeline->first; s; s = s->next) {
+    if (s->on_headers_complete
+        && s->on_headers_complete(s, pipeline->parser) != 0) {
+      return fail(pipeline);
+    }
+  }
+  return 0;
+}
+
+
+int
+http_pipeline_body (struct http_pipeline *pipeline,
+                    const char *at,
+                    size_t len)
+{
+  struct http_pool *pool = pipeline->pool;
+
+  if (pipeline->failed) return -1;
+  if (pipeline->first && deliver(pipeline->first, at, len) != 0) {
+    return fail(pipeline);
+  }
+  if (pool && pool->nfree < pool->low) http_pipeline_pause(pipeline);
+  return 0;
+}
+
+
+int
+http_pipeline_message_complete (struct http_pipeline *pipeline)
+{
+  struct http_stage *s;
+  int rc;
+
+  if (pipeline->failed) return -1;
+
+  for (s = pipeline->first; s; s = s->next) {
+    if (!s->on_message_complete) continue;
+
+    if (pipeline->timed && s->on_body) {
+      s->since = now();
+      rc = s->on_message_complete(s);
+      s->stats.ns += now() - s->since;
+    } else {
+      rc = s->on_message_complete(s);
+    }
+    if (rc != 0) return fail(pipeline);
+  }
+  return 0;
+}
+
+
+static int
+pipeline_message_begin_cb (http_parser *p)
+{
+  return http_pipeline_message_begin(p->data, p);
+}
+
+
+static int
+pipeline_header_field_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_pipeline_header_field(p->data, at, len);
+}
+
+
+static int
+pipeline_header_value_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_pipeline_header_value(p->data, at, len);
+}
+
+
+static int
+pipeline_headers_complete_cb (http_parser *p)
+{
+  return http_pipeline_headers_complete(p->data);
+}
+
+
+static int
+pipeline_body_cb (http_parser *p, const char *at, size_t len)
+{
+  return http_pipeline_body(p->data, at, len);
+}
+
+
+static int
+pipeline_message_complete_cb (http_parser *p)
+{
+  return http_pipeline_message_complete(p->data);
+}
+
+
+const http_parser_settings http_pipeline_settings =
+  { .on_message_begin = pipeline_message_begin_cb
+  , .on_header_field = pipeline_header_field_cb
+  , .on_header_value = pipeline_header_value_cb
+  , .on_headers_complete = pipeline_headers_complete_cb
+  , .on_body = pipeline_body_cb
+  , .on_message_complete = pipeline_message_complete_cb
+  };
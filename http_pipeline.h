@@ -0,0 +1,198 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef http_pipeline_h
+#define http_pipeline_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <http_parser.h>
+
+
+/* A chain of stages the body of each message passes through: decoding,
+ * hashing, scanning, spilling, forwarding. The parser removes the chunked
+ * framing, the first stage gets the body as on_body delivers it and each
+ * stage hands its output to the next with http_stage_emit(). Spans are
+ * borrowed: they are only valid during the call, nothing is copied on the
+ * way. A stage that has to keep bytes past the call copies them once,
+ * into a buffer of the pipeline's pool.
+ *
+ * Backpressure goes back to the parser: a stage that can not take more
+ * calls http_pipeline_pause(), and so does the pipeline itself when the
+ * pool runs low. http_parser_execute() then returns early with
+ * HPE_PAUSED, see http_parser_pause(), and the connection stops reading
+ * until http_pipeline_resume().
+ */
+struct http_pipeline;
+struct http_stage;
+
+
+/* Fixed size buffers for the stages to keep data in, allocated up front.
+ * Not thread safe; give each connection or each core its own.
+ */
+struct http_pool {
+  /** READ-ONLY **/
+  size_t size;    /* of each buffer */
+  unsigned int count;
+  unsigned int nfree;
+
+  /* The pipeline pauses the parser when fewer buffers are free */
+  unsigned int low;
+
+  /** PRIVATE **/
+  char *mem;
+  char **stack;  /* the free buffers */
+};
+
+
+/* Allocates 'count' buffers of 'size' bytes. The pipeline pauses once
+ * fewer than 'low' are free. Returns -1 if out of memory.
+ */
+int http_pool_init(struct http_pool *pool,
+                   size_t size,
+                   unsigned int count,
+                   unsigned int low);
+
+void http_pool_free(struct http_pool *pool);
+
+/* Returns a buffer of pool->size bytes, or NULL if none is free */
+char *http_pool_get(struct http_pool *pool);
+
+void http_pool_put(struct http_pool *pool, char *buf);
+
+
+/* Counters of a stage. 'ns' is the time spent in the stage itself, not in
+ * the stages after it; it is only kept when the pipeline is timed.
+ */
+struct http_stage_stats {
+  uint64_t calls;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t ns;
+};
+
+
+/* The callbacks mirror those of http_parser_settings and any of them may
+ * be NULL. A stage without on_body passes the body on unchanged. Return
+ * 0, or -1 to fail the message: the rest of the body is skipped and
+ * on_message_complete fails.
+ */
+struct http_stage {
+  /** PUBLIC **/
+  void *data;
+  const char *name;
+
+  int (*on_message_begin)(struct http_stage *);
+  int (*on_header_field)(struct http_stage *, const char *at, size_t len);
+  int (*on_header_value)(struct http_stage *, const char *at, size_t len);
+  int (*on_headers_complete)(struct http_stage *, const http_parser *);
+  int (*on_body)(struct http_stage *, const char *at, size_t len);
+
+  /* The body is complete; called in order, after the stage before has
+   * emitted what it held back.
+   */
+  int (*on_message_complete)(struct http_stage *);
+
+  /** READ-ONLY **/
+  struct http_stage_stats stats;
+  struct http_pipeline *pipeline;
+
+  /** PRIVATE **/
+  struct http_stage *next;
+  uint64_t since;  /* when the stage got control back, when timed */
+};
+
+
+struct http_pipeline {
+  /** PUBLIC **/
+  void *data;
+
+  /* Keep the 'ns' counters of the stages, at two clock reads per span
+   * and stage.
+   */
+  int timed;
+
+  /** READ-ONLY **/
+  struct http_pool *pool;
+  int failed;
+
+  /** PRIVATE **/
+  http_parser *parser;
+  struct http_stage *first;
+  struct http_stage *last;
+};
+
+
+/* 'pool' may be NULL if no stage keeps data */
+void http_pipeline_init(struct http_pipeline *pipeline, struct http_pool *pool);
+
+/* Appends 'stage' to the chain. Its counters are cleared. */
+void http_pipeline_add(struct http_pipeline *pipeline,
+                       struct http_stage *stage);
+
+
+/* Passes 'len' bytes to the stage after 'stage'. Called from the stage's
+ * on_body or on_message_complete. Returns what the next stage returned.
+ */
+int http_stage_emit(struct http_stage *stage, const char *at, size_t len);
+
+
+/* Stops the parser after the current span, for backpressure */
+void http_pipeline_pause(struct http_pipeline *pipeline);
+
+/* Lets the parser go on. The bytes http_parser_execute() did not parse
+ * have to be passed again.
+ */
+void http_pipeline_resume(struct http_pipeline *pipeline);
+
+
+/* These are fed from the parser callbacks of the same name and return
+ * what those should return.
+ */
+int http_pipeline_message_begin(struct http_pipeline *pipeline,
+                                http_parser *parser);
+
+int http_pipeline_header_field(struct http_pipeline *pipeline,
+                               const char *at,
+                               size_t len);
+
+int http_pipeline_header_value(struct http_pipeline *pipeline,
+                               const char *at,
+                               size_t len);
+
+int http_pipeline_headers_complete(struct http_pipeline *pipeline);
+
+int http_pipeline_body(struct http_pipeline *pipeline,
+                       const char *at,
+                       size_t len);
+
+int http_pipeline_message_complete(struct http_pipeline *pipeline);
+
+
+/* Callbacks feeding the pipeline in the parser's 'data' field */
+extern const http_parser_settings http_pipeline_settings;
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,406 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <http_writer.h>
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+
+#define CRLF "\r\n"
+#define LAST_CHUNK "0\r\n"
+#define LAST_CHUNK_NO_TRAILERS "0\r\n\r\n"
+
+
+static const char hex[] = "0123456789abcdef";
+
+
+#define HTTP_STATUS_MAP(XX)                                          \
+  XX(100, "Continue")                                                \
+  XX(101, "Switching Protocols")                                     \
+  XX(200, "OK")                                                      \
+  XX(201, "Created")                                                 \
+  XX(202, "Accepted")                                                \
+  XX(203, "Non-Authoritative Information")                           \
+  XX(204, "No Content")                                              \
+  XX(205, "Reset Content")                                           \
+  XX(206, "Partial Content")                                         \
+  XX(300, "Multiple Choices")                                        \
+  XX(301, "Moved Permanently")                                       \
+  XX(302, "Found")                                                   \
+  XX(303, "See Other")                                               \
+  XX(304, "Not Modified")                                            \
+  XX(305, "Use Proxy")                                               \
+  XX(307, "Temporary Redirect")                                      \
+  XX(400, "Bad Request")                                             \
+  XX(401, "Unauthorized")                                            \
+  XX(402, "Payment Required")                                        \
+  XX(403, "Forbidden")                                               \
+  XX(404, "Not Found")                                               \
+  XX(405, "Method Not Allowed")                                      \
+  XX(406, "Not Acceptable")                                          \
+  XX(407, "Proxy Authentication Required")                           \
+  XX(408, "Request Timeout")                                         \
+  XX(409, "Conflict")                                                \
+  XX(410, "Gone")                                                    \
+  XX(411, "Length Required")                                         \
+  XX(412, "Precondition Failed")                                     \
+  XX(413, "Request Entity Too Large")                                \
+  XX(414, "Request-URI Too Long")                                    \
+  XX(415, "Unsupported Media Type")                                  \
+  XX(416, "Requested Range Not Satisfiable")                         \
+  XX(417, "Expectation Failed")                                      \
+  XX(428, "Precondition Required")                                   \
+  XX(429, "Too Many Requests")                                       \
+  XX(431, "Request Header Fields Too Large")                         \
+  XX(500, "Internal Server Error")                                   \
+  XX(501, "Not Implemented")                                         \
+  XX(502, "Bad Gateway")                                             \
+  XX(503, "Service Unavailable")                                     \
+  XX(504, "Gateway Timeout")                                         \
+  XX(505, "HTTP Version Not Supported")
+
+
+#define STATUS_LINE(version, code, reason)                           \
+  "HTTP/" version " " #code " " reason "\r\n"
+
+
+/* Pre-rendered status lines for HTTP/1.0 and HTTP/1.1. */
+static const struct status_line {
+  const char *reason;
+  const char *line[2];
+  unsigned char len;
+} status_lines[] =
+  {
+#define XX(code, reason)                                             \
+    { reason                                                         \
+    , { STATUS_LINE("1.0", code, reason)                             \
+      , STATUS_LINE("1.1", code, reason)                             \
+      }                                                              \
+    , sizeof(STATUS_LINE("1.1", code, reason)) - 1                   \
+    },
+  HTTP_STATUS_MAP(XX)
+#undef XX
+  };
+
+
+enum status_line_index
+  {
+#define XX(code, reason) STATUS_##code,
+  HTTP_STATUS_MAP(XX)
+#undef XX
+  };
+
+
+/* Maps a status code to its index in status_lines[] plus one. */
+static const unsigned char status_index[600] =
+  {
+#define XX(code, reason) [code] = STATUS_##code + 1,
+  HTTP_STATUS_MAP(XX)
+#undef XX
+  };
+
+
+static const char *day_names[] =
+  { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+
+static const char *month_names[] =
+  { "Jan", "Feb", "Mar", "Apr", "May", "Jun"
+  , "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+  };
+
+
+#define HEADER_SEPARATOR ": "
+#define REQUEST_VERSION_1_0 " HTTP/1.0\r\n"
+#define REQUEST_VERSION_1_1 " HTTP/1.1\r\n"
+
+
+/* iov_base is not const. The writer only hands these to writev(). */
+static inline void
+iov_set (struct iovec *iov, const void *base, size_t len)
+{
+  iov->iov_base = (void *) base;
+  iov->iov_len = len;
+}
+
+
+size_t
+http_chunk_header (char *buf, size_t len)
+{
+  char digits[16];
+  size_t n = 0, i;
+
+  do {
+    digits[n++] = hex[len & 0xf];
+    len >>= 4;
+  } while (len);
+
+  for (i = 0; i < n; i++) {
+    buf[i] = digits[n - i - 1];
+  }
+
+  buf[n++] = '\r';
+  buf[n++] = '\n';
+
+  assert(n <= HTTP_CHUNK_HEADER_SIZE);
+  return n;
+}
+
+
+int
+http_chunk_iov (struct iovec *iov,
+                char *header,
+                const void *data,
+                size_t len)
+{
+  if (len == 0) return 0;
+
+  iov_set(&iov[0], header, http_chunk_header(header, len));
+  iov_set(&iov[1], data, len);
+  iov_set(&iov[2], CRLF, sizeof(CRLF)-1);
+
+  return HTTP_CHUNK_IOVCNT;
+}
+
+
+int
+http_chunk_last_iov (struct iovec *iov,
+                     const char *trailers,
+                     size_t trailers_len)
+{
+  if (trailers == NULL || trailers_len == 0) {
+    iov_set(&iov[0], LAST_CHUNK_NO_TRAILERS, sizeof(LAST_CHUNK_NO_TRAILERS)-1);
+    return 1;
+  }
+
+  iov_set(&iov[0], LAST_CHUNK, sizeof(LAST_CHUNK)-1);
+  iov_set(&iov[1], trailers, trailers_len);
+  iov_set(&iov[2], CRLF, sizeof(CRLF)-1);
+
+  return 3;
+}
+
+
+static void
+put2 (char *buf, int n)
+{
+  buf[0] = '0' + n / 10;
+  buf[1] = '0' + n % 10;
+}
+
+
+const char *
+http_date (struct http_date_cache *cache, time_t now)
+{
+  struct tm tm;
+  char *d = cache->line;
+
+  if (now == cache->last && d[0] == 'D') return d;
+
+  gmtime_r(&now, &tm);
+
+  /* Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n */
+  memcpy(d, "Date: ", 6);
+  memcpy(d + 6, day_names[tm.tm_wday], 3);
+  d[9] = ',';
+  d[10] = ' ';
+  put2(d + 11, tm.tm_mday);
+  d[13] = ' ';
+  memcpy(d + 14, month_names[tm.tm_mon], 3);
+  d[17] = ' ';
+  put2(d + 18, (tm.tm_year + 1900) / 100);
+  put2(d + 20, (tm.tm_year + 1900) % 100);
+  d[22] = ' ';
+  put2(d + 23, tm.tm_hour);
+  d[25] = ':';
+  put2(d + 26, tm.tm_min);
+  d[28] = ':';
+  put2(d + 29, tm.tm_sec);
+  memcpy(d + 31, " GMT\r\n", 6);
+
+  cache->last = now;
+  return d;
+}
+
+
+const char *
+http_status_str (unsigned short status_code)
+{
+  if (status_code >= sizeof(status_index)) return NULL;
+  if (status_index[status_code] == 0) return NULL;
+  return status_lines[status_index[status_code] - 1].reason;
+}
+
+
+/* Returns 0 for HTTP/1.0, 1 for HTTP/1.1 and -1 otherwise. */
+static int
+version_index (const struct http_head *head)
+{
+  if (head->http_major != 1 || head->http_minor > 1) return -1;
+  return head->http_minor;
+}
+
+
+static const struct status_line *
+status_line (const struct http_head *head)
+{
+  if (head->status_code >= sizeof(status_index)) return NULL;
+  if (status_index[head->status_code] == 0) return NULL;
+  return &status_lines[status_index[head->status_code] - 1];
+}
+
+
+/* Length of the request or status line, 0 if it can not be rendered. */
+static size_t
+first_line_size (const struct http_head *head)
+{
+  const struct status_line *s;
+
+  if (version_index(head) < 0) return 0;
+
+  if (head->type == HTTP_REQUEST) {
+    return strlen(http_method_str(head->method))
+         + 1
+         + head->url_len
+         + sizeof(REQUEST_VERSION_1_1)-1;
+  }
+
+  s = status_line(head);
+  return s ? s->len : 0;
+}
+
+
+size_t
+http_head_size (const struct http_head *head)
+{
+  size_t size = first_line_size(head);
+  int i;
+
+  if (size == 0) return 0;
+
+  if (head->date) size += HTTP_DATE_LINE_LEN;
+
+  for (i = 0; i < head->num_headers; i++) {
+    size += head->headers[i].field_len
+          + sizeof(HEADER_SEPARATOR)-1
+          + head->headers[i].value_len
+          + sizeof(CRLF)-1;
+  }
+
+  return size + sizeof(CRLF)-1;
+}
+
+
+#define APPEND(s, n)                                                 \
+do {                                                                 \
+  memcpy(p, (s), (n));                                               \
+  p += (n);                                                          \
+} while (0)
+
+
+size_t
+http_head_write (const struct http_head *head, char *buf, size_t len)
+{
+  size_t size = http_head_size(head);
+  const char *method;
+  char *p = buf;
+  int i;
+
+  if (size == 0 || size > len) return 0;
+
+  if (head->type == HTTP_REQUEST) {
+    method = http_method_str(head->method);
+    APPEND(method, strlen(method));
+    *p++ = ' ';
+    APPEND(head->url, head->url_len);
+    if (version_index(head) == 0) {
+      APPEND(REQUEST_VERSION_1_0, sizeof(REQUEST_VERSION_1_0)-1);
+    } else {
+      APPEND(REQUEST_VERSION_1_1, sizeof(REQUEST_VERSION_1_1)-1);
+    }
+  } else {
+    const struct status_line *s = status_line(head);
+    APPEND(s->line[version_index(head)], s->len);
+  }
+
+  if (head->date) APPEND(head->date, HTTP_DATE_LINE_LEN);
+
+  for (i = 0; i < head->num_headers; i++) {
+    APPEND(head->headers[i].field, head->headers[i].field_len);
+    APPEND(HEADER_SEPARATOR, sizeof(HEADER_SEPARATOR)-1);
+    APPEND(head->headers[i].value, head->headers[i].value_len);
+    APPEND(CRLF, sizeof(CRLF)-1);
+  }
+
+  APPEND(CRLF, sizeof(CRLF)-1);
+
+  assert((size_t)(p - buf) == size);
+  return size;
+}
+
+
+int
+http_head_iovcnt (const struct http_head *head)
+{
+  return (head->type == HTTP_REQUEST ? 4 : 1)
+       + (head->date ? 1 : 0)
+       + 4 * head->num_headers
+       + 1;
+}
+
+
+int
+http_head_iov (const struct http_head *head, struct iovec *iov, int iovcnt)
+{
+  int v = version_index(head), i, n = 0;
+  const char *method;
+
+  if (v < 0 || iovcnt < http_head_iovcnt(head)) return -1;
+
+  if (head->type == HTTP_REQUEST) {
+    method = http_method_str(head->method);
+    iov_set(&iov[n++], method, strlen(method));
+    iov_set(&iov[n++], " ", 1);
+    iov_set(&iov[n++], head->url, head->url_len);
+    if (v == 0) {
+      iov_set(&iov[n++], REQUEST_VERSION_1_0, sizeof(REQUEST_VERSION_1_0)-1);
+    } else {
+      iov_set(&iov[n++], REQUEST_VERSION_1_1, sizeof(REQUEST_VERSION_1_1)-1);
+    }
+  } else {
+    const struct status_line *s = status_line(head);
+    if (s == NULL) return -1;
+    iov_set(&iov[n++], s->line[v], s->len);
+  }
+
+  if (head->date) iov_set(&iov[n++], head->date, HTTP_DATE_LINE_LEN);
+
+  for (i = 0; i < head->num_headers; i++) {
+    iov_set(&iov[n++], head->headers[i].field, head->headers[i].field_len);
+    iov_set(&iov[n++], HEADER_SEPARATOR, sizeof(HEADER_SEPARATOR)-1);
+    iov_set(&iov[n++], head->headers[i].value, head->headers[i].value_len);
+    iov_set(&iov[n++], CRLF, sizeof(CRLF)-1);
+  }
+
+  iov_set(&iov[n++], CRLF, sizeof(CRLF)-1);
+
+  assert(n == http_head_iovcnt(head));
+  return n;
+}
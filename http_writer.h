@@ -0,0 +1,163 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef http_writer_h
+#define http_writer_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <http_parser.h>
+#include <time.h>
+
+
+/* Size of the buffer needed to hold a chunk-size line: up to 16 hex digits
+ * for a 64 bit length followed by CRLF.
+ */
+#define HTTP_CHUNK_HEADER_SIZE 18
+
+/* Number of iovecs used by a single chunk: size line, payload, CRLF. */
+#define HTTP_CHUNK_IOVCNT 3
+
+
+/* The writer is the inverse of the chunked decoder in http_parser_execute().
+ * It never copies payload: body fragments are referenced from the iovec
+ * array as they are, only the chunk-size line is rendered into a small
+ * caller supplied buffer. Hand the result to writev().
+ *
+ * Everything referenced by the iovecs (payload, header buffer, trailers)
+ * must stay valid until the data has been written.
+ */
+
+
+/* Renders the chunk-size line for a chunk of 'len' bytes, e.g. "1a2\r\n",
+ * into 'buf' which must hold HTTP_CHUNK_HEADER_SIZE bytes. Returns the
+ * length of the line. No terminating '\0' is written.
+ */
+size_t http_chunk_header(char *buf, size_t len);
+
+
+/* Fills iov[0..2] with a complete chunk carrying 'len' bytes at 'data'.
+ * 'header' is used to store the chunk-size line and must hold
+ * HTTP_CHUNK_HEADER_SIZE bytes.
+ *
+ * Returns the number of iovecs used: HTTP_CHUNK_IOVCNT, or 0 if 'len' is
+ * zero since an empty chunk would terminate the body.
+ */
+int http_chunk_iov(struct iovec *iov,
+                   char *header,
+                   const void *data,
+                   size_t len);
+
+
+/* Fills 'iov' with the last-chunk and the end of the message. 'trailers'
+ * is an optional block of trailer headers, each line terminated by CRLF,
+ * and may be NULL.
+ *
+ * Returns the number of iovecs used: 1 without trailers, 3 with.
+ */
+int http_chunk_last_iov(struct iovec *iov,
+                        const char *trailers,
+                        size_t trailers_len);
+
+
+/* Length of a rendered Date header line:
+ * "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+ */
+#define HTTP_DATE_LINE_LEN 37
+
+
+/* Keep one of these per thread. The Date line is only rendered again when
+ * the second changes.
+ */
+struct http_date_cache {
+  time_t last;
+  char line[HTTP_DATE_LINE_LEN];
+};
+
+
+/* Returns the Date line (HTTP_DATE_LINE_LEN bytes, not '\0' terminated)
+ * for 'now'. Initialize the cache with zeros before the first call.
+ */
+const char *http_date(struct http_date_cache *cache, time_t now);
+
+
+struct http_header {
+  const char *field;
+  size_t field_len;
+  const char *value;
+  size_t value_len;
+};
+
+
+/* Describes a message head to serialize. Only HTTP/1.0 and HTTP/1.1 are
+ * supported. Responses must use one of the status codes known to the
+ * status line table; see http_status_str().
+ */
+struct http_head {
+  enum http_parser_type type;  /* HTTP_REQUEST or HTTP_RESPONSE */
+  unsigned short http_major;
+  unsigned short http_minor;
+  unsigned short status_code;  /* responses only */
+  enum http_method method;     /* requests only */
+  const char *url;             /* requests only */
+  size_t url_len;
+  const char *date;            /* optional, from http_date() */
+  const struct http_header *headers;
+  int num_headers;
+};
+
+
+/* Returns the exact number of bytes http_head_write() will produce, or 0
+ * if the head can not be serialized (unknown status code or version).
+ */
+size_t http_head_size(const struct http_head *head);
+
+
+/* Serializes the head, including the blank line ending it, into 'buf'.
+ * Returns the number of bytes written or 0 if the head can not be
+ * serialized or does not fit into 'len' bytes.
+ */
+size_t http_head_write(const struct http_head *head, char *buf, size_t len);
+
+
+/* Returns the number of iovecs http_head_iov() needs. */
+int http_head_iovcnt(const struct http_head *head);
+
+
+/* Fills 'iov' with the head without copying anything: status lines come
+ * from a static table, the method from http_method_str(), header fields
+ * and values are referenced in place. Returns the number of iovecs used,
+ * or -1 if the head can not be serialized or 'iovcnt' is too small.
+ */
+int http_head_iov(const struct http_head *head, struct iovec *iov, int iovcnt);
+
+
+/* Returns the reason phrase for a status code, or NULL if the code is not
+ * in the status line table.
+ */
+const char *http_status_str(unsigned short status_code);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,392 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <multipart_parser.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+# define MULTIPART_SSE2 1
+#endif
+
+
+#define CR '\r'
+#define LF '\n'
+
+#ifndef MIN
+# define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+
+#define SET_ERRNO(e)                                                 \
+do {                                                                 \
+  parser->mp_errno = (e);                                            \
+} while (0)
+
+
+#define CALLBACK(FOR)                                                \
+do {                                                                 \
+  if (settings->on_##FOR && settings->on_##FOR(parser) != 0) {       \
+    SET_ERRNO(MPE_CALLBACK);                                         \
+    goto error;                                                      \
+  }                                                                  \
+} while (0)
+
+
+#define CALLBACK_DATA(FOR, AT, LEN)                                  \
+do {                                                                 \
+  if (settings->on_##FOR                                             \
+      && settings->on_##FOR(parser, (AT), (LEN)) != 0) {             \
+    SET_ERRNO(MPE_CALLBACK);                                         \
+    goto error;                                                      \
+  }                                                                  \
+} while (0)
+
+
+enum state
+  { s_dead = 1
+
+  , s_preamble
+  , s_delim_end     /* after a boundary: padding, CRLF or "--" */
+  , s_close_hyphen
+  , s_delim_lf
+
+  , s_header_field_start
+  , s_header_field
+  , s_header_value_start
+  , s_header_value
+  , s_header_value_lf
+  , s_headers_lf
+
+  , s_part_data
+  , s_epilogue
+  };
+
+#define PARSING_HEADER(state) \
+  ((state) >= s_header_field_start && (state) <= s_headers_lf)
+
+
+static const char *errno_strings[] =
+  { "success"
+  , "a callback failed"
+  , "invalid bytes after a boundary"
+  , "invalid part header"
+  , "part header too long"
+  , "body ended before the close delimiter"
+  , "data after an error"
+  };
+
+
+/* Header field names are tokens */
+static int
+is_token (char ch)
+{
+  return ch > ' ' && ch < 127 && ch != ':';
+}
+
+
+/* First position from 'p' where the delimiter 'd' of 'n' bytes starts,
+ * or where its first bytes end the buffer, or 'pe'.
+ */
+static const char *
+find_delimiter (const char *p, const char *pe, const char *d, size_t n)
+{
+  const char *q;
+
+#if MULTIPART_SSE2
+  /* Filter 16 positions at once on the first and the last byte of the
+   * delimiter, then compare what is left. CRLF followed by the last
+   * boundary byte n - 1 bytes later is rare in any data.
+   */
+  const __m128i first = _mm_set1_epi8(d[0]);
+  const __m128i last = _mm_set1_epi8(d[n - 1]);
+  unsigned int mask;
+
+  while ((size_t) (pe - p) >= n - 1 + 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *) p);
+    __m128i b = _mm_loadu_si128((const __m128i *) (p + n - 1));
+
+    mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                           _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      q = p + __builtin_ctz(mask);
+      if (memcmp(q + 1, d + 1, n - 2) == 0) return q;
+      mask &= mask - 1;
+    }
+    p += 16;
+  }
+#endif
+
+  /* The rest, where a delimiter may be cut off by the end */
+  while ((q = memchr(p, d[0], pe - p)) != NULL) {
+    if (memcmp(q, d, MIN(n, (size_t) (pe - q))) == 0) return q;
+    p = q + 1;
+  }
+  return pe;
+}
+
+
+int
+multipart_boundary (const char *content_type,
+                    size_t len,
+                    const char **boundary,
+                    size_t *boundary_len)
+{
+  const char *p = content_type, *end = content_type + len, *q;
+
+  while ((p = memchr(p, ';', end - p)) != NULL) {
+    p++;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (end - p <= 9 || strncasecmp(p, "boundary=", 9) != 0) continue;
+
+    p += 9;
+    if (*p == '"') {
+      p++;
+      q = memchr(p, '"', end - p);
+      if (!q) return -1;
+    } else {
+      for (q = p; q < end && *q != ';' && *q != ' ' && *q != '\t'; q++);
+    }
+    if (q == p || q - p > MULTIPART_MAX_BOUNDARY) return -1;
+    *boundary = p;
+    *boundary_len = q - p;
+    return 0;
+  }
+  return -1;
+}
+
+
+int
+multipart_parser_init (multipart_parser *parser,
+                       const char *boundary,
+                       size_t len)
+{
+  size_t i;
+
+  if (len == 0 || len > MULTIPART_MAX_BOUNDARY) return -1;
+  for (i = 0; i < len; i++) {
+    /* the delimiter search relies on CR only starting it */
+    if ((unsigned char) boundary[i] < ' ') return -1;
+  }
+
+  memset(parser, 0, sizeof *parser);
+  memcpy(parser->delim, "\r\n--", 4);
+  memcpy(parser->delim + 4, boundary, len);
+  parser->delim_len = 4 + len;
+  parser->state = s_preamble;
+  parser->index = 2;  /* the first delimiter needs no CRLF before it */
+  return 0;
+}
+
+
+size_t
+multipart_parser_execute (multipart_parser *parser,
+                          const multipart_parser_settings *settings,
+                          const char *data,
+                          size_t len)
+{
+  const char *p = data, *pe = data + len, *q;
+  const char *mark = NULL;  /* header field or value in progress */
+  const char *delim = parser->delim;
+  size_t n = parser->delim_len;
+  size_t index = parser->index;
+  enum state state = (enum state) parser->state;
+  char ch;
+
+  if (state == s_dead) {
+    if (parser->mp_errno == MPE_OK) SET_ERRNO(MPE_CLOSED);
+    return 0;
+  }
+
+  if (len == 0) {
+    if (state != s_epilogue) {
+      SET_ERRNO(MPE_INVALID_EOF);
+      parser->state = s_dead;
+    }
+    return 0;
+  }
+
+  if (state == s_header_field || state == s_header_value) mark = data;
+
+  for (; p != pe; p++) {
+    ch = *p;
+
+    if (PARSING_HEADER(state) && ++parser->nread > MULTIPART_MAX_HEADER_SIZE) {
+      SET_ERRNO(MPE_HEADER_OVERFLOW);
+      goto error;
+    }
+
+    switch (state) {
+      case s_preamble:
+      case s_part_data:
+        if (index > 0) {
+          /* a delimiter cut off by the end of the last buffer */
+          if (ch == delim[index]) {
+            if (++index == n) {
+              index = 0;
+              state = s_delim_end;
+            }
+            break;
+          }
+          /* it was not one, the bytes held back are data */
+          if (state == s_part_data) CALLBACK_DATA(part_data, delim, index);
+          index = 0;
+        }
+
+        q = find_delimiter(p, pe, delim, n);
+        if (q > p && state == s_part_data) CALLBACK_DATA(part_data, p, q - p);
+
+        if (q == pe) {
+          p = pe - 1;
+        } else if ((size_t) (pe - q) >= n) {
+          p = q + n - 1;
+          state = s_delim_end;
+        } else {
+          index = pe - q;
+          p = pe - 1;
+        }
+        break;
+
+      case s_delim_end:
+        if (ch == '-') {
+          state = s_close_hyphen;
+        } else if (ch == CR) {
+          state = s_delim_lf;
+        } else if (ch != ' ' && ch != '\t') {  /* transport padding */
+          SET_ERRNO(MPE_INVALID_DELIMITER);
+          goto error;
+        }
+        break;
+
+      case s_close_hyphen:
+        if (ch != '-') {
+          SET_ERRNO(MPE_INVALID_DELIMITER);
+          goto error;
+        }
+        if (parser->in_part) {
+          parser->in_part = 0;
+          CALLBACK(part_end);
+        }
+        state = s_epilogue;
+        CALLBACK(body_end);
+        break;
+
+      case s_delim_lf:
+        if (ch != LF) {
+          SET_ERRNO(MPE_INVALID_DELIMITER);
+          goto error;
+        }
+        if (parser->in_part) CALLBACK(part_end);
+        parser->in_part = 1;
+        parser->nparts++;
+        parser->nread = 0;
+        state = s_header_field_start;
+        CALLBACK(part_begin);
+        break;
+
+      case s_header_field_start:
+        if (ch == CR) {
+          state = s_headers_lf;
+          break;
+        }
+        if (!is_token(ch)) {
+          SET_ERRNO(MPE_INVALID_HEADER);
+          goto error;
+        }
+        mark = p;
+        state = s_header_field;
+        break;
+
+      case s_header_field:
+        if (ch == ':') {
+          CALLBACK_DATA(header_field, mark, p - mark);
+          mark = NULL;
+          state = s_header_value_start;
+        } else if (!is_token(ch)) {
+          SET_ERRNO(MPE_INVALID_HEADER);
+          goto error;
+        }
+        break;
+
+      case s_header_value_start:
+        if (ch == ' ' || ch == '\t') break;
+        mark = p;
+        state = s_header_value;
+        /* fall through */
+
+      case s_header_value:
+        if (ch == CR) {
+          CALLBACK_DATA(header_value, mark, p - mark);
+          mark = NULL;
+          state = s_header_value_lf;
+        } else if (ch == LF) {
+          SET_ERRNO(MPE_INVALID_HEADER);
+          goto error;
+        }
+        break;
+
+      case s_header_value_lf:
+      case s_headers_lf:
+        if (ch != LF) {
+          SET_ERRNO(MPE_INVALID_HEADER);
+          goto error;
+        }
+        if (state == s_headers_lf) {
+          state = s_part_data;
+          CALLBACK(headers_complete);
+        } else {
+          state = s_header_field_start;
+        }
+        break;
+
+      case s_epilogue:
+        p = pe - 1;
+        break;
+
+      default:
+        SET_ERRNO(MPE_CLOSED);
+        goto error;
+    }
+  }
+
+  if (mark) {
+    if (state == s_header_field) {
+      CALLBACK_DATA(header_field, mark, pe - mark);
+    } else {
+      CALLBACK_DATA(header_value, mark, pe - mark);
+    }
+  }
+
+  parser->state = state;
+  parser->index = index;
+  return len;
+
+error:
+  parser->state = s_dead;
+  return p - data;
+}
+
+
+const char *
+multipart_errno_description (enum multipart_errno err)
+{
+  return errno_strings[err];
+}
@@ -0,0 +1,132 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef multipart_parser_h
+#define multipart_parser_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Streaming parser for multipart bodies (RFC 2046), as multipart/form-data
+ * uploads are, fed from on_body. Like http_parser it is resumable at any
+ * byte, allocates nothing and reports data through callbacks that point
+ * into the buffers passed in. Part data is scanned for the delimiter a
+ * block at a time, so large files go through at memory speed.
+ */
+typedef struct multipart_parser multipart_parser;
+typedef struct multipart_parser_settings multipart_parser_settings;
+
+typedef int (*multipart_data_cb) (multipart_parser *, const char *at,
+                                  size_t len);
+typedef int (*multipart_cb) (multipart_parser *);
+
+
+/* RFC 2046 allows boundaries of up to 70 characters */
+#define MULTIPART_MAX_BOUNDARY 70
+
+/* Maximum header bytes of a part */
+#define MULTIPART_MAX_HEADER_SIZE (8*1024)
+
+
+enum multipart_errno
+  { MPE_OK = 0
+  , MPE_CALLBACK            /* a callback returned non-zero */
+  , MPE_INVALID_DELIMITER   /* bad bytes after a boundary */
+  , MPE_INVALID_HEADER      /* bad part header line */
+  , MPE_HEADER_OVERFLOW     /* part header over MULTIPART_MAX_HEADER_SIZE */
+  , MPE_INVALID_EOF         /* the body ended before the close delimiter */
+  , MPE_CLOSED              /* data after a failed parse */
+  };
+
+
+struct multipart_parser {
+  /** PRIVATE **/
+  unsigned char state;
+  unsigned char index;      /* bytes of the delimiter matched so far */
+  unsigned char delim_len;
+  unsigned char in_part;
+  uint32_t nread;           /* header bytes of the current part */
+
+  /* CRLF "--" boundary */
+  char delim[4 + MULTIPART_MAX_BOUNDARY];
+
+  /** READ-ONLY **/
+  unsigned int nparts;
+  unsigned char mp_errno;   /* enum multipart_errno */
+
+  /** PUBLIC **/
+  void *data;
+};
+
+
+struct multipart_parser_settings {
+  multipart_cb      on_part_begin;
+  multipart_data_cb on_header_field;
+  multipart_data_cb on_header_value;
+  multipart_cb      on_headers_complete;
+  multipart_data_cb on_part_data;
+  multipart_cb      on_part_end;
+  multipart_cb      on_body_end;  /* the close delimiter was seen */
+};
+
+
+/* Finds the boundary parameter in a Content-Type value, quoted or not.
+ * Sets '*boundary' and '*len' to it, without quotes. Returns -1 if there
+ * is none or it is empty or longer than MULTIPART_MAX_BOUNDARY.
+ */
+int multipart_boundary(const char *content_type,
+                       size_t len,
+                       const char **boundary,
+                       size_t *boundary_len);
+
+
+/* Returns -1 if the boundary is empty or too long. The boundary is
+ * copied, it need not outlive the call.
+ */
+int multipart_parser_init(multipart_parser *parser,
+                          const char *boundary,
+                          size_t len);
+
+
+/* Parses 'len' bytes of the body and returns how many were parsed; fewer
+ * on an error, see multipart_parser_errno(). The preamble and the
+ * epilogue are skipped. Call with a length of 0 at the end of the body to
+ * check that it was complete.
+ */
+size_t multipart_parser_execute(multipart_parser *parser,
+                                const multipart_parser_settings *settings,
+                                const char *data,
+                                size_t len);
+
+
+#define multipart_parser_errno(p) ((enum multipart_errno) (p)->mp_errno)
+
+const char *multipart_errno_description(enum multipart_errno err);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
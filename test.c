@@ -19,909 +19,33 @@
  * IN THE SOFTWARE.
  */
 #include "http_parser.h"
+#include "http_writer.h"
+#include "http_cache.h"
+#include "http_inflate.h"
+#include "http_pipeline.h"
+#include "multipart_parser.h"
+#include "websocket_parser.h"
+#include "test_corpus.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h> /* rand */
 #include <string.h>
 #include <stdarg.h>
-
-#undef TRUE
-#define TRUE 1
-#undef FALSE
-#define FALSE 0
-
-#define MAX_HEADERS 13
-#define MAX_ELEMENT_SIZE 500
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
 static http_parser *parser;
 
-struct message {
-  const char *name; // for debugging purposes
-  const char *raw;
-  enum http_parser_type type;
-  enum http_method method;
-  int status_code;
-  char request_path[MAX_ELEMENT_SIZE];
-  char request_url[MAX_ELEMENT_SIZE];
-  char fragment[MAX_ELEMENT_SIZE];
-  char query_string[MAX_ELEMENT_SIZE];
-  char body[MAX_ELEMENT_SIZE];
-  size_t body_size;
-  int num_headers;
-  enum { NONE=0, FIELD, VALUE } last_header_element;
-  char headers [MAX_HEADERS][2][MAX_ELEMENT_SIZE];
-  int should_keep_alive;
-
-  int upgrade;
-
-  unsigned short http_major;
-  unsigned short http_minor;
-
-  int message_begin_cb_called;
-  int headers_complete_cb_called;
-  int message_complete_cb_called;
-  int message_complete_on_eof;
-};
-
 static int currently_parsing_eof;
+static int pause_parser;
 
 static struct message messages[5];
 static int num_messages;
 
-/* * R E Q U E S T S * */
-const struct message requests[] =
-#define CURL_GET 0
-{ {.name= "curl get"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /test HTTP/1.1\r\n"
-         "User-Agent: curl/7.18.0 (i486-pc-linux-gnu) libcurl/7.18.0 OpenSSL/0.9.8g zlib/1.2.3.3 libidn/1.1\r\n"
-         "Host: 0.0.0.0=5000\r\n"
-         "Accept: */*\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/test"
-  ,.request_url= "/test"
-  ,.num_headers= 3
-  ,.headers=
-    { { "User-Agent", "curl/7.18.0 (i486-pc-linux-gnu) libcurl/7.18.0 OpenSSL/0.9.8g zlib/1.2.3.3 libidn/1.1" }
-    , { "Host", "0.0.0.0=5000" }
-    , { "Accept", "*/*" }
-    }
-  ,.body= ""
-  }
-
-#define FIREFOX_GET 1
-, {.name= "firefox get"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /favicon.ico HTTP/1.1\r\n"
-         "Host: 0.0.0.0=5000\r\n"
-         "User-Agent: Mozilla/5.0 (X11; U; Linux i686; en-US; rv:1.9) Gecko/2008061015 Firefox/3.0\r\n"
-         "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
-         "Accept-Language: en-us,en;q=0.5\r\n"
-         "Accept-Encoding: gzip,deflate\r\n"
-         "Accept-Charset: ISO-8859-1,utf-8;q=0.7,*;q=0.7\r\n"
-         "Keep-Alive: 300\r\n"
-         "Connection: keep-alive\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/favicon.ico"
-  ,.request_url= "/favicon.ico"
-  ,.num_headers= 8
-  ,.headers=
-    { { "Host", "0.0.0.0=5000" }
-    , { "User-Agent", "Mozilla/5.0 (X11; U; Linux i686; en-US; rv:1.9) Gecko/2008061015 Firefox/3.0" }
-    , { "Accept", "text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8" }
-    , { "Accept-Language", "en-us,en;q=0.5" }
-    , { "Accept-Encoding", "gzip,deflate" }
-    , { "Accept-Charset", "ISO-8859-1,utf-8;q=0.7,*;q=0.7" }
-    , { "Keep-Alive", "300" }
-    , { "Connection", "keep-alive" }
-    }
-  ,.body= ""
-  }
-
-#define DUMBFUCK 2
-, {.name= "dumbfuck"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /dumbfuck HTTP/1.1\r\n"
-         "aaaaaaaaaaaaa:++++++++++\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/dumbfuck"
-  ,.request_url= "/dumbfuck"
-  ,.num_headers= 1
-  ,.headers=
-    { { "aaaaaaaaaaaaa",  "++++++++++" }
-    }
-  ,.body= ""
-  }
-
-#define FRAGMENT_IN_URI 3
-, {.name= "fragment in url"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /forums/1/topics/2375?page=1#posts-17408 HTTP/1.1\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= "page=1"
-  ,.fragment= "posts-17408"
-  ,.request_path= "/forums/1/topics/2375"
-  /* XXX request url does include fragment? */
-  ,.request_url= "/forums/1/topics/2375?page=1#posts-17408"
-  ,.num_headers= 0
-  ,.body= ""
-  }
-
-#define GET_NO_HEADERS_NO_BODY 4
-, {.name= "get no headers no body"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /get_no_headers_no_body/world HTTP/1.1\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE /* would need Connection: close */
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/get_no_headers_no_body/world"
-  ,.request_url= "/get_no_headers_no_body/world"
-  ,.num_headers= 0
-  ,.body= ""
-  }
-
-#define GET_ONE_HEADER_NO_BODY 5
-, {.name= "get one header no body"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /get_one_header_no_body HTTP/1.1\r\n"
-         "Accept: */*\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE /* would need Connection: close */
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/get_one_header_no_body"
-  ,.request_url= "/get_one_header_no_body"
-  ,.num_headers= 1
-  ,.headers=
-    { { "Accept" , "*/*" }
-    }
-  ,.body= ""
-  }
-
-#define GET_FUNKY_CONTENT_LENGTH 6
-, {.name= "get funky content length body hello"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /get_funky_content_length_body_hello HTTP/1.0\r\n"
-         "conTENT-Length: 5\r\n"
-         "\r\n"
-         "HELLO"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 0
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/get_funky_content_length_body_hello"
-  ,.request_url= "/get_funky_content_length_body_hello"
-  ,.num_headers= 1
-  ,.headers=
-    { { "conTENT-Length" , "5" }
-    }
-  ,.body= "HELLO"
-  }
-
-#define POST_IDENTITY_BODY_WORLD 7
-, {.name= "post identity body world"
-  ,.type= HTTP_REQUEST
-  ,.raw= "POST /post_identity_body_world?q=search#hey HTTP/1.1\r\n"
-         "Accept: */*\r\n"
-         "Transfer-Encoding: identity\r\n"
-         "Content-Length: 5\r\n"
-         "\r\n"
-         "World"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_POST
-  ,.query_string= "q=search"
-  ,.fragment= "hey"
-  ,.request_path= "/post_identity_body_world"
-  ,.request_url= "/post_identity_body_world?q=search#hey"
-  ,.num_headers= 3
-  ,.headers=
-    { { "Accept", "*/*" }
-    , { "Transfer-Encoding", "identity" }
-    , { "Content-Length", "5" }
-    }
-  ,.body= "World"
-  }
-
-#define POST_CHUNKED_ALL_YOUR_BASE 8
-, {.name= "post - chunked body: all your base are belong to us"
-  ,.type= HTTP_REQUEST
-  ,.raw= "POST /post_chunked_all_your_base HTTP/1.1\r\n"
-         "Transfer-Encoding: chunked\r\n"
-         "\r\n"
-         "1e\r\nall your base are belong to us\r\n"
-         "0\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_POST
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/post_chunked_all_your_base"
-  ,.request_url= "/post_chunked_all_your_base"
-  ,.num_headers= 1
-  ,.headers=
-    { { "Transfer-Encoding" , "chunked" }
-    }
-  ,.body= "all your base are belong to us"
-  }
-
-#define TWO_CHUNKS_MULT_ZERO_END 9
-, {.name= "two chunks ; triple zero ending"
-  ,.type= HTTP_REQUEST
-  ,.raw= "POST /two_chunks_mult_zero_end HTTP/1.1\r\n"
-         "Transfer-Encoding: chunked\r\n"
-         "\r\n"
-         "5\r\nhello\r\n"
-         "6\r\n world\r\n"
-         "000\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_POST
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/two_chunks_mult_zero_end"
-  ,.request_url= "/two_chunks_mult_zero_end"
-  ,.num_headers= 1
-  ,.headers=
-    { { "Transfer-Encoding", "chunked" }
-    }
-  ,.body= "hello world"
-  }
-
-#define CHUNKED_W_TRAILING_HEADERS 10
-, {.name= "chunked with trailing headers. blech."
-  ,.type= HTTP_REQUEST
-  ,.raw= "POST /chunked_w_trailing_headers HTTP/1.1\r\n"
-         "Transfer-Encoding: chunked\r\n"
-         "\r\n"
-         "5\r\nhello\r\n"
-         "6\r\n world\r\n"
-         "0\r\n"
-         "Vary: *\r\n"
-         "Content-Type: text/plain\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_POST
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/chunked_w_trailing_headers"
-  ,.request_url= "/chunked_w_trailing_headers"
-  ,.num_headers= 3
-  ,.headers=
-    { { "Transfer-Encoding",  "chunked" }
-    , { "Vary", "*" }
-    , { "Content-Type", "text/plain" }
-    }
-  ,.body= "hello world"
-  }
-
-#define CHUNKED_W_BULLSHIT_AFTER_LENGTH 11
-, {.name= "with bullshit after the length"
-  ,.type= HTTP_REQUEST
-  ,.raw= "POST /chunked_w_bullshit_after_length HTTP/1.1\r\n"
-         "Transfer-Encoding: chunked\r\n"
-         "\r\n"
-         "5; ihatew3;whatthefuck=aretheseparametersfor\r\nhello\r\n"
-         "6; blahblah; blah\r\n world\r\n"
-         "0\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_POST
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/chunked_w_bullshit_after_length"
-  ,.request_url= "/chunked_w_bullshit_after_length"
-  ,.num_headers= 1
-  ,.headers=
-    { { "Transfer-Encoding", "chunked" }
-    }
-  ,.body= "hello world"
-  }
-
-#define WITH_QUOTES 12
-, {.name= "with quotes"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /with_\"stupid\"_quotes?foo=\"bar\" HTTP/1.1\r\n\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= "foo=\"bar\""
-  ,.fragment= ""
-  ,.request_path= "/with_\"stupid\"_quotes"
-  ,.request_url= "/with_\"stupid\"_quotes?foo=\"bar\""
-  ,.num_headers= 0
-  ,.headers= { }
-  ,.body= ""
-  }
-
-#define APACHEBENCH_GET 13
-/* The server receiving this request SHOULD NOT wait for EOF
- * to know that content-length == 0.
- * How to represent this in a unit test? message_complete_on_eof
- * Compare with NO_CONTENT_LENGTH_RESPONSE.
- */
-, {.name = "apachebench get"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /test HTTP/1.0\r\n"
-         "Host: 0.0.0.0:5000\r\n"
-         "User-Agent: ApacheBench/2.3\r\n"
-         "Accept: */*\r\n\r\n"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 0
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/test"
-  ,.request_url= "/test"
-  ,.num_headers= 3
-  ,.headers= { { "Host", "0.0.0.0:5000" }
-             , { "User-Agent", "ApacheBench/2.3" }
-             , { "Accept", "*/*" }
-             }
-  ,.body= ""
-  }
-
-#define QUERY_URL_WITH_QUESTION_MARK_GET 14
-/* Some clients include '?' characters in query strings.
- */
-, {.name = "query url with question mark"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /test.cgi?foo=bar?baz HTTP/1.1\r\n\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= "foo=bar?baz"
-  ,.fragment= ""
-  ,.request_path= "/test.cgi"
-  ,.request_url= "/test.cgi?foo=bar?baz"
-  ,.num_headers= 0
-  ,.headers= {}
-  ,.body= ""
-  }
-
-#define PREFIX_NEWLINE_GET 15
-/* Some clients, especially after a POST in a keep-alive connection,
- * will send an extra CRLF before the next request
- */
-, {.name = "newline prefix get"
-  ,.type= HTTP_REQUEST
-  ,.raw= "\r\nGET /test HTTP/1.1\r\n\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/test"
-  ,.request_url= "/test"
-  ,.num_headers= 0
-  ,.headers= { }
-  ,.body= ""
-  }
-
-#define UPGRADE_REQUEST 16
-, {.name = "upgrade request"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /demo HTTP/1.1\r\n"
-         "Host: example.com\r\n"
-         "Connection: Upgrade\r\n"
-         "Sec-WebSocket-Key2: 12998 5 Y3 1  .P00\r\n"
-         "Sec-WebSocket-Protocol: sample\r\n"
-         "Upgrade: WebSocket\r\n"
-         "Sec-WebSocket-Key1: 4 @1  46546xW%0l 1 5\r\n"
-         "Origin: http://example.com\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/demo"
-  ,.request_url= "/demo"
-  ,.num_headers= 7
-  ,.upgrade=1
-  ,.headers= { { "Host", "example.com" }
-             , { "Connection", "Upgrade" }
-             , { "Sec-WebSocket-Key2", "12998 5 Y3 1  .P00" }
-             , { "Sec-WebSocket-Protocol", "sample" }
-             , { "Upgrade", "WebSocket" }
-             , { "Sec-WebSocket-Key1", "4 @1  46546xW%0l 1 5" }
-             , { "Origin", "http://example.com" }
-             }
-  ,.body= ""
-  }
-
-#define CONNECT_REQUEST 17
-, {.name = "connect request"
-  ,.type= HTTP_REQUEST
-  ,.raw= "CONNECT home0.netscape.com:443 HTTP/1.0\r\n"
-         "User-agent: Mozilla/1.1N\r\n"
-         "Proxy-authorization: basic aGVsbG86d29ybGQ=\r\n"
-         "\r\n"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 0
-  ,.method= HTTP_CONNECT
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= ""
-  ,.request_url= "home0.netscape.com:443"
-  ,.num_headers= 2
-  ,.upgrade=1
-  ,.headers= { { "User-agent", "Mozilla/1.1N" }
-             , { "Proxy-authorization", "basic aGVsbG86d29ybGQ=" }
-             }
-  ,.body= ""
-  }
-
-#define REPORT_REQ 18
-, {.name= "report request"
-  ,.type= HTTP_REQUEST
-  ,.raw= "REPORT /test HTTP/1.1\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.method= HTTP_REPORT
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/test"
-  ,.request_url= "/test"
-  ,.num_headers= 0
-  ,.headers= {}
-  ,.body= ""
-  }
-
-#define NO_HTTP_VERSION 19
-, {.name= "request with no http version"
-  ,.type= HTTP_REQUEST
-  ,.raw= "GET /\r\n"
-         "\r\n"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 0
-  ,.http_minor= 9
-  ,.method= HTTP_GET
-  ,.query_string= ""
-  ,.fragment= ""
-  ,.request_path= "/"
-  ,.request_url= "/"
-  ,.num_headers= 0
-  ,.headers= {}
-  ,.body= ""
-  }
-
-, {.name= NULL } /* sentinel */
-};
-
-/* * R E S P O N S E S * */
-const struct message responses[] =
-#define GOOGLE_301 0
-{ {.name= "google 301"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 301 Moved Permanently\r\n"
-         "Location: http://www.google.com/\r\n"
-         "Content-Type: text/html; charset=UTF-8\r\n"
-         "Date: Sun, 26 Apr 2009 11:11:49 GMT\r\n"
-         "Expires: Tue, 26 May 2009 11:11:49 GMT\r\n"
-         "X-$PrototypeBI-Version: 1.6.0.3\r\n" /* $ char in header field */
-         "Cache-Control: public, max-age=2592000\r\n"
-         "Server: gws\r\n"
-         "Content-Length:  219  \r\n"
-         "\r\n"
-         "<HTML><HEAD><meta http-equiv=\"content-type\" content=\"text/html;charset=utf-8\">\n"
-         "<TITLE>301 Moved</TITLE></HEAD><BODY>\n"
-         "<H1>301 Moved</H1>\n"
-         "The document has moved\n"
-         "<A HREF=\"http://www.google.com/\">here</A>.\r\n"
-         "</BODY></HTML>\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 301
-  ,.num_headers= 8
-  ,.headers=
-    { { "Location", "http://www.google.com/" }
-    , { "Content-Type", "text/html; charset=UTF-8" }
-    , { "Date", "Sun, 26 Apr 2009 11:11:49 GMT" }
-    , { "Expires", "Tue, 26 May 2009 11:11:49 GMT" }
-    , { "X-$PrototypeBI-Version", "1.6.0.3" }
-    , { "Cache-Control", "public, max-age=2592000" }
-    , { "Server", "gws" }
-    , { "Content-Length", "219  " }
-    }
-  ,.body= "<HTML><HEAD><meta http-equiv=\"content-type\" content=\"text/html;charset=utf-8\">\n"
-          "<TITLE>301 Moved</TITLE></HEAD><BODY>\n"
-          "<H1>301 Moved</H1>\n"
-          "The document has moved\n"
-          "<A HREF=\"http://www.google.com/\">here</A>.\r\n"
-          "</BODY></HTML>\r\n"
-  }
-
-#define NO_CONTENT_LENGTH_RESPONSE 1
-/* The client should wait for the server's EOF. That is, when content-length
- * is not specified, and "Connection: close", the end of body is specified
- * by the EOF.
- * Compare with APACHEBENCH_GET
- */
-, {.name= "no content-length response"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\r\n"
-         "Date: Tue, 04 Aug 2009 07:59:32 GMT\r\n"
-         "Server: Apache\r\n"
-         "X-Powered-By: Servlet/2.5 JSP/2.1\r\n"
-         "Content-Type: text/xml; charset=utf-8\r\n"
-         "Connection: close\r\n"
-         "\r\n"
-         "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-         "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
-         "  <SOAP-ENV:Body>\n"
-         "    <SOAP-ENV:Fault>\n"
-         "       <faultcode>SOAP-ENV:Client</faultcode>\n"
-         "       <faultstring>Client Error</faultstring>\n"
-         "    </SOAP-ENV:Fault>\n"
-         "  </SOAP-ENV:Body>\n"
-         "</SOAP-ENV:Envelope>"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= TRUE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 5
-  ,.headers=
-    { { "Date", "Tue, 04 Aug 2009 07:59:32 GMT" }
-    , { "Server", "Apache" }
-    , { "X-Powered-By", "Servlet/2.5 JSP/2.1" }
-    , { "Content-Type", "text/xml; charset=utf-8" }
-    , { "Connection", "close" }
-    }
-  ,.body= "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-          "<SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://schemas.xmlsoap.org/soap/envelope/\">\n"
-          "  <SOAP-ENV:Body>\n"
-          "    <SOAP-ENV:Fault>\n"
-          "       <faultcode>SOAP-ENV:Client</faultcode>\n"
-          "       <faultstring>Client Error</faultstring>\n"
-          "    </SOAP-ENV:Fault>\n"
-          "  </SOAP-ENV:Body>\n"
-          "</SOAP-ENV:Envelope>"
-  }
-
-#define NO_HEADERS_NO_BODY_404 2
-, {.name= "404 no headers no body"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 404 Not Found\r\n\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 404
-  ,.num_headers= 0
-  ,.headers= {}
-  ,.body_size= 0
-  ,.body= ""
-  }
-
-#define NO_REASON_PHRASE 3
-, {.name= "301 no response phrase"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 301\r\n\r\n"
-  ,.should_keep_alive = TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 301
-  ,.num_headers= 0
-  ,.headers= {}
-  ,.body= ""
-  }
-
-#define TRAILING_SPACE_ON_CHUNKED_BODY 4
-, {.name="200 trailing space on chunked body"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\r\n"
-         "Content-Type: text/plain\r\n"
-         "Transfer-Encoding: chunked\r\n"
-         "\r\n"
-         "25  \r\n"
-         "This is the data in the first chunk\r\n"
-         "\r\n"
-         "1C\r\n"
-         "and this is the second one\r\n"
-         "\r\n"
-         "0  \r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 2
-  ,.headers=
-    { {"Content-Type", "text/plain" }
-    , {"Transfer-Encoding", "chunked" }
-    }
-  ,.body_size = 37+28
-  ,.body =
-         "This is the data in the first chunk\r\n"
-         "and this is the second one\r\n"
-
-  }
-
-#define NO_CARRIAGE_RET 5
-, {.name="no carriage ret"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\n"
-         "Content-Type: text/html; charset=utf-8\n"
-         "Connection: close\n"
-         "\n"
-         "these headers are from http://news.ycombinator.com/"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= TRUE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 2
-  ,.headers=
-    { {"Content-Type", "text/html; charset=utf-8" }
-    , {"Connection", "close" }
-    }
-  ,.body= "these headers are from http://news.ycombinator.com/"
-  }
-
-#define PROXY_CONNECTION 6
-, {.name="proxy connection"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\r\n"
-         "Content-Type: text/html; charset=UTF-8\r\n"
-         "Content-Length: 11\r\n"
-         "Proxy-Connection: close\r\n"
-         "Date: Thu, 31 Dec 2009 20:55:48 +0000\r\n"
-         "\r\n"
-         "hello world"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 4
-  ,.headers=
-    { {"Content-Type", "text/html; charset=UTF-8" }
-    , {"Content-Length", "11" }
-    , {"Proxy-Connection", "close" }
-    , {"Date", "Thu, 31 Dec 2009 20:55:48 +0000"}
-    }
-  ,.body= "hello world"
-  }
-
-#define UNDERSTORE_HEADER_KEY 7
-  // shown by
-  // curl -o /dev/null -v "http://ad.doubleclick.net/pfadx/DARTSHELLCONFIGXML;dcmt=text/xml;"
-, {.name="underscore header key"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\r\n"
-         "Server: DCLK-AdSvr\r\n"
-         "Content-Type: text/xml\r\n"
-         "Content-Length: 0\r\n"
-         "DCLK_imp: v7;x;114750856;0-0;0;17820020;0/0;21603567/21621457/1;;~okv=;dcmt=text/xml;;~cs=o\r\n\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 4
-  ,.headers=
-    { {"Server", "DCLK-AdSvr" }
-    , {"Content-Type", "text/xml" }
-    , {"Content-Length", "0" }
-    , {"DCLK_imp", "v7;x;114750856;0-0;0;17820020;0/0;21603567/21621457/1;;~okv=;dcmt=text/xml;;~cs=o" }
-    }
-  ,.body= ""
-  }
-
-#define BONJOUR_MADAME_FR 8
-/* The client should not merge two headers fields when the first one doesn't
- * have a value.
- */
-, {.name= "bonjourmadame.fr"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.0 301 Moved Permanently\r\n"
-         "Date: Thu, 03 Jun 2010 09:56:32 GMT\r\n"
-         "Server: Apache/2.2.3 (Red Hat)\r\n"
-         "Cache-Control: public\r\n"
-         "Pragma: \r\n"
-         "Location: http://www.bonjourmadame.fr/\r\n"
-         "Vary: Accept-Encoding\r\n"
-         "Content-Length: 0\r\n"
-         "Content-Type: text/html; charset=UTF-8\r\n"
-         "Connection: keep-alive\r\n"
-         "\r\n"
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 0
-  ,.status_code= 301
-  ,.num_headers= 9
-  ,.headers=
-    { { "Date", "Thu, 03 Jun 2010 09:56:32 GMT" }
-    , { "Server", "Apache/2.2.3 (Red Hat)" }
-    , { "Cache-Control", "public" }
-    , { "Pragma", "" }
-    , { "Location", "http://www.bonjourmadame.fr/" }
-    , { "Vary",  "Accept-Encoding" }
-    , { "Content-Length", "0" }
-    , { "Content-Type", "text/html; charset=UTF-8" }
-    , { "Connection", "keep-alive" }
-    }
-  ,.body= ""
-  }
-
-#define SPACE_IN_FIELD_RES 9
-/* Should handle spaces in header fields */
-, {.name= "field space"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\r\n"
-         "Server: Microsoft-IIS/6.0\r\n"
-         "X-Powered-By: ASP.NET\r\n"
-         "en-US Content-Type: text/xml\r\n" /* this is the problem */
-         "Content-Type: text/xml\r\n"
-         "Content-Length: 16\r\n"
-         "Date: Fri, 23 Jul 2010 18:45:38 GMT\r\n"
-         "Connection: keep-alive\r\n"
-         "\r\n"
-         "<xml>hello</xml>" /* fake body */
-  ,.should_keep_alive= TRUE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 7
-  ,.headers=
-    { { "Server",  "Microsoft-IIS/6.0" }
-    , { "X-Powered-By", "ASP.NET" }
-    , { "en-US Content-Type", "text/xml" }
-    , { "Content-Type", "text/xml" }
-    , { "Content-Length", "16" }
-    , { "Date", "Fri, 23 Jul 2010 18:45:38 GMT" }
-    , { "Connection", "keep-alive" }
-    }
-  ,.body= "<xml>hello</xml>"
-  }
-
-
-#define RES_FIELD_UNDERSCORE 10
-/* Should handle spaces in header fields */
-, {.name= "field underscore"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 200 OK\r\n"
-         "Date: Tue, 28 Sep 2010 01:14:13 GMT\r\n"
-         "Server: Apache\r\n"
-         "Cache-Control: no-cache, must-revalidate\r\n"
-         "Expires: Mon, 26 Jul 1997 05:00:00 GMT\r\n"
-         ".et-Cookie: PlaxoCS=1274804622353690521; path=/; domain=.plaxo.com\r\n"
-         "Vary: Accept-Encoding\r\n"
-         "_eep-Alive: timeout=45\r\n" /* semantic value ignored */
-         "_onnection: Keep-Alive\r\n" /* semantic value ignored */
-         "Transfer-Encoding: chunked\r\n"
-         "Content-Type: text/html\r\n"
-         "Connection: close\r\n"
-         "\r\n"
-         "0\r\n\r\n"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 200
-  ,.num_headers= 11
-  ,.headers=
-    { { "Date", "Tue, 28 Sep 2010 01:14:13 GMT" }
-    , { "Server", "Apache" }
-    , { "Cache-Control", "no-cache, must-revalidate" }
-    , { "Expires", "Mon, 26 Jul 1997 05:00:00 GMT" }
-    , { ".et-Cookie", "PlaxoCS=1274804622353690521; path=/; domain=.plaxo.com" }
-    , { "Vary", "Accept-Encoding" }
-    , { "_eep-Alive", "timeout=45" }
-    , { "_onnection", "Keep-Alive" }
-    , { "Transfer-Encoding", "chunked" }
-    , { "Content-Type", "text/html" }
-    , { "Connection", "close" }
-    }
-  ,.body= ""
-  }
-
-#define NON_ASCII_IN_STATUS_LINE 11
-/* Should handle non-ASCII in status line */
-, {.name= "non-ASCII in status line"
-  ,.type= HTTP_RESPONSE
-  ,.raw= "HTTP/1.1 500 Oriëntatieprobleem\r\n"
-         "Date: Fri, 5 Nov 2010 23:07:12 GMT+2\r\n"
-         "Content-Length: 0\r\n"
-         "Connection: close\r\n"
-         "\r\n"
-  ,.should_keep_alive= FALSE
-  ,.message_complete_on_eof= FALSE
-  ,.http_major= 1
-  ,.http_minor= 1
-  ,.status_code= 500
-  ,.num_headers= 3
-  ,.headers=
-    { { "Date", "Fri, 5 Nov 2010 23:07:12 GMT+2" }
-    , { "Content-Length", "0" }
-    , { "Connection", "close" }
-    }
-  ,.body= ""
-  }
-
-
-, {.name= NULL } /* sentinel */
-};
-
 int
 request_path_cb (http_parser *p, const char *buf, size_t len)
 {
@@ -989,6 +113,7 @@ body_cb (http_parser *p, const char *buf, size_t len)
   assert(p == parser);
   strncat(messages[num_messages].body, buf, len);
   messages[num_messages].body_size += len;
+  if (pause_parser) http_parser_pause(p, 1);
  // printf("body_cb: '%s'\n", requests[num_messages].body);
   return 0;
 }
@@ -1020,6 +145,8 @@ headers_complete_cb (http_parser *p)
   messages[num_messages].http_minor = parser->http_minor;
   messages[num_messages].headers_complete_cb_called = TRUE;
   messages[num_messages].should_keep_alive = http_should_keep_alive(parser);
+  messages[num_messages].hop_by_hop = parser->hop_by_hop;
+  if (pause_parser) http_parser_pause(p, 1);
   return 0;
 }
 
@@ -1040,6 +167,7 @@ message_complete_cb (http_parser *p)
   messages[num_messages].message_complete_on_eof = currently_parsing_eof;
 
   num_messages++;
+  if (pause_parser) http_parser_pause(p, 1);
   return 0;
 }
 
@@ -1172,6 +300,7 @@ message_eq (int index, const struct message *expected)
   }
 
   MESSAGE_CHECK_NUM_EQ(expected, m, should_keep_alive);
+  MESSAGE_CHECK_NUM_EQ(expected, m, hop_by_hop);
   MESSAGE_CHECK_NUM_EQ(expected, m, message_complete_on_eof);
 
   assert(m->message_begin_cb_called);
@@ -1205,7 +334,8 @@ message_eq (int index, const struct message *expected)
 static void
 print_error (const char *raw, size_t error_location)
 {
-  fprintf(stderr, "\n*** parse error ***\n\n");
+  fprintf(stderr, "\n*** parse error: %s ***\n\n",
+          parser ? http_errno_description(HTTP_PARSER_ERRNO(parser)) : "?");
 
   int this_line = 0, char_len = 0;
   size_t i, j, len = strlen(raw), error_location_line = 0;
@@ -1289,6 +419,12 @@ test_message (const struct message *message)
 
   test:
 
+    if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
+      printf("\n*** %s after testing '%s' ***\n\n",
+             http_errno_name(HTTP_PARSER_ERRNO(parser)), message->name);
+      exit(1);
+    }
+
     if (num_messages != 1) {
       printf("\n*** num_messages != 1 after testing '%s' ***\n\n", message->name);
       exit(1);
@@ -1300,225 +436,2886 @@ test_message (const struct message *message)
   }
 }
 
+/* Feed the message to http_parser_execute_inplace() in two pieces, split
+ * at every byte.
+ */
 void
-test_message_count_body (const struct message *message)
+test_message_inplace (const struct message *message)
 {
-  parser_init(message->type);
+  size_t raw_len = strlen(message->raw);
+  size_t i, read;
+  char *copy = malloc(raw_len + 1);
 
-  size_t read;
-  size_t l = strlen(message->raw);
-  size_t i, toread;
-  size_t chunk = 4024;
+  for (i = 0; i < raw_len; i++) {
+    memcpy(copy, message->raw, raw_len);
+    parser_init(message->type);
+    currently_parsing_eof = 0;
+
+    /* a zero length read would be EOF */
+    read = i ? http_parser_execute_inplace(parser, &settings, copy, i) : 0;
+    if (!(message->upgrade && parser->upgrade)) {
+      assert(read == i);
+      read = http_parser_execute_inplace(parser, &settings, copy + i, raw_len - i);
+      if (!(message->upgrade && parser->upgrade)) {
+        if (read != raw_len - i) {
+          print_error(message->raw, i + read);
+          exit(1);
+        }
+        parse(NULL, 0);
+      }
+    }
 
-  for (i = 0; i < l; i+= chunk) {
-    toread = MIN(l-i, chunk);
-    read = parse_count_body(message->raw + i, toread);
-    if (read != toread) {
-      print_error(message->raw, read);
+    if (num_messages != 1) {
+      printf("\n*** num_messages != 1 after testing '%s' in place ***\n\n", message->name);
       exit(1);
     }
+
+    if(!message_eq(0, message)) exit(1);
+
+    parser_free();
   }
 
+  free(copy);
+}
 
-  read = parse_count_body(NULL, 0);
-  if (read != 0) {
-    print_error(message->raw, read);
-    exit(1);
+/* Pause in every callback that may, resume and pass the rest again */
+void
+test_message_pause (const struct message *message)
+{
+  const char *raw = message->raw;
+  size_t len = strlen(raw), read;
+  int pauses = 0;
+
+  parser_init(message->type);
+  pause_parser = 1;
+  while (len > 0) {
+    read = parse(raw, len);
+    if (message->upgrade && parser->upgrade) break;
+    if (HTTP_PARSER_ERRNO(parser) != HPE_PAUSED) {
+      if (read != len) {
+        print_error(message->raw, raw - message->raw + read);
+        exit(1);
+      }
+      break;
+    }
+    assert(read <= len);
+    assert(parse(raw + read, len - read) == 0);  /* nothing while paused */
+    http_parser_pause(parser, 0);
+    raw += read;
+    len -= read;
+    pauses++;
   }
+  pause_parser = 0;
+  if (!(message->upgrade && parser->upgrade)) parse(NULL, 0);
 
+  assert(pauses > 0 || message->upgrade);
   if (num_messages != 1) {
-    printf("\n*** num_messages != 1 after testing '%s' ***\n\n", message->name);
+    printf("\n*** num_messages != 1 after testing '%s' paused ***\n\n", message->name);
     exit(1);
   }
-
-  if(!message_eq(0, message)) exit(1);
+  if (!message_eq(0, message)) exit(1);
 
   parser_free();
 }
 
+/* Feed the message as three non-adjacent segments, split at every byte. */
 void
-test_simple (const char *buf, int should_pass)
+test_message_iov (const struct message *message)
 {
-  parser_init(HTTP_REQUEST);
+  size_t raw_len = strlen(message->raw);
+  size_t i, j, read;
+  char *copy = malloc(raw_len + 2);
+  struct iovec iov[3];
 
-  size_t parsed;
-  int pass;
-  parsed = parse(buf, strlen(buf));
-  pass = (parsed == strlen(buf));
-  parsed = parse(NULL, 0);
-  pass &= (parsed == 0);
+  for (i = 0; i < raw_len; i++) {
+    j = i + (raw_len - i) / 2;
 
-  parser_free();
+    /* leave a gap between segments so they can't be merged */
+    memcpy(copy, message->raw, i);
+    memcpy(copy + i + 1, message->raw + i, j - i);
+    memcpy(copy + j + 2, message->raw + j, raw_len - j);
 
-  if (pass != should_pass) {
-    fprintf(stderr, "\n*** test_simple expected %s ***\n\n%s", should_pass ? "success" : "error", buf);
-    exit(1);
-  }
-}
+    iov[0].iov_base = copy;
+    iov[0].iov_len = i;
+    iov[1].iov_base = copy + i + 1;
+    iov[1].iov_len = j - i;
+    iov[2].iov_base = copy + j + 2;
+    iov[2].iov_len = raw_len - j;
 
-void
-test_header_overflow_error (int req)
-{
-  http_parser parser;
-  http_parser_init(&parser, req ? HTTP_REQUEST : HTTP_RESPONSE);
-  size_t parsed;
-  const char *buf;
-  buf = req ? "GET / HTTP/1.1\r\n" : "HTTP/1.0 200 OK\r\n";
-  parsed = http_parser_execute(&parser, &settings_null, buf, strlen(buf));
-  assert(parsed == strlen(buf));
+    parser_init(message->type);
 
-  buf = "header-key: header-value\r\n";
-  int i;
-  for (i = 0; i < 10000; i++) {
-    if (http_parser_execute(&parser, &settings_null, buf, strlen(buf)) != strlen(buf)) {
-      //fprintf(stderr, "error found on iter %d\n", i);
-      return;
+    currently_parsing_eof = 0;
+    read = http_parser_execute_iov(parser, &settings, iov, 3);
+
+    if (!(message->upgrade && parser->upgrade)) {
+      if (read != raw_len) {
+        print_error(message->raw, read);
+        exit(1);
+      }
+      parse(NULL, 0);
     }
-  }
 
-  fprintf(stderr, "\n*** Error expected but none in header overflow test ***\n");
-  exit(1);
-}
+    if (num_messages != 1) {
+      printf("\n*** num_messages != 1 after testing '%s' with iov ***\n\n", message->name);
+      exit(1);
+    }
 
-void
-test_no_overflow_long_body (int req, size_t length)
-{
-  http_parser parser;
-  http_parser_init(&parser, req ? HTTP_REQUEST : HTTP_RESPONSE);
-  size_t parsed;
-  size_t i;
-  char buf1[3000];
-  size_t buf1len = sprintf(buf1, "%s\r\nConnection: Keep-Alive\r\nContent-Length: %zu\r\n\r\n",
-      req ? "POST / HTTP/1.0" : "HTTP/1.0 200 OK", length);
-  parsed = http_parser_execute(&parser, &settings_null, buf1, buf1len);
-  if (parsed != buf1len)
-    goto err;
+    if(!message_eq(0, message)) exit(1);
 
-  for (i = 0; i < length; i++) {
-    char foo = 'a';
-    parsed = http_parser_execute(&parser, &settings_null, &foo, 1);
-    if (parsed != 1)
-      goto err;
+    parser_free();
   }
 
-  parsed = http_parser_execute(&parser, &settings_null, buf1, buf1len);
-  if (parsed != buf1len) goto err;
-  return;
+  free(copy);
+}
 
- err:
-  fprintf(stderr,
-          "\n*** error in test_no_overflow_long_body %s of length %zu ***\n",
-          req ? "REQUEST" : "RESPONSE",
-          length);
-  exit(1);
+static int retain_field_calls;
+static int retain_url_calls;
+
+int
+retain_url_cb (http_parser *p, const char *buf, size_t len)
+{
+  retain_url_calls++;
+  return request_url_cb(p, buf, len);
+}
+
+int
+retain_header_field_cb (http_parser *p, const char *buf, size_t len)
+{
+  retain_field_calls++;
+  return header_field_cb(p, buf, len);
 }
 
+/* Receive the message 'step' bytes at a time into a buffer which only
+ * keeps what http_parser_retained() asks for. Every token must reach the
+ * callbacks in one piece.
+ */
 void
-test_multiple3 (const struct message *r1, const struct message *r2, const struct message *r3)
+test_message_retain (const struct message *message, size_t step)
 {
-  int message_count = 1;
-  if (!r1->upgrade) {
-    message_count++;
-    if (!r2->upgrade) message_count++;
-  }
-  int has_upgrade = (message_count < 3 || r3->upgrade);
+  http_parser_settings s = settings;
+  s.on_url = retain_url_cb;
+  s.on_header_field = retain_header_field_cb;
 
-  char total[ strlen(r1->raw)
-            + strlen(r2->raw)
-            + strlen(r3->raw)
-            + 1
-            ];
-  total[0] = '\0';
+  size_t raw_len = strlen(message->raw);
+  size_t off = 0, have = 0, n, read, keep;
+  char buf[MAX_ELEMENT_SIZE * 2];
 
-  strcat(total, r1->raw);
-  strcat(total, r2->raw);
-  strcat(total, r3->raw);
+  parser_init(message->type);
+  http_parser_set_retain(parser, 1);
+  retain_field_calls = 0;
+  retain_url_calls = 0;
+  currently_parsing_eof = 0;
 
-  parser_init(r1->type);
+  while (off < raw_len) {
+    n = MIN(step, raw_len - off);
+    assert(have + n <= sizeof buf);
+    memcpy(buf + have, message->raw + off, n);
+    off += n;
 
-  size_t read;
+    read = http_parser_execute(parser, &s, buf, have + n);
 
-  read = parse(total, strlen(total));
+    if (message->upgrade && parser->upgrade) goto test;
 
-  if (has_upgrade && parser->upgrade) goto test;
+    if (read != have + n) {
+      print_error(message->raw, off - n + read - have);
+      exit(1);
+    }
 
-  if (read != strlen(total)) {
-    print_error(total, read);
-    exit(1);
-  }
+    keep = http_parser_retained(parser);
+    assert(keep <= read);
 
-  read = parse(NULL, 0);
+    /* only the retained bytes survive, poison the rest */
+    memmove(buf, buf + read - keep, keep);
+    memset(buf + keep, '@', sizeof buf - keep);
+    have = keep;
+  }
 
-  if (has_upgrade && parser->upgrade) goto test;
+  assert(have == 0);
+  parse(NULL, 0);
 
-  if (read != 0) {
-    print_error(total, read);
+test:
+  if (num_messages != 1) {
+    printf("\n*** num_messages != 1 after testing '%s' in retain mode ***\n\n", message->name);
     exit(1);
   }
 
-test:
+  if (!message_eq(0, message)) exit(1);
 
-  if (message_count != num_messages) {
-    fprintf(stderr, "\n\n*** Parser didn't see 3 messages only %d *** \n", num_messages);
+  if (retain_field_calls != message->num_headers
+      || retain_url_calls != (message->type == HTTP_REQUEST)) {
+    printf("\n*** token split in retain mode in '%s' ***\n\n", message->name);
     exit(1);
   }
 
-  if (!message_eq(0, r1)) exit(1);
-  if (message_count > 1) {
-    if (!message_eq(1, r2)) exit(1);
-    if (message_count > 2) {
-      if (!message_eq(2, r3)) exit(1);
-    }
-  }
-
   parser_free();
 }
 
-/* SCAN through every possible breaking to make sure the
- * parser can handle getting the content in any chunks that
- * might come from the socket
+/* Snapshot the parser at every byte offset and continue with a restored
+ * copy in a freshly allocated, poisoned parser.
  */
 void
-test_scan (const struct message *r1, const struct message *r2, const struct message *r3)
+test_message_snapshot (const struct message *message, int retain)
 {
-  char total[80*1024] = "\0";
-  char buf1[80*1024] = "\0";
-  char buf2[80*1024] = "\0";
-  char buf3[80*1024] = "\0";
+  size_t raw_len = strlen(message->raw);
+  size_t i, read, keep;
+  char snap[HTTP_PARSER_SNAPSHOT_SIZE];
+  http_parser *restored;
 
-  strcat(total, r1->raw);
-  strcat(total, r2->raw);
-  strcat(total, r3->raw);
+  for (i = 0; i <= raw_len; i++) {
+    parser_init(message->type);
+    http_parser_set_retain(parser, retain);
 
-  size_t read;
+    read = parse(message->raw, i);
+    if (message->upgrade && parser->upgrade) goto test;
+    if (read != i) {
+      print_error(message->raw, read);
+      exit(1);
+    }
 
-  int total_len = strlen(total);
+    keep = http_parser_retained(parser);
 
-  int total_ops = 2 * (total_len - 1) * (total_len - 2) / 2;
-  int ops = 0 ;
+    assert(http_parser_snapshot(parser, snap, sizeof snap - 1) == 0);
+    assert(http_parser_snapshot(parser, snap, sizeof snap) == HTTP_PARSER_SNAPSHOT_SIZE);
 
-  size_t buf1_len, buf2_len, buf3_len;
+    restored = malloc(sizeof(http_parser));
+    memset(restored, 0xff, sizeof(http_parser));
+    assert(http_parser_restore(restored, snap, sizeof snap - 1) == -1);
+    assert(http_parser_restore(restored, snap, sizeof snap) == 0);
+    restored->data = parser->data;
+    restored->stats = parser->stats;
+    restored->timing = parser->timing;
+    restored->key = parser->key;
+    parser_free();
+    parser = restored;
 
-  int i,j,type_both;
-  for (type_both = 0; type_both < 2; type_both ++ ) {
-    for (j = 2; j < total_len; j ++ ) {
-      for (i = 1; i < j; i ++ ) {
+    /* a zero length read would be EOF */
+    if (i - keep < raw_len) {
+      read = parse(message->raw + i - keep, raw_len - i + keep);
+      if (message->upgrade && parser->upgrade) goto test;
+      if (read != raw_len - i + keep) {
+        print_error(message->raw, i - keep + read);
+        exit(1);
+      }
+    }
+    parse(NULL, 0);
 
-        if (ops % 1000 == 0)  {
-          printf("\b\b\b\b%3.0f%%", 100 * (float)ops /(float)total_ops);
-          fflush(stdout);
-        }
-        ops += 1;
+test:
+    if (num_messages != 1) {
+      printf("\n*** num_messages != 1 after testing '%s' with snapshot at %u ***\n\n",
+             message->name, (unsigned)i);
+      exit(1);
+    }
 
-        parser_init(type_both ? HTTP_BOTH : r1->type);
+    if (!message_eq(0, message)) exit(1);
 
-        buf1_len = i;
-        strncpy(buf1, total, buf1_len);
-        buf1[buf1_len] = 0;
+    parser_free();
+  }
+}
 
-        buf2_len = j - i;
-        strncpy(buf2, total+i, buf2_len);
-        buf2[buf2_len] = 0;
+void
+test_snapshot_errors (void)
+{
+  char snap[HTTP_PARSER_SNAPSHOT_SIZE];
+  http_parser parser, restored;
+
+  http_parser_init(&parser, HTTP_REQUEST);
+  assert(http_parser_snapshot(&parser, snap, sizeof snap) == sizeof snap);
+  assert(snap[0] == HTTP_PARSER_SNAPSHOT_VERSION);
+
+  /* the parser is not touched when the snapshot is refused */
+  memset(&restored, 0, sizeof restored);
+  snap[0]++;
+  assert(http_parser_restore(&restored, snap, sizeof snap) == -1);
+  assert(restored.state == 0);
+  snap[0]--;
+
+  /* state out of range */
+  snap[3] = (char) 0xff;
+  assert(http_parser_restore(&restored, snap, sizeof snap) == -1);
+  assert(restored.state == 0);
+}
+
+size_t
+head_len (const char *raw)
+{
+  return strstr(raw, "\r\n\r\n") + 4 - raw;
+}
+
+static int
+abort_url_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  (void)at;
+  (void)len;
+  return -1;
+}
+
+#if HTTP_PARSER_STATS
+void
+test_stats (void)
+{
+  const struct message *chunked = &requests[CHUNKED_W_TRAILING_HEADERS];
+  const struct message *connect = &requests[CONNECT_REQUEST];
+  struct http_parser_stats stats, total;
+  http_parser_settings abort_url = settings_null;
+  http_parser parser;
+  char buf[4096];
+  size_t len;
+
+  memset(&stats, 0, sizeof stats);
+  memset(&total, 0, sizeof total);
+  abort_url.on_url = abort_url_cb;
+
+  /* pipelined: a chunked request with trailers, then a tunnel */
+  len = strlen(chunked->raw);
+  memcpy(buf, chunked->raw, len);
+  strcpy(buf + len, connect->raw);
+
+  http_parser_init(&parser, HTTP_REQUEST);
+  parser.stats = &stats;
+  http_parser_execute(&parser, &settings_null, buf, strlen(buf));
+  assert(parser.upgrade);
+
+  assert(stats.messages == 2);
+  assert(stats.head_bytes == head_len(chunked->raw) + strlen(connect->raw));
+  assert(stats.body_bytes == strlen(chunked->body));
+  assert(stats.headers == (uint64_t) (chunked->num_headers + connect->num_headers));
+  assert(stats.chunks == 2);
+  assert(stats.upgrades == 1);
+  assert(stats.connects == 1);
+
+  /* a bad method, then more data on the dead connection */
+  http_parser_init(&parser, HTTP_REQUEST);
+  parser.stats = &stats;
+  http_parser_execute(&parser, &settings_null, "XET / HTTP/1.1\r\n", 16);
+  http_parser_execute(&parser, &settings_null, "GET", 3);
+  assert(stats.errors[HPE_INVALID_METHOD] == 1);
+  assert(stats.errors[HPE_CLOSED_CONNECTION] == 1);
+
+  /* a callback failure and a misuse are errors too, a pause is not */
+  http_parser_init(&parser, HTTP_REQUEST);
+  parser.stats = &stats;
+  http_parser_execute(&parser, &abort_url, "GET / HTTP/1.1\r\n\r\n", 18);
+  http_parser_set_retain(&parser, 1);
+  http_parser_execute_iov(&parser, &settings_null, NULL, 0);
+  assert(stats.errors[HPE_CB_url] == 1);
+  assert(stats.errors[HPE_INVALID_ARGUMENT] == 1);
+
+  http_parser_stats_merge(&total, &stats);
+  http_parser_stats_merge(&total, &stats);
+  assert(total.messages == 4);
+  assert(total.errors[HPE_INVALID_METHOD] == 2);
+
+  len = http_parser_stats_format(&total, buf, sizeof buf);
+  assert(len > 0 && len == strlen(buf));
+  assert(strstr(buf, "# TYPE http_parser_messages_total counter\n"
+                     "http_parser_messages_total 4\n"));
+  assert(strstr(buf, "\nhttp_parser_errors_total{errno=\"HPE_CLOSED_CONNECTION\"} 2\n"));
+  assert(strstr(buf, "\nhttp_parser_errors_total{errno=\"HPE_CB_url\"} 2\n"));
+  assert(!strstr(buf, "HPE_PAUSED"));
+
+  assert(http_parser_stats_format(&total, buf, len) == 0);
+}
+#endif
+
+#if HTTP_PARSER_TIMING
+static uint64_t fake_now;
+static struct http_parser_timing timing_seen;
+
+static uint64_t
+fake_clock (void)
+{
+  return ++fake_now;
+}
+
+static int
+slow_header_field_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  (void)at;
+  (void)len;
+  fake_now += 1000;
+  return 0;
+}
+
+static int
+timing_complete_cb (http_parser *p)
+{
+  timing_seen = *p->timing;
+  return 0;
+}
+
+void
+test_timing (void)
+{
+  const struct message *m = &requests[POST_IDENTITY_BODY_WORLD];
+  size_t head = head_len(m->raw), len = strlen(m->raw);
+  struct http_parser_timing timing;
+  http_parser_settings s = settings_null;
+  http_parser parser;
+  uint64_t t;
+
+  s.on_message_complete = timing_complete_cb;
+
+  /* caller supplied time, one timestamp per call */
+  memset(&timing, 0, sizeof timing);
+  http_parser_init(&parser, HTTP_REQUEST);
+  parser.timing = &timing;
+
+  timing.now = 100;
+  assert(http_parser_execute(&parser, &s, m->raw, 10) == 10);
+  timing.now = 200;
+  assert(http_parser_execute(&parser, &s, m->raw + 10, head - 10) == head - 10);
+  timing.now = 300;
+  assert(http_parser_execute(&parser, &s, m->raw + head, len - head) == len - head);
+
+  assert(timing_seen.begin == 100);
+  assert(timing_seen.headers_complete == 200);
+  assert(timing_seen.message_complete == 300);
+  assert(timing_seen.in_callbacks == 0 && timing_seen.in_parser == 0);
+
+  /* with a clock, each header callback takes 1000 ticks */
+  memset(&timing, 0, sizeof timing);
+  timing.clock = fake_clock;
+  s.on_header_field = slow_header_field_cb;
+  fake_now = 0;
+  http_parser_init(&parser, HTTP_REQUEST);
+  parser.timing = &timing;
+
+  assert(http_parser_execute(&parser, &s, m->raw, len) == len);
+
+  assert(0 < timing_seen.begin);
+  assert(timing_seen.begin < timing_seen.headers_complete);
+  assert(timing_seen.headers_complete < timing_seen.message_complete);
+  assert(timing_seen.in_callbacks >= 1000 * (uint64_t) m->num_headers);
+  assert(timing_seen.in_callbacks < 1000 * (uint64_t) m->num_headers + 100);
+  assert(0 < timing_seen.in_parser && timing_seen.in_parser < 100);
+  assert(timing_seen.in_callbacks + timing_seen.in_parser
+         == timing_seen.message_complete - timing_seen.begin);
+
+  t = http_parser_clock();
+  assert(http_parser_clock() >= t);
+}
+#endif
+
+/* Parse 'buf' followed by EOF and check why the parser stopped. */
+static void
+expect_errno (enum http_parser_type type,
+              const http_parser_settings *s,
+              const char *buf,
+              size_t len,
+              enum http_errno err)
+{
+  http_parser p;
+  size_t parsed;
+
+  http_parser_init(&p, type);
+  parsed = http_parser_execute(&p, s, buf, len);
+  if (parsed == len) http_parser_execute(&p, s, NULL, 0);
+
+  if (HTTP_PARSER_ERRNO(&p) != err) {
+    printf("\n*** expected %s, got %s for ***\n%.*s\n\n",
+           http_errno_name(err),
+           http_errno_name(HTTP_PARSER_ERRNO(&p)),
+           (int)MIN(len, 256),
+           buf);
+    exit(1);
+  }
+}
+
+#define EXPECT_ERRNO(type, buf, err) \
+  expect_errno(type, &settings_null, buf, strlen(buf), err)
+
+void
+test_errno (void)
+{
+  http_parser_settings s = settings_null;
+  size_t len;
+  char *buf;
+
+  assert(0 == strcmp(http_errno_name(HPE_OK), "HPE_OK"));
+  assert(0 == strcmp(http_errno_description(HPE_INVALID_METHOD),
+                     "invalid HTTP method"));
+
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/1.1\r\n\r\n", HPE_OK);
+  EXPECT_ERRNO(HTTP_REQUEST, "XET / HTTP/1.1\r\n\r\n", HPE_INVALID_METHOD);
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/01.1\r\n\r\n", HPE_INVALID_VERSION);
+  EXPECT_ERRNO(HTTP_RESPONSE, "HTTP/1.1 2x0 OK\r\n\r\n", HPE_INVALID_STATUS);
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/1.1\r\nFo@o: bar\r\n\r\n",
+               HPE_INVALID_HEADER_TOKEN);
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+               HPE_INVALID_CONTENT_LENGTH);
+  EXPECT_ERRNO(HTTP_REQUEST, "POST / HTTP/1.1\r\n"
+                             "Transfer-Encoding: chunked\r\n\r\n"
+                             "zz\r\n",
+               HPE_INVALID_CHUNK_SIZE);
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/1.1\r\nHost: a", HPE_INVALID_EOF_STATE);
+  EXPECT_ERRNO(HTTP_RESPONSE, "HTTP/1.0 200 OK\r\n\r\nbody", HPE_OK);
+
+#if HTTP_PARSER_STRICT
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/1.1\r\nHost: a\rX", HPE_STRICT);
+  EXPECT_ERRNO(HTTP_REQUEST, "GET / HTTP/1.1\r\n"
+                             "Connection: close\r\n\r\n"
+                             "GET / HTTP/1.1\r\n\r\n",
+               HPE_CLOSED_CONNECTION);
+#endif
+
+  s.on_url = abort_url_cb;
+  expect_errno(HTTP_REQUEST, &s, "GET / HTTP/1.1\r\n\r\n", 18, HPE_CB_url);
+
+  /* a stream cut short leaves the parser dead too */
+  {
+    const char *cut = "GET / HTTP/1.1\r\nHost: a";
+    http_parser p;
+
+    http_parser_init(&p, HTTP_REQUEST);
+    assert(http_parser_execute(&p, &settings_null, cut, strlen(cut))
+           == strlen(cut));
+    assert(http_parser_execute(&p, &settings_null, NULL, 0) == 0);
+    assert(HTTP_PARSER_ERRNO(&p) == HPE_INVALID_EOF_STATE);
+    assert(http_parser_execute(&p, &settings_null, "\r\n\r\n", 4) == 0);
+    assert(HTTP_PARSER_ERRNO(&p) != HPE_OK);
+    assert(http_parser_expected_bytes(&p, NULL, NULL) == HTTP_EXPECT_NONE);
+  }
+
+  len = HTTP_MAX_HEADER_SIZE + 100;
+  buf = malloc(len);
+  memcpy(buf, "GET / HTTP/1.1\r\nX: ", 20);
+  memset(buf + 20, 'a', len - 20);
+  expect_errno(HTTP_REQUEST, &settings_null, buf, len, HPE_HEADER_OVERFLOW);
+  free(buf);
+}
+
+/* Set for parse_limited() to parse in route mode */
+static int limit_route;
+
+/* Parse 'buf' 'step' bytes at a time, then EOF. Returns the offset where
+ * the parser stopped and stores the errno.
+ */
+static size_t
+parse_limited (const struct http_parser_limits *limits,
+               enum http_parser_type type,
+               const char *buf,
+               size_t step,
+               enum http_errno *err)
+{
+  http_parser_settings s = settings_null;
+  http_parser p;
+  size_t len = strlen(buf), off = 0, n, parsed;
+
+  s.limits = limits;
+  http_parser_init(&p, type);
+  http_parser_set_route(&p, limit_route);
+
+  while (off < len) {
+    n = MIN(step, len - off);
+    parsed = http_parser_execute(&p, &s, buf + off, n);
+    off += parsed;
+    if (parsed != n || p.upgrade) break;
+  }
+  if (off == len && !p.upgrade) http_parser_execute(&p, &s, NULL, 0);
+
+  *err = HTTP_PARSER_ERRNO(&p);
+  return off;
+}
+
+/* 'offset' is where the message must be rejected, both when it arrives in
+ * one piece and byte by byte.
+ */
+static void
+expect_limit (const struct http_parser_limits *limits,
+              enum http_parser_type type,
+              const char *buf,
+              enum http_errno err,
+              size_t offset)
+{
+  enum http_errno got;
+  size_t step, off;
+
+  for (step = 1; step <= strlen(buf); step += strlen(buf) - 1) {
+    off = parse_limited(limits, type, buf, step, &got);
+    if (got != err || off != offset) {
+      printf("\n*** expected %s at %u, got %s at %u (step %u) for ***\n%s\n\n",
+             http_errno_name(err), (unsigned)offset,
+             http_errno_name(got), (unsigned)off,
+             (unsigned)step, buf);
+      exit(1);
+    }
+  }
+}
+
+void
+test_limits (void)
+{
+  struct http_parser_limits limits;
+  enum http_errno err;
+  const char *url = "GET /abcde HTTP/1.1\r\n\r\n";
+  const char *headers = "GET / HTTP/1.1\r\nAb: cd\r\nEf: gh\r\n\r\n";
+  const char *length = "POST / HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789";
+  const char *chunked = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                        "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+  const char *eof = "HTTP/1.0 200 OK\r\n\r\nabcdef";
+  int i;
+
+  /* the corpus passes with budgets it fits into */
+  memset(&limits, 0, sizeof limits);
+  limits.max_head_size = 4096;
+  limits.max_url_size = 128;
+  limits.max_header_size = 256;
+  limits.max_headers = MAX_HEADERS;
+  limits.max_body_size = MAX_ELEMENT_SIZE;
+  for (i = 0; requests[i].name; i++) {
+    parse_limited(&limits, HTTP_REQUEST, requests[i].raw, 1, &err);
+    assert(err == HPE_OK);
+  }
+  for (i = 0; responses[i].name; i++) {
+    parse_limited(&limits, HTTP_RESPONSE, responses[i].raw, 1, &err);
+    assert(err == HPE_OK);
+  }
+
+  /* head */
+  memset(&limits, 0, sizeof limits);
+  limits.max_head_size = strlen(headers);
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_OK, strlen(headers));
+  limits.max_head_size--;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_HEADER_OVERFLOW, strlen(headers) - 1);
+
+  /* URL, rejected at its 6th byte */
+  memset(&limits, 0, sizeof limits);
+  limits.max_url_size = 6;
+  expect_limit(&limits, HTTP_REQUEST, url, HPE_OK, strlen(url));
+  limits.max_url_size = 5;
+  expect_limit(&limits, HTTP_REQUEST, url, HPE_URL_OVERFLOW, 9);
+
+  /* header line "Ab: cd", rejected at 'd' */
+  memset(&limits, 0, sizeof limits);
+  limits.max_header_size = 6;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_OK, strlen(headers));
+  limits.max_header_size = 5;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_HEADER_LINE_OVERFLOW, 21);
+
+  /* header count, rejected at the start of the second field */
+  memset(&limits, 0, sizeof limits);
+  limits.max_headers = 2;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_OK, strlen(headers));
+  limits.max_headers = 1;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_TOO_MANY_HEADERS, 24);
+
+  /* Content-Length, rejected at the end of the head */
+  memset(&limits, 0, sizeof limits);
+  limits.max_body_size = 10;
+  expect_limit(&limits, HTTP_REQUEST, length, HPE_OK, strlen(length));
+  limits.max_body_size = 9;
+  expect_limit(&limits, HTTP_REQUEST, length, HPE_BODY_OVERFLOW, head_len(length) - 1);
+
+  /* chunked, rejected at the size of the second chunk */
+  limits.max_body_size = 11;
+  expect_limit(&limits, HTTP_REQUEST, chunked, HPE_OK, strlen(chunked));
+  limits.max_body_size = 10;
+  expect_limit(&limits, HTTP_REQUEST, chunked, HPE_BODY_OVERFLOW, head_len(chunked) + 10);
+
+  /* read until EOF, rejected at the first byte over */
+  limits.max_body_size = 6;
+  expect_limit(&limits, HTTP_RESPONSE, eof, HPE_OK, strlen(eof));
+  limits.max_body_size = 4;
+  expect_limit(&limits, HTTP_RESPONSE, eof, HPE_BODY_OVERFLOW, head_len(eof) + 4);
+}
+
+static char route_log[1024];
+static char route_host[256];
+static uint32_t route_heads[2];
+static int route_messages;
+
+static void
+route_append (char *log, size_t size, const char *at, size_t len)
+{
+  size_t n = strlen(log);
+
+  assert(n + len < size);
+  memcpy(log + n, at, len);
+  log[n + len] = '\0';
+}
+
+static int
+route_field_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  route_append(route_log, sizeof route_log, "\n", 1);
+  route_append(route_log, sizeof route_log, at, len);
+  route_append(route_log, sizeof route_log, ": ", 2);
+  return 0;
+}
+
+static int
+route_data_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  route_append(route_log, sizeof route_log, at, len);
+  return 0;
+}
+
+static int
+route_host_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  route_append(route_host, sizeof route_host, at, len);
+  return 0;
+}
+
+static int
+route_headers_complete_cb (http_parser *p)
+{
+  route_heads[route_messages] = http_parser_head_length(p);
+  route_append(route_log, sizeof route_log, "\n\n", 2);
+  return 0;
+}
+
+static int
+route_message_complete_cb (http_parser *p)
+{
+  (void)p;
+  route_messages++;
+  route_append(route_log, sizeof route_log, "$", 1);
+  return 0;
+}
+
+/* Parses 'buf' in two pieces split at 'split' */
+static void
+parse_route (const http_parser_settings *s,
+             int route,
+             const char *buf,
+             size_t split)
+{
+  http_parser p;
+  size_t len = strlen(buf);
+
+  route_log[0] = route_host[0] = '\0';
+  route_messages = 0;
+
+  http_parser_init(&p, HTTP_REQUEST);
+  http_parser_set_route(&p, route);
+  assert(http_parser_execute(&p, s, buf, split) == split);
+  assert(http_parser_execute(&p, s, buf + split, len - split) == len - split);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_OK);
+}
+
+void
+test_route (void)
+{
+  static const char * const names[] = { "x-trace", "cookie", NULL };
+  const char *first =
+    "GET /x HTTP/1.1\r\n"
+    "User-Agent: curl\r\n"
+    "Host: example.com\r\n"
+    "X-Trace: abc\r\n"
+    "X-Tr: not a route header\r\n"
+    "X-Traces: nor this one\r\n"
+    "Cookie: a=b\r\n"
+    "Content-Length: 5\r\n"
+    "X-Skipped: \x01 not validated\r\n"
+    "\r\n"
+    "hello";
+  const char *second =
+    "GET /y HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "host:b\r\n"
+    "\r\n"
+    "3\r\nabc\r\n0\r\n\r\n";
+  http_parser_settings s;
+  struct http_parser_limits limits;
+  const char *headers = "GET / HTTP/1.1\r\nAb: cd\r\nEf: gh\r\n\r\n";
+  char buf[1024];
+  size_t i;
+
+  strcpy(buf, first);
+  strcat(buf, second);
+
+  memset(&s, 0, sizeof s);
+  s.on_header_field = route_field_cb;
+  s.on_header_value = route_data_cb;
+  s.on_body = route_data_cb;
+  s.on_host = route_host_cb;
+  s.on_headers_complete = route_headers_complete_cb;
+  s.on_message_complete = route_message_complete_cb;
+  s.route_headers = names;
+
+  for (i = 0; i <= strlen(buf); i++) {
+    /* only the route headers, framing still works */
+    parse_route(&s, 1, buf, i);
+    assert(route_messages == 2);
+    assert(0 == strcmp(route_log, "\nx-trace: abc\ncookie: a=b\n\nhello$"
+                                  "\n\nabc$"));
+    assert(0 == strcmp(route_host, "example.comb"));
+    assert(route_heads[0] == head_len(first));
+    assert(route_heads[1] == head_len(second));
+
+    /* on_host and the head length outside route mode */
+    s.on_header_field = NULL;
+    s.on_header_value = NULL;
+    parse_route(&s, 0, buf, i);
+    assert(route_messages == 2);
+    assert(0 == strcmp(route_host, "example.comb"));
+    assert(route_heads[0] == head_len(first));
+    assert(route_heads[1] == head_len(second));
+    s.on_header_field = route_field_cb;
+    s.on_header_value = route_data_cb;
+  }
+
+  /* skipped lines count against the limits as usual */
+  limit_route = 1;
+
+  memset(&limits, 0, sizeof limits);
+  limits.max_head_size = 20;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_HEADER_OVERFLOW, 20);
+
+  memset(&limits, 0, sizeof limits);
+  limits.max_header_size = 6;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_OK, strlen(headers));
+  limits.max_header_size = 5;
+  expect_limit(&limits, HTTP_REQUEST, headers, HPE_HEADER_LINE_OVERFLOW, 21);
+
+  limit_route = 0;
+}
+
+static uint64_t key_seen;
+
+static int
+key_headers_complete_cb (http_parser *p)
+{
+  key_seen = p->key->hash;
+  return 0;
+}
+
+/* Key of the request in 'buf' as seen in on_headers_complete, parsed in
+ * two pieces split at 'split'.
+ */
+static uint64_t
+parse_key (const char *buf, uint64_t seed, int route, int retain, size_t split)
+{
+  static const char * const names[] = { "accept", "cookie", NULL };
+  http_parser_settings s = settings_null;
+  struct http_parser_key key;
+  http_parser p;
+  size_t len = strlen(buf), keep;
+
+  s.on_headers_complete = key_headers_complete_cb;
+  s.route_headers = names;
+
+  memset(&key, 0, sizeof key);
+  key.seed = seed;
+  key_seen = 0;
+
+  http_parser_init(&p, HTTP_REQUEST);
+  http_parser_set_route(&p, route);
+  http_parser_set_retain(&p, retain);
+  p.key = &key;
+
+  assert(http_parser_execute(&p, &s, buf, split) == split);
+  keep = http_parser_retained(&p);
+  assert(http_parser_execute(&p, &s, buf + split - keep, len - split + keep)
+         == len - split + keep);
+  assert(key_seen == key.hash);
+  return key_seen;
+}
+
+void
+test_key (void)
+{
+  const char *req = "GET /a?b=c HTTP/1.1\r\n"
+                    "Host: example.com\r\n"
+                    "User-Agent: curl\r\n"
+                    "Accept: text/html\r\n"
+                    "Cookie: session=0123456789abcdef\r\n"
+                    "\r\n";
+  uint64_t hash = parse_key(req, 1, 0, 0, 0);
+  size_t i;
+
+  /* however it arrives, in any mode */
+  for (i = 0; i <= strlen(req); i++) {
+    assert(parse_key(req, 1, 0, 0, i) == hash);
+    assert(parse_key(req, 1, 1, 0, i) == hash);
+    assert(parse_key(req, 1, 0, 1, i) == hash);
+  }
+
+  /* headers not routed on don't matter */
+  assert(hash == parse_key("GET /a?b=c HTTP/1.1\r\n"
+                           "Host: example.com\r\n"
+                           "Accept: text/html\r\n"
+                           "Cookie: session=0123456789abcdef\r\n"
+                           "X-Forwarded-For: 10.0.0.1\r\n"
+                           "\r\n", 1, 0, 0, 0));
+
+  /* everything else does */
+  assert(hash != parse_key(req, 2, 0, 0, 0));
+  assert(hash != parse_key("HEAD /a?b=c HTTP/1.1\r\n"
+                           "Host: example.com\r\n"
+                           "Accept: text/html\r\n"
+                           "Cookie: session=0123456789abcdef\r\n"
+                           "\r\n", 1, 0, 0, 0));
+  assert(hash != parse_key("GET /a?b=d HTTP/1.1\r\n"
+                           "Host: example.com\r\n"
+                           "Accept: text/html\r\n"
+                           "Cookie: session=0123456789abcdef\r\n"
+                           "\r\n", 1, 0, 0, 0));
+  assert(hash != parse_key("GET /a?b=c HTTP/1.1\r\n"
+                           "Host: example.org\r\n"
+                           "Accept: text/html\r\n"
+                           "Cookie: session=0123456789abcdef\r\n"
+                           "\r\n", 1, 0, 0, 0));
+  assert(hash != parse_key("GET /a?b=c HTTP/1.1\r\n"
+                           "Host: example.com\r\n"
+                           "Accept: text/html\r\n"
+                           "Cookie: session=0123456789abcdeF\r\n"
+                           "\r\n", 1, 0, 0, 0));
+
+  /* which value is which */
+  assert(parse_key("GET / HTTP/1.1\r\nAccept: a\r\n\r\n", 1, 0, 0, 0)
+         != parse_key("GET / HTTP/1.1\r\nCookie: a\r\n\r\n", 1, 0, 0, 0));
+  assert(parse_key("GET /ab HTTP/1.1\r\nHost: c\r\n\r\n", 1, 0, 0, 0)
+         != parse_key("GET /a HTTP/1.1\r\nHost: bc\r\n\r\n", 1, 0, 0, 0));
+}
+
+static int inplace_calls;
+static char inplace_body[64];
+
+static int
+inplace_body_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  inplace_calls++;
+  strncat(inplace_body, at, len);
+  return 0;
+}
+
+/* Number of on_body calls for 'buf' parsed in place in 'step' byte pieces
+ * with 'coalesce'. The body must be "hello world".
+ */
+static int
+inplace_body_calls (const char *raw, size_t step, size_t coalesce)
+{
+  http_parser_settings s = settings_null;
+  http_parser p;
+  char buf[256];
+  size_t len = strlen(raw), off, n;
+
+  strcpy(buf, raw);
+  s.on_body = inplace_body_cb;
+  s.body_coalesce = coalesce;
+  inplace_calls = 0;
+  inplace_body[0] = '\0';
+
+  http_parser_init(&p, HTTP_RESPONSE);
+  for (off = 0; off < len; off += n) {
+    n = MIN(step, len - off);
+    assert(http_parser_execute_inplace(&p, &s, buf + off, n) == n);
+  }
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_OK);
+  assert(0 == strcmp(inplace_body, "hello world"));
+  return inplace_calls;
+}
+
+void
+test_inplace (void)
+{
+  const char *tiny =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "1\r\nh\r\n1\r\ne\r\n1\r\nl\r\n2\r\nlo\r\n"
+    "1\r\n \r\n3;ext=1\r\nwor\r\n2\r\nld\r\n"
+    "0\r\nTrailer: x\r\n\r\n";
+  char buf[256];
+  http_parser p;
+
+  /* all of it in one piece, the rest of the buffer untouched */
+  assert(inplace_body_calls(tiny, strlen(tiny), 0) == 1);
+  strcpy(buf, tiny);
+  http_parser_init(&p, HTTP_RESPONSE);
+  http_parser_execute_inplace(&p, &settings_null, buf, strlen(buf));
+  assert(0 == memcmp(buf + head_len(tiny) + 3, "hello world", 11));
+  assert(0 == strcmp(strstr(buf, "0\r\nTrailer"), "0\r\nTrailer: x\r\n\r\n"));
+
+  /* once at least 3 bytes are together: "hel" "lo " "wor" "ld" */
+  assert(inplace_body_calls(tiny, strlen(tiny), 3) == 4);
+
+  /* nothing held back across calls */
+  assert(inplace_body_calls(tiny, 1, 0) == 11);
+  assert(inplace_body_calls(tiny, 10, 0) > 1);
+}
+
+static const char *span_at[2];
+static size_t span_len[2];
+static int nspans;
+
+static int
+span_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  assert(nspans < 2);
+  span_at[nspans] = at;
+  span_len[nspans] = len;
+  nspans++;
+  return 0;
+}
+
+void
+test_dechunk (void)
+{
+  const char *first =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "1\r\nh\r\n1\r\ne\r\n1\r\nl\r\n2\r\nlo\r\n"
+    "1\r\n \r\n3;ext=1\r\nwor\r\n2\r\nld\r\n"
+    "0\r\nTrailer: x\r\n\r\n";
+  const char *second =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "0\r\n\r\n";
+  http_parser_settings s = settings_null;
+  http_parser p;
+  char raw[256], buf[256];
+  size_t len, i, j;
+
+  strcpy(raw, first);
+  strcat(raw, second);
+  len = strlen(raw);
+  s.on_body = inplace_body_cb;
+  s.on_body_span = span_cb;
+
+  /* the body ends up right after the head, however the calls split it */
+  for (i = 1; i < len; i++) {
+    for (j = i + 1; j < len; j++) {
+      memcpy(buf, raw, len);
+      nspans = 0;
+      inplace_body[0] = '\0';
+
+      http_parser_init(&p, HTTP_RESPONSE);
+      http_parser_set_dechunk(&p, 1);
+      assert(http_parser_execute_inplace(&p, &s, buf, i) == i);
+      assert(http_parser_execute_inplace(&p, &s, buf + i, j - i) == j - i);
+      assert(http_parser_execute_inplace(&p, &s, buf + j, len - j)
+             == len - j);
+      assert(HTTP_PARSER_ERRNO(&p) == HPE_OK);
+
+      assert(0 == strcmp(inplace_body, "hello world"));
+      assert(nspans == 2);
+      assert(span_at[0] == buf + head_len(first));
+      assert(span_len[0] == 11);
+      assert(0 == memcmp(span_at[0], "hello world", 11));
+      assert(span_at[1] == buf + strlen(first) + head_len(second));
+      assert(span_len[1] == 0);
+    }
+  }
+
+  /* survives a snapshot */
+  {
+    char snap[HTTP_PARSER_SNAPSHOT_SIZE];
+    http_parser restored;
+
+    memcpy(buf, raw, len);
+    nspans = 0;
+    http_parser_init(&p, HTTP_RESPONSE);
+    http_parser_set_dechunk(&p, 1);
+    assert(http_parser_execute_inplace(&p, &s, buf, 60) == 60);
+    http_parser_snapshot(&p, snap, sizeof snap);
+    http_parser_init(&restored, HTTP_RESPONSE);
+    assert(http_parser_restore(&restored, snap, sizeof snap) == 0);
+    assert(http_parser_execute_inplace(&restored, &s, buf + 60, len - 60)
+           == len - 60);
+    assert(nspans == 2);
+    assert(span_len[0] == 11);
+    assert(0 == memcmp(span_at[0], "hello world", 11));
+  }
+}
+
+static uint32_t trailer_heads[2];
+static int trailer_messages;
+
+static int
+trailer_headers_complete_cb (http_parser *p)
+{
+  assert(trailer_messages < 2);
+  trailer_heads[trailer_messages++] = http_parser_head_length(p);
+  return 0;
+}
+
+/* The head of a message that follows trailers counts from its first byte,
+ * for its length as for the head limit.
+ */
+void
+test_head_after_trailers (void)
+{
+  const char *chunked =
+    "POST / HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "5\r\nhello\r\n0\r\nTrailer: x\r\n\r\n";
+  /* longer than the chunked head, for the limit below */
+  const char *get =
+    "GET /abc HTTP/1.1\r\n"
+    "User-Agent: regression-test\r\n"
+    "\r\n";
+  struct http_parser_limits limits = { .max_head_size = 0 };
+  http_parser_settings s = settings_null;
+  http_parser p;
+  char buf[256];
+  size_t len;
+
+  strcpy(buf, chunked);
+  strcat(buf, get);
+  len = strlen(buf);
+  s.on_headers_complete = trailer_headers_complete_cb;
+  s.limits = &limits;
+
+  trailer_messages = 0;
+  http_parser_init(&p, HTTP_REQUEST);
+  assert(http_parser_execute(&p, &s, buf, len) == len);
+  assert(trailer_messages == 2);
+  assert(trailer_heads[0] == head_len(chunked));
+  assert(trailer_heads[1] == strlen(get));
+
+  /* one byte over */
+  limits.max_head_size = strlen(get) - 1;
+  trailer_messages = 0;
+  http_parser_init(&p, HTTP_REQUEST);
+  assert(http_parser_execute(&p, &s, buf, len) == len - 1);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_HEADER_OVERFLOW);
+  assert(trailer_messages == 1);
+}
+
+/* Feeds 'response' to a fill of 'key', in two pieces split at 'split'.
+ * Returns whether it was stored.
+ */
+static int
+cache_fill (struct http_cache *cache,
+            uint64_t key,
+            const char *response,
+            size_t split)
+{
+  struct http_cache_fill fill;
+  struct http_cache_stats before, after;
+  http_parser p;
+  size_t len = strlen(response);
+
+  http_cache_stats(cache, &before);
+  http_cache_fill_init(&fill, cache, key);
+  http_parser_init(&p, HTTP_RESPONSE);
+  p.data = &fill;
+  assert(http_parser_execute(&p, &http_cache_fill_settings, response, split)
+         == split);
+  assert(http_parser_execute(&p, &http_cache_fill_settings,
+                             response + split, len - split) == len - split);
+
+  http_cache_stats(cache, &after);
+  return after.inserts > before.inserts;
+}
+
+static void
+expect_cached (struct http_cache *cache, uint64_t key, const char *expected)
+{
+  struct http_cache_entry *e;
+
+  assert(http_cache_lookup(cache, key, 0, &e) == HTTP_CACHE_HIT);
+  assert(e->iov.iov_len == strlen(expected));
+  assert(0 == memcmp(e->iov.iov_base, expected, e->iov.iov_len));
+  assert(e->head_len == head_len(expected));
+  http_cache_release(e);
+}
+
+static int
+cache_missing (struct http_cache *cache, uint64_t key)
+{
+  struct http_cache_entry *e;
+  struct http_cache_fill fill;
+
+  if (http_cache_lookup(cache, key, 0, &e) == HTTP_CACHE_HIT) {
+    http_cache_release(e);
+    return 0;
+  }
+  http_cache_fill_init(&fill, cache, key);
+  http_cache_fill_abort(&fill);
+  return 1;
+}
+
+/* Sun, 06 Nov 1994 08:49:37 GMT */
+static time_t cache_now = 784111777;
+
+static time_t
+cache_clock (time_t *t)
+{
+  if (t) *t = cache_now;
+  return cache_now;
+}
+
+/* Fills 'key' with a 200 carrying 'headers', returns whether it was
+ * stored.
+ */
+static int
+cache_fill_fresh (struct http_cache *cache, uint64_t key, const char *headers)
+{
+  struct http_cache_entry *e;
+  char response[512];
+
+  snprintf(response, sizeof response,
+           "HTTP/1.1 200 OK\r\n%sContent-Length: 2\r\n\r\nhi", headers);
+  assert(http_cache_lookup(cache, key, 0, &e) == HTTP_CACHE_MISS);
+  return cache_fill(cache, key, response, 0);
+}
+
+/* Is 'key' still fresh 'seconds' from now? */
+static int
+cache_fresh_for (struct http_cache *cache, uint64_t key, time_t seconds)
+{
+  time_t now = cache_now;
+  struct http_cache_entry *e;
+  int fresh;
+
+  cache_now = now + seconds;
+  fresh = http_cache_lookup(cache, key, 0, &e) == HTTP_CACHE_HIT;
+  if (fresh) {
+    http_cache_release(e);
+  } else {
+    cache_missing(cache, key);
+  }
+  cache_now = now;
+  return fresh;
+}
+
+static void
+test_cache_freshness (void)
+{
+  struct http_cache *cache = http_cache_new(64 * 1024, 1);
+  struct http_cache_stats stats;
+  struct http_date_cache date, expires;
+  char headers[256];
+
+  memset(&date, 0, sizeof date);
+  memset(&expires, 0, sizeof expires);
+  http_cache_set_clock(cache, cache_clock);
+
+  /* stale already: not stored */
+  assert(!cache_fill_fresh(cache, 1, "Cache-Control: max-age=0\r\n"));
+  assert(!cache_fill_fresh(cache, 2, "Cache-Control: public, max-age=100\r\n"
+                                     "Age: 100\r\n"));
+  assert(!cache_fill_fresh(cache, 3, "Expires: 0\r\n"));
+  assert(!cache_fill_fresh(cache, 4,
+                           "Expires: Sun, 06 Nov 1994 08:49:36 GMT\r\n"));
+  assert(!cache_fill_fresh(cache, 5,
+                           "Expires: Sunday, 06-Nov-94 09:49:37 GMT\r\n"));
+  http_cache_stats(cache, &stats);
+  assert(stats.inserts == 0);
+
+  /* max-age less the Age */
+  assert(cache_fill_fresh(cache, 6, "Cache-Control: max-age=100\r\n"
+                                    "Age: 40\r\n"));
+  assert(cache_fresh_for(cache, 6, 59));
+  assert(!cache_fresh_for(cache, 6, 60));
+  http_cache_stats(cache, &stats);
+  assert(stats.expired == 1 && stats.entries == 0);
+
+  /* s-maxage wins over max-age */
+  assert(cache_fill_fresh(cache, 7,
+                          "Cache-Control: max-age=1000,s-maxage=\"10\"\r\n"));
+  assert(cache_fresh_for(cache, 7, 9));
+  assert(!cache_fresh_for(cache, 7, 10));
+
+  /* Expires counts from the Date, which was a minute ago */
+  snprintf(headers, sizeof headers, "%.37sExpires: %.29s\r\n",
+           http_date(&date, cache_now - 60),
+           http_date(&expires, cache_now + 120) + 6);
+  assert(cache_fill_fresh(cache, 8, headers));
+  assert(cache_fresh_for(cache, 8, 119));
+  assert(!cache_fresh_for(cache, 8, 120));
+
+  /* nothing explicit: the default lifetime */
+  assert(cache_fill_fresh(cache, 9, ""));
+  assert(cache_fresh_for(cache, 9, HTTP_CACHE_DEFAULT_TTL - 1));
+  assert(!cache_fresh_for(cache, 9, HTTP_CACHE_DEFAULT_TTL));
+  http_cache_set_default_ttl(cache, 0);
+  assert(!cache_fill_fresh(cache, 10, ""));
+  assert(cache_missing(cache, 10));
+
+  http_cache_free(cache);
+}
+
+struct cache_waiter {
+  pthread_t thread;
+  struct http_cache *cache;
+  uint64_t key;
+  enum http_cache_result result;
+};
+
+static void *
+cache_wait (void *arg)
+{
+  struct cache_waiter *w = arg;
+  struct http_cache_entry *e;
+
+  w->result = http_cache_lookup(w->cache, w->key, 1, &e);
+  if (e) http_cache_release(e);
+  return NULL;
+}
+
+/* Starts a lookup of 'key' on another thread, returns once it waits */
+static void
+cache_waiter_start (struct cache_waiter *w, struct http_cache *cache, uint64_t key)
+{
+  struct http_cache_stats stats;
+  uint64_t waits;
+
+  http_cache_stats(cache, &stats);
+  waits = stats.waits;
+
+  w->cache = cache;
+  w->key = key;
+  assert(pthread_create(&w->thread, NULL, cache_wait, w) == 0);
+  do {
+    sched_yield();
+    http_cache_stats(cache, &stats);
+  } while (stats.waits == waits);
+}
+
+/* The key of 'req' with 'names' as the route headers */
+static uint64_t
+cache_key (const char *req, const char * const *names)
+{
+  http_parser_settings s = settings_null;
+  struct http_parser_key key;
+  http_parser p;
+  size_t len = strlen(req);
+
+  memset(&key, 0, sizeof key);
+  key.seed = 1;
+  s.route_headers = names;
+  http_parser_init(&p, HTTP_REQUEST);
+  p.key = &key;
+  assert(http_parser_execute(&p, &s, req, len) == len);
+  return key.hash;
+}
+
+void
+test_cache_vary (void)
+{
+  static const char * const encoding[] = { "accept-encoding", NULL };
+  const char *gzip_req = "GET / HTTP/1.1\r\n"
+                         "Host: example.com\r\n"
+                         "Accept-Encoding: gzip\r\n"
+                         "\r\n";
+  const char *plain_req = "GET / HTTP/1.1\r\n"
+                          "Host: example.com\r\n"
+                          "\r\n";
+  const char *gzipped = "HTTP/1.1 200 OK\r\n"
+                        "Vary: Accept-Encoding\r\n"
+                        "Content-Encoding: gzip\r\n"
+                        "Content-Length: 2\r\n"
+                        "\r\n"
+                        "hi";
+  struct http_cache *cache = http_cache_new(64 * 1024, 1);
+  struct http_cache_entry *e;
+  uint64_t gzip_key, plain_key;
+
+  /* the key does not tell the two apart, so the variant is not stored */
+  gzip_key = cache_key(gzip_req, NULL);
+  plain_key = cache_key(plain_req, NULL);
+  assert(gzip_key == plain_key);
+  assert(http_cache_lookup(cache, gzip_key, 0, &e) == HTTP_CACHE_MISS);
+  assert(!cache_fill(cache, gzip_key, gzipped, 0));
+  assert(cache_missing(cache, plain_key));
+
+  /* it is once Accept-Encoding is hashed */
+  http_cache_set_key_headers(cache, encoding);
+  gzip_key = cache_key(gzip_req, encoding);
+  plain_key = cache_key(plain_req, encoding);
+  assert(gzip_key != plain_key);
+  assert(http_cache_lookup(cache, gzip_key, 0, &e) == HTTP_CACHE_MISS);
+  assert(cache_fill(cache, gzip_key, gzipped, 0));
+  expect_cached(cache, gzip_key, "HTTP/1.1 200 OK\r\n"
+                                 "Vary: Accept-Encoding\r\n"
+                                 "Content-Encoding: gzip\r\n"
+                                 "Content-Length: 2\r\n"
+                                 "\r\n"
+                                 "hi");
+  assert(cache_missing(cache, plain_key));
+
+  /* Host is always in the key, "*" never */
+  assert(http_cache_lookup(cache, 1, 0, &e) == HTTP_CACHE_MISS);
+  assert(cache_fill(cache, 1, "HTTP/1.1 200 OK\r\n"
+                              "Vary: host, accept-encoding\r\n"
+                              "Content-Length: 0\r\n"
+                              "\r\n", 0));
+  assert(http_cache_lookup(cache, 2, 0, &e) == HTTP_CACHE_MISS);
+  assert(!cache_fill(cache, 2, "HTTP/1.1 200 OK\r\n"
+                               "Vary: Accept-Encoding, Cookie\r\n"
+                               "Content-Length: 0\r\n"
+                               "\r\n", 0));
+  assert(http_cache_lookup(cache, 3, 0, &e) == HTTP_CACHE_MISS);
+  assert(!cache_fill(cache, 3, "HTTP/1.1 200 OK\r\n"
+                               "Vary: *\r\n"
+                               "Content-Length: 0\r\n"
+                               "\r\n", 0));
+
+  http_cache_free(cache);
+}
+
+void
+test_cache (void)
+{
+  const char *response =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n";
+  const char *cached =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 11\r\n"
+    "\r\n"
+    "hello world";
+  const char *private =
+    "HTTP/1.1 200 OK\r\n"
+    "Cache-Control: max-age=60, Private\r\n"
+    "Content-Length: 2\r\n"
+    "\r\n"
+    "hi";
+  struct http_cache *cache;
+  struct http_cache_entry *e, *held;
+  struct http_cache_fill fill;
+  struct http_cache_stats stats;
+  struct cache_waiter w;
+  size_t i, size;
+
+  cache = http_cache_new(64 * 1024, 4);
+  assert(cache);
+
+  /* a miss makes the others wait, however the response arrives */
+  for (i = 0; i <= strlen(response); i++) {
+    assert(http_cache_lookup(cache, i, 0, &e) == HTTP_CACHE_MISS);
+    assert(http_cache_lookup(cache, i, 0, &e) == HTTP_CACHE_PENDING);
+    assert(cache_fill(cache, i, response, i));
+    expect_cached(cache, i, cached);
+  }
+
+  /* not stored, the next lookup fetches again */
+  assert(http_cache_lookup(cache, 1000, 0, &e) == HTTP_CACHE_MISS);
+  assert(!cache_fill(cache, 1000, private, 0));
+  assert(cache_missing(cache, 1000));
+  assert(cache_fill(cache, 1000, "HTTP/1.1 302 Found\r\n"
+                                 "Location: /\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "\r\n", 0) == 0);
+  assert(cache_missing(cache, 1000));
+
+  /* headers the Connection header names are not stored either */
+  assert(http_cache_lookup(cache, 1001, 0, &e) == HTTP_CACHE_MISS);
+  assert(cache_fill(cache, 1001, "HTTP/1.1 200 OK\r\n"
+                                 "Connection: x-foo,, close\r\n"
+                                 "X-Foo: upstream only\r\n"
+                                 "X-Bar: kept\r\n"
+                                 "Content-Length: 2\r\n"
+                                 "\r\n"
+                                 "hi", 0));
+  expect_cached(cache, 1001, "HTTP/1.1 200 OK\r\n"
+                             "X-Bar: kept\r\n"
+                             "Content-Length: 2\r\n"
+                             "\r\n"
+                             "hi");
+
+  /* a 204 gets no Content-Length */
+  assert(http_cache_lookup(cache, 1002, 0, &e) == HTTP_CACHE_MISS);
+  assert(cache_fill(cache, 1002, "HTTP/1.1 204 No Content\r\n"
+                                 "X-Bar: kept\r\n"
+                                 "\r\n", 0));
+  expect_cached(cache, 1002, "HTTP/1.1 204 No Content\r\n"
+                             "X-Bar: kept\r\n"
+                             "\r\n");
+
+  /* collapsed misses get what the first one fetched */
+  assert(http_cache_lookup(cache, 2000, 1, &e) == HTTP_CACHE_MISS);
+  cache_waiter_start(&w, cache, 2000);
+  cache_fill(cache, 2000, response, 0);
+  pthread_join(w.thread, NULL);
+  assert(w.result == HTTP_CACHE_HIT);
+
+  /* or their turn to fetch if it failed */
+  assert(http_cache_lookup(cache, 2001, 1, &e) == HTTP_CACHE_MISS);
+  cache_waiter_start(&w, cache, 2001);
+  http_cache_fill_init(&fill, cache, 2001);
+  http_cache_fill_abort(&fill);
+  pthread_join(w.thread, NULL);
+  assert(w.result == HTTP_CACHE_MISS);
+  assert(http_cache_lookup(cache, 2001, 0, &e) == HTTP_CACHE_PENDING);
+  http_cache_fill_abort(&fill);
+
+  http_cache_free(cache);
+
+  /* CLOCK: room for three, a hit spares an entry once */
+  cache = http_cache_new(64 * 1024, 1);
+  cache_fill(cache, 1, response, 0);
+  http_cache_stats(cache, &stats);
+  size = stats.bytes;
+  http_cache_free(cache);
+
+  cache = http_cache_new(3 * size + size / 2, 1);
+  cache_fill(cache, 1, response, 0);
+  cache_fill(cache, 2, response, 0);
+  cache_fill(cache, 3, response, 0);
+  expect_cached(cache, 1, cached);
+  assert(http_cache_lookup(cache, 3, 0, &held) == HTTP_CACHE_HIT);
+  cache_fill(cache, 4, response, 0);
+  assert(cache_missing(cache, 2));  /* 1 spared */
+  cache_fill(cache, 5, response, 0);
+  assert(cache_missing(cache, 1));  /* 3 spared */
+  cache_fill(cache, 6, response, 0);
+  assert(cache_missing(cache, 4));
+  expect_cached(cache, 3, cached);
+  http_cache_release(held);
+
+  http_cache_stats(cache, &stats);
+  assert(stats.entries == 3);
+  assert(stats.bytes == 3 * size);
+  assert(stats.evictions == 3);
+  http_cache_free(cache);
+
+  /* the table grows */
+  cache = http_cache_new(1 << 24, 1);
+  for (i = 0; i < 1000; i++) {
+    assert(cache_fill(cache, (uint64_t) i << 32 | i, response, 0));
+  }
+  for (i = 0; i < 1000; i++) {
+    expect_cached(cache, (uint64_t) i << 32 | i, cached);
+  }
+  http_cache_free(cache);
+
+  test_cache_freshness();
+  test_cache_vary();
+}
+
+/* Compresses 'len' bytes of 'in' with 'bits' as for deflateInit2():
+ * 31 for gzip, 15 for zlib, -15 for raw deflate.
+ */
+static size_t
+compress_body (char *out, size_t size, const char *in, size_t len, int bits)
+{
+  z_stream z;
+
+  memset(&z, 0, sizeof z);
+  assert(deflateInit2(&z, 9, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  z.next_in = (Bytef *) in;
+  z.avail_in = len;
+  z.next_out = (Bytef *) out;
+  z.avail_out = size;
+  assert(deflate(&z, Z_FINISH) == Z_STREAM_END);
+  deflateEnd(&z);
+  return size - z.avail_out;
+}
+
+static char inflated[8192];
+static size_t inflated_len;
+static int inflate_windows;
+
+static int
+inflated_cb (struct http_inflate *inf, const char *at, size_t len)
+{
+  (void)inf;
+  if (inflated_len + len <= sizeof inflated) {
+    memcpy(inflated + inflated_len, at, len);
+  }
+  inflated_len += len;
+  inflate_windows++;
+  return 0;
+}
+
+/* Parses a response with 'body' encoded as 'coding' (NULL for no header)
+ * through 'inf', in two pieces split at 'split' or whole if it is beyond
+ * the end. Returns the parser's errno.
+ */
+static enum http_errno
+parse_encoded (struct http_inflate *inf,
+               const char *coding,
+               const char *body,
+               size_t body_len,
+               size_t split)
+{
+  static char raw[16384];
+  http_parser p;
+  size_t len;
+
+  if (coding) {
+    len = sprintf(raw, "HTTP/1.1 200 OK\r\n"
+                       "Content-Encoding: %s\r\n"
+                       "Content-Length: %u\r\n"
+                       "\r\n", coding, (unsigned) body_len);
+  } else {
+    len = sprintf(raw, "HTTP/1.1 200 OK\r\n"
+                       "Content-Length: %u\r\n"
+                       "\r\n", (unsigned) body_len);
+  }
+  assert(len + body_len <= sizeof raw);
+  memcpy(raw + len, body, body_len);
+  len += body_len;
+  if (split > len) split = len;
+
+  inflated_len = 0;
+  inflate_windows = 0;
+  http_parser_init(&p, HTTP_RESPONSE);
+  p.data = inf;
+  if (http_parser_execute(&p, &http_inflate_settings, raw, split) == split
+      && split < len) {
+    http_parser_execute(&p, &http_inflate_settings, raw + split, len - split);
+  }
+  return HTTP_PARSER_ERRNO(&p);
+}
+
+void
+test_inflate (void)
+{
+  static const struct {
+    const char *coding;
+    int bits;
+  } codings[] =
+    { { "gzip", 31 }
+    , { "x-gzip", 31 }
+    , { " GZIP ", 31 }
+    , { "deflate", 15 }
+    , { "deflate", -15 }
+    };
+  struct http_inflate inf;
+  char window[100];
+  char text[4000], gz[8192];
+  char *zeros;
+  size_t text_len = 0, gz_len, n, split;
+  unsigned int i;
+
+  while (text_len < sizeof text - 64) {
+    text_len += sprintf(text + text_len, "line %u of the body\n",
+                        (unsigned) text_len);
+  }
+
+  assert(http_inflate_init(&inf, window, sizeof window, inflated_cb) == 0);
+
+  /* in whole windows, wherever the body is split */
+  for (i = 0; i < sizeof codings / sizeof codings[0]; i++) {
+    gz_len = compress_body(gz, sizeof gz, text, text_len, codings[i].bits);
+    for (split = 0; split < 100 + gz_len; split += 7) {
+      assert(parse_encoded(&inf, codings[i].coding, gz, gz_len, split)
+             == HPE_OK);
+      assert(inf.error == HTTP_INFLATE_OK);
+      assert(inflated_len == text_len);
+      assert(0 == memcmp(inflated, text, text_len));
+      assert(inflate_windows == (int) ((text_len + 99) / 100));
+      assert(inf.in == gz_len && inf.out == text_len);
+    }
+  }
+
+  /* passed on as they are */
+  assert(parse_encoded(&inf, NULL, text, 100, -1) == HPE_OK);
+  assert(inf.coding == HTTP_INFLATE_IDENTITY && inflated_len == 100);
+  assert(parse_encoded(&inf, "identity", text, 100, -1) == HPE_OK);
+  assert(inflated_len == 100);
+
+  /* gzip members one after the other */
+  gz_len = compress_body(gz, sizeof gz, text, 1000, 31);
+  gz_len += compress_body(gz + gz_len, sizeof gz - gz_len,
+                          text + 1000, text_len - 1000, 31);
+  assert(parse_encoded(&inf, "gzip", gz, gz_len, 50) == HPE_OK);
+  assert(inflated_len == text_len);
+  assert(0 == memcmp(inflated, text, text_len));
+
+  /* refused */
+  assert(parse_encoded(&inf, "br", gz, gz_len, -1)
+         == HPE_CB_headers_complete);
+  assert(inf.error == HTTP_INFLATE_UNSUPPORTED);
+  assert(parse_encoded(&inf, "gzip, br", gz, gz_len, -1)
+         == HPE_CB_headers_complete);
+  assert(parse_encoded(&inf, "deflate", gz, gz_len, -1)
+         == HPE_CB_message_complete);
+  assert(inf.error == HTTP_INFLATE_CORRUPT);
+  assert(parse_encoded(&inf, "gzip", text, 100, -1)
+         == HPE_CB_message_complete);
+  assert(inf.error == HTTP_INFLATE_CORRUPT);
+  assert(parse_encoded(&inf, "gzip", gz, gz_len - 4, -1)
+         == HPE_CB_message_complete);
+  assert(inf.error == HTTP_INFLATE_TRUNCATED);
+
+  /* size limit */
+  inf.max_size = 1000;
+  gz_len = compress_body(gz, sizeof gz, text, text_len, 31);
+  assert(parse_encoded(&inf, "gzip", gz, gz_len, -1)
+         == HPE_CB_message_complete);
+  assert(inf.error == HTTP_INFLATE_TOO_LARGE);
+  assert(inflated_len <= 1000);
+  inf.max_size = 0;
+
+  /* a bomb: 4 MB of zeros in a few kB, stopped early */
+  n = 4 << 20;
+  zeros = calloc(n, 1);
+  gz_len = compress_body(gz, sizeof gz, zeros, n, 31);
+  assert(parse_encoded(&inf, "gzip", gz, gz_len, -1)
+         == HPE_CB_message_complete);
+  assert(inf.error == HTTP_INFLATE_RATIO);
+  assert(inf.out <= HTTP_INFLATE_RATIO_FLOOR + gz_len * inf.max_ratio
+                    + sizeof window);
+  free(zeros);
+
+  http_inflate_end(&inf);
+
+  /* no window: refused, and encoded bodies fail instead of spinning */
+  assert(http_inflate_init(&inf, window, 0, inflated_cb) == -1);
+  gz_len = compress_body(gz, sizeof gz, text, text_len, 31);
+  assert(parse_encoded(&inf, "gzip", gz, gz_len, -1)
+         == HPE_CB_headers_complete);
+  assert(inf.error == HTTP_INFLATE_NOMEM);
+  assert(parse_encoded(&inf, NULL, text, text_len, -1) == HPE_OK);
+  assert(inflated_len == text_len);
+  http_inflate_end(&inf);
+}
+
+/* Copies the body into pool buffers, as a stage writing to disk or to
+ * another socket would, and holds them until drained.
+ */
+struct spill {
+  char *buf;
+  size_t len;
+  char *held[16];
+  size_t held_len[16];
+  int nheld;
+  char out[8192];
+  size_t out_len;
+};
+
+static void
+spill_hold (struct spill *sp)
+{
+  sp->held[sp->nheld] = sp->buf;
+  sp->held_len[sp->nheld++] = sp->len;
+  sp->buf = NULL;
+}
+
+static int
+spill_body (struct http_stage *stage, const char *at, size_t len)
+{
+  struct spill *sp = stage->data;
+  struct http_pool *pool = stage->pipeline->pool;
+  size_t n;
+
+  while (len > 0) {
+    if (!sp->buf) {
+      sp->buf = http_pool_get(pool);
+      if (!sp->buf) return -1;
+      sp->len = 0;
+    }
+    n = MIN(len, pool->size - sp->len);
+    memcpy(sp->buf + sp->len, at, n);
+    sp->len += n;
+    at += n;
+    len -= n;
+    if (sp->len == pool->size) spill_hold(sp);
+  }
+  return http_stage_emit(stage, NULL, 0);
+}
+
+static int
+spill_complete (struct http_stage *stage)
+{
+  struct spill *sp = stage->data;
+
+  if (sp->buf) spill_hold(sp);
+  return 0;
+}
+
+static void
+spill_drain (struct spill *sp, struct http_pool *pool)
+{
+  int i;
+
+  for (i = 0; i < sp->nheld; i++) {
+    memcpy(sp->out + sp->out_len, sp->held[i], sp->held_len[i]);
+    sp->out_len += sp->held_len[i];
+    http_pool_put(pool, sp->held[i]);
+  }
+  sp->nheld = 0;
+}
+
+static int
+fnv_body (struct http_stage *stage, const char *at, size_t len)
+{
+  uint64_t *h = stage->data;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    *h = (*h ^ (unsigned char) at[i]) * 0x100000001B3ULL;
+  }
+  return http_stage_emit(stage, at, len);
+}
+
+static int
+refuse_body (struct http_stage *stage, const char *at, size_t len)
+{
+  (void)stage;
+  (void)at;
+  (void)len;
+  return -1;
+}
+
+void
+test_pipeline (void)
+{
+  struct http_pool pool;
+  struct http_pipeline pl;
+  struct http_stage inflate, fnv, pass, spill;
+  struct http_inflate inf;
+  struct spill sp;
+  http_parser p;
+  char window[300];
+  char text[4000], gz[8192], raw[16384];
+  size_t text_len = 0, gz_len, len, off, n, i;
+  uint64_t hash = 0xCBF29CE484222325ULL, expected = hash, calls;
+  int pauses = 0;
+
+  while (text_len < sizeof text - 64) {
+    text_len += sprintf(text + text_len, "record %u\n", (unsigned) text_len);
+  }
+  for (i = 0; i < text_len; i++) {
+    expected = (expected ^ (unsigned char) text[i]) * 0x100000001B3ULL;
+  }
+
+  /* a chunked gzip response, in 100 byte chunks */
+  gz_len = compress_body(gz, sizeof gz, text, text_len, 31);
+  len = sprintf(raw, "HTTP/1.1 200 OK\r\n"
+                     "Content-Encoding: gzip\r\n"
+                     "Transfer-Encoding: chunked\r\n"
+                     "\r\n");
+  for (off = 0; off < gz_len; off += n) {
+    n = MIN(100, gz_len - off);
+    len += sprintf(raw + len, "%x\r\n", (unsigned) n);
+    memcpy(raw + len, gz + off, n);
+    len += n;
+    len += sprintf(raw + len, "\r\n");
+  }
+  len += sprintf(raw + len, "0\r\n\r\n");
+
+  assert(http_pool_init(&pool, 256, 8, 3) == 0);
+  http_pipeline_init(&pl, &pool);
+  pl.timed = 1;
+
+  http_inflate_stage_init(&inflate, &inf, window, sizeof window);
+  memset(&fnv, 0, sizeof fnv);
+  fnv.data = &hash;
+  fnv.on_body = fnv_body;
+  memset(&pass, 0, sizeof pass);
+  memset(&spill, 0, sizeof spill);
+  memset(&sp, 0, sizeof sp);
+  spill.data = &sp;
+  spill.on_body = spill_body;
+  spill.on_message_complete = spill_complete;
+  http_pipeline_add(&pl, &inflate);
+  http_pipeline_add(&pl, &fnv);
+  http_pipeline_add(&pl, &pass);
+  http_pipeline_add(&pl, &spill);
+
+  /* the pool runs low every few windows: drain, resume, pass the rest */
+  http_parser_init(&p, HTTP_RESPONSE);
+  p.data = &pl;
+  for (off = 0; off < len; off += n) {
+    n = http_parser_execute(&p, &http_pipeline_settings, raw + off, len - off);
+    if (HTTP_PARSER_ERRNO(&p) == HPE_PAUSED) {
+      assert(pool.nfree < pool.low);
+      pauses++;
+      spill_drain(&sp, &pool);
+      http_pipeline_resume(&pl);
+    } else {
+      assert(HTTP_PARSER_ERRNO(&p) == HPE_OK);
+      assert(n == len - off);
+    }
+  }
+  spill_drain(&sp, &pool);
+
+  assert(pauses > 0);
+  assert(pool.nfree == pool.count);
+  assert(sp.out_len == text_len);
+  assert(0 == memcmp(sp.out, text, text_len));
+  assert(hash == expected);
+
+  assert(inflate.stats.bytes_in == gz_len);
+  assert(inflate.stats.bytes_out == text_len);
+  assert(inflate.stats.calls > 1);
+  assert(inflate.stats.ns > 0);
+  assert(fnv.stats.bytes_in == text_len && fnv.stats.bytes_out == text_len);
+  assert(pass.stats.bytes_in == text_len && pass.stats.bytes_out == text_len);
+  assert(pass.stats.calls == fnv.stats.calls);
+  assert(spill.stats.bytes_in == text_len);
+
+  /* a failing stage fails the message */
+  spill.on_body = refuse_body;
+  calls = spill.stats.calls;
+  http_parser_init(&p, HTTP_RESPONSE);
+  p.data = &pl;
+  n = http_parser_execute(&p, &http_pipeline_settings, raw, len);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_CB_message_complete);
+  assert(pl.failed);
+  assert(spill.stats.calls == calls + 1);
+
+  http_inflate_end(&inf);
+  http_pool_free(&pool);
+}
+
+/* Multipart events as text: one line per event, consecutive pieces of the
+ * same field, value or data joined.
+ */
+static char mp_log[8192];
+static size_t mp_log_len;
+static char mp_last;
+
+static void
+mp_event (char type, const char *at, size_t len)
+{
+  if (type != mp_last || !at) {
+    assert(mp_log_len + 3 <= sizeof mp_log);
+    mp_log[mp_log_len++] = '\n';
+    mp_log[mp_log_len++] = type;
+    mp_log[mp_log_len++] = ':';
+  }
+  mp_last = at ? type : 0;
+  if (at) {
+    assert(mp_log_len + len <= sizeof mp_log);
+    memcpy(mp_log + mp_log_len, at, len);
+    mp_log_len += len;
+  }
+}
+
+static int mp_part_begin (multipart_parser *p) { (void)p; mp_event('B', NULL, 0); return 0; }
+static int mp_headers_complete (multipart_parser *p) { (void)p; mp_event('H', NULL, 0); return 0; }
+static int mp_part_end (multipart_parser *p) { (void)p; mp_event('E', NULL, 0); return 0; }
+static int mp_body_end (multipart_parser *p) { (void)p; mp_event('Z', NULL, 0); return 0; }
+
+static int
+mp_header_field (multipart_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  mp_event('F', at, len);
+  return 0;
+}
+
+static int
+mp_header_value (multipart_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  mp_event('V', at, len);
+  return 0;
+}
+
+static int
+mp_part_data (multipart_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  mp_event('D', at, len);
+  return 0;
+}
+
+static const multipart_parser_settings mp_settings =
+  { .on_part_begin = mp_part_begin
+  , .on_header_field = mp_header_field
+  , .on_header_value = mp_header_value
+  , .on_headers_complete = mp_headers_complete
+  , .on_part_data = mp_part_data
+  , .on_part_end = mp_part_end
+  , .on_body_end = mp_body_end
+  };
+
+/* Parses 'body' in three pieces and checks the log is 'expected' */
+static void
+parse_multipart (const char *body, size_t len, size_t i, size_t j,
+                 const char *expected, size_t expected_len)
+{
+  multipart_parser mp;
+
+  assert(multipart_parser_init(&mp, "XyZ", 3) == 0);
+  mp_log_len = 0;
+  mp_last = 0;
+  /* a zero length would be the end */
+  if (i > 0) {
+    assert(multipart_parser_execute(&mp, &mp_settings, body, i) == i);
+  }
+  if (j > i) {
+    assert(multipart_parser_execute(&mp, &mp_settings, body + i, j - i)
+           == j - i);
+  }
+  assert(multipart_parser_execute(&mp, &mp_settings, body + j, len - j)
+         == len - j);
+  assert(multipart_parser_execute(&mp, &mp_settings, NULL, 0) == 0);
+  assert(multipart_parser_errno(&mp) == MPE_OK);
+  assert(mp.nparts == 3);
+  assert(mp_log_len == expected_len);
+  assert(0 == memcmp(mp_log, expected, expected_len));
+}
+
+static enum multipart_errno
+multipart_error (const char *body, size_t len)
+{
+  multipart_parser mp;
+
+  assert(multipart_parser_init(&mp, "XyZ", 3) == 0);
+  mp_log_len = 0;
+  if (multipart_parser_execute(&mp, &mp_settings, body, len) == len) {
+    multipart_parser_execute(&mp, &mp_settings, NULL, 0);
+  }
+  return multipart_parser_errno(&mp);
+}
+
+void
+test_multipart (void)
+{
+  static const char body[] =
+    "preamble, --XyZ is not a boundary here\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"a\"\r\n"
+    "\r\n"
+    "value a\r\n"
+    "--XyZ \t\r\n"
+    "Content-Disposition: form-data; name=\"file\"; filename=\"f.bin\"\r\n"
+    "Content-Type:application/octet-stream\r\n"
+    "\r\n"
+    "\0\r\n--XyY\r\n--Xy\r\r\n-\r\n--Xy-Z is near a boundary\r\n"
+    "--XyZ\r\n"
+    "X-Empty:\r\n"
+    "\r\n"
+    "\r\n"
+    "--XyZ--\r\n"
+    "epilogue\r\n--XyZ\r\n";
+  static const char expected[] =
+    "\nB:"
+    "\nF:Content-Disposition\nV:form-data; name=\"a\"\nH:"
+    "\nD:value a\nE:"
+    "\nB:"
+    "\nF:Content-Disposition\nV:form-data; name=\"file\"; filename=\"f.bin\""
+    "\nF:Content-Type\nV:application/octet-stream\nH:"
+    "\nD:\0\r\n--XyY\r\n--Xy\r\r\n-\r\n--Xy-Z is near a boundary\nE:"
+    "\nB:"
+    "\nF:X-Empty\nV:\nH:\nE:"
+    "\nZ:";
+  size_t len = sizeof body - 1, i, j;
+  const char *b;
+  size_t blen;
+  char big[20000];
+  multipart_parser mp;
+  uint64_t rng = 1;
+
+  /* wherever it is split */
+  for (i = 0; i < len; i++) {
+    for (j = i; j < len; j++) {
+      parse_multipart(body, len, i, j, expected, sizeof expected - 1);
+    }
+  }
+
+  /* the boundary from Content-Type */
+  assert(multipart_boundary("multipart/form-data; boundary=XyZ", 33,
+                            &b, &blen) == 0);
+  assert(blen == 3 && 0 == memcmp(b, "XyZ", 3));
+  assert(multipart_boundary("multipart/mixed;charset=x; BOUNDARY=\"a b\"; x=y",
+                            47, &b, &blen) == 0);
+  assert(blen == 3 && 0 == memcmp(b, "a b", 3));
+  assert(multipart_boundary("multipart/form-data", 19, &b, &blen) == -1);
+  assert(multipart_boundary("multipart/form-data; boundary=", 30,
+                            &b, &blen) == -1);
+  assert(multipart_boundary("multipart/form-data; boundary=\"XyZ", 34,
+                            &b, &blen) == -1);
+  memset(big, 'b', 71);
+  assert(multipart_parser_init(&mp, big, 70) == 0);
+  assert(multipart_parser_init(&mp, big, 71) == -1);
+  assert(multipart_parser_init(&mp, "a\rb", 3) == -1);
+
+  /* errors */
+  assert(multipart_error("--XyZ\r\n\r\ndata", 13) == MPE_INVALID_EOF);
+  assert(multipart_error("--XyZx\r\n", 8) == MPE_INVALID_DELIMITER);
+  assert(multipart_error("--XyZ-x", 7) == MPE_INVALID_DELIMITER);
+  assert(multipart_error("--XyZ\r\nBad Field: x\r\n", 21)
+         == MPE_INVALID_HEADER);
+  assert(multipart_error("--XyZ\r\nA: x\n", 12) == MPE_INVALID_HEADER);
+  assert(multipart_error("no delimiter at all", 19) == MPE_INVALID_EOF);
+  len = sprintf(big, "--XyZ\r\nA: ");
+  memset(big + len, 'a', MULTIPART_MAX_HEADER_SIZE);
+  assert(multipart_error(big, len + MULTIPART_MAX_HEADER_SIZE)
+         == MPE_HEADER_OVERFLOW);
+
+  /* random bytes with delimiter prefixes, in random pieces */
+  len = sprintf(big, "--XyZ\r\n\r\n");
+  for (i = 0; i < 6000; i++) {
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    if (rng >> 60 == 0) {
+      /* a cut off delimiter */
+      j = (rng >> 32) % 7;
+      memcpy(big + len, "\r\n--XyZ", j);
+      len += j;
+    }
+    big[len++] = rng >> 40;
+  }
+  blen = len - 9;
+  len += sprintf(big + len, "\r\n--XyZ--");
+
+  assert(multipart_parser_init(&mp, "XyZ", 3) == 0);
+  mp_log_len = 0;
+  mp_last = 0;
+  for (i = 0; i < len; i += j) {
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    j = MIN((rng >> 33) % 100 + 1, len - i);
+    assert(multipart_parser_execute(&mp, &mp_settings, big + i, j) == j);
+  }
+  assert(multipart_parser_errno(&mp) == MPE_OK);
+  assert(mp_log_len == 3 + 3 + 3 + blen + 3 + 3);
+  assert(0 == memcmp(mp_log + 9, big + 9, blen));
+}
+
+/* WebSocket events as text, as for multipart: H: with the opcode and fin,
+ * P: the payload, E: frame end, M: message end.
+ */
+static char ws_log[1 << 17];
+static size_t ws_log_len;
+static char ws_last;
+
+static void
+ws_event (char type, const char *at, size_t len)
+{
+  if (type != ws_last || !at) {
+    assert(ws_log_len + 3 <= sizeof ws_log);
+    ws_log[ws_log_len++] = '\n';
+    ws_log[ws_log_len++] = type;
+    ws_log[ws_log_len++] = ':';
+  }
+  ws_last = at ? type : 0;
+  if (at) {
+    assert(ws_log_len + len <= sizeof ws_log);
+    memcpy(ws_log + ws_log_len, at, len);
+    ws_log_len += len;
+  }
+}
+
+static int
+ws_frame_header (websocket_parser *p)
+{
+  char h[2];
+
+  h[0] = "0123456789abcdef"[p->opcode];
+  h[1] = '0' + p->fin;
+  ws_event('H', NULL, 0);
+  ws_event('h', h, 2);
+  return 0;
+}
+
+static int
+ws_frame_payload (websocket_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  ws_event('P', at, len);
+  return 0;
+}
+
+static int ws_frame_end (websocket_parser *p) { (void)p; ws_event('E', NULL, 0); return 0; }
+static int ws_message_end (websocket_parser *p) { (void)p; ws_event('M', NULL, 0); return 0; }
+
+static const websocket_parser_settings ws_settings =
+  { .on_frame_header = ws_frame_header
+  , .on_frame_payload = ws_frame_payload
+  , .on_frame_end = ws_frame_end
+  , .on_message_end = ws_message_end
+  };
+
+/* Appends a frame as a client sends it */
+static size_t
+ws_frame (char *buf, int fin, enum websocket_opcode opcode,
+          const char *payload, size_t len, const unsigned char *mask)
+{
+  size_t n = websocket_frame_header(buf, fin, opcode, len, mask);
+
+  memcpy(buf + n, payload, len);
+  if (mask) websocket_mask(buf + n, len, mask, 0);
+  return n + len;
+}
+
+static void
+ws_reset (websocket_parser *ws, enum websocket_role role)
+{
+  websocket_parser_init(ws, role);
+  ws_log_len = 0;
+  ws_last = 0;
+}
+
+static enum websocket_errno
+websocket_error (enum websocket_role role, const char *frames, size_t len)
+{
+  websocket_parser ws;
+  char buf[64];
+
+  assert(len <= sizeof buf);
+  memcpy(buf, frames, len);
+  memset(&ws, 0, sizeof ws);
+  ws.max_length = 16;
+  ws_reset(&ws, role);
+  assert(websocket_parser_execute(&ws, &ws_settings, buf, len) < len);
+  assert(websocket_parser_execute(&ws, &ws_settings, buf, len) == 0);
+  return websocket_parser_errno(&ws);
+}
+
+void
+test_websocket (void)
+{
+  static const unsigned char m1[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  static const unsigned char m2[4] = { 0x00, 0xff, 0x80, 0x01 };
+  static const char hello[] = "Hello, long enough for a block of ASCII";
+  static const char upgrade[] =
+    "GET /chat HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+  static const char expected[] =
+    "\nH:\nh:11\nP:Hello, long enough for a block of ASCII\nE:\nM:"
+    "\nH:\nh:20\nP:ab\0\nE:"
+    "\nH:\nh:91\nP:ping\nE:"
+    "\nH:\nh:01\nP:cd\nE:\nM:"
+    "\nH:\nh:10\nP:caf\xc3\nE:"
+    "\nH:\nh:00\nP:\xa9 \xe2\x82\nE:"
+    "\nH:\nh:a1\nE:"
+    "\nH:\nh:01\nP:\xac \xf0\x9f\x98\x80!\nE:\nM:"
+    "\nH:\nh:21\nP:";
+  static const char expected_close[] = "\nE:\nM:\nH:\nh:81\nP:\x03\xe8" "bye\nE:";
+  static char plain[70000], big[70000 + 14];
+  char frames[1024], buf[1024];
+  char *elog;
+  size_t len, elen, i, j, n, nparsed;
+  websocket_parser ws;
+  http_parser parser;
+  uint64_t rng = 7;
+
+  memset(&ws, 0, sizeof ws);
+  len = ws_frame(frames, 1, WS_TEXT, hello, sizeof hello - 1, m1);
+  len += ws_frame(frames + len, 0, WS_BINARY, "ab\0", 3, m2);
+  len += ws_frame(frames + len, 1, WS_PING, "ping", 4, m1);
+  len += ws_frame(frames + len, 1, WS_CONTINUATION, "cd", 2, m2);
+  /* a character split over fragments and a control frame between */
+  len += ws_frame(frames + len, 0, WS_TEXT, "caf\xc3", 4, m1);
+  len += ws_frame(frames + len, 0, WS_CONTINUATION, "\xa9 \xe2\x82", 4, m2);
+  len += ws_frame(frames + len, 1, WS_PONG, "", 0, m1);
+  len += ws_frame(frames + len, 1, WS_CONTINUATION,
+                  "\xac \xf0\x9f\x98\x80!", 7, m1);
+  /* a 16-bit length */
+  memset(big, 'x', 300);
+  len += ws_frame(frames + len, 1, WS_BINARY, big, 300, m2);
+  len += ws_frame(frames + len, 1, WS_CLOSE, "\x03\xe8" "bye", 5, m1);
+  assert(len < sizeof frames - 8);
+
+  elog = malloc(sizeof expected + 300 + sizeof expected_close);
+  memcpy(elog, expected, sizeof expected - 1);
+  memset(elog + sizeof expected - 1, 'x', 300);
+  memcpy(elog + sizeof expected - 1 + 300, expected_close,
+         sizeof expected_close - 1);
+  elen = sizeof expected - 1 + 300 + sizeof expected_close - 1;
+
+  /* wherever it is split */
+  for (i = 0; i <= len; i++) {
+    for (j = i; j <= len; j++) {
+      memcpy(buf, frames, len);
+      ws_reset(&ws, WS_SERVER);
+      assert(websocket_parser_execute(&ws, &ws_settings, buf, i) == i);
+      assert(websocket_parser_execute(&ws, &ws_settings, buf + i, j - i)
+             == j - i);
+      assert(websocket_parser_execute(&ws, &ws_settings, buf + j, len - j)
+             == len - j);
+      assert(websocket_parser_errno(&ws) == WSE_OK);
+      assert(ws_log_len == elen);
+      assert(0 == memcmp(ws_log, elog, elen));
+    }
+  }
+
+  /* the close frame ends the stream */
+  memcpy(buf, frames, len);
+  memcpy(buf + len, "\x81\x80junk", 6);
+  ws_reset(&ws, WS_SERVER);
+  assert(websocket_parser_execute(&ws, &ws_settings, buf, len + 6) == len);
+  assert(websocket_parser_errno(&ws) == WSE_OK);
+  assert(websocket_parser_execute(&ws, &ws_settings, buf + len, 6) == 0);
+  assert(websocket_parser_errno(&ws) == WSE_CLOSED);
+
+  /* taking over from an upgrade */
+  n = sizeof upgrade - 1;
+  memcpy(buf, upgrade, n);
+  n += ws_frame(buf + n, 1, WS_TEXT, "hi", 2, m1);
+  http_parser_init(&parser, HTTP_REQUEST);
+  nparsed = http_parser_execute(&parser, &settings_null, buf, n);
+  assert(parser.upgrade && nparsed == sizeof upgrade - 1);
+  ws_reset(&ws, WS_SERVER);
+  assert(websocket_parser_execute(&ws, &ws_settings, buf + nparsed,
+                                  n - nparsed) == n - nparsed);
+  assert(ws_log_len == 19);
+  assert(0 == memcmp(ws_log, "\nH:\nh:11\nP:hi\nE:\nM:", 19));
+
+  /* a client gets unmasked frames */
+  n = ws_frame(buf, 1, WS_BINARY, "\x80\xff", 2, NULL);
+  ws_reset(&ws, WS_CLIENT);
+  assert(websocket_parser_execute(&ws, &ws_settings, buf, n) == n);
+  assert(ws_log_len == 19);
+  assert(0 == memcmp(ws_log, "\nH:\nh:21\nP:\x80\xff\nE:\nM:", 19));
+
+  /* a 64-bit length, in random pieces */
+  for (i = 0; i < sizeof plain; i++) {
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    plain[i] = rng >> 33;
+  }
+  n = ws_frame(big, 1, WS_BINARY, plain, sizeof plain, m1);
+  assert(n == sizeof big);
+  ws_reset(&ws, WS_SERVER);
+  for (i = 0; i < n; i += j) {
+    rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    j = MIN((rng >> 33) % 5000 + 1, n - i);
+    assert(websocket_parser_execute(&ws, &ws_settings, big + i, j) == j);
+  }
+  assert(ws.length == sizeof plain && ws.message_opcode == 0);
+  assert(ws_log_len == 11 + sizeof plain + 6);
+  assert(0 == memcmp(ws_log + 11, plain, sizeof plain));
+
+  /* errors */
+  assert(websocket_error(WS_SERVER, "\xc1\x80", 2) == WSE_INVALID_RSV);
+  assert(websocket_error(WS_SERVER, "\x83\x80", 2) == WSE_INVALID_OPCODE);
+  assert(websocket_error(WS_SERVER, "\x81\x05", 2) == WSE_INVALID_MASK);
+  assert(websocket_error(WS_CLIENT, "\x81\x85", 2) == WSE_INVALID_MASK);
+  assert(websocket_error(WS_CLIENT, "\x82\x7f\x80\0\0\0\0\0\0\0", 10)
+         == WSE_INVALID_LENGTH);
+  assert(websocket_error(WS_SERVER, "\x09\x80", 2) == WSE_INVALID_CONTROL);
+  assert(websocket_error(WS_SERVER, "\x89\xfe", 2) == WSE_INVALID_CONTROL);
+  assert(websocket_error(WS_SERVER, "\x80\x80", 2) == WSE_INVALID_FRAGMENT);
+  assert(websocket_error(WS_SERVER, "\x01\x80\0\0\0\0\x82\x80", 8)
+         == WSE_INVALID_FRAGMENT);
+  assert(websocket_error(WS_CLIENT, "\x81\x02\xc0\xaf", 4) == WSE_INVALID_UTF8);
+  assert(websocket_error(WS_CLIENT, "\x81\x03\xed\xa0\x80", 5)
+         == WSE_INVALID_UTF8);
+  assert(websocket_error(WS_CLIENT, "\x81\x04\xf4\x90\x80\x80", 6)
+         == WSE_INVALID_UTF8);
+  assert(websocket_error(WS_CLIENT, "\x01\x01\x41\x80\x01\xc3", 6)
+         == WSE_INVALID_UTF8);
+  assert(websocket_error(WS_CLIENT, "\x88\x01\x03", 3) == WSE_INVALID_CLOSE);
+  assert(websocket_error(WS_CLIENT, "\x88\x03\x03\xe8\xff", 5)
+         == WSE_INVALID_UTF8);
+  assert(websocket_error(WS_CLIENT, "\x82\x11", 2) == WSE_TOO_LARGE);
+
+  free(elog);
+}
+
+#if HTTP_PARSER_TRACE
+static int trace_errors;
+
+static void
+trace_error_cb (struct http_trace *trace, const http_parser *p)
+{
+  (void)trace;
+  (void)p;
+  trace_errors++;
+}
+
+void
+test_trace (void)
+{
+  const char *raw = requests[GET_NO_HEADERS_NO_BODY].raw;
+  struct http_trace_event events[8], out[8];
+  struct http_trace trace;
+  http_parser parser;
+  http_parser_settings s = settings_null;
+  char line[128];
+  size_t n;
+  int i;
+
+  assert(http_trace_init(&trace, events, 6, 1) == -1);
+  assert(http_trace_init(&trace, events, 1, 1) == -1);
+  assert(http_trace_init(&trace, events, 8, 3) == -1);
+  assert(http_trace_init(&trace, events, 8, 1) == 0);
+  trace.on_error = trace_error_cb;
+  trace_errors = 0;
+  http_trace_attach(&trace);
+
+  http_parser_init(&parser, HTTP_REQUEST);
+  http_parser_execute(&parser, &settings_null, raw, strlen(raw));
+
+  assert(http_trace_read(&trace, out, 8) == 4);
+  assert(out[0].type == HTTP_TRACE_EXECUTE && out[0].offset == strlen(raw));
+  assert(out[1].type == HTTP_TRACE_MESSAGE_BEGIN && out[1].offset == 0);
+  assert(out[2].type == HTTP_TRACE_HEADERS_COMPLETE);
+  assert(out[2].arg == HTTP_GET && out[2].offset == strlen(raw) - 1);
+  assert(out[3].type == HTTP_TRACE_MESSAGE_COMPLETE);
+  assert(out[3].time >= out[0].time);
+
+  /* a callback stopping the parser */
+  s.on_url = abort_url_cb;
+  http_parser_init(&parser, HTTP_REQUEST);
+  http_parser_execute(&parser, &s, raw, strlen(raw));
+
+  assert(http_trace_read(&trace, out, 1) == 1);
+  assert(out[0].type == HTTP_TRACE_CALLBACK);
+  assert(out[0].arg >> 8 == HTTP_TRACE_CB_URL);
+  assert((int8_t) (out[0].arg & 0xff) == -1);
+  assert(http_trace_format(&out[0], line, sizeof line) == strlen(line));
+  assert(strstr(line, " url returned -1\n"));
+  assert(http_trace_format(&out[0], line, 8) == 0);
+
+  /* every callback is named */
+  {
+    static const char * const names[] =
+      { "message_begin", "path", "query_string", "url", "fragment"
+      , "header_field", "header_value", "headers_complete"
+      , "message_complete", "host", "body_span"
+      };
+    struct http_trace_event e;
+    char want[64];
+
+    assert(sizeof names / sizeof names[0] == HTTP_TRACE_CB_MAX);
+    memset(&e, 0, sizeof e);
+    e.type = HTTP_TRACE_CALLBACK;
+    for (i = 0; i < HTTP_TRACE_CB_MAX; i++) {
+      e.arg = i << 8 | 1;
+      assert(http_trace_format(&e, line, sizeof line) == strlen(line));
+      sprintf(want, " callback state=0 offset=0 %s returned 1\n", names[i]);
+      assert(strstr(line, want));
+    }
+  }
+
+  /* one call in four is traced, but every error is */
+  assert(http_trace_init(&trace, events, 8, 4) == 0);
+  trace.on_error = trace_error_cb;
+  http_parser_init(&parser, HTTP_REQUEST);
+  for (i = 0; i < 8; i++) {
+    assert(http_parser_execute(&parser, &settings_null, "XET", 3) == 0);
+  }
+  assert(trace_errors == 8);
+
+  /* 2 sampled calls and 8 errors, the newest 7 can be read */
+  assert(http_trace_read(&trace, out, 8) == 7);
+  for (i = 0; i < 7; i++) {
+    assert(out[i].type == (i == 2 ? HTTP_TRACE_EXECUTE : HTTP_TRACE_ERROR));
+  }
+  assert(out[6].arg == 'X');
+  assert(http_trace_read(&trace, out, 3) == 3);
+  assert(out[0].type == HTTP_TRACE_ERROR);
+
+  http_trace_attach(NULL);
+  http_parser_execute(&parser, &settings_null, "XET", 3);
+  assert(trace_errors == 8);
+  n = http_trace_read(&trace, out, 8);
+  assert(n == 7 && out[2].type == HTTP_TRACE_EXECUTE);
+}
+#endif
+
+/* Place the message in a ring buffer so that it wraps at every byte. */
+void
+test_message_ring (const struct message *message)
+{
+  size_t raw_len = strlen(message->raw);
+  size_t size = raw_len + 7;
+  size_t start, k, read;
+  char *ring = malloc(size);
+
+  for (start = 0; start < size; start++) {
+    memset(ring, 'X', size);
+    for (k = 0; k < raw_len; k++) {
+      ring[(start + k) % size] = message->raw[k];
+    }
+
+    parser_init(message->type);
+
+    currently_parsing_eof = 0;
+    read = http_parser_execute_ring(parser, &settings, ring, size, start, raw_len);
+
+    if (!(message->upgrade && parser->upgrade)) {
+      if (read != raw_len) {
+        print_error(message->raw, read);
+        exit(1);
+      }
+      parse(NULL, 0);
+    }
+
+    if (num_messages != 1) {
+      printf("\n*** num_messages != 1 after testing '%s' in a ring ***\n\n", message->name);
+      exit(1);
+    }
+
+    if(!message_eq(0, message)) exit(1);
+
+    parser_free();
+  }
+
+  free(ring);
+}
+
+/* Misuse is an error even when assert() is compiled out */
+void
+test_execute_arguments (void)
+{
+  const char *raw = "GET / HTTP/1.1\r\n\r\n";
+  struct iovec iov = { (void *) raw, 10 };
+  char ring[8] = "GET / HT";
+  http_parser p;
+
+  http_parser_init(&p, HTTP_REQUEST);
+  http_parser_set_retain(&p, 1);
+  assert(http_parser_execute_iov(&p, &settings_null, &iov, 1) == 0);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_INVALID_ARGUMENT);
+  assert(http_parser_execute(&p, &settings_null, raw, 1) == 0);
+
+  http_parser_init(&p, HTTP_REQUEST);
+  assert(http_parser_execute_ring(&p, &settings_null, ring, 8, 8, 1) == 0);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_INVALID_ARGUMENT);
+
+  http_parser_init(&p, HTTP_REQUEST);
+  assert(http_parser_execute_ring(&p, &settings_null, ring, 8, 0, 9) == 0);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_INVALID_ARGUMENT);
+
+  /* what fits is parsed */
+  http_parser_init(&p, HTTP_REQUEST);
+  assert(http_parser_execute_ring(&p, &settings_null, ring, 8, 0, 8) == 8);
+  assert(HTTP_PARSER_ERRNO(&p) == HPE_OK);
+}
+
+void
+test_message_count_body (const struct message *message)
+{
+  parser_init(message->type);
+
+  size_t read;
+  size_t l = strlen(message->raw);
+  size_t i, toread;
+  size_t chunk = 4024;
+
+  for (i = 0; i < l; i+= chunk) {
+    toread = MIN(l-i, chunk);
+    read = parse_count_body(message->raw + i, toread);
+    if (read != toread) {
+      print_error(message->raw, read);
+      exit(1);
+    }
+  }
+
+
+  read = parse_count_body(NULL, 0);
+  if (read != 0) {
+    print_error(message->raw, read);
+    exit(1);
+  }
+
+  if (num_messages != 1) {
+    printf("\n*** num_messages != 1 after testing '%s' ***\n\n", message->name);
+    exit(1);
+  }
+
+  if(!message_eq(0, message)) exit(1);
+
+  parser_free();
+}
+
+void
+test_simple (const char *buf, int should_pass)
+{
+  parser_init(HTTP_REQUEST);
+
+  size_t parsed;
+  int pass;
+  parsed = parse(buf, strlen(buf));
+  pass = (parsed == strlen(buf));
+  parsed = parse(NULL, 0);
+  pass &= (parsed == 0);
+
+  parser_free();
+
+  if (pass != should_pass) {
+    fprintf(stderr, "\n*** test_simple expected %s ***\n\n%s", should_pass ? "success" : "error", buf);
+    exit(1);
+  }
+}
+
+void
+test_header_overflow_error (int req)
+{
+  http_parser parser;
+  http_parser_init(&parser, req ? HTTP_REQUEST : HTTP_RESPONSE);
+  size_t parsed;
+  const char *buf;
+  buf = req ? "GET / HTTP/1.1\r\n" : "HTTP/1.0 200 OK\r\n";
+  parsed = http_parser_execute(&parser, &settings_null, buf, strlen(buf));
+  assert(parsed == strlen(buf));
+
+  buf = "header-key: header-value\r\n";
+  int i;
+  for (i = 0; i < 10000; i++) {
+    if (http_parser_execute(&parser, &settings_null, buf, strlen(buf)) != strlen(buf)) {
+      //fprintf(stderr, "error found on iter %d\n", i);
+      return;
+    }
+  }
+
+  fprintf(stderr, "\n*** Error expected but none in header overflow test ***\n");
+  exit(1);
+}
+
+void
+test_no_overflow_long_body (int req, size_t length)
+{
+  http_parser parser;
+  http_parser_init(&parser, req ? HTTP_REQUEST : HTTP_RESPONSE);
+  size_t parsed;
+  size_t i;
+  char buf1[3000];
+  size_t buf1len = sprintf(buf1, "%s\r\nConnection: Keep-Alive\r\nContent-Length: %zu\r\n\r\n",
+      req ? "POST / HTTP/1.0" : "HTTP/1.0 200 OK", length);
+  parsed = http_parser_execute(&parser, &settings_null, buf1, buf1len);
+  if (parsed != buf1len)
+    goto err;
+
+  for (i = 0; i < length; i++) {
+    char foo = 'a';
+    parsed = http_parser_execute(&parser, &settings_null, &foo, 1);
+    if (parsed != 1)
+      goto err;
+  }
+
+  parsed = http_parser_execute(&parser, &settings_null, buf1, buf1len);
+  if (parsed != buf1len) goto err;
+  return;
+
+ err:
+  fprintf(stderr,
+          "\n*** error in test_no_overflow_long_body %s of length %zu ***\n",
+          req ? "REQUEST" : "RESPONSE",
+          length);
+  exit(1);
+}
+
+static void
+expect_bytes (const char *buf, enum http_expect expect, uint64_t n)
+{
+  uint64_t got_n = 12345;
+  size_t len = strlen(buf);
+
+  assert(len == parse(buf, len));
+
+  enum http_expect got = http_parser_expected_bytes(parser, &settings, &got_n);
+  if (got != expect || got_n != n) {
+    fprintf(stderr, "\n*** expected bytes after '%s': %d/%llu, got %d/%llu ***\n",
+            buf, expect, (unsigned long long)n, got, (unsigned long long)got_n);
+    exit(1);
+  }
+}
+
+void
+test_expected_bytes (void)
+{
+  parser_init(HTTP_REQUEST);
+  assert(HTTP_EXPECT_HEAD == http_parser_expected_bytes(parser, NULL, NULL));
+  expect_bytes("POST / HTTP/1.1\r\n", HTTP_EXPECT_HEAD, HTTP_MAX_HEADER_SIZE - 17);
+  expect_bytes("Content-Length: 10\r\n\r\n", HTTP_EXPECT_BODY, 10);
+  expect_bytes("0123", HTTP_EXPECT_BODY, 6);
+  expect_bytes("456789", HTTP_EXPECT_HEAD, HTTP_MAX_HEADER_SIZE);
+
+  expect_bytes("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+               HTTP_EXPECT_CHUNK, 5);
+  expect_bytes("1", HTTP_EXPECT_CHUNK, 2 + 1 + 2 + 5);
+  expect_bytes("a", HTTP_EXPECT_CHUNK, 2 + 0x1a + 2 + 5);
+  expect_bytes("\r\n", HTTP_EXPECT_CHUNK, 0x1a + 2 + 5);
+  expect_bytes("0123456789", HTTP_EXPECT_CHUNK, 16 + 2 + 5);
+  expect_bytes("0123456789abcdef", HTTP_EXPECT_CHUNK, 2 + 5);
+  expect_bytes("\r\n", HTTP_EXPECT_CHUNK, 5);
+  expect_bytes("0\r\n", HTTP_EXPECT_CHUNK, 1);
+  expect_bytes("\r\n", HTTP_EXPECT_HEAD, HTTP_MAX_HEADER_SIZE);
+  assert(num_messages == 2);
+
+  expect_bytes("GET / HTTP/1.1\r\nConnection: Upgrade\r\nUpgrade: x\r\n\r\n",
+               HTTP_EXPECT_NONE, 0);
+  parser_free();
+
+  parser_init(HTTP_RESPONSE);
+  expect_bytes("HTTP/1.0 200 OK\r\n\r\n", HTTP_EXPECT_EOF, 0);
+  parser_free();
+
+  /* the head limit in the settings */
+  {
+    struct http_parser_limits limits = { .max_head_size = 100 };
+    uint64_t n;
+
+    settings.limits = &limits;
+    parser_init(HTTP_REQUEST);
+    assert(HTTP_EXPECT_HEAD == http_parser_expected_bytes(parser, &settings, &n));
+    assert(n == 100);
+    expect_bytes("POST / HTTP/1.1\r\n", HTTP_EXPECT_HEAD, 100 - 17);
+    parser_free();
+    settings.limits = NULL;
+  }
+}
+
+/* A client pipelines HEAD, GET and CONNECT. The responses are framed by
+ * the methods it told the parser about.
+ */
+void
+test_expect_response (void)
+{
+  const char *raw =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 10\r\n"
+    "\r\n"
+    "HTTP/1.1 100 Continue\r\n"
+    "\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 3\r\n"
+    "\r\n"
+    "abc"
+    "HTTP/1.1 200 Connection established\r\n"
+    "\r\n";
+  const char *tunnel = "\x16\x03\x01 tls client hello";
+  char buf[1024];
+  size_t read, len;
+  int i;
+
+  strcpy(buf, raw);
+  strcat(buf, tunnel);
+  len = strlen(buf);
+
+  parser_init(HTTP_RESPONSE);
+
+  assert(0 == http_parser_expect_response(parser, HTTP_HEAD));
+  assert(0 == http_parser_expect_response(parser, HTTP_GET));
+  assert(0 == http_parser_expect_response(parser, HTTP_CONNECT));
+
+  read = parse(buf, len);
+
+  if (!parser->upgrade || read != strlen(raw)) {
+    fprintf(stderr, "\n*** CONNECT response did not start a tunnel ***\n");
+    exit(1);
+  }
+
+  assert(num_messages == 4);
+  assert(messages[0].status_code == 200);
+  assert(messages[0].body_size == 0);
+  assert(messages[1].status_code == 100);
+  assert(messages[2].status_code == 200);
+  assert(0 == strcmp(messages[2].body, "abc"));
+  assert(messages[3].status_code == 200);
+
+  parser_free();
+
+  /* the queue is bounded */
+  parser_init(HTTP_RESPONSE);
+  for (i = 0; i < HTTP_MAX_PENDING_REQUESTS; i++) {
+    assert(0 == http_parser_expect_response(parser, HTTP_GET));
+  }
+  assert(-1 == http_parser_expect_response(parser, HTTP_GET));
+  parser_free();
+}
+
+void
+test_multiple3 (const struct message *r1, const struct message *r2, const struct message *r3)
+{
+  int message_count = 1;
+  if (!r1->upgrade) {
+    message_count++;
+    if (!r2->upgrade) message_count++;
+  }
+  int has_upgrade = (message_count < 3 || r3->upgrade);
+
+  char total[ strlen(r1->raw)
+            + strlen(r2->raw)
+            + strlen(r3->raw)
+            + 1
+            ];
+  total[0] = '\0';
+
+  strcat(total, r1->raw);
+  strcat(total, r2->raw);
+  strcat(total, r3->raw);
+
+  parser_init(r1->type);
+
+  size_t read;
+
+  read = parse(total, strlen(total));
+
+  if (has_upgrade && parser->upgrade) goto test;
+
+  if (read != strlen(total)) {
+    print_error(total, read);
+    exit(1);
+  }
+
+  read = parse(NULL, 0);
+
+  if (has_upgrade && parser->upgrade) goto test;
+
+  if (read != 0) {
+    print_error(total, read);
+    exit(1);
+  }
+
+test:
+
+  if (message_count != num_messages) {
+    fprintf(stderr, "\n\n*** Parser didn't see 3 messages only %d *** \n", num_messages);
+    exit(1);
+  }
+
+  if (!message_eq(0, r1)) exit(1);
+  if (message_count > 1) {
+    if (!message_eq(1, r2)) exit(1);
+    if (message_count > 2) {
+      if (!message_eq(2, r3)) exit(1);
+    }
+  }
+
+  parser_free();
+}
+
+/* SCAN through every possible breaking to make sure the
+ * parser can handle getting the content in any chunks that
+ * might come from the socket
+ */
+void
+test_scan (const struct message *r1, const struct message *r2, const struct message *r3)
+{
+  char total[80*1024] = "\0";
+  char buf1[80*1024] = "\0";
+  char buf2[80*1024] = "\0";
+  char buf3[80*1024] = "\0";
+
+  strcat(total, r1->raw);
+  strcat(total, r2->raw);
+  strcat(total, r3->raw);
+
+  size_t read;
+
+  int total_len = strlen(total);
+
+  int total_ops = 2 * (total_len - 1) * (total_len - 2) / 2;
+  int ops = 0 ;
+
+  size_t buf1_len, buf2_len, buf3_len;
+
+  int i,j,type_both;
+  for (type_both = 0; type_both < 2; type_both ++ ) {
+    for (j = 2; j < total_len; j ++ ) {
+      for (i = 1; i < j; i ++ ) {
+
+        if (ops % 1000 == 0)  {
+          printf("\b\b\b\b%3.0f%%", 100 * (float)ops /(float)total_ops);
+          fflush(stdout);
+        }
+        ops += 1;
+
+        parser_init(type_both ? HTTP_BOTH : r1->type);
+
+        buf1_len = i;
+        strncpy(buf1, total, buf1_len);
+        buf1[buf1_len] = 0;
+
+        buf2_len = j - i;
+        strncpy(buf2, total+i, buf2_len);
+        buf2[buf2_len] = 0;
 
         buf3_len = total_len - j;
         strncpy(buf3, total+j, buf3_len);
@@ -1621,15 +3418,394 @@ create_large_chunked_message (int body_size_in_kb, const char* headers)
   return buf;
 }
 
+// user required to free the result
+// string terminated by \0
+static char *
+flatten_iov (const struct iovec *iov, int iovcnt)
+{
+  int i;
+  size_t len = 0, wrote = 0;
+
+  for (i = 0; i < iovcnt; i++) len += iov[i].iov_len;
+
+  char *buf = malloc(len + 1);
+
+  for (i = 0; i < iovcnt; i++) {
+    memcpy(buf + wrote, iov[i].iov_base, iov[i].iov_len);
+    wrote += iov[i].iov_len;
+  }
+  buf[wrote] = '\0';
+
+  return buf;
+}
+
+void
+test_chunk_header (size_t len, const char *expected)
+{
+  char header[HTTP_CHUNK_HEADER_SIZE + 1];
+  size_t n = http_chunk_header(header, len);
+  header[n] = '\0';
+
+  if (0 != strcmp(header, expected)) {
+    fprintf(stderr, "\n*** http_chunk_header(%zu) expected '%s' got '%s' ***\n",
+            len, expected, header);
+    exit(1);
+  }
+}
+
+/* Encode body fragments with the chunk writer, then make sure the parser
+ * decodes them back to the original body.
+ */
+void
+test_chunk_writer (const char *trailers)
+{
+  static const char *fragments[] =
+    { "hello"
+    , ""
+    , " "
+    , "world, this fragment is longer than fifteen bytes"
+    , 0 };
+  const char *head = "HTTP/1.1 200 OK\r\n"
+                     "Transfer-Encoding: chunked\r\n"
+                     "\r\n";
+  struct iovec iov[1 + 4 * HTTP_CHUNK_IOVCNT + 3];
+  char headers[4][HTTP_CHUNK_HEADER_SIZE];
+  int i, iovcnt = 0;
+
+  iov[iovcnt].iov_base = (void *) head;
+  iov[iovcnt].iov_len = strlen(head);
+  iovcnt++;
+
+  for (i = 0; fragments[i]; i++) {
+    iovcnt += http_chunk_iov(iov + iovcnt,
+                             headers[i],
+                             fragments[i],
+                             strlen(fragments[i]));
+  }
+
+  iovcnt += http_chunk_last_iov(iov + iovcnt,
+                                trailers,
+                                trailers ? strlen(trailers) : 0);
+
+  /* the payload is referenced, never copied */
+  assert(iov[2].iov_base == fragments[0]);
+
+  char *raw = flatten_iov(iov, iovcnt);
+
+  struct message m =
+    {.name= "chunk writer"
+    ,.type= HTTP_RESPONSE
+    ,.raw= raw
+    ,.should_keep_alive= TRUE
+    ,.message_complete_on_eof= FALSE
+    ,.http_major= 1
+    ,.http_minor= 1
+    ,.status_code= 200
+    ,.num_headers= trailers ? 3 : 1
+    ,.headers=
+      { { "Transfer-Encoding", "chunked" }
+      , { "Vary", "*" }
+      , { "Content-Type", "text/plain" }
+      }
+    ,.body= "hello world, this fragment is longer than fifteen bytes"
+    };
+
+  test_message(&m);
+  free(raw);
+}
+
+void
+test_chunk_writer_large (void)
+{
+  size_t body_len = 300 * 1024, i;
+  char *body = malloc(body_len);
+  const char *head = "HTTP/1.1 200 OK\r\n"
+                     "Transfer-Encoding: chunked\r\n"
+                     "\r\n";
+  struct iovec iov[1 + 2 * HTTP_CHUNK_IOVCNT + 1];
+  char headers[2][HTTP_CHUNK_HEADER_SIZE];
+  int iovcnt = 0;
+
+  for (i = 0; i < body_len; i++) body[i] = 'a' + i % 26;
+
+  iov[iovcnt].iov_base = (void *) head;
+  iov[iovcnt].iov_len = strlen(head);
+  iovcnt++;
+  iovcnt += http_chunk_iov(iov + iovcnt, headers[0], body, 0x10000);
+  iovcnt += http_chunk_iov(iov + iovcnt, headers[1], body + 0x10000, body_len - 0x10000);
+  iovcnt += http_chunk_last_iov(iov + iovcnt, NULL, 0);
+
+  char *raw = flatten_iov(iov, iovcnt);
+
+  struct message m =
+    {.name= "chunk writer large"
+    ,.type= HTTP_RESPONSE
+    ,.raw= raw
+    ,.should_keep_alive= TRUE
+    ,.message_complete_on_eof= FALSE
+    ,.http_major= 1
+    ,.http_minor= 1
+    ,.status_code= 200
+    ,.num_headers= 1
+    ,.headers=
+      { { "Transfer-Encoding", "chunked" }
+      }
+    ,.body_size= 300 * 1024
+    };
+
+  test_message_count_body(&m);
+  free(raw);
+  free(body);
+}
+
+void
+test_date (void)
+{
+  struct http_date_cache cache;
+  memset(&cache, 0, sizeof cache);
+
+  const char *expected = "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n";
+  const char *d = http_date(&cache, 784111777);
+  assert(strlen(expected) == HTTP_DATE_LINE_LEN);
+  assert(0 == memcmp(d, expected, HTTP_DATE_LINE_LEN));
+
+  /* same second, served from the cache */
+  assert(d == http_date(&cache, 784111777));
+
+  d = http_date(&cache, 0);
+  assert(0 == memcmp(d, "Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n", HTTP_DATE_LINE_LEN));
+}
+
+#define HEADER(f, v) { f, sizeof(f)-1, v, sizeof(v)-1 }
+
+/* Serialize a head through both http_head_write() and http_head_iov(),
+ * check they agree and that the parser reads back what was written.
+ */
+void
+test_head_writer (const struct http_head *head, const struct message *expected)
+{
+  char buf[1024];
+  size_t size = http_head_size(head);
+  assert(size > 0);
+
+  assert(0 == http_head_write(head, buf, size - 1));
+  assert(size == http_head_write(head, buf, sizeof buf));
+  buf[size] = '\0';
+
+  int iovcnt = http_head_iovcnt(head);
+  struct iovec iov[iovcnt];
+  assert(-1 == http_head_iov(head, iov, iovcnt - 1));
+  assert(iovcnt == http_head_iov(head, iov, iovcnt));
+
+  char *flat = flatten_iov(iov, iovcnt);
+  if (0 != strcmp(buf, flat)) {
+    fprintf(stderr, "\n*** http_head_iov and http_head_write disagree ***\n"
+                    "%s\n---\n%s\n", buf, flat);
+    exit(1);
+  }
+  free(flat);
+
+  struct message m = *expected;
+  m.raw = buf;
+  test_message(&m);
+}
+
+void
+test_head_writers (void)
+{
+  struct http_date_cache cache;
+  memset(&cache, 0, sizeof cache);
+
+  const struct http_header headers[] =
+    { HEADER("Content-Type", "text/plain")
+    , HEADER("Content-Length", "0")
+    };
+
+  struct http_head head =
+    {.type= HTTP_RESPONSE
+    ,.http_major= 1
+    ,.http_minor= 1
+    ,.status_code= 404
+    ,.date= http_date(&cache, 784111777)
+    ,.headers= headers
+    ,.num_headers= 2
+    };
+
+  struct message expected =
+    {.name= "head writer response"
+    ,.type= HTTP_RESPONSE
+    ,.should_keep_alive= TRUE
+    ,.message_complete_on_eof= FALSE
+    ,.http_major= 1
+    ,.http_minor= 1
+    ,.status_code= 404
+    ,.num_headers= 3
+    ,.headers=
+      { { "Date", "Sun, 06 Nov 1994 08:49:37 GMT" }
+      , { "Content-Type", "text/plain" }
+      , { "Content-Length", "0" }
+      }
+    ,.body= ""
+    };
+
+  test_head_writer(&head, &expected);
+
+  head.http_minor = 0;
+  head.status_code = 200;
+  expected.http_minor = 0;
+  expected.status_code = 200;
+  expected.should_keep_alive = FALSE;
+  test_head_writer(&head, &expected);
+
+  char buf[64];
+  assert(0 == strcmp(http_status_str(431), "Request Header Fields Too Large"));
+  assert(NULL == http_status_str(299));
+  head.status_code = 299;
+  assert(0 == http_head_size(&head));
+  assert(0 == http_head_write(&head, buf, sizeof buf));
+  head.status_code = 200;
+  head.http_major = 2;
+  assert(0 == http_head_size(&head));
+
+  const struct http_header req_headers[] =
+    { HEADER("Host", "example.com")
+    };
+
+  struct http_head req =
+    {.type= HTTP_REQUEST
+    ,.http_major= 1
+    ,.http_minor= 1
+    ,.method= HTTP_PROPFIND
+    ,.url= "/dav/file?x=1"
+    ,.url_len= sizeof("/dav/file?x=1")-1
+    ,.headers= req_headers
+    ,.num_headers= 1
+    };
+
+  struct message req_expected =
+    {.name= "head writer request"
+    ,.type= HTTP_REQUEST
+    ,.should_keep_alive= TRUE
+    ,.message_complete_on_eof= FALSE
+    ,.http_major= 1
+    ,.http_minor= 1
+    ,.method= HTTP_PROPFIND
+    ,.query_string= "x=1"
+    ,.fragment= ""
+    ,.request_path= "/dav/file"
+    ,.request_url= "/dav/file?x=1"
+    ,.num_headers= 1
+    ,.headers= { { "Host", "example.com" } }
+    ,.body= ""
+    };
+
+  test_head_writer(&req, &req_expected);
+}
+
+/* * B E N C H M A R K S * */
+
+/* Cycle counter where there is one, nanoseconds otherwise. */
+static inline uint64_t
+bench_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static double
+bench_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Feed a message to the parser one byte per call, like a client that sends
+ * one byte per packet. Returns the number of calls made.
+ */
+static size_t
+bench_dribble_message (const struct message *m)
+{
+  http_parser p;
+  size_t i, len = strlen(m->raw);
+
+  http_parser_init(&p, m->type);
+
+  for (i = 0; i < len; i++) {
+    if (http_parser_execute(&p, &settings_null, m->raw + i, 1) != 1) break;
+  }
+
+  return i;
+}
+
+void
+bench_dribble (const char *name, int iterations)
+{
+  uint64_t start, ticks;
+  double seconds;
+  size_t calls = 0;
+  int i, n;
+
+  start = bench_ticks();
+  seconds = bench_seconds();
+
+  for (n = 0; n < iterations; n++) {
+    for (i = 0; requests[i].name; i++) calls += bench_dribble_message(&requests[i]);
+    for (i = 0; responses[i].name; i++) calls += bench_dribble_message(&responses[i]);
+  }
+
+  ticks = bench_ticks() - start;
+  seconds = bench_seconds() - seconds;
+
+  printf("%s: %zu one byte calls, %.1f ticks/call, %.1f ns/call\n",
+         name,
+         calls,
+         (double)ticks / calls,
+         seconds * 1e9 / calls);
+}
+
+int
+bench (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  bench_dribble("dribble", 2000);
+
+#if HTTP_PARSER_TRACE
+  {
+    static struct http_trace_event events[1024];
+    struct http_trace trace;
+
+    /* the setup the README suggests */
+    http_trace_init(&trace, events, 1024, 64);
+    http_trace_attach(&trace);
+    bench_dribble("dribble, traced 1 in 64", 2000);
+    http_trace_attach(NULL);
+  }
+#endif
+
+  return 0;
+}
+
 
 int
-main (void)
+main (int argc, char **argv)
 {
   parser = NULL;
   int i, j, k;
   int request_count;
   int response_count;
 
+  if (argc > 1 && 0 == strcmp(argv[1], "bench")) {
+    return bench(argc - 2, argv + 2);
+  }
+
   printf("sizeof(http_parser) = %u\n", (unsigned int)sizeof(http_parser));
 
   for (request_count = 0; requests[request_count].name; request_count++);
@@ -1649,6 +3825,14 @@ main (void)
 
   for (i = 0; i < response_count; i++) {
     test_message(&responses[i]);
+    test_message_inplace(&responses[i]);
+    test_message_pause(&responses[i]);
+    test_message_iov(&responses[i]);
+    test_message_ring(&responses[i]);
+    test_message_retain(&responses[i], 1);
+    test_message_retain(&responses[i], 7);
+    test_message_snapshot(&responses[i], 0);
+    test_message_snapshot(&responses[i], 1);
   }
 
   for (i = 0; i < response_count; i++) {
@@ -1691,6 +3875,49 @@ main (void)
     free(msg);
   }
 
+  test_expect_response();
+  test_expected_bytes();
+  test_snapshot_errors();
+  test_execute_arguments();
+  test_errno();
+  test_limits();
+  test_route();
+  test_key();
+  test_cache();
+  test_inflate();
+  test_pipeline();
+  test_multipart();
+  test_websocket();
+  test_inplace();
+  test_dechunk();
+  test_head_after_trailers();
+#if HTTP_PARSER_STATS
+  test_stats();
+#endif
+#if HTTP_PARSER_TRACE
+  test_trace();
+#endif
+#if HTTP_PARSER_TIMING
+  test_timing();
+#endif
+
+  //// CHUNK WRITER
+
+  test_chunk_header(0, "0\r\n");
+  test_chunk_header(0x1a2, "1a2\r\n");
+  test_chunk_header(0x10000, "10000\r\n");
+  test_chunk_header((size_t)-1, sizeof(size_t) == 8 ? "ffffffffffffffff\r\n"
+                                                     : "ffffffff\r\n");
+  test_chunk_writer(NULL);
+  test_chunk_writer("Vary: *\r\n"
+                    "Content-Type: text/plain\r\n");
+  test_chunk_writer_large();
+
+  //// HEAD WRITER
+
+  test_date();
+  test_head_writers();
+
 
 
   printf("response scan 1/2      ");
@@ -1797,6 +4024,14 @@ main (void)
   /* check to make sure our predefined requests are okay */
   for (i = 0; requests[i].name; i++) {
     test_message(&requests[i]);
+    test_message_inplace(&requests[i]);
+    test_message_pause(&requests[i]);
+    test_message_iov(&requests[i]);
+    test_message_ring(&requests[i]);
+    test_message_retain(&requests[i], 1);
+    test_message_retain(&requests[i], 7);
+    test_message_snapshot(&requests[i], 0);
+    test_message_snapshot(&requests[i], 1);
   }
 
 
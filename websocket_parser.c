@@ -0,0 +1,425 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <websocket_parser.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+# include <emmintrin.h>
+# define WEBSOCKET_SSE2 1
+#endif
+
+
+#ifndef MIN
+# define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+
+#define SET_ERRNO(e)                                                 \
+do {                                                                 \
+  parser->ws_errno = (e);                                            \
+} while (0)
+
+
+#define CALLBACK(FOR)                                                \
+do {                                                                 \
+  if (settings->on_##FOR && settings->on_##FOR(parser) != 0) {       \
+    SET_ERRNO(WSE_CALLBACK);                                         \
+    goto error;                                                      \
+  }                                                                  \
+} while (0)
+
+
+#define CALLBACK_DATA(FOR, AT, LEN)                                  \
+do {                                                                 \
+  if (settings->on_##FOR                                             \
+      && settings->on_##FOR(parser, (AT), (LEN)) != 0) {             \
+    SET_ERRNO(WSE_CALLBACK);                                         \
+    goto error;                                                      \
+  }                                                                  \
+} while (0)
+
+
+enum state
+  { s_dead = 1
+  , s_closed
+
+  , s_start
+  , s_length
+  , s_ext_length
+  , s_mask
+  , s_payload
+  };
+
+
+static const char *errno_strings[] =
+  { "success"
+  , "a callback failed"
+  , "RSV bit set without an extension"
+  , "reserved opcode"
+  , "wrong masking for the role"
+  , "invalid 64-bit length"
+  , "fragmented or too long control frame"
+  , "continuation frame out of place"
+  , "text is not valid UTF-8"
+  , "close payload of one byte"
+  , "frame longer than max_length"
+  , "data after the close frame or an error"
+  };
+
+
+/* UTF-8 decoder state: the continuation bytes still expected and the
+ * range the next one has to be in, which rules out overlong forms,
+ * surrogates and code points past U+10FFFF. 0 between characters.
+ */
+#define UTF8_ACCEPT 0
+#define UTF8_REJECT 0xff
+#define UTF8_NEED(n, lo, hi) ((uint32_t) (n) | (lo) << 8 | (hi) << 16)
+
+
+static uint32_t
+utf8_check (uint32_t state, const unsigned char *p, size_t len)
+{
+  const unsigned char *pe = p + len;
+  unsigned char c;
+  uint32_t n;
+
+  while (p != pe) {
+    if (state != UTF8_ACCEPT) {
+      c = *p++;
+      if (c < ((state >> 8) & 0xff) || c > state >> 16) return UTF8_REJECT;
+      n = (state & 0xff) - 1;
+      state = n ? UTF8_NEED(n, 0x80, 0xbf) : UTF8_ACCEPT;
+      continue;
+    }
+
+    /* ASCII, a block at a time */
+#if WEBSOCKET_SSE2
+    while (pe - p >= 16
+           && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) p))) {
+      p += 16;
+    }
+#else
+    {
+      uint64_t w;
+      while (pe - p >= 8) {
+        memcpy(&w, p, 8);
+        if (w & 0x8080808080808080ULL) break;
+        p += 8;
+      }
+    }
+#endif
+    while (p != pe && *p < 0x80) p++;
+    if (p == pe) break;
+
+    c = *p++;
+    if (c >= 0xc2 && c <= 0xdf) state = UTF8_NEED(1, 0x80, 0xbf);
+    else if (c == 0xe0) state = UTF8_NEED(2, 0xa0, 0xbf);
+    else if (c == 0xed) state = UTF8_NEED(2, 0x80, 0x9f);
+    else if (c >= 0xe1 && c <= 0xef) state = UTF8_NEED(2, 0x80, 0xbf);
+    else if (c == 0xf0) state = UTF8_NEED(3, 0x90, 0xbf);
+    else if (c >= 0xf1 && c <= 0xf3) state = UTF8_NEED(3, 0x80, 0xbf);
+    else if (c == 0xf4) state = UTF8_NEED(3, 0x80, 0x8f);
+    else return UTF8_REJECT;
+  }
+  return state;
+}
+
+
+void
+websocket_mask (char *data,
+                size_t len,
+                const unsigned char *mask,
+                uint64_t offset)
+{
+  unsigned char key[4];
+  uint32_t key32;
+  uint64_t key64, w;
+  size_t i = 0;
+  int j;
+
+  /* the mask as it lines up with data[0] */
+  for (j = 0; j < 4; j++) key[j] = mask[(offset + j) & 3];
+  memcpy(&key32, key, 4);
+  key64 = (uint64_t) key32 << 32 | key32;
+
+#if WEBSOCKET_SSE2
+  {
+    const __m128i m = _mm_set1_epi32((int) key32);
+
+    for (; i + 16 <= len; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+      _mm_storeu_si128((__m128i *) (data + i), _mm_xor_si128(v, m));
+    }
+  }
+#endif
+
+  for (; i + 8 <= len; i += 8) {
+    memcpy(&w, data + i, 8);
+    w ^= key64;
+    memcpy(data + i, &w, 8);
+  }
+  for (; i < len; i++) data[i] ^= key[i & 3];
+}
+
+
+size_t
+websocket_frame_header (char *buf,
+                        int fin,
+                        enum websocket_opcode opcode,
+                        uint64_t length,
+                        const unsigned char *mask)
+{
+  unsigned char *p = (unsigned char *) buf;
+  size_t n = 2;
+  int i;
+
+  p[0] = (fin ? 0x80 : 0) | opcode;
+  p[1] = mask ? 0x80 : 0;
+  if (length < 126) {
+    p[1] |= length;
+  } else if (length <= 0xffff) {
+    p[1] |= 126;
+    p[2] = length >> 8;
+    p[3] = length;
+    n = 4;
+  } else {
+    p[1] |= 127;
+    for (i = 0; i < 8; i++) p[2 + i] = length >> (56 - 8 * i);
+    n = 10;
+  }
+  if (mask) {
+    memcpy(p + n, mask, 4);
+    n += 4;
+  }
+  return n;
+}
+
+
+void
+websocket_parser_init (websocket_parser *parser, enum websocket_role role)
+{
+  void *data = parser->data;
+  uint64_t max_length = parser->max_length;
+
+  memset(parser, 0, sizeof *parser);
+  parser->data = data;
+  parser->max_length = max_length;
+  parser->role = role;
+  parser->state = s_start;
+}
+
+
+/* Text, a continuation of text, or the reason of a close */
+static int
+checks_utf8 (const websocket_parser *parser)
+{
+  return parser->opcode == WS_TEXT
+      || parser->opcode == WS_CLOSE
+      || (parser->opcode == WS_CONTINUATION
+          && parser->message_opcode == WS_TEXT);
+}
+
+
+size_t
+websocket_parser_execute (websocket_parser *parser,
+                          const websocket_parser_settings *settings,
+                          char *data,
+                          size_t len)
+{
+  char *p = data, *pe = data + len;
+  enum state state = (enum state) parser->state;
+  unsigned char ch;
+  size_t n, skip;
+  uint64_t offset;
+
+  if (state == s_dead || state == s_closed) {
+    if (len > 0 && parser->ws_errno == WSE_OK) SET_ERRNO(WSE_CLOSED);
+    return 0;
+  }
+
+  for (; p != pe; p++) {
+    ch = (unsigned char) *p;
+
+    switch (state) {
+      case s_start:
+        if (ch & 0x70) {
+          SET_ERRNO(WSE_INVALID_RSV);
+          goto error;
+        }
+        parser->fin = ch >> 7;
+        parser->opcode = ch & 0x0f;
+        switch (parser->opcode) {
+          case WS_CONTINUATION:
+            if (!parser->message_opcode) {
+              SET_ERRNO(WSE_INVALID_FRAGMENT);
+              goto error;
+            }
+            break;
+          case WS_TEXT:
+          case WS_BINARY:
+            if (parser->message_opcode) {
+              SET_ERRNO(WSE_INVALID_FRAGMENT);
+              goto error;
+            }
+            break;
+          case WS_CLOSE:
+          case WS_PING:
+          case WS_PONG:
+            if (!parser->fin) {
+              SET_ERRNO(WSE_INVALID_CONTROL);
+              goto error;
+            }
+            break;
+          default:
+            SET_ERRNO(WSE_INVALID_OPCODE);
+            goto error;
+        }
+        state = s_length;
+        break;
+
+      case s_length:
+        parser->masked = ch >> 7;
+        if (parser->masked != (parser->role == WS_SERVER)) {
+          SET_ERRNO(WSE_INVALID_MASK);
+          goto error;
+        }
+        ch &= 0x7f;
+        if (WEBSOCKET_IS_CONTROL(parser->opcode) && ch > 125) {
+          SET_ERRNO(WSE_INVALID_CONTROL);
+          goto error;
+        }
+        parser->length = 0;
+        if (ch >= 126) {
+          parser->index = ch == 126 ? 2 : 8;
+          state = s_ext_length;
+          break;
+        }
+        parser->length = ch;
+        if (parser->masked) {
+          parser->index = 4;
+          state = s_mask;
+          break;
+        }
+        goto header_done;
+
+      case s_ext_length:
+        parser->length = parser->length << 8 | ch;
+        if (--parser->index > 0) break;
+        if (parser->length >> 63) {
+          SET_ERRNO(WSE_INVALID_LENGTH);
+          goto error;
+        }
+        if (parser->masked) {
+          parser->index = 4;
+          state = s_mask;
+          break;
+        }
+        goto header_done;
+
+      case s_mask:
+        parser->mask[4 - parser->index] = ch;
+        if (--parser->index > 0) break;
+        goto header_done;
+
+      case s_payload:
+        n = MIN((uint64_t) (pe - p), parser->remaining);
+        offset = parser->length - parser->remaining;
+        if (parser->masked) websocket_mask(p, n, parser->mask, offset);
+
+        if (checks_utf8(parser)) {
+          /* a close payload starts with a 2 byte status code */
+          skip = parser->opcode == WS_CLOSE && offset < 2
+               ? MIN(2 - offset, n) : 0;
+          parser->utf8 = utf8_check(parser->utf8,
+                                    (const unsigned char *) p + skip,
+                                    n - skip);
+          if (parser->utf8 == UTF8_REJECT) {
+            SET_ERRNO(WSE_INVALID_UTF8);
+            goto error;
+          }
+        }
+
+        CALLBACK_DATA(frame_payload, p, n);
+        parser->remaining -= n;
+        p += n - 1;
+        if (parser->remaining > 0) break;
+        goto frame_end;
+
+      default:
+        SET_ERRNO(WSE_CLOSED);
+        goto error;
+    }
+    continue;
+
+header_done:
+    if (parser->max_length && parser->length > parser->max_length) {
+      SET_ERRNO(WSE_TOO_LARGE);
+      goto error;
+    }
+    if (parser->opcode == WS_CLOSE && parser->length == 1) {
+      SET_ERRNO(WSE_INVALID_CLOSE);
+      goto error;
+    }
+    if (parser->opcode == WS_TEXT || parser->opcode == WS_BINARY) {
+      parser->message_opcode = parser->opcode;
+      parser->utf8 = UTF8_ACCEPT;
+    } else if (parser->opcode == WS_CLOSE) {
+      parser->utf8 = UTF8_ACCEPT;
+    }
+    parser->remaining = parser->length;
+    state = s_payload;
+    CALLBACK(frame_header);
+    if (parser->remaining > 0) continue;
+
+frame_end:
+    state = s_start;
+    if (checks_utf8(parser)
+        && (parser->fin || parser->opcode == WS_CLOSE)
+        && parser->utf8 != UTF8_ACCEPT) {
+      SET_ERRNO(WSE_INVALID_UTF8);
+      goto error;
+    }
+    CALLBACK(frame_end);
+
+    if (parser->opcode == WS_CLOSE) {
+      parser->state = s_closed;
+      return p - data + 1;
+    }
+    if (!WEBSOCKET_IS_CONTROL(parser->opcode) && parser->fin) {
+      parser->message_opcode = 0;
+      CALLBACK(message_end);
+    }
+  }
+
+  parser->state = state;
+  return len;
+
+error:
+  parser->state = s_dead;
+  return p - data;
+}
+
+
+const char *
+websocket_errno_description (enum websocket_errno err)
+{
+  return errno_strings[err];
+}
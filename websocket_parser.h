@@ -0,0 +1,168 @@
+/* Copyright 2009,2010 Ryan Dahl <ry@tinyclouds.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef websocket_parser_h
+#define websocket_parser_h
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* Parser for WebSocket frames (RFC 6455), for the bytes that follow an
+ * upgrade: when http_parser_execute() returns with parser->upgrade set,
+ * the frames start at the offset it returned. Like http_parser it is
+ * resumable at any byte, allocates nothing and reports payload through
+ * callbacks that point into the buffers passed in. Masked payload is
+ * unmasked in place, text is checked to be UTF-8 across fragments.
+ * Extensions are not supported, a frame with an RSV bit set is an error.
+ */
+typedef struct websocket_parser websocket_parser;
+typedef struct websocket_parser_settings websocket_parser_settings;
+
+typedef int (*websocket_data_cb) (websocket_parser *, const char *at,
+                                  size_t len);
+typedef int (*websocket_cb) (websocket_parser *);
+
+
+/* The longest frame header: 2 bytes, a 64-bit length and a mask */
+#define WEBSOCKET_MAX_HEADER_SIZE 14
+
+
+enum websocket_opcode
+  { WS_CONTINUATION = 0x0
+  , WS_TEXT         = 0x1
+  , WS_BINARY       = 0x2
+  , WS_CLOSE        = 0x8
+  , WS_PING         = 0x9
+  , WS_PONG         = 0xA
+  };
+
+#define WEBSOCKET_IS_CONTROL(opcode) ((opcode) & 0x8)
+
+
+/* Servers get masked frames from clients, clients unmasked ones */
+enum websocket_role { WS_SERVER, WS_CLIENT };
+
+
+enum websocket_errno
+  { WSE_OK = 0
+  , WSE_CALLBACK            /* a callback returned non-zero */
+  , WSE_INVALID_RSV         /* an RSV bit is set */
+  , WSE_INVALID_OPCODE      /* a reserved opcode */
+  , WSE_INVALID_MASK        /* masked to a client or unmasked to a server */
+  , WSE_INVALID_LENGTH      /* 64-bit length with the top bit set */
+  , WSE_INVALID_CONTROL     /* fragmented or too long control frame */
+  , WSE_INVALID_FRAGMENT    /* continuation out of place, or missing */
+  , WSE_INVALID_UTF8        /* text or close reason not UTF-8 */
+  , WSE_INVALID_CLOSE       /* close payload of one byte */
+  , WSE_TOO_LARGE           /* frame over max_length */
+  , WSE_CLOSED              /* data after the close frame or an error */
+  };
+
+
+struct websocket_parser {
+  /** PRIVATE **/
+  unsigned char state;
+  unsigned char role;       /* enum websocket_role */
+  unsigned char index;      /* header bytes still to read */
+  unsigned char mask[4];
+  uint32_t utf8;            /* UTF-8 decoder state of the text */
+  uint64_t remaining;       /* payload bytes of the frame still to read */
+
+  /** READ-ONLY **/
+  /* The frame being parsed, set before on_frame_header */
+  uint64_t length;
+  unsigned char opcode;     /* enum websocket_opcode */
+  unsigned char fin;
+  unsigned char masked;
+
+  /* WS_TEXT or WS_BINARY while a data message is in progress, else 0 */
+  unsigned char message_opcode;
+
+  unsigned char ws_errno;   /* enum websocket_errno */
+
+  /** PUBLIC **/
+  void *data;
+
+  /* Frames longer than this are refused; 0 for no limit. Like 'data' it
+   * is kept by websocket_parser_init().
+   */
+  uint64_t max_length;
+};
+
+
+/* Any of the callbacks may be NULL. Control frames may come between the
+ * fragments of a message; check parser->opcode in on_frame_payload.
+ */
+struct websocket_parser_settings {
+  websocket_cb      on_frame_header;
+  websocket_data_cb on_frame_payload;  /* unmasked */
+  websocket_cb      on_frame_end;
+  websocket_cb      on_message_end;    /* the last fragment of a message */
+};
+
+
+void websocket_parser_init(websocket_parser *parser, enum websocket_role role);
+
+
+/* Parses 'len' bytes and returns how many were parsed; fewer on an error,
+ * see websocket_parser_errno(). Masked payload is unmasked in 'data'
+ * before it is passed to on_frame_payload. After a close frame the parser
+ * stops and returns the offset just past it.
+ */
+size_t websocket_parser_execute(websocket_parser *parser,
+                                const websocket_parser_settings *settings,
+                                char *data,
+                                size_t len);
+
+
+/* Writes a frame header into 'buf', which has room for
+ * WEBSOCKET_MAX_HEADER_SIZE bytes, and returns its length. 'mask' is NULL
+ * for an unmasked frame, as servers send.
+ */
+size_t websocket_frame_header(char *buf,
+                              int fin,
+                              enum websocket_opcode opcode,
+                              uint64_t length,
+                              const unsigned char *mask);
+
+
+/* XORs 'len' bytes of payload with 'mask', in place. 'offset' is where
+ * they start in the payload of their frame. Masks and unmasks alike.
+ */
+void websocket_mask(char *data,
+                    size_t len,
+                    const unsigned char *mask,
+                    uint64_t offset);
+
+
+#define websocket_parser_errno(p) ((enum websocket_errno) (p)->ws_errno)
+
+const char *websocket_errno_description(enum websocket_errno err);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif